@@ -6,6 +6,8 @@
 #include "MLX90640_I2C_Driver.h"
 #include "SPIFFS.h"
 #include "MLX90640_calibration.h"
+#include "MLX90640_fusion.h"
+#include "MLX90640_palette.h"
 
 const char* strBuildTimestamp = __TIMESTAMP__;
 
@@ -88,12 +90,12 @@ void setup() {
 		config.pixel_format   = PIXFORMAT_JPEG;
 
 		// CAMERA_GRAB_LATEST, CAMERA_GRAB_WHEN_EMPTY
-		config.grab_mode      = CAMERA_GRAB_WHEN_EMPTY;	// refreshes framebuffer only when there is a slot in fb_count of buffers
+		config.grab_mode      = CAMERA_GRAB_LATEST;		// the frame hub wants the newest frame, not the oldest queued one
 
 		// CAMERA_FB_IN_DRAM, CAMERA_FB_IN_PSRAM
 		config.fb_location    = CAMERA_FB_IN_PSRAM;		// 4 MB connected with 80MHz SPI
 		config.jpeg_quality   = 14;						// 0-63 (lower means higher quality)
-		config.fb_count	      = 2;
+		config.fb_count	      = 3;						// frame hub holds up to HUB_CAM_DRIVER_FRAMES, one left for the driver
 
 		// camera init
 		esp_err_t err = esp_camera_init(&config);
@@ -138,6 +140,8 @@ void setup() {
 		mlx90640.MLX90640_Init(MLX90640_address);
 		mlx90640.SetRefreshRate(MLX90640_REFRESH_RATE_4HZ);
 
+		MLXpalette::buildLUTs();
+
 	Serial.println("success");
 
 
@@ -189,6 +193,12 @@ void setup() {
 
 	Serial.println("success");
 
+	Serial.println("Reading fusion homography from SPIFFS...");
+
+		MLXfusion::readHomography();
+
+	Serial.println("success");
+
   Serial.println("Launching http servers...");
 
 	startControlAndStreamServers();
@@ -16,6 +16,9 @@
  */
 #include "MLX90640_I2C_Driver.h"
 #include "MLX90640_API.h"
+#include "MLX90640_calibration.h"
+#include "metrics.h"
+#include "trace.h"
 #include <math.h>
 #include "esp_timer.h"
 #include <stdlib.h>
@@ -35,6 +38,16 @@ float mlx90640_float_frame[MLX90640_pixelCOUNT]   = {0.0};	// 32 columns x 24 ro
 // user calibration offsets
 float mlx90640_float_offsets[MLX90640_pixelCOUNT] = {0.0};	// 32 columns x 24 rows
 
+// frames published to consumers, immutable while the slot is held
+typedef struct {
+	float             raw[MLX90640_pixelCOUNT];
+	float             values[MLX90640_pixelCOUNT];
+	uint16_t          ck[MLX90640_pixelCOUNT];
+	mlx_frame_stats_t stats;
+} mlx_pub_slot_t;
+
+static mlx_pub_slot_t* mlx90640_pub = NULL;		// MLX90640_FB_COUNT slots, PSRAM when available
+
 
 void ExtractVDDParameters(uint16_t *eeData, paramsMLX90640 *mlx90640);
 void ExtractPTATParameters(uint16_t *eeData, paramsMLX90640 *mlx90640);
@@ -77,6 +90,27 @@ MLX90640::MLX90640()
 
 	// 80% of delta between samples
 	iFrame_delayMS		= 0.8 * 1000 / 2;   // 2HZ by default
+
+	// frame publishing works even if the sensor is offline
+	mlx90640_pub = (mlx_pub_slot_t*)ps_malloc(MLX90640_FB_COUNT * sizeof(mlx_pub_slot_t));
+	if (!mlx90640_pub)
+		mlx90640_pub = (mlx_pub_slot_t*)malloc(MLX90640_FB_COUNT * sizeof(mlx_pub_slot_t));
+
+	// the sensor stays offline and fb_get returns empty frames without them
+	if (!mlx90640_pub)
+		log_e("MLX90640 frame slots allocation failed: %u", MLX90640_FB_COUNT * sizeof(mlx_pub_slot_t));
+
+	fbMutex   = xSemaphoreCreateMutex();
+	fbFreeSem = xSemaphoreCreateCounting(MLX90640_FB_COUNT, MLX90640_FB_COUNT);
+
+	for (uint8_t i = 0; i < MLX90640_FB_COUNT; i++)
+		fbSlotBusy[i] = false;
+
+	fbSeq        = 0;
+	frameReadyUs = 0;
+	frameSubpage = 0;
+	frameTa      = 0.0f;
+	frameVdd     = 0.0f;
 }
 
 
@@ -92,6 +126,13 @@ int MLX90640::MLX90640_Init(uint8_t _slaveAddr)
 {
 	uiSlaveAddr = _slaveAddr;
 
+	if (!mlx90640_pub) {
+		Serial.println("MLX90640 frame slots not allocated, sensor kept offline");
+
+		bOnline = false;
+		return -4;
+	}
+
 	Wire.beginTransmission(uiSlaveAddr);
 	if (Wire.endTransmission() != 0) {
 		Serial.print("MLX90640 not detected at address ");
@@ -194,6 +235,12 @@ int MLX90640::GetFrameData_(uint16_t *frameData)
 
 	xSemaphoreGive(mlxMutex);
 
+	int64_t readUs = esp_timer_get_time();
+	metrics_observe(METRIC_MLX_READ_US, (uint32_t)(readUs - mlx_update_t1_usec));
+
+	// data ready to the subpage in RAM, traced under the sequence number the frame will get
+	trace_span(TRACE_MLX, TRACE_LANE_CAPTURE, "i2c_read", fbSeq, mlx_update_t1_usec, readUs);
+
 	frameData[MLX90640_FRAME_AUX_CTRL_REG1] = controlRegister1;
 	frameData[MLX90640_FRAME_AUX_SUBPAGE]   = statusRegister & 0x0001;
 	
@@ -203,45 +250,151 @@ int MLX90640::GetFrameData_(uint16_t *frameData)
 mlx_fb_t MLX90640::fb_get()
 {
 	mlx_fb_t fb = {};
-	
-	if (bOnline)
-	{
-		// sample twice sequentially to be sure we get 0th and 1st subpages
-		for (uint8_t x = 0; x < 2; x++)
+	fb.slot = -1;
+
+	if (!mlx90640_pub) return fb;	// empty fb, nothing to publish into
+
+	// wait until at least one published frame slot is returned by consumers
+	xSemaphoreTake(fbFreeSem, portMAX_DELAY);
+
+	// working frame buffers are shared, only one consumer acquires at a time
+	xSemaphoreTake(fbMutex, portMAX_DELAY);
+
+		if (bOnline)
 		{
-			int status = GetFrameData_(mlx90640_frame);
-			if (status < 0)
+			// sample twice sequentially to be sure we get 0th and 1st subpages
+			for (uint8_t x = 0; x < 2; x++)
 			{
-				log_e("GetFrame Error: %d", status);
-				return fb;	// empty fb
+				int status = GetFrameData_(mlx90640_frame);
+				if (status < 0)
+				{
+					log_e("GetFrame Error: %d", status);
+					metrics_inc(METRIC_MLX_I2C_ERRORS);
+
+					xSemaphoreGive(fbMutex);
+					xSemaphoreGive(fbFreeSem);
+					return fb;	// empty fb
+				}
+
+				frameReadyUs = esp_timer_get_time();
+
+				CalculateTo(mlx90640_frame, &mlx90640, fEmissivity, fTambientReflected, mlx90640_float_frame);
+
+				int64_t calculatedUs = esp_timer_get_time();
+				metrics_observe(METRIC_MLX_CALCULATE_US, (uint32_t)(calculatedUs - frameReadyUs));
+				trace_span(TRACE_MLX, TRACE_LANE_PROCESS, "calculate", fbSeq, frameReadyUs, calculatedUs);
 			}
 
-			CalculateTo(mlx90640_frame, &mlx90640, fEmissivity, fTambientReflected, mlx90640_float_frame);
+			frameSubpage = mlx90640_frame[MLX90640_FRAME_AUX_SUBPAGE];
+			frameTa      = GetTa(mlx90640_frame, &mlx90640);
+			frameVdd     = GetVdd(mlx90640_frame, &mlx90640);
+		}
+		else
+			frameReadyUs = esp_timer_get_time();
+		// prepare fb data even if sensor is offline
+
+		int64_t publishUs = esp_timer_get_time();
+
+		PublishFrame_(fb);
+
+		// user offsets, calibration accumulation and renderer statistics
+		trace_span(TRACE_MLX, TRACE_LANE_PROCESS, "calibrate", fb.seq, publishUs, esp_timer_get_time());
+
+	xSemaphoreGive(fbMutex);
+
+	return fb;
+}
+
+// Copies the working frame into a free slot applying user offsets in the same pass,
+// so consumers never modify the data and the offsets are subtracted exactly once
+// Must be called holding fbMutex and a fbFreeSem count
+void MLX90640::PublishFrame_(mlx_fb_t& fb)
+{
+	int8_t slot = 0;
+	while (fbSlotBusy[slot]) slot++;	// free slot is guaranteed by fbFreeSem
+
+	fbSlotBusy[slot] = true;
+
+	// if calibration is in progress accumulate offsets from the uncorrected frame
+	MLXcalibration::accumulateUserCalibrationFrame(mlx90640_float_frame, fTambientReflected);
+
+	float* raw    = mlx90640_pub[slot].raw;
+	float* values = mlx90640_pub[slot].values;
+	uint16_t* ck  = mlx90640_pub[slot].ck;
+
+	mlx_frame_stats_t& stats = mlx90640_pub[slot].stats;
+
+	// single pass: copy, correct and gather min/max/histogram for the renderers
+	MLXagc::begin(stats);
+
+	if (MLXcalibration::getUserCalibrationOffsetsEnabled())
+	{
+		for (uint16_t i = 0; i < MLX90640_pixelCOUNT; i++) {
+			float fValue = mlx90640_float_frame[i];
+
+			raw[i]    = fValue;
+			fValue   -= mlx90640_float_offsets[i];
+			values[i] = fValue;
+			ck[i]     = MLX90640_centiKelvin(fValue);
+
+			MLXagc::accumulate(stats, fValue, i);
 		}
 	}
-	// prepare fb data even if sensor is offline
+	else
+	{
+		for (uint16_t i = 0; i < MLX90640_pixelCOUNT; i++) {
+			float fValue = mlx90640_float_frame[i];
 
-	//MLXframe2bmp(mlx90640_float_frame,MLX90640_pixelCOUNT, 32,24,  &fb.buf,&fb.len);
+			raw[i] = fValue;
+			ck[i]  = MLX90640_centiKelvin(fValue);
 
-	uint64_t us = (uint64_t)esp_timer_get_time();
+			MLXagc::accumulate(stats, fValue, i);
+		}
+		values = raw;	// uncorrected plane is the published one
+	}
+
+	MLXagc::end(stats, MLX90640_pixelCOUNT);
+
+	uint64_t us = (uint64_t)frameReadyUs;
 	fb.timestamp.tv_sec  = us / 1000000UL;
 	fb.timestamp.tv_usec = us % 1000000UL;
 
 	fb.width    = 32;
 	fb.height   = 24;
-	fb.values   = mlx90640_float_frame;
+	fb.values   = values;
+	fb.raw      = raw;
 	fb.offsets  = mlx90640_float_offsets;
+	fb.stats    = &stats;
+	fb.centiKelvin = ck;
 	fb.nBytes   = fb.width * fb.height * sizeof(float);
 	fb.fTambientReflected = fTambientReflected;
-
-	return fb;
+	fb.fEmissivity = fEmissivity;
+	fb.fTa      = frameTa;
+	fb.fVdd     = frameVdd;
+	fb.seq      = fbSeq++;
+	fb.subpage  = frameSubpage;
+	fb.slot     = slot;
 }
 
 void MLX90640::fb_return(mlx_fb_t& fb)
 {
-	//free(fb.buf);
+	if (fb.slot >= 0)
+	{
+		fbSlotBusy[fb.slot] = false;
+		xSemaphoreGive(fbFreeSem);
+	}
+
 	fb.values  = NULL;
+	fb.raw     = NULL;
 	fb.offsets = NULL;
+	fb.stats   = NULL;
+	fb.centiKelvin = NULL;
+	fb.slot    = -1;
+}
+
+uint8_t MLX90640::fb_free()
+{
+	return uxSemaphoreGetCount(fbFreeSem);
 }
 
 // offset buffer get
@@ -492,6 +645,18 @@ void MLX90640::SetEmissivity(float value)
 	fEmissivity = value;
 }
 
+bool MLX90640::GetFrameTelemetry(float& ta, float& vdd, int64_t& readyUs)
+{
+	if (!bOnline || frameReadyUs == 0) return false;
+
+	// written once per frame by fb_get, the floats are word sized and do not tear
+	ta      = frameTa;
+	vdd     = frameVdd;
+	readyUs = frameReadyUs;
+
+	return true;
+}
+
 float MLX90640::GetAmbientReflected()
 {
 	return fTambientReflected;
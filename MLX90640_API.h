@@ -22,11 +22,17 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 
+#include "MLX90640_agc.h"
+
 	#define MLX90640_eepromSIZE				832
 	#define MLX90640_ramSIZEframe			832	// ram bytes (768 frame + 64 params tag)
 	#define MLX90640_ramSIZEuser			834	// contains two additional bytes
 	#define MLX90640_pixelCOUNT				768
 
+	// Number of published frames that can be held by consumers at the same time
+	// (frame hub: one in use per subscriber, the frame being read and the latest published one)
+	#define MLX90640_FB_COUNT				10
+
 	// Number of subpages per second
 	#define MLX90640_REFRESH_RATE_05HZ		0
 	#define MLX90640_REFRESH_RATE_1HZ		1
@@ -82,16 +88,34 @@
     } paramsMLX90640;
 
 
+	// Published frame, immutable until handed back with fb_return()
 	typedef struct {
-		float* values;              // Pointer to the pixel data
-		float* offsets;             // Pointer to the offsets array
+		const float* values;        // Pointer to the pixel data (user offsets applied when enabled)
+		const float* raw;           // Pointer to the pixel data without user offsets (may alias values)
+		const float* offsets;       // Pointer to the offsets array
+		const mlx_frame_stats_t* stats; // Min/max, histogram and AGC state of values
+		const uint16_t* centiKelvin; // values in 0.01K units, written in the same conversion pass
 		uint16_t nBytes;            // Length of the buffer in bytes
 		uint16_t width;             // Width of the buffer in pixels
 		uint16_t height;            // Height of the buffer in pixels
-		struct timeval timestamp;   // Timestamp since boot of the first DMA buffer of the frame
+		struct timeval timestamp;   // Timestamp since boot when the last subpage was read
 		float fTambientReflected;
+		float fEmissivity;
+		float fTa;                  // Sensor die temperature of the last subpage
+		float fVdd;                 // Supply voltage of the last subpage
+		uint32_t seq;               // Published frame number, gaps mean frames taken by other consumers
+		uint8_t subpage;            // Last subpage read into the frame
+		int8_t slot;                // Index of the published frame slot, -1 if empty
 	} mlx_fb_t;
 
+	// Temperature in 0.01K units, unsigned as the sensor range exceeds int16 above 54C
+	inline uint16_t MLX90640_centiKelvin(float fCelsius)
+	{
+		int32_t ck = (int32_t)((fCelsius + 273.15f) * 100.0f + 0.5f);
+
+		return (ck < 0) ? 0 : (ck > 0xFFFF) ? 0xFFFF : ck;
+	}
+
 	typedef struct {
 		float* offsets;             // Pointer to the offsets array
 		uint16_t nBytes;            // Length of the buffer in bytes
@@ -114,8 +138,13 @@
 		float GetVddRAM();
 		float GetTaRAM();
 
+		// Ta and Vdd of the last subpage read by fb_get, no I2C traffic
+		// Returns false until a frame was read
+		bool  GetFrameTelemetry(float& ta, float& vdd, int64_t& readyUs);
+
 		mlx_fb_t fb_get();
 		void     fb_return(mlx_fb_t& fb);
+		uint8_t  fb_free();				// published frame slots not held by consumers, fb_get blocks at 0
 
 		mlx_ob_t ob_get();
 		void     ob_return(mlx_ob_t& ob);
@@ -160,6 +189,20 @@
 		// mutex for exclusive device interaction
 		SemaphoreHandle_t mlxMutex;
 
+		// serializes frame acquisition and publishing among consumers
+		SemaphoreHandle_t fbMutex;
+
+		// counts published frame slots not held by consumers
+		SemaphoreHandle_t fbFreeSem;
+		bool              fbSlotBusy[MLX90640_FB_COUNT];
+		uint32_t          fbSeq;
+
+		// state of the last subpage read by fb_get
+		int64_t           frameReadyUs;
+		uint8_t           frameSubpage;
+		float             frameTa;
+		float             frameVdd;
+
 		// delete copy constuctor
 		MLX90640(const MLX90640&) = delete;
 
@@ -168,6 +211,7 @@
 
 		int DumpEE_(uint16_t *eeData);
 		int GetFrameData_(uint16_t *frameData);
+		void PublishFrame_(mlx_fb_t& fb);
 
 	};
 
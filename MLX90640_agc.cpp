@@ -0,0 +1,171 @@
+
+#include "MLX90640_agc.h"
+
+#include <string.h>
+#include <float.h>
+
+
+namespace MLXagc
+{
+	// EWMA weights: the range follows hotter/colder objects quickly and relaxes slowly
+	static const float fAttack  = 0.5f;
+	static const float fRelease = 0.1f;
+	static const float fEqRate  = 0.2f;
+
+	// Bins holding more than this multiple of the average share are clipped (CLAHE)
+	static const float fClipLimit = 4.0f;
+
+	static uint8_t eMode = MLX_AGC_SMOOTH;
+
+	static bool  bValid   = false;
+	static float fAgcMin  = 0.0f;
+	static float fAgcMax  = 0.0f;
+	static float fEq[MLX_PALETTE_LUT_SIZE];
+
+
+	void begin(mlx_frame_stats_t& st)
+	{
+		st.fMin = FLT_MAX;
+		st.fMax = -FLT_MAX;
+		st.iMin = 0;
+		st.iMax = 0;
+		st.fSum = 0.0f;
+
+		memset(st.hist, 0, sizeof(st.hist));
+
+		float fLo = fAgcMin;
+		float fHi = fAgcMax;
+
+		if (!bValid) {
+			// room temperature scene until the first frame arrives
+			fLo = 0.0f;
+			fHi = 50.0f;
+		}
+
+		float fSpan = fHi - fLo;
+		if (fSpan < MLX_AGC_MIN_RANGE) fSpan = MLX_AGC_MIN_RANGE;
+
+		fLo -= fSpan * 0.25f;
+		fSpan *= 1.5f;
+
+		st.fHistScale = MLX_AGC_HIST_BINS / fSpan;
+		st.fHistBias  = -fLo * st.fHistScale;
+	}
+
+
+	static float ewma(float fState, float fValue, bool bExpanding)
+	{
+		return fState + (bExpanding ? fAttack : fRelease) * (fValue - fState);
+	}
+
+
+	void end(mlx_frame_stats_t& st, uint16_t nPixels)
+	{
+		st.fMean = st.fSum / nPixels;
+
+		if (!bValid) {
+			fAgcMin = st.fMin;
+			fAgcMax = st.fMax;
+		}
+		else {
+			fAgcMin = ewma(fAgcMin, st.fMin, st.fMin < fAgcMin);
+			fAgcMax = ewma(fAgcMax, st.fMax, st.fMax > fAgcMax);
+		}
+
+		st.fAgcMin = fAgcMin;
+		st.fAgcMax = fAgcMax;
+
+		// clipped histogram, the excess is spread evenly over all bins
+		const float fLimit = fClipLimit * nPixels / MLX_AGC_HIST_BINS;
+
+		float fBins[MLX_AGC_HIST_BINS];
+		float fExcess = 0.0f;
+		for (uint8_t b = 0; b < MLX_AGC_HIST_BINS; b++) {
+			fBins[b] = st.hist[b];
+			if (fBins[b] > fLimit) {
+				fExcess += fBins[b] - fLimit;
+				fBins[b] = fLimit;
+			}
+		}
+
+		float fCdf[MLX_AGC_HIST_BINS + 1];
+		fCdf[0] = 0.0f;
+		for (uint8_t b = 0; b < MLX_AGC_HIST_BINS; b++)
+			fCdf[b + 1] = fCdf[b] + fBins[b] + fExcess / MLX_AGC_HIST_BINS;
+
+		// sample the CDF at the temperature of every LUT entry of the smoothed range
+		mlx_palette_norm_t lin = MLXpalette::norm(fAgcMin, fAgcMax, MLX_AGC_MIN_RANGE);
+
+		float fTarget[MLX_PALETTE_LUT_SIZE];
+
+		for (uint16_t i = 0; i < MLX_PALETTE_LUT_SIZE; i++)
+		{
+			fTarget[i] = 0.0f;
+
+			if (lin.scale > 0.0f)
+			{
+				float fT = (i - lin.bias + 0.5f) / lin.scale;
+				float fB = fT * st.fHistScale + st.fHistBias;
+
+				if (fB <= 0.0f)
+					fTarget[i] = 0.0f;
+				else if (fB >= MLX_AGC_HIST_BINS)
+					fTarget[i] = fCdf[MLX_AGC_HIST_BINS];
+				else {
+					uint8_t b = (uint8_t)fB;
+					fTarget[i] = fCdf[b] + (fCdf[b + 1] - fCdf[b]) * (fB - b);
+				}
+			}
+		}
+
+		// the first and the last entries keep the ends of the palette
+		float fSpan = fTarget[MLX_PALETTE_LUT_SIZE - 1] - fTarget[0];
+		float fTo   = (fSpan > 0.0f) ? (MLX_PALETTE_LUT_SIZE - 1) / fSpan : 0.0f;
+
+		for (uint16_t i = 0; i < MLX_PALETTE_LUT_SIZE; i++)
+		{
+			float fIndex = fSpan > 0.0f ? (fTarget[i] - fTarget[0]) * fTo : i;
+
+			fEq[i] = bValid ? fEq[i] + fEqRate * (fIndex - fEq[i]) : fIndex;
+
+			st.eq[i] = (uint16_t)(fEq[i] + 0.5f);
+		}
+
+		bValid = true;
+	}
+
+
+	mlx_palette_norm_t norm(const mlx_frame_stats_t& st)
+	{
+		switch (eMode)
+		{
+			case MLX_AGC_OFF:
+				return MLXpalette::norm(st.fMin, st.fMax, MLX_AGC_MIN_RANGE);
+
+			case MLX_AGC_EQUALIZE: {
+				mlx_palette_norm_t n = MLXpalette::norm(st.fAgcMin, st.fAgcMax, MLX_AGC_MIN_RANGE);
+				n.eq = st.eq;
+				return n;
+			}
+
+			default:
+				return MLXpalette::norm(st.fAgcMin, st.fAgcMax, MLX_AGC_MIN_RANGE);
+		}
+	}
+
+
+	int setMode(int mode)
+	{
+		if (mode < 0 || mode >= MLX_AGC_COUNT) return -1;
+
+		eMode = mode;
+
+		return 0;
+	}
+
+	int getMode()
+	{
+		return eMode;
+	}
+
+}
@@ -0,0 +1,69 @@
+
+#ifndef _MLX90640_AGC_H_
+#define _MLX90640_AGC_H_
+
+#include <stdint.h>
+#include "MLX90640_palette.h"
+
+#define MLX_AGC_HIST_BINS		64
+
+// Narrower scenes are mapped onto the lower part of the palette to keep sensor noise dark
+#define MLX_AGC_MIN_RANGE		10.0f
+
+typedef enum {
+	MLX_AGC_OFF = 0,			// per frame min/max
+	MLX_AGC_SMOOTH,				// temporally smoothed min/max
+	MLX_AGC_EQUALIZE,			// smoothed range with histogram equalization
+	MLX_AGC_COUNT
+} mlx_agc_mode_t;
+
+// Per frame statistics gathered while the frame is published
+typedef struct {
+	float    fMin;
+	float    fMax;
+	float    fMean;
+	uint16_t iMin;                          // Pixel index of the minimum, sensor order
+	uint16_t iMax;                          // Pixel index of the maximum, sensor order
+
+	float    fHistScale;                    // bin = value*fHistScale + fHistBias
+	float    fHistBias;
+	uint16_t hist[MLX_AGC_HIST_BINS];
+
+	float    fAgcMin;                       // Smoothed range at the time of the frame
+	float    fAgcMax;
+	uint16_t eq[MLX_PALETTE_LUT_SIZE];      // Smoothed equalization of the smoothed range
+
+	float    fSum;
+} mlx_frame_stats_t;
+
+// Per-frame statistics, smoothed auto gain and histogram equalization
+namespace MLXagc {
+
+	// Resets statistics, histogram bins cover the current smoothed range with margins
+	void begin(mlx_frame_stats_t& st);
+
+	// Accumulates one pixel, called from the frame conversion loop
+	inline void accumulate(mlx_frame_stats_t& st, float fValue, uint16_t i)
+	{
+		if (fValue < st.fMin) { st.fMin = fValue; st.iMin = i; }
+		if (fValue > st.fMax) { st.fMax = fValue; st.iMax = i; }
+
+		st.fSum += fValue;
+
+		int32_t b = (int32_t)(fValue * st.fHistScale + st.fHistBias);
+		b = (b < 0) ? 0 : (b > MLX_AGC_HIST_BINS - 1) ? MLX_AGC_HIST_BINS - 1 : b;
+
+		st.hist[b]++;
+	}
+
+	// Completes statistics of nPixels and advances the smoothed range and equalization
+	void end(mlx_frame_stats_t& st, uint16_t nPixels);
+
+	// Palette mapping of a frame according to the current AGC mode
+	mlx_palette_norm_t norm(const mlx_frame_stats_t& st);
+
+	int setMode(int mode);
+	int getMode();
+}
+
+#endif
@@ -7,6 +7,9 @@
 
 extern float mlx90640_float_offsets[MLX90640_pixelCOUNT];
 
+// number of frames accumulated by the ongoing calibration, 0 when idle
+uint8_t mlx90640calibration_frame = 0;
+
 namespace MLXcalibration
 {
 
@@ -147,13 +150,20 @@ namespace MLXcalibration
 	}
 
 
-	void applyUserCalibrationOffsets(mlx_fb_t& fb)
+	// Called once per published frame with the uncorrected temperatures
+	void accumulateUserCalibrationFrame(const float* raw, float fTambientReflected)
 	{
-		if (!bObserveOffsetAdjustment) return;
+		if (mlx90640calibration_frame == 0) return;
+
+		mlx90640calibration_frame++;
 
 		for (uint16_t i = 0; i < MLX90640_pixelCOUNT; i++) {
-			fb.values[i] -= fb.offsets[i];
+			mlx90640_float_offsets[i] += raw[i]/100.0f - fTambientReflected/100.0f;
 		}
+
+		if (mlx90640calibration_frame > 100)
+			// disable calibration after 100 full frames
+			mlx90640calibration_frame = 0;
 	}
 
 }
\ No newline at end of file
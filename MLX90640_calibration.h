@@ -20,7 +20,7 @@ namespace MLXcalibration {
 	int  setUserCalibrationOffsetsEnabled(uint8_t enabled);
 	int  getUserCalibrationOffsetsEnabled();
 
-	void applyUserCalibrationOffsets(mlx_fb_t& fb);
+	void accumulateUserCalibrationFrame(const float* raw, float fTambientReflected);
 }
 
 
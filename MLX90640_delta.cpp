@@ -0,0 +1,196 @@
+
+#include "MLX90640_delta.h"
+
+#include <string.h>
+
+
+namespace MLXdelta
+{
+
+	void init(mlx_delta_state_t& st, uint16_t keyInterval, uint8_t step)
+	{
+		memset(st.recon, 0, sizeof(st.recon));
+
+		st.seq         = 0;
+		st.keyInterval = keyInterval;
+		st.step        = step ? step : 1;
+		st.bValid      = false;
+	}
+
+
+	void requestKeyframe(mlx_delta_state_t& st)
+	{
+		st.bValid = false;
+	}
+
+
+	static inline uint32_t zigzag(int32_t v)
+	{
+		return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+	}
+
+	static inline int32_t unzigzag(uint32_t z)
+	{
+		return (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+	}
+
+	static inline uint8_t* putVarint(uint8_t* p, uint32_t v)
+	{
+		while (v >= 0x80) {
+			*p++ = (uint8_t)v | 0x80;
+			v >>= 7;
+		}
+		*p++ = (uint8_t)v;
+
+		return p;
+	}
+
+	static inline const uint8_t* getVarint(const uint8_t* p, const uint8_t* end, uint32_t* v)
+	{
+		uint32_t result = 0;
+
+		for (uint8_t shift = 0; shift < 28 && p < end; shift += 7)
+		{
+			uint8_t b = *p++;
+			result |= (uint32_t)(b & 0x7F) << shift;
+
+			if (!(b & 0x80)) {
+				*v = result;
+				return p;
+			}
+		}
+
+		return NULL;
+	}
+
+	// rounds to nearest, halves away from zero
+	static inline int32_t quantize(int32_t v, uint8_t step)
+	{
+		return (v >= 0) ? (v + step / 2) / step : -((-v + step / 2) / step);
+	}
+
+	static inline uint16_t clamp16(int32_t v)
+	{
+		return (v < 0) ? 0 : (v > 0xFFFF) ? 0xFFFF : v;
+	}
+
+
+	size_t encode(mlx_delta_state_t& st, const uint16_t* ck, uint16_t nPixels, uint8_t* out)
+	{
+		if (nPixels > MLX_DELTA_MAX_PIXELS) return 0;
+
+		const uint8_t step = st.step;
+
+		bool bKey = !st.bValid || !st.keyInterval || (st.seq % st.keyInterval) == 0;
+
+		out[0] = bKey ? 'K' : 'D';
+		out[1] = step;
+		out[2] = nPixels & 0xFF;
+		out[3] = nPixels >> 8;
+		out[4] = st.seq & 0xFF;
+		out[5] = (st.seq >> 8)  & 0xFF;
+		out[6] = (st.seq >> 16) & 0xFF;
+		out[7] = (st.seq >> 24) & 0xFF;
+
+		uint8_t* p = out + MLX_DELTA_HEADER_LEN;
+
+		uint32_t run  = 0;
+		int32_t  prev = 0;		// previous quantized pixel of a keyframe
+
+		for (uint16_t i = 0; i < nPixels; i++)
+		{
+			int32_t v;
+
+			if (bKey) {
+				int32_t q = quantize(ck[i], step);
+
+				v    = q - prev;
+				prev = q;
+				st.recon[i] = clamp16(q * step);
+			}
+			else {
+				v = quantize((int32_t)ck[i] - st.recon[i], step);
+				st.recon[i] = clamp16(st.recon[i] + v * step);
+			}
+
+			if (v == 0) {
+				run++;
+				continue;
+			}
+
+			if (run) {
+				p = putVarint(p, (run << 1) | 1);
+				run = 0;
+			}
+
+			p = putVarint(p, zigzag(v) << 1);
+		}
+
+		if (run)
+			p = putVarint(p, (run << 1) | 1);
+
+		st.seq++;
+		st.bValid = true;
+
+		return p - out;
+	}
+
+
+	int decode(mlx_delta_state_t& st, const uint8_t* in, size_t len, uint16_t* ck)
+	{
+		if (len < MLX_DELTA_HEADER_LEN) return -1;
+
+		const bool     bKey    = (in[0] == 'K');
+		const uint8_t  step    = in[1];
+		const uint16_t nPixels = in[2] | (in[3] << 8);
+		const uint32_t seq     = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+
+		if ((!bKey && in[0] != 'D') || !step || nPixels > MLX_DELTA_MAX_PIXELS) return -1;
+
+		// a lost frame breaks the delta chain until the next keyframe
+		if (!bKey && (!st.bValid || seq != st.seq || step != st.step)) return -2;
+
+		const uint8_t* p   = in + MLX_DELTA_HEADER_LEN;
+		const uint8_t* end = in + len;
+
+		uint16_t recon[MLX_DELTA_MAX_PIXELS];
+		if (!bKey) memcpy(recon, st.recon, nPixels * sizeof(uint16_t));
+
+		int32_t  prev = 0;
+		uint16_t i    = 0;
+
+		while (i < nPixels)
+		{
+			uint32_t token;
+			p = getVarint(p, end, &token);
+			if (!p) return -1;
+
+			uint32_t count = (token & 1) ? token >> 1 : 1;
+			int32_t  v     = (token & 1) ? 0 : unzigzag(token >> 1);
+
+			if (!count || count > (uint32_t)(nPixels - i)) return -1;
+
+			for (; count; count--, i++)
+			{
+				if (bKey) {
+					prev += v;
+					recon[i] = clamp16(prev * step);
+				}
+				else
+					recon[i] = clamp16(recon[i] + v * step);
+			}
+		}
+
+		if (p != end) return -1;
+
+		memcpy(st.recon, recon, nPixels * sizeof(uint16_t));
+		memcpy(ck, recon, nPixels * sizeof(uint16_t));
+
+		st.step   = step;
+		st.seq    = seq + 1;
+		st.bValid = true;
+
+		return nPixels;
+	}
+
+}
@@ -0,0 +1,52 @@
+
+#ifndef _MLX90640_DELTA_H_
+#define _MLX90640_DELTA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Inter-frame delta coding of centi-kelvin frames
+//
+// Frame layout (little endian):
+//   uint8_t  type       'K' keyframe, 'D' delta against the previous reconstructed frame
+//   uint8_t  step       quantization step in centi-kelvin, 1 is lossless
+//   uint16_t nPixels
+//   uint32_t seq        frame number, deltas are only valid right after seq-1
+//   tokens             varints, (zigzag(value) << 1) or (zeroRun << 1 | 1)
+//
+// Keyframe values are spatial differences of quantized pixels,
+// delta frame values are quantized differences against the reconstruction,
+// the encoder tracks the reconstruction so quantization error never accumulates
+
+#define MLX_DELTA_MAX_PIXELS	768
+#define MLX_DELTA_HEADER_LEN	8
+
+// Worst case: 3 varint bytes per pixel (17 bit zigzag plus the run flag)
+#define MLX_DELTA_MAX_LEN(nPixels)	(MLX_DELTA_HEADER_LEN + (nPixels) * 3)
+
+typedef struct {
+	uint16_t recon[MLX_DELTA_MAX_PIXELS];	// last reconstructed frame
+	uint32_t seq;							// number of the next frame to encode / expected frame to decode
+	uint16_t keyInterval;					// frames between keyframes, 0 sends keyframes only
+	uint8_t  step;
+	bool     bValid;						// recon holds a decoded frame
+} mlx_delta_state_t;
+
+// Keyframe and delta encoder / decoder of centi-kelvin frames
+namespace MLXdelta {
+
+	void init(mlx_delta_state_t& st, uint16_t keyInterval, uint8_t step);
+
+	// Forces the next encoded frame to be a keyframe
+	void requestKeyframe(mlx_delta_state_t& st);
+
+	// Encodes nPixels centi-kelvin values, out must hold MLX_DELTA_MAX_LEN(nPixels)
+	// Returns encoded length, 0 on error
+	size_t encode(mlx_delta_state_t& st, const uint16_t* ck, uint16_t nPixels, uint8_t* out);
+
+	// Decodes a frame into ck (MLX_DELTA_MAX_PIXELS entries)
+	// Returns number of pixels, -1 if malformed, -2 if a delta arrived without its reference
+	int decode(mlx_delta_state_t& st, const uint8_t* in, size_t len, uint16_t* ck);
+}
+
+#endif
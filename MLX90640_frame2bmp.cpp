@@ -1,6 +1,8 @@
 
 #include "MLX90640_frame2bmp.h"
 #include <cstddef>
+#include <string.h>
+#include <stdlib.h>
 #include "esp_heap_caps.h"
 #include <esp32-hal-log.h>
 #include <math.h>
@@ -11,105 +13,197 @@ constexpr const T& clamp(const T& v, const T& lo, const T& hi) {
 	return (v < lo) ? lo : (v > hi) ? hi : v;
 }
 
-bool MLXframe2bmp(float* src, uint16_t src_len, uint16_t width, uint16_t height,
-	              uint8_t** out, uint16_t* out_len)
+
+static uint32_t bmp_row_size(uint32_t width)
 {
-	*out = NULL;
-	*out_len = 0;
+	return (width * 3 + 3) & ~3u;		// BMP rows are padded to 4 bytes
+}
 
-	int pix_count = width * height;
-	int bpp = 3;
-	int palette_size = 0;
+uint32_t MLXbmp_size(uint16_t width, uint16_t height, uint8_t scale)
+{
+	return BMP_HEADER_LEN + bmp_row_size((uint32_t)width * scale) * height * scale;
+}
 
-	uint16_t out_size = (pix_count * bpp) + BMP_HEADER_LEN + palette_size;
-	uint8_t* out_buf  = (uint8_t*)heap_caps_malloc(out_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-	if (!out_buf) {
-		ESP_LOGE("MLXframe2bmp", "heap_caps_malloc failed! %u", out_size);
-		return false;
-	}
 
-	out_buf[0] = 'B';
-	out_buf[1] = 'M';
-	bmp_header_t* bitmapH = (bmp_header_t*)&out_buf[2];
-	bitmapH->reserved = 0;
-	bitmapH->filesize = out_size;
-	bitmapH->fileoffset_to_pixelarray = BMP_HEADER_LEN + palette_size;
-	bitmapH->dibheadersize = 40;
-	bitmapH->width  = width;
-	bitmapH->height = height;
-	bitmapH->planes = 1;
-	bitmapH->bitsperpixel = bpp * 8;
-	bitmapH->compression = 0;
-	bitmapH->imagesize = pix_count * bpp;
-	bitmapH->ypixelpermeter = 0x0B13; //2835 , 72 DPI
-	bitmapH->xpixelpermeter = 0x0B13; //2835 , 72 DPI
-	bitmapH->numcolorspallette = 0;
-	bitmapH->mostimpcolor = 0;
-
-	uint8_t* palette_buf = out_buf + BMP_HEADER_LEN;
-	uint8_t* pix_buf = palette_buf + palette_size;
+// Renders src upscaled by an integer factor with bilinear interpolation into B,G,R pixels
+// Temperatures are mapped to LUT indices once per source row, interpolation runs on
+// Q6 fixed point indices with Q8 weights, so the output loop has no float math
+//
+// src        - width x height temperatures
+// first_row  - first displayed row to render, rows - number of rows
+// out        - first rendered row
+// row_stride - bytes between displayed rows, negative for bottom-up images
+bool MLXrender_bgr888_rows(const float* src, uint16_t width, uint16_t height, uint8_t scale,
+	                       mlx_palette_t palette, const mlx_palette_norm_t& norm,
+	                       uint32_t first_row, uint32_t rows, uint8_t* out, int32_t row_stride)
+{
+	if (width > MLX_RENDER_MAX_WIDTH || scale == 0) return false;
+	if (first_row + rows > (uint32_t)height * scale) return false;
 
-//--Find min max--------------------------------------
-	float fMin =  FLT_MAX;
-	float fMax = -FLT_MAX;
+	const uint8_t* lut = MLXpalette::lutBGR888(palette);
 
-	for (int i = 0; i < pix_count; i++) {
-		if (src[i] < fMin) fMin = src[i];
-		if (src[i] > fMax) fMax = src[i];
-	}
-//----------------------------------------------------
+	// two cached source rows converted to Q6 LUT indices, mirrored horizontally
+	uint16_t rowQ[2][MLX_RENDER_MAX_WIDTH];
+	int      rowY[2] = { -1, -1 };
 
+	const uint32_t out_width  = (uint32_t)width  * scale;
 
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++)
+	for (uint32_t Y = first_row; Y < first_row + rows; Y++)
+	{
+		// pixel centers: v = (Y + 0.5)/scale - 0.5 in Q8
+		int32_t v  = (int32_t)(((2*Y + 1) << 7) / scale) - 128;
+		int32_t y0 = v >> 8;
+		int32_t fy = v & 0xFF;
+
+		// displayed rows go from the last source row to the first
+		int ya = height-1 - clamp<int32_t>(y0,     0, height-1);
+		int yb = height-1 - clamp<int32_t>(y0 + 1, 0, height-1);
+
+		int srcRows[2] = { ya, yb };
+		for (int r = 0; r < 2; r++)
+		{
+			if (rowY[r] == srcRows[r]) continue;
+
+			// reuse the other cached row if it matches
+			if (rowY[r^1] == srcRows[r]) {
+				memcpy(rowQ[r], rowQ[r^1], width * sizeof(uint16_t));
+			}
+			else {
+				const float* srcRow = &src[srcRows[r] * width];
+				for (int x = 0; x < width; x++)
+					rowQ[r][x] = MLXpalette::lutIndexQ6(srcRow[width-1 - x], norm);	// mirror horizontally
+			}
+			rowY[r] = srcRows[r];
+		}
+
+		uint8_t* pix = out + (int32_t)(Y - first_row) * row_stride;
+
+		for (uint32_t X = 0; X < out_width; X++)
 		{
-			int srcInd = y * width + (width-1 - x);   // mirror horizontally
-			float fValue = src[srcInd];
+			int32_t u  = (int32_t)(((2*X + 1) << 7) / scale) - 128;
+			int32_t x0 = u >> 8;
+			int32_t fx = u & 0xFF;
+
+			int xa = clamp<int32_t>(x0,     0, width-1);
+			int xb = clamp<int32_t>(x0 + 1, 0, width-1);
+
+			int32_t top    = (rowQ[0][xa] * (256 - fx) + rowQ[0][xb] * fx) >> 8;
+			int32_t bottom = (rowQ[1][xa] * (256 - fx) + rowQ[1][xb] * fx) >> 8;
+			int32_t q      = (top * (256 - fy) + bottom * fy) >> 8;
 
-			RGB rgbPixel = ironbow(fValue, fMin, fMax);
+			const uint8_t* bgr = &lut[((q + 32) >> 6) * 3];
 
-			*pix_buf++ = rgbPixel.b;
-			*pix_buf++ = rgbPixel.g;
-			*pix_buf++ = rgbPixel.r;
+			*pix++ = bgr[0];
+			*pix++ = bgr[1];
+			*pix++ = bgr[2];
 		}
 	}
 
-	*out     = out_buf;
-	*out_len = out_size;
-
 	return true;
 }
 
 
-// Simple Ironbow-like colormap
-RGB ironbow(float value, float minVal, float maxVal)
+bool MLXrender_bgr888(const float* src, uint16_t width, uint16_t height, uint8_t scale,
+	                  mlx_palette_t palette, const mlx_palette_norm_t& norm,
+	                  uint8_t* out, int32_t row_stride)
 {
-	float t = (value - minVal) / (maxVal - minVal);
+	return MLXrender_bgr888_rows(src, width, height, scale, palette, norm,
+	                             0, (uint32_t)height * scale, out, row_stride);
+}
+
+
+bool MLXframe2bmp_buf(const float* src, uint16_t width, uint16_t height, uint8_t scale,
+	                  mlx_palette_t palette, const mlx_palette_norm_t* norm,
+	                  uint8_t* out, uint32_t out_size, uint32_t* out_len)
+{
+	*out_len = 0;
 
-	// Map through segments: blue -> purple -> red -> orange -> yellow -> white
-	float r = 0, g = 0, b = 0;
+	if (scale == 0) return false;
 
-	if (t < 0.25f) {		// Blue to Purple
-		r = 128.0f * (t / 0.25f);
-		g = 0;
-		b = 255.0f;
+	uint32_t bmp_size = MLXbmp_size(width, height, scale);
+	if (out_size < bmp_size) {
+		ESP_LOGE("MLXframe2bmp", "buffer too small %u < %u", out_size, bmp_size);
+		return false;
 	}
-	else if (t < 0.5f) {	// Purple to Red
-		r = 128.0f + 127.0f * ((t - 0.25f) / 0.25f);
-		g = 0;
-		b = 255.0f - 255.0f * ((t - 0.25f) / 0.25f);
+
+	int32_t  out_width  = (int32_t)width  * scale;
+	int32_t  out_height = (int32_t)height * scale;
+	uint32_t row_size   = bmp_row_size(out_width);
+
+	bmp_header_t bitmapH;
+	bitmapH.reserved = 0;
+	bitmapH.filesize = bmp_size;
+	bitmapH.fileoffset_to_pixelarray = BMP_HEADER_LEN;
+	bitmapH.dibheadersize = 40;
+	bitmapH.width  = out_width;
+	bitmapH.height = out_height;
+	bitmapH.planes = 1;
+	bitmapH.bitsperpixel = 24;
+	bitmapH.compression = 0;
+	bitmapH.imagesize = row_size * out_height;
+	bitmapH.ypixelpermeter = 0x0B13; //2835 , 72 DPI
+	bitmapH.xpixelpermeter = 0x0B13; //2835 , 72 DPI
+	bitmapH.numcolorspallette = 0;
+	bitmapH.mostimpcolor = 0;
+
+	out[0] = 'B';
+	out[1] = 'M';
+	memcpy(&out[2], &bitmapH, sizeof(bitmapH));	// header is not 4-byte aligned in the file
+
+	uint8_t* pix_buf = out + BMP_HEADER_LEN;
+
+	// zero the padding bytes once, pixels overwrite the rest
+	if (row_size != (uint32_t)out_width * 3) memset(pix_buf, 0, row_size * out_height);
+
+	mlx_palette_norm_t frameNorm;
+	if (norm) {
+		frameNorm = *norm;
 	}
-	else if (t < 0.75f) {	// Red to Orange
-		r = 255.0f;
-		g = 128.0f * ((t - 0.5f) / 0.25f);
-		b = 0;
+	else {
+//--Find min max--------------------------------------
+		float fMin =  FLT_MAX;
+		float fMax = -FLT_MAX;
+
+		for (int i = 0; i < width * height; i++) {
+			if (src[i] < fMin) fMin = src[i];
+			if (src[i] > fMax) fMax = src[i];
+		}
+//----------------------------------------------------
+		frameNorm = MLXpalette::norm(fMin, fMax);
 	}
-	else {					// Orange to Yellow/White
-		r = 255.0f;
-		g = 128.0f + 127.0f * ((t - 0.75f) / 0.25f);
-		b = 127.0f * ((t - 0.75f) / 0.25f);
+
+	// BMP is stored bottom-up, so the top displayed row is the last one in the file
+	if (!MLXrender_bgr888(src, width, height, scale, palette, frameNorm,
+		                  pix_buf + (out_height-1) * row_size, -(int32_t)row_size))
+		return false;
+
+	*out_len = bmp_size;
+
+	return true;
+}
+
+
+bool MLXframe2bmp(const float* src, uint16_t src_len, uint16_t width, uint16_t height,
+	              uint8_t** out, uint16_t* out_len, mlx_palette_t palette)
+{
+	*out = NULL;
+	*out_len = 0;
+
+	uint32_t out_size = MLXbmp_size(width, height, 1);
+	uint8_t* out_buf  = (uint8_t*)heap_caps_malloc(out_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (!out_buf) {
+		ESP_LOGE("MLXframe2bmp", "heap_caps_malloc failed! %u", out_size);
+		return false;
 	}
 
-	// truncate
-	return { static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b) };
-}
\ No newline at end of file
+	uint32_t len = 0;
+	if (!MLXframe2bmp_buf(src, width, height, 1, palette, NULL, out_buf, out_size, &len)) {
+		free(out_buf);
+		return false;
+	}
+
+	*out     = out_buf;
+	*out_len = len;
+
+	return true;
+}
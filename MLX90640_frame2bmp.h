@@ -18,9 +18,13 @@
 #define _MLX90640_FRAME2BMP_H_
 
 #include <stdint.h>
+#include "MLX90640_palette.h"
 
 static const int BMP_HEADER_LEN = 54;
 
+// Widest source frame MLXrender_bgr888 can upscale
+#define MLX_RENDER_MAX_WIDTH	64
+
 typedef struct {
 	uint32_t filesize;
 	uint32_t reserved;
@@ -38,16 +42,30 @@ typedef struct {
 	uint32_t mostimpcolor;
 } bmp_header_t;
 
-bool MLXframe2bmp(float* src, uint16_t src_len,
-	              uint16_t width, uint16_t height, uint8_t** out, uint16_t* out_len);
+// Allocates out in PSRAM, caller frees it
+bool MLXframe2bmp(const float* src, uint16_t src_len,
+	              uint16_t width, uint16_t height, uint8_t** out, uint16_t* out_len,
+	              mlx_palette_t palette = MLX_PALETTE_IRONBOW);
+
+// Size of the BMP produced by MLXframe2bmp_buf
+uint32_t MLXbmp_size(uint16_t width, uint16_t height, uint8_t scale);
+
+// Writes a width*scale x height*scale BMP into caller provided out of out_size bytes
+// norm - temperature to palette mapping, NULL to stretch frame min/max over the palette
+bool MLXframe2bmp_buf(const float* src, uint16_t width, uint16_t height, uint8_t scale,
+	                  mlx_palette_t palette, const mlx_palette_norm_t* norm,
+	                  uint8_t* out, uint32_t out_size, uint32_t* out_len);
 
-struct RGB {
-	uint8_t r;
-	uint8_t g;
-	uint8_t b;
-};
+// Writes width*scale x height*scale B,G,R pixels, mirrored horizontally, upscaled bilinearly
+bool MLXrender_bgr888(const float* src, uint16_t width, uint16_t height, uint8_t scale,
+	                  mlx_palette_t palette, const mlx_palette_norm_t& norm,
+	                  uint8_t* out, int32_t row_stride);
 
-RGB ironbow(float value, float minVal, float maxVal);
+// Same for displayed rows first_row..first_row+rows-1 only, out receives first_row
+// Lets encoders consume the image in strips instead of a full frame buffer
+bool MLXrender_bgr888_rows(const float* src, uint16_t width, uint16_t height, uint8_t scale,
+	                       mlx_palette_t palette, const mlx_palette_norm_t& norm,
+	                       uint32_t first_row, uint32_t rows, uint8_t* out, int32_t row_stride);
 
 
 #endif
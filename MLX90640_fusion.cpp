@@ -0,0 +1,222 @@
+
+#include "MLX90640_fusion.h"
+#include "MLX90640_API.h"
+#include "SPIFFS.h"
+
+#include <string.h>
+
+
+namespace MLXfusion
+{
+
+	// Sensor is mirrored horizontally and flipped vertically against the visible camera,
+	// default maps the cropped OV2640 window onto the whole thermal array
+	static float   fHomography[9] = {
+		-32.0f,  0.0f, 31.5f,
+		  0.0f,-24.0f, 23.5f,
+		  0.0f,  0.0f,  1.0f
+	};
+
+	static uint8_t eMode  = MLX_FUSION_BLEND;
+	static int     iAlpha = 160;
+
+	static const char* pathFile = "/fusion.txt";
+
+
+	int readHomography()
+	{
+		File file = SPIFFS.open(pathFile, "r");
+
+		if (!file || !file.available()) {
+			log_e("Failed to open file %s, using default homography", pathFile);
+			return 1;
+		}
+
+		float h[9];
+
+		if (file.size() != sizeof(h) || file.readBytes((char*)h, sizeof(h)) != sizeof(h))
+		{
+			log_e("Fusion file %s is corrupted, using default homography", pathFile);
+			file.close();
+			return 2;
+		}
+
+		file.close();
+
+		memcpy(fHomography, h, sizeof(fHomography));
+
+		return 0;
+	}
+
+
+	int writeHomography(const float* h)
+	{
+		memcpy(fHomography, h, sizeof(fHomography));
+
+		File fd = SPIFFS.open(pathFile, "w");
+		if (!fd) {
+			log_e("Failed to open %s file for writing", pathFile);
+			return ESP_FAIL;
+		}
+
+		size_t len = fd.write((const uint8_t*)fHomography, sizeof(fHomography));
+
+		fd.close();
+
+		log_i("File %s saved to SPIFFS taking %ubytes", pathFile, len);
+
+		return ESP_OK;
+	}
+
+
+	void getHomography(float* h)
+	{
+		memcpy(h, fHomography, sizeof(fHomography));
+	}
+
+
+	int setMode(int mode)
+	{
+		if (mode < 0 || mode >= MLX_FUSION_COUNT) return -1;
+
+		eMode = mode;
+
+		return 0;
+	}
+
+	int getMode()
+	{
+		return eMode;
+	}
+
+
+	int setAlpha(int alpha)
+	{
+		if (alpha < 0 || alpha > 256) return -1;
+
+		iAlpha = alpha;
+
+		return 0;
+	}
+
+	int getAlpha()
+	{
+		return iAlpha;
+	}
+
+
+	static inline uint8_t clamp8(int32_t v)
+	{
+		return (v < 0) ? 0 : (v > 255) ? 255 : v;
+	}
+
+	// BT.601 luma of a RGB565 pixel
+	static inline int32_t luma565(uint16_t p)
+	{
+		int32_t r = (p >> 8) & 0xF8;
+		int32_t g = (p >> 3) & 0xFC;
+		int32_t b = (p << 3) & 0xF8;
+
+		return (r * 77 + g * 150 + b * 29) >> 8;
+	}
+
+
+	bool fuse(const uint16_t* visible, uint16_t width, uint16_t height,
+	          const float* thermal, mlx_palette_t palette, const mlx_palette_norm_t& norm,
+	          uint8_t* out)
+	{
+		if (!width || !height) return false;
+
+		const uint8_t* lut = MLXpalette::lutBGR888(palette);
+
+		// thermal frame mapped to Q6 LUT indices once, registration samples it bilinearly
+		uint16_t thermalQ[MLX90640_pixelCOUNT];
+		for (uint16_t i = 0; i < MLX90640_pixelCOUNT; i++)
+			thermalQ[i] = MLXpalette::lutIndexQ6(thermal[i], norm);
+
+		const float* h = fHomography;
+		const bool   bAffine = (h[6] == 0.0f && h[7] == 0.0f);
+
+		const float du = 1.0f / width;
+		const float dv = 1.0f / height;
+
+		const uint8_t mode  = eMode;
+		const int32_t alpha = iAlpha;
+
+		for (uint16_t y = 0; y < height; y++)
+		{
+			const float vn = (y + 0.5f) * dv;
+
+			// homogeneous coordinates change linearly along the row
+			float tx = h[0] * 0.5f * du + h[1] * vn + h[2];
+			float ty = h[3] * 0.5f * du + h[4] * vn + h[5];
+			float tw = h[6] * 0.5f * du + h[7] * vn + h[8];
+
+			const float dtx = h[0] * du;
+			const float dty = h[3] * du;
+			const float dtw = h[6] * du;
+
+			const uint16_t* row   = &visible[y * width];
+			const uint16_t* rowUp = &visible[(y > 0 ? y - 1 : y) * width];
+			const uint16_t* rowDn = &visible[(y < height - 1 ? y + 1 : y) * width];
+
+			uint8_t* pix = &out[y * width * 3];
+
+			for (uint16_t x = 0; x < width; x++, tx += dtx, ty += dty, tw += dtw)
+			{
+				float fx = tx;
+				float fy = ty;
+				if (!bAffine) {
+					float rw = 1.0f / tw;
+					fx *= rw;
+					fy *= rw;
+				}
+
+				// Q8 thermal coordinates clamped to the sensor
+				int32_t sx = (int32_t)(fx * 256.0f);
+				int32_t sy = (int32_t)(fy * 256.0f);
+				sx = (sx < 0) ? 0 : (sx > 31 * 256) ? 31 * 256 : sx;
+				sy = (sy < 0) ? 0 : (sy > 23 * 256) ? 23 * 256 : sy;
+
+				int32_t x0 = sx >> 8, wx = sx & 0xFF;
+				int32_t y0 = sy >> 8, wy = sy & 0xFF;
+				int32_t x1 = (x0 < 31) ? x0 + 1 : x0;
+				int32_t y1 = (y0 < 23) ? y0 + 1 : y0;
+
+				int32_t top    = (thermalQ[y0*32 + x0] * (256 - wx) + thermalQ[y0*32 + x1] * wx) >> 8;
+				int32_t bottom = (thermalQ[y1*32 + x0] * (256 - wx) + thermalQ[y1*32 + x1] * wx) >> 8;
+				int32_t q      = (top * (256 - wy) + bottom * wy) >> 8;
+
+				const uint8_t* bgr = &lut[((q + 32) >> 6) * 3];
+
+				uint16_t p = row[x];
+
+				if (mode == MLX_FUSION_MSX)
+				{
+					// Laplacian of visible luma adds scene detail on top of the thermal colors
+					int32_t edge = 4 * luma565(p)
+					             - luma565(row[x > 0 ? x - 1 : x]) - luma565(row[x < width - 1 ? x + 1 : x])
+					             - luma565(rowUp[x]) - luma565(rowDn[x]);
+					edge = (edge * alpha) >> 8;
+
+					*pix++ = clamp8(bgr[0] + edge);
+					*pix++ = clamp8(bgr[1] + edge);
+					*pix++ = clamp8(bgr[2] + edge);
+				}
+				else
+				{
+					int32_t r = (p >> 8) & 0xF8;
+					int32_t g = (p >> 3) & 0xFC;
+					int32_t b = (p << 3) & 0xF8;
+
+					*pix++ = (bgr[0] * alpha + b * (256 - alpha)) >> 8;
+					*pix++ = (bgr[1] * alpha + g * (256 - alpha)) >> 8;
+					*pix++ = (bgr[2] * alpha + r * (256 - alpha)) >> 8;
+				}
+			}
+		}
+
+		return true;
+	}
+
+}
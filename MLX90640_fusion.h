@@ -0,0 +1,41 @@
+
+#ifndef _MLX90640_FUSION_H_
+#define _MLX90640_FUSION_H_
+
+#include <stdint.h>
+#include "MLX90640_palette.h"
+
+typedef enum {
+	MLX_FUSION_BLEND = 0,		// alpha blend of the colorized thermal layer over the visible image
+	MLX_FUSION_MSX,				// visible edges embossed into the colorized thermal layer
+	MLX_FUSION_COUNT
+} mlx_fusion_mode_t;
+
+// Registration and blending of the thermal layer onto the visible image
+namespace MLXfusion {
+
+	// Homography mapping normalized visible coordinates (0..1, pixel centers) onto
+	// thermal sensor pixel coordinates (0..31, 0..23), row-major 3x3
+	// Affine when the last row is 0,0,1
+	int  readHomography();
+	int  writeHomography(const float* h);
+	void getHomography(float* h);
+
+	int  setMode(int mode);
+	int  getMode();
+
+	// 0..256, thermal layer weight in blend mode, edge strength in MSX mode
+	int  setAlpha(int alpha);
+	int  getAlpha();
+
+	// Registers the thermal frame onto the visible image and writes fused B,G,R pixels
+	//
+	// visible - width x height native endian RGB565 (jpg2rgb565 output)
+	// thermal - 32x24 temperatures in sensor order
+	// out     - width x height x 3 bytes, top-down
+	bool fuse(const uint16_t* visible, uint16_t width, uint16_t height,
+	          const float* thermal, mlx_palette_t palette, const mlx_palette_norm_t& norm,
+	          uint8_t* out);
+}
+
+#endif
@@ -0,0 +1,151 @@
+
+#include "MLX90640_palette.h"
+#include <math.h>
+
+
+// B,G,R triplets, same layout as the BMP pixel array
+static uint8_t  lut_bgr888[MLX_PALETTE_COUNT][MLX_PALETTE_LUT_SIZE * 3];
+static uint16_t lut_rgb565[MLX_PALETTE_COUNT][MLX_PALETTE_LUT_SIZE];
+
+
+namespace MLXpalette
+{
+
+	static mlx_palette_t ePalette = MLX_PALETTE_IRONBOW;		// static hides variable from extern keyword access
+
+	static const char* const paletteNames[MLX_PALETTE_COUNT] = {
+		"ironbow", "rainbow", "grey", "whitehot", "blackhot"
+	};
+
+
+	// Simple Ironbow-like colormap, t in [0..1]
+	static void ironbow(float t, float& r, float& g, float& b)
+	{
+		// Map through segments: blue -> purple -> red -> orange -> yellow -> white
+		if (t < 0.25f) {		// Blue to Purple
+			r = 128.0f * (t / 0.25f);
+			g = 0;
+			b = 255.0f;
+		}
+		else if (t < 0.5f) {	// Purple to Red
+			r = 128.0f + 127.0f * ((t - 0.25f) / 0.25f);
+			g = 0;
+			b = 255.0f - 255.0f * ((t - 0.25f) / 0.25f);
+		}
+		else if (t < 0.75f) {	// Red to Orange
+			r = 255.0f;
+			g = 128.0f * ((t - 0.5f) / 0.25f);
+			b = 0;
+		}
+		else {					// Orange to Yellow/White
+			r = 255.0f;
+			g = 128.0f + 127.0f * ((t - 0.75f) / 0.25f);
+			b = 127.0f * ((t - 0.75f) / 0.25f);
+		}
+	}
+
+	// Hue sweep from blue (cold) to red (hot), t in [0..1]
+	static void rainbow(float t, float& r, float& g, float& b)
+	{
+		float h = (1.0f - t) * 4.0f;		// 4: blue, 3: cyan, 2: green, 1: yellow, 0: red
+		int   sector = (int)h;
+		float f = h - sector;
+
+		switch (sector) {
+		case 0:  r = 255.0f;              g = 255.0f * f;          b = 0;                    break;
+		case 1:  r = 255.0f * (1.0f - f); g = 255.0f;              b = 0;                    break;
+		case 2:  r = 0;                   g = 255.0f;              b = 255.0f * f;           break;
+		case 3:  r = 0;                   g = 255.0f * (1.0f - f); b = 255.0f;               break;
+		default: r = 0;                   g = 0;                   b = 255.0f;               break;
+		}
+	}
+
+
+	void buildLUTs()
+	{
+		for (int i = 0; i < MLX_PALETTE_LUT_SIZE; i++)
+		{
+			float t = (float)i / (MLX_PALETTE_LUT_SIZE - 1);
+
+			// gamma lifts warm details in white hot/black hot modes
+			float fHot = 255.0f * powf(t, 1.0f / 1.5f);
+
+			float rgb[MLX_PALETTE_COUNT][3];
+
+			ironbow(t, rgb[MLX_PALETTE_IRONBOW][0], rgb[MLX_PALETTE_IRONBOW][1], rgb[MLX_PALETTE_IRONBOW][2]);
+			rainbow(t, rgb[MLX_PALETTE_RAINBOW][0], rgb[MLX_PALETTE_RAINBOW][1], rgb[MLX_PALETTE_RAINBOW][2]);
+
+			rgb[MLX_PALETTE_GREY][0] = rgb[MLX_PALETTE_GREY][1] = rgb[MLX_PALETTE_GREY][2] = 255.0f * t;
+			rgb[MLX_PALETTE_WHITEHOT][0] = rgb[MLX_PALETTE_WHITEHOT][1] = rgb[MLX_PALETTE_WHITEHOT][2] = fHot;
+			rgb[MLX_PALETTE_BLACKHOT][0] = rgb[MLX_PALETTE_BLACKHOT][1] = rgb[MLX_PALETTE_BLACKHOT][2] = 255.0f - fHot;
+
+			for (int p = 0; p < MLX_PALETTE_COUNT; p++)
+			{
+				// truncate
+				uint8_t r = (uint8_t)rgb[p][0];
+				uint8_t g = (uint8_t)rgb[p][1];
+				uint8_t b = (uint8_t)rgb[p][2];
+
+				lut_bgr888[p][i*3 + 0] = b;
+				lut_bgr888[p][i*3 + 1] = g;
+				lut_bgr888[p][i*3 + 2] = r;
+
+				lut_rgb565[p][i] = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+			}
+		}
+	}
+
+
+	const uint8_t* lutBGR888(mlx_palette_t palette)
+	{
+		return lut_bgr888[palette < MLX_PALETTE_COUNT ? palette : MLX_PALETTE_IRONBOW];
+	}
+
+	const uint16_t* lutRGB565(mlx_palette_t palette)
+	{
+		return lut_rgb565[palette < MLX_PALETTE_COUNT ? palette : MLX_PALETTE_IRONBOW];
+	}
+
+
+	mlx_palette_norm_t norm(float fMin, float fMax, float fMinRange)
+	{
+		mlx_palette_norm_t n;
+		n.eq = NULL;
+
+		float fRange = fMax - fMin;
+		if (fRange < fMinRange) fRange = fMinRange;
+
+		if (fRange <= 0.0f) {
+			// flat frame maps onto the first entry
+			n.scale = 0.0f;
+			n.bias  = 0.0f;
+			return n;
+		}
+
+		n.scale = (MLX_PALETTE_LUT_SIZE - 1) / fRange;
+		n.bias  = -fMin * n.scale + 0.5f;	// round to nearest entry
+
+		return n;
+	}
+
+
+	int setPalette(int palette)
+	{
+		if (palette < 0 || palette >= MLX_PALETTE_COUNT) return -1;
+
+		ePalette = (mlx_palette_t)palette;
+
+		return 0;
+	}
+
+	mlx_palette_t getPalette()
+	{
+		return ePalette;
+	}
+
+	const char* getPaletteName(mlx_palette_t palette)
+	{
+		return (palette < MLX_PALETTE_COUNT) ? paletteNames[palette] : "unknown";
+	}
+
+}
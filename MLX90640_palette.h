@@ -0,0 +1,79 @@
+
+#ifndef _MLX90640_PALETTE_H_
+#define _MLX90640_PALETTE_H_
+
+#include <stdint.h>
+
+// Number of entries in each palette lookup table, 256 or 1024
+#ifndef MLX_PALETTE_LUT_SIZE
+	#define MLX_PALETTE_LUT_SIZE	256
+#endif
+
+typedef enum {
+	MLX_PALETTE_IRONBOW = 0,
+	MLX_PALETTE_RAINBOW,
+	MLX_PALETTE_GREY,
+	MLX_PALETTE_WHITEHOT,
+	MLX_PALETTE_BLACKHOT,
+	MLX_PALETTE_COUNT
+} mlx_palette_t;
+
+// Linear mapping of a temperature onto a LUT index: index = value*scale + bias
+// optionally followed by eq[index] remapping (histogram equalization)
+typedef struct {
+	float scale;
+	float bias;
+	const uint16_t* eq;		// MLX_PALETTE_LUT_SIZE entries or NULL
+} mlx_palette_norm_t;
+
+// Temperature to colour mapping through per-palette lookup tables
+namespace MLXpalette {
+
+	// Fills all the lookup tables, call once before rendering
+	void buildLUTs();
+
+	// MLX_PALETTE_LUT_SIZE entries of 3 bytes in B,G,R order (BMP and fmt2jpg RGB888 layout)
+	const uint8_t*  lutBGR888(mlx_palette_t palette);
+
+	// MLX_PALETTE_LUT_SIZE entries of native endian RGB565
+	const uint16_t* lutRGB565(mlx_palette_t palette);
+
+	// Maps [fMin, fMax] onto the whole LUT,
+	// ranges narrower than fMinRange are mapped onto the lower part of the LUT
+	mlx_palette_norm_t norm(float fMin, float fMax, float fMinRange = 0.0f);
+
+	inline uint16_t lutIndex(float fValue, const mlx_palette_norm_t& norm)
+	{
+		int32_t i = (int32_t)(fValue * norm.scale + norm.bias);
+
+		i = (i < 0) ? 0 : (i > MLX_PALETTE_LUT_SIZE - 1) ? MLX_PALETTE_LUT_SIZE - 1 : i;
+
+		return norm.eq ? norm.eq[i] : i;
+	}
+
+	// Q6 fixed point LUT index for interpolating renderers, rounding is left to the caller
+	inline uint16_t lutIndexQ6(float fValue, const mlx_palette_norm_t& norm)
+	{
+		const int32_t qMax = (MLX_PALETTE_LUT_SIZE - 1) << 6;
+
+		int32_t q = (int32_t)(fValue * norm.scale * 64.0f + (norm.bias - 0.5f) * 64.0f);
+		q = (q < 0) ? 0 : (q > qMax) ? qMax : q;
+
+		if (!norm.eq) return q;
+
+		// equalization table is interpolated between neighbouring entries
+		int32_t i = q >> 6;
+		int32_t f = q & 63;
+		int32_t j = (i < MLX_PALETTE_LUT_SIZE - 1) ? i + 1 : i;
+
+		return norm.eq[i] * (64 - f) + norm.eq[j] * f;
+	}
+
+	// Palette used by renderers unless asked otherwise
+	int           setPalette(int palette);
+	mlx_palette_t getPalette();
+
+	const char* getPaletteName(mlx_palette_t palette);
+}
+
+#endif
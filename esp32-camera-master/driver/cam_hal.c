@@ -678,6 +678,9 @@ void cam_start(void)
     ll_cam_vsync_intr_enable(cam_obj, true);
 }
 
+/* JPEG frames dropped for a missing end marker, read by the application metrics */
+uint32_t cam_hal_no_eoi_count = 0;
+
 camera_fb_t *cam_take(TickType_t timeout)
 {
     camera_fb_t *dma_buffer = NULL;
@@ -761,6 +764,7 @@ camera_fb_t *cam_take(TickType_t timeout)
 
 skip_eoi_check:
 
+            __atomic_fetch_add(&cam_hal_no_eoi_count, 1, __ATOMIC_RELAXED);
             CAM_WARN_THROTTLE(warn_eoi_miss_cnt,
                               "NO-EOI - JPEG end marker missing");
             cam_give(dma_buffer);
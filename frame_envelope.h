@@ -0,0 +1,56 @@
+
+#ifndef _FRAME_ENVELOPE_H_
+#define _FRAME_ENVELOPE_H_
+
+#include <stdint.h>
+
+// Binary header prefixing stream payloads when requested with ?hdr=1
+// Little endian, fields are only ever appended, clients skip headerLen bytes to reach the payload
+
+#define FRAME_ENVELOPE_MAGIC	0x46584C4D	// "MLXF" on the wire
+#define FRAME_ENVELOPE_VERSION	1
+
+#define FRAME_ENVELOPE_CONTENT_TYPE	"application/x-mlx-frame"
+
+// OV2640 envelope and JPEG followed by the MLX90640 envelope and payload of the nearest camera frame
+#define FRAME_PAIR_CONTENT_TYPE		"application/x-mlx-pair"
+
+typedef enum {
+	FRAME_SOURCE_MLX90640 = 0,
+	FRAME_SOURCE_OV2640   = 1,
+} frame_source_t;
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint8_t  version;
+	uint8_t  headerLen;			// sizeof(frame_envelope_t) of the sender
+	uint8_t  source;			// frame_source_t
+	uint8_t  format;			// thermal payload format (fmt= of the stream), 0xFF for JPEG
+	uint32_t seq;				// frame number of the source since boot, see below
+	uint32_t dropped;			// frames of the source not delivered to this client since it connected, see below
+	int64_t  timestampUs;		// capture time since boot, common time base of both sensors
+	uint8_t  subpage;			// last MLX90640 subpage of the frame
+	uint8_t  reserved[3];
+	float    fTa;				// MLX90640 die temperature
+	float    fVdd;
+	float    fEmissivity;
+	float    fMin;				// temperature statistics of the corrected frame
+	float    fMax;
+	float    fMean;
+	uint16_t iMin;				// pixel index in sensor order
+	uint16_t iMax;
+	uint32_t payloadLen;		// bytes following the header
+} frame_envelope_t;
+
+static_assert(sizeof(frame_envelope_t) == 60, "frame envelope layout changed");
+
+// seq is the frame hub counter of the source: the publisher frame number of the MLX90640,
+// the capture loop count of the OV2640, which stands still while nobody subscribes to it.
+//
+// dropped counts the seq gaps since the first frame of the connection: frames the hub
+// replaced or reclaimed before the client took them, and WebSocket frames passed over
+// while its sender was busy. Frames /stream2640 skips on purpose to hold its latency
+// are not counted, they leave a seq gap larger than dropped and show as "skipped" in /status.
+// Time-lapse records are sampled and always carry 0.
+
+#endif
@@ -0,0 +1,540 @@
+
+#include "frame_hub.h"
+#include "metrics.h"
+#include "trace.h"
+#include "img_converters.h"
+#include "esp32-hal-log.h"
+#include "esp32-hal-psram.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include <string.h>
+
+
+typedef struct {
+	bool         bUsed;
+	hub_source_t source;
+	char         name[16];
+	bool         bHistory;
+	hub_frame_t* pending;			// latest frame not yet picked up
+	SemaphoreHandle_t ready;
+
+	uint32_t     delivered;
+	uint32_t     dropped;
+	float        fps;
+	int64_t      lastUs;
+} hub_sub_t;
+
+static hub_sub_t         hubSubs[HUB_MAX_SUBSCRIBERS];
+static SemaphoreHandle_t hubMutex = NULL;
+
+static TaskHandle_t      hubTask[HUB_SRC_COUNT] = { NULL, NULL };
+static uint32_t          hubFrames[HUB_SRC_COUNT] = { 0, 0 };
+static uint8_t           hubCamHeld = 0;		// driver buffers referenced by live frames
+
+// ring of recent frames per source, hubHistoryHead is the next slot to write
+static hub_frame_t*      hubHistory[HUB_SRC_COUNT][HUB_HISTORY_DEPTH];
+static uint8_t           hubHistoryHead[HUB_SRC_COUNT] = { 0, 0 };
+
+
+// every subscriber holds at most one frame in use, pending frames are reclaimed by hub_mlx_task
+static_assert(MLX90640_FB_COUNT >= HUB_MAX_SUBSCRIBERS + 2, "MLX90640_FB_COUNT is too small for the frame hub");
+
+
+void hub_init()
+{
+	if (hubMutex) return;
+
+	for (uint8_t i = 0; i < HUB_MAX_SUBSCRIBERS; i++) {
+		hubSubs[i].bUsed   = false;
+		hubSubs[i].pending = NULL;
+		hubSubs[i].ready   = xSemaphoreCreateBinary();
+	}
+
+	hubMutex = xSemaphoreCreateMutex();
+}
+
+
+// frees the frame, hubMutex is held by the caller
+static void hub_free_locked(hub_frame_t* f)
+{
+	if (f->fb) {
+		esp_camera_fb_return(f->fb);
+		hubCamHeld--;
+	}
+
+	free(f->copy);
+
+	if (f->source == HUB_SRC_MLX)
+		MLX90640::getInstance().fb_return(f->mlx);
+
+	free(f);
+}
+
+
+void hub_release(hub_frame_t* f)
+{
+	if (!f) return;
+
+	xSemaphoreTake(hubMutex, portMAX_DELAY);
+		if (--f->refs == 0) hub_free_locked(f);
+	xSemaphoreGive(hubMutex);
+}
+
+
+hub_frame_t* hub_retain(hub_frame_t* f)
+{
+	xSemaphoreTake(hubMutex, portMAX_DELAY);
+		f->refs++;
+	xSemaphoreGive(hubMutex);
+
+	return f;
+}
+
+
+// hubMutex is held by the caller
+static bool hub_wants_history_locked(hub_source_t source)
+{
+	for (uint8_t i = 0; i < HUB_MAX_SUBSCRIBERS; i++)
+		if (hubSubs[i].bUsed && hubSubs[i].bHistory && hubSubs[i].source == source) return true;
+
+	return false;
+}
+
+
+// hubMutex is held by the caller
+static void hub_history_clear_locked(hub_source_t source)
+{
+	for (uint8_t i = 0; i < HUB_HISTORY_DEPTH; i++)
+	{
+		hub_frame_t*& h = hubHistory[source][i];
+		if (h && --h->refs == 0) hub_free_locked(h);
+		h = NULL;
+	}
+}
+
+
+static bool hub_has_subscribers(hub_source_t source)
+{
+	bool bAny = false;
+
+	xSemaphoreTake(hubMutex, portMAX_DELAY);
+		for (uint8_t i = 0; i < HUB_MAX_SUBSCRIBERS && !bAny; i++)
+			bAny = hubSubs[i].bUsed && hubSubs[i].source == source;
+	xSemaphoreGive(hubMutex);
+
+	return bAny;
+}
+
+
+// Hands the frame to every subscriber of its source replacing what they did not pick up
+static void hub_publish(hub_frame_t* f)
+{
+	xSemaphoreTake(hubMutex, portMAX_DELAY);
+
+		hubFrames[f->source]++;
+
+		// history frames stay referenced, camera frames past HUB_CAM_DRIVER_FRAMES get copied then
+		if (hub_wants_history_locked(f->source))
+		{
+			hub_frame_t*& h = hubHistory[f->source][hubHistoryHead[f->source]];
+			if (h && --h->refs == 0) hub_free_locked(h);
+
+			f->refs++;
+			h = f;
+
+			hubHistoryHead[f->source] = (hubHistoryHead[f->source] + 1) % HUB_HISTORY_DEPTH;
+		}
+
+		for (uint8_t i = 0; i < HUB_MAX_SUBSCRIBERS; i++)
+		{
+			hub_sub_t& s = hubSubs[i];
+			if (!s.bUsed || s.source != f->source) continue;
+
+			// history subscribers pick frames from the history, only wake them up
+			if (s.bHistory) {
+				xSemaphoreGive(s.ready);
+				continue;
+			}
+
+			if (s.pending) {
+				if (--s.pending->refs == 0) hub_free_locked(s.pending);
+				s.dropped++;
+				metrics_inc(METRIC_HUB_DROPS);
+			}
+
+			f->refs++;
+			s.pending = f;
+
+			xSemaphoreGive(s.ready);
+		}
+
+		// producer reference
+		if (--f->refs == 0) hub_free_locked(f);
+
+	xSemaphoreGive(hubMutex);
+}
+
+
+static void hub_cam_task(void* arg)
+{
+	uint32_t seq = 0;
+
+	while (true)
+	{
+		if (!hub_has_subscribers(HUB_SRC_CAM)) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		int64_t waitUs = esp_timer_get_time();
+
+		camera_fb_t* fb = esp_camera_fb_get();
+
+		int64_t gotUs = esp_timer_get_time();
+		metrics_observe(METRIC_CAM_WAIT_US, (uint32_t)(gotUs - waitUs));
+
+		if (!fb) {
+			log_e("Camera capture failed");
+			metrics_inc(METRIC_CAM_ERRORS);
+			vTaskDelay(pdMS_TO_TICKS(100));
+			continue;
+		}
+
+		hub_frame_t* f = (hub_frame_t*)calloc(1, sizeof(hub_frame_t));
+		if (!f) {
+			esp_camera_fb_return(fb);
+			vTaskDelay(pdMS_TO_TICKS(100));
+			continue;
+		}
+
+		f->source    = HUB_SRC_CAM;
+		f->seq       = seq++;
+		f->width     = fb->width;
+		f->height    = fb->height;
+		f->timestamp = fb->timestamp;
+		f->refs      = 1;
+
+		const char* stage = NULL;		// traced processing step
+
+		if (fb->format != PIXFORMAT_JPEG)
+		{
+			stage = "convert";
+
+			// converted once for all subscribers
+			size_t len = 0;
+			if (!frame2jpg(fb, 80, &f->copy, &len)) {
+				log_e("JPEG compression failed");
+				f->copy = NULL;
+			}
+			f->jpg_len = len;
+
+			esp_camera_fb_return(fb);
+		}
+		else
+		{
+			xSemaphoreTake(hubMutex, portMAX_DELAY);
+				bool bHold = hubCamHeld < HUB_CAM_DRIVER_FRAMES;
+				if (bHold) hubCamHeld++;
+			xSemaphoreGive(hubMutex);
+
+			if (bHold)
+				f->fb = fb;
+			else {
+				// slow subscribers still hold older buffers, keep the driver running
+				stage = "copy";
+				f->copy = (uint8_t*)ps_malloc(fb->len);
+				if (f->copy) {
+					memcpy(f->copy, fb->buf, fb->len);
+					f->jpg_len = fb->len;
+				}
+				esp_camera_fb_return(fb);
+			}
+		}
+
+		if (f->fb) {
+			f->jpg     = f->fb->buf;
+			f->jpg_len = f->fb->len;
+		}
+		else
+			f->jpg = f->copy;
+
+		if (!f->jpg) {
+			hub_release(f);
+			continue;
+		}
+
+		metrics_inc(METRIC_CAM_FRAMES);
+		metrics_observe(METRIC_CAM_JPEG_BYTES, f->jpg_len);
+
+		// frame start (VSYNC) to the driver handing the buffer over, then conversion or copy
+		trace_span(TRACE_CAM, TRACE_LANE_CAPTURE, "capture", f->seq, hub_frame_us(f), gotUs);
+		if (stage)
+			trace_span(TRACE_CAM, TRACE_LANE_PROCESS, stage, f->seq, gotUs, esp_timer_get_time());
+
+		hub_publish(f);
+	}
+}
+
+
+// Drops frames not yet picked up by subscribers until a sensor frame slot is free,
+// oldest history frames go last. Frames in use by subscribers are never touched
+static void hub_mlx_reclaim(MLX90640& mlx90640)
+{
+	xSemaphoreTake(hubMutex, portMAX_DELAY);
+
+		for (uint8_t i = 0; i < HUB_MAX_SUBSCRIBERS && mlx90640.fb_free() == 0; i++)
+		{
+			hub_sub_t& s = hubSubs[i];
+			if (!s.bUsed || s.source != HUB_SRC_MLX || !s.pending) continue;
+
+			if (--s.pending->refs == 0) hub_free_locked(s.pending);
+			s.pending = NULL;
+			s.dropped++;
+			metrics_inc(METRIC_HUB_DROPS);
+		}
+
+		for (uint8_t i = 0; i < HUB_HISTORY_DEPTH && mlx90640.fb_free() == 0; i++)
+		{
+			hub_frame_t*& h = hubHistory[HUB_SRC_MLX][(hubHistoryHead[HUB_SRC_MLX] + i) % HUB_HISTORY_DEPTH];
+			if (h && --h->refs == 0) hub_free_locked(h);
+			h = NULL;
+		}
+
+	xSemaphoreGive(hubMutex);
+}
+
+
+static void hub_mlx_task(void* arg)
+{
+	MLX90640& mlx90640 = MLX90640::getInstance();
+
+	while (true)
+	{
+		if (!hub_has_subscribers(HUB_SRC_MLX)) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		hub_frame_t* f = (hub_frame_t*)calloc(1, sizeof(hub_frame_t));
+		if (!f) {
+			vTaskDelay(pdMS_TO_TICKS(100));
+			continue;
+		}
+
+		// slow subscribers must not stall the sensor for the others
+		if (mlx90640.fb_free() == 0)
+			hub_mlx_reclaim(mlx90640);
+
+		f->source = HUB_SRC_MLX;
+		f->refs   = 1;
+		f->mlx    = mlx90640.fb_get();
+
+		if (!f->mlx.values) {
+			hub_release(f);
+			vTaskDelay(pdMS_TO_TICKS(100));
+			continue;
+		}
+
+		f->seq       = f->mlx.seq;
+		f->timestamp = f->mlx.timestamp;
+		f->width     = f->mlx.width;
+		f->height    = f->mlx.height;
+
+		metrics_inc(METRIC_MLX_FRAMES);
+
+		hub_publish(f);
+	}
+}
+
+
+int hub_subscribe(hub_source_t source, const char* name, bool bHistory)
+{
+	int id = -1;
+
+	xSemaphoreTake(hubMutex, portMAX_DELAY);
+
+		for (uint8_t i = 0; i < HUB_MAX_SUBSCRIBERS && id < 0; i++)
+		{
+			hub_sub_t& s = hubSubs[i];
+			if (s.bUsed) continue;
+
+			s.bUsed     = true;
+			s.source    = source;
+			s.bHistory  = bHistory;
+			s.pending   = NULL;
+			s.delivered = 0;
+			s.dropped   = 0;
+			s.fps       = 0.0f;
+			s.lastUs    = 0;
+			strncpy(s.name, name, sizeof(s.name) - 1);
+			s.name[sizeof(s.name) - 1] = '\0';
+
+			xSemaphoreTake(s.ready, 0);
+
+			id = i;
+		}
+
+		// checked and started under the lock, concurrent first subscribers would start two loops
+		if (id >= 0 && !hubTask[source])
+		{
+			// capture loops run on the application core, away from WiFi
+			BaseType_t res = xTaskCreatePinnedToCore(source == HUB_SRC_CAM ? hub_cam_task : hub_mlx_task,
+			                                         source == HUB_SRC_CAM ? "hub_cam" : "hub_mlx",
+			                                         4096, NULL, 5, &hubTask[source], 1);
+			if (res != pdPASS) {
+				log_e("Frame hub task creation failed");
+				hubTask[source] = NULL;
+			}
+		}
+		else if (id >= 0)
+			xTaskNotifyGive(hubTask[source]);
+
+	xSemaphoreGive(hubMutex);
+
+	if (id < 0) {
+		log_e("Frame hub is full");
+		return -1;
+	}
+
+	log_i("Hub subscriber %d: %s", id, name);
+
+	return id;
+}
+
+
+void hub_unsubscribe(int id)
+{
+	if (id < 0 || id >= HUB_MAX_SUBSCRIBERS) return;
+
+	xSemaphoreTake(hubMutex, portMAX_DELAY);
+
+		hub_sub_t& s = hubSubs[id];
+
+		if (s.pending) {
+			if (--s.pending->refs == 0) hub_free_locked(s.pending);
+			s.pending = NULL;
+		}
+
+		s.bUsed = false;
+
+		if (s.bHistory && !hub_wants_history_locked(s.source))
+			hub_history_clear_locked(s.source);
+
+	xSemaphoreGive(hubMutex);
+}
+
+
+// hubMutex is held by the caller
+static void hub_count_delivery_locked(hub_sub_t& s)
+{
+	int64_t now = esp_timer_get_time();
+	if (s.lastUs) {
+		float fFps = 1000000.0f / (float)(now - s.lastUs);
+		s.fps = s.fps ? s.fps + 0.1f * (fFps - s.fps) : fFps;
+	}
+	s.lastUs = now;
+	s.delivered++;
+}
+
+
+hub_frame_t* hub_get(int id, TickType_t timeout)
+{
+	if (id < 0 || id >= HUB_MAX_SUBSCRIBERS) return NULL;
+
+	hub_sub_t& s = hubSubs[id];
+
+	if (xSemaphoreTake(s.ready, timeout) != pdTRUE) return NULL;
+
+	xSemaphoreTake(hubMutex, portMAX_DELAY);
+
+		hub_frame_t* f = s.pending;
+		s.pending = NULL;
+
+		if (f) hub_count_delivery_locked(s);
+
+	xSemaphoreGive(hubMutex);
+
+	return f;
+}
+
+
+hub_frame_t* hub_get_nearest(int id, int64_t timestampUs, TickType_t timeout)
+{
+	if (id < 0 || id >= HUB_MAX_SUBSCRIBERS) return NULL;
+
+	hub_sub_t& s = hubSubs[id];
+	if (!s.bHistory) return NULL;
+
+	TickType_t start = xTaskGetTickCount();
+
+	while (true)
+	{
+		hub_frame_t* nearest = NULL;
+		int64_t      nearestDist = 0;
+		int64_t      newestUs = INT64_MIN;
+
+		xSemaphoreTake(hubMutex, portMAX_DELAY);
+
+			for (uint8_t i = 0; i < HUB_HISTORY_DEPTH; i++)
+			{
+				hub_frame_t* h = hubHistory[s.source][i];
+				if (!h) continue;
+
+				int64_t us   = hub_frame_us(h);
+				int64_t dist = us > timestampUs ? us - timestampUs : timestampUs - us;
+
+				if (!nearest || dist < nearestDist) {
+					nearest     = h;
+					nearestDist = dist;
+				}
+
+				if (us > newestUs) newestUs = us;
+			}
+
+			TickType_t elapsed = xTaskGetTickCount() - start;
+
+			// frames on both sides of the timestamp are known or there is no time left to wait
+			if (nearest && (newestUs >= timestampUs || elapsed >= timeout))
+			{
+				nearest->refs++;
+				hub_count_delivery_locked(s);
+
+				xSemaphoreGive(hubMutex);
+				return nearest;
+			}
+
+		xSemaphoreGive(hubMutex);
+
+		if (elapsed >= timeout) return NULL;
+
+		xSemaphoreTake(s.ready, timeout - elapsed);
+	}
+}
+
+
+uint32_t hub_source_frames(hub_source_t source)
+{
+	return hubFrames[source];
+}
+
+
+void hub_get_info(hub_sub_info_t* info)
+{
+	xSemaphoreTake(hubMutex, portMAX_DELAY);
+
+		for (uint8_t i = 0; i < HUB_MAX_SUBSCRIBERS; i++)
+		{
+			const hub_sub_t& s = hubSubs[i];
+
+			info[i].bUsed     = s.bUsed;
+			info[i].source    = s.source;
+			info[i].delivered = s.delivered;
+			info[i].dropped   = s.dropped;
+			info[i].fps       = s.fps;
+			memcpy(info[i].name, s.name, sizeof(info[i].name));
+		}
+
+	xSemaphoreGive(hubMutex);
+}
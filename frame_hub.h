@@ -0,0 +1,92 @@
+#ifndef _FRAME_HUB_H_
+#define _FRAME_HUB_H_
+
+
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "MLX90640_API.h"
+
+
+// One capture loop per sensor feeding every stream
+//
+// Frames are refcounted and shared by all subscribers, each subscriber has a
+// latest-only queue of depth one: a frame not picked up before the next one
+// arrives is released and counted as dropped for that subscriber only. When the
+// thermal sensor runs out of frame slots, undelivered frames are reclaimed the same way
+
+#define HUB_MAX_SUBSCRIBERS		8
+
+// Camera frame buffers the hub may keep out of the driver, keep below fb_count
+// so the driver always has a buffer to fill; frames arriving above this are copied
+#define HUB_CAM_DRIVER_FRAMES	2
+
+// Recent frames kept per source for pairing by timestamp, only while a subscriber asked for them
+#define HUB_HISTORY_DEPTH		4
+
+typedef enum {
+	HUB_SRC_CAM = 0,
+	HUB_SRC_MLX,
+	HUB_SRC_COUNT
+} hub_source_t;
+
+typedef struct {
+	hub_source_t   source;
+	uint32_t       seq;				// frame number of the source
+
+	// HUB_SRC_CAM
+	const uint8_t* jpg;				// JPEG, converted once if the sensor delivers raw pixels
+	size_t         jpg_len;
+	uint16_t       width;
+	uint16_t       height;
+	struct timeval timestamp;
+
+	// HUB_SRC_MLX
+	mlx_fb_t       mlx;
+
+	// owned by the hub
+	camera_fb_t*   fb;				// driver buffer held zero copy
+	uint8_t*       copy;			// or private copy
+	uint8_t        refs;
+} hub_frame_t;
+
+typedef struct {
+	bool     bUsed;
+	uint8_t  source;
+	char     name[16];
+	uint32_t delivered;
+	uint32_t dropped;
+	float    fps;					// smoothed delivery rate
+} hub_sub_info_t;
+
+// Creates the subscriber slots, call once at startup before any other hub function
+void hub_init();
+
+// Returns subscriber id or -1 if all slots are taken
+// bHistory- keep the last HUB_HISTORY_DEPTH frames of the source for hub_get_nearest
+int  hub_subscribe(hub_source_t source, const char* name, bool bHistory = false);
+void hub_unsubscribe(int id);
+
+// Waits for the latest undelivered frame, the caller owns one reference
+// Returns NULL on timeout
+hub_frame_t* hub_get(int id, TickType_t timeout);
+void         hub_release(hub_frame_t* frame);
+
+// Extra reference for another owner, also released with hub_release
+// Thermal frames occupy a sensor slot while referenced, hand camera frames only
+hub_frame_t* hub_retain(hub_frame_t* frame);
+
+// Frame of the subscriber's source captured nearest to timestampUs, waits up to timeout
+// for a frame captured after it so the one on either side can be compared
+// Returns NULL if the history is empty
+hub_frame_t* hub_get_nearest(int id, int64_t timestampUs, TickType_t timeout);
+
+inline int64_t hub_frame_us(const hub_frame_t* frame)
+{
+	return (int64_t)frame->timestamp.tv_sec * 1000000 + frame->timestamp.tv_usec;
+}
+
+// Capture loop statistics and per subscriber counters
+uint32_t hub_source_frames(hub_source_t source);
+void     hub_get_info(hub_sub_info_t* info);	// HUB_MAX_SUBSCRIBERS entries
+
+#endif
@@ -18,8 +18,22 @@
 #include "httpd_firmware.h"
 #include "httpd_capture_stream.h"
 #include "httpd_mlx.h"
+#include "httpd_ws.h"
+#include "httpd_async.h"
+#include "httpd_stream.h"
+#include "httpd_status.h"
+#include "httpd_settings.h"
+#include "httpd_events.h"
+#include "httpd_tasks.h"
+#include "httpd_recorder.h"
+#include "httpd_timelapse.h"
 #include "MLX90640_calibration.h"
 #include "MLX90640_API.h"
+#include "MLX90640_palette.h"
+#include "MLX90640_fusion.h"
+#include "frame_hub.h"
+#include "metrics.h"
+#include "trace.h"
 #include "Arduino.h"
 
 
@@ -27,16 +41,7 @@
 	#include "esp32-hal-log.h"
 #endif
 
-extern bool isStreaming;
-
-// LED FLASH setup
-
-extern int led_duty;
-extern void enable_LED(bool en);
-
-httpd_handle_t stream_httpd  = NULL;
 httpd_handle_t control_httpd = NULL;
-httpd_handle_t mlxthc_httpd  = NULL;
 
 
 // GET can have query string comming after ?, eg GET /search?query=esp32&lang=en
@@ -90,91 +95,8 @@ static esp_err_t control_handler(httpd_req_t *req)
 	}
   
     free(buf);
-   
-    int val = atoi(value);
-    log_i("%s = %s", variable, value);
-    
-    sensor_t *cam = esp_camera_sensor_get();
-	MLX90640& mlx90640 = MLX90640::getInstance();
-
-    int res = 0;
-    if (!strcmp(variable, "framesize"))
-    {
-        if (cam->pixformat == PIXFORMAT_JPEG)
-            res = cam->set_framesize(cam, (framesize_t)val);	// resolution enum
-    }
-    else if (!strcmp(variable, "quality"))
-        res = cam->set_quality(cam, val);
-    else if (!strcmp(variable, "contrast"))
-        res = cam->set_contrast(cam, val);
-    else if (!strcmp(variable, "brightness"))
-        res = cam->set_brightness(cam, val);
-    else if (!strcmp(variable, "saturation"))
-        res = cam->set_saturation(cam, val);
-    else if (!strcmp(variable, "gainceiling"))
-        res = cam->set_gainceiling(cam, (gainceiling_t)val);
-    else if (!strcmp(variable, "colorbar"))
-        res = cam->set_colorbar(cam, val);
-    else if (!strcmp(variable, "awb"))
-        res = cam->set_whitebal(cam, val);
-    else if (!strcmp(variable, "agc"))
-        res = cam->set_gain_ctrl(cam, val);
-    else if (!strcmp(variable, "aec"))
-        res = cam->set_exposure_ctrl(cam, val);
-    else if (!strcmp(variable, "hmirror"))
-        res = cam->set_hmirror(cam, val);
-    else if (!strcmp(variable, "vflip"))
-        res = cam->set_vflip(cam, val);
-    else if (!strcmp(variable, "awb_gain"))
-        res = cam->set_awb_gain(cam, val);
-    else if (!strcmp(variable, "agc_gain"))
-        res = cam->set_agc_gain(cam, val);
-    else if (!strcmp(variable, "aec_value"))
-        res = cam->set_aec_value(cam, val);
-    else if (!strcmp(variable, "aec2"))
-        res = cam->set_aec2(cam, val);
-    else if (!strcmp(variable, "dcw"))
-        res = cam->set_dcw(cam, val);
-    else if (!strcmp(variable, "bpc"))
-        res = cam->set_bpc(cam, val);
-    else if (!strcmp(variable, "wpc"))
-        res = cam->set_wpc(cam, val);
-    else if (!strcmp(variable, "raw_gma"))
-        res = cam->set_raw_gma(cam, val);
-    else if (!strcmp(variable, "lenc"))
-        res = cam->set_lenc(cam, val);
-    else if (!strcmp(variable, "special_effect"))
-        res = cam->set_special_effect(cam, val);
-    else if (!strcmp(variable, "wb_mode"))
-        res = cam->set_wb_mode(cam, val);
-    else if (!strcmp(variable, "ae_level"))
-        res = cam->set_ae_level(cam, val);
-    else if (!strcmp(variable, "mlx_fast"))
-  	    res = mlx90640.SetFastRefreshRate(val);
-	else if (!strcmp(variable, "mlx_observe_offset"))
-		res = MLXcalibration::setUserCalibrationOffsetsEnabled(val);
-	else if (!strcmp(variable, "ambReflected"))
-	{
-		float ambReflected = atof(value);
-		mlx90640.SetAmbientReflected(ambReflected);
-	}
-	else if (!strcmp(variable, "emissivity"))
-	{
-		float fEmissivity = atof(value);
-		mlx90640.SetEmissivity(fEmissivity);
-	}
-    else if (!strcmp(variable, "led_intensity"))
-    {
-        led_duty = val;
-        if (isStreaming) enable_LED(true);
-    }
-    else
-	{
-        log_i("Unknown command: %s", variable);
-        res = -1;
-    }
 
-	if (res < 0) {
+	if (control_set(variable, value) < 0) {
 		return httpd_resp_send_500(req);
 	}
 
@@ -184,103 +106,110 @@ static esp_err_t control_handler(httpd_req_t *req)
 }
 
 
-static int print_reg(char *p, sensor_t *s, uint16_t reg, uint32_t mask)
+// GET /hub
+// Frames produced per source and delivered/dropped counts of every stream subscriber
+static esp_err_t hub_handler(httpd_req_t *req)
 {
-    return sprintf(p, "\"0x%x\":%u,", reg, s->get_reg(s, reg, mask));
-}
+	static const char* sources[HUB_SRC_COUNT] = { "cam", "mlx" };
 
+	hub_sub_info_t info[HUB_MAX_SUBSCRIBERS];
+	hub_get_info(info);
 
-static esp_err_t status_handler(httpd_req_t *req)
-{
-    char* json_response = (char*)ps_malloc(2048);
-
-		sensor_t* cam      = esp_camera_sensor_get();
-		MLX90640& mlx90640 = MLX90640::getInstance();
+	char json_response[128 + HUB_MAX_SUBSCRIBERS * 96];
 
 		char *p = json_response;
-		*p++ = '{';
+		p += sprintf(p, "{\"cam_frames\":%u,\"mlx_frames\":%u,\"subscribers\":[",
+		             hub_source_frames(HUB_SRC_CAM), hub_source_frames(HUB_SRC_MLX));
 
-		if (cam->id.PID == OV5640_PID || cam->id.PID == OV3660_PID)
+		bool bFirst = true;
+		for (uint8_t i = 0; i < HUB_MAX_SUBSCRIBERS; i++)
 		{
-			for (int reg = 0x3400; reg < 0x3406; reg += 2)
-				p += print_reg(p, cam, reg, 0xFFF);		//12 bit
- 
-			p += print_reg(p, cam, 0x3406, 0xFF);
+			if (!info[i].bUsed) continue;
 
-			p += print_reg(p, cam, 0x3500, 0xFFFF0);	//16 bit
-			p += print_reg(p, cam, 0x3503, 0xFF);
-			p += print_reg(p, cam, 0x350a, 0x3FF);		//10 bit
-			p += print_reg(p, cam, 0x350c, 0xFFFF);		//16 bit
+			p += sprintf(p, "%s{\"id\":%u,\"name\":\"%s\",\"source\":\"%s\",\"delivered\":%u,\"dropped\":%u,\"fps\":%.1f}",
+			             bFirst ? "" : ",", i, info[i].name, sources[info[i].source],
+			             info[i].delivered, info[i].dropped, info[i].fps);
+			bFirst = false;
+		}
 
-			for (int reg = 0x5480; reg <= 0x5490; reg++)
-				p += print_reg(p, cam, reg, 0xFF);
+		p += sprintf(p, "]}");
 
-			for (int reg = 0x5380; reg <= 0x538b; reg++)
-				p += print_reg(p, cam, reg, 0xFF);
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-			for (int reg = 0x5580; reg < 0x558a; reg++)
-				p += print_reg(p, cam, reg, 0xFF);
- 
-				p += print_reg(p, cam, 0x558a, 0x1FF);  //9 bit
-		}
-		else if (cam->id.PID == OV2640_PID)
-		{
-			p += print_reg(p, cam, 0xd3, 0xFF);
-			p += print_reg(p, cam, 0x111, 0xFF);
-			p += print_reg(p, cam, 0x132, 0xFF);
-		}
+	return httpd_resp_send(req, json_response, p - json_response);
+}
 
-		char strMLXcalibDate[32];
-		MLXcalibration::readUserCalibrationOffsetsDate(strMLXcalibDate);
-	
-		p += sprintf(p, "\"xclk\":%u,",        cam->xclk_freq_hz / 1000000);
-		p += sprintf(p, "\"pixformat\":%u,",   cam->pixformat);
-		p += sprintf(p, "\"framesize\":%u,",   cam->status.framesize);
-		p += sprintf(p, "\"quality\":%u,",     cam->status.quality);
-		p += sprintf(p, "\"brightness\":%d,",  cam->status.brightness);
-		p += sprintf(p, "\"contrast\":%d,",    cam->status.contrast);
-		p += sprintf(p, "\"saturation\":%d,",  cam->status.saturation);
-		p += sprintf(p, "\"sharpness\":%d,",   cam->status.sharpness);
-		p += sprintf(p, "\"special_effect\":%u,", cam->status.special_effect);
-		p += sprintf(p, "\"wb_mode\":%u,",     cam->status.wb_mode);
-		p += sprintf(p, "\"awb\":%u,",         cam->status.awb);
-		p += sprintf(p, "\"awb_gain\":%u,",    cam->status.awb_gain);
-		p += sprintf(p, "\"aec\":%u,",         cam->status.aec);
-		p += sprintf(p, "\"aec2\":%u,",        cam->status.aec2);
-		p += sprintf(p, "\"ae_level\":%d,",    cam->status.ae_level);
-		p += sprintf(p, "\"aec_value\":%u,",   cam->status.aec_value);
-		p += sprintf(p, "\"agc\":%u,",         cam->status.agc);
-		p += sprintf(p, "\"agc_gain\":%u,",    cam->status.agc_gain);
-		p += sprintf(p, "\"gainceiling\":%u,", cam->status.gainceiling);
-		p += sprintf(p, "\"bpc\":%u,",         cam->status.bpc);
-		p += sprintf(p, "\"wpc\":%u,",         cam->status.wpc);
-		p += sprintf(p, "\"raw_gma\":%u,",     cam->status.raw_gma);
-		p += sprintf(p, "\"lenc\":%u,",        cam->status.lenc);
-		p += sprintf(p, "\"hmirror\":%u,",     cam->status.hmirror);
-		p += sprintf(p, "\"vflip\":%u,",       cam->status.vflip);
-		p += sprintf(p, "\"dcw\":%u,",         cam->status.dcw);
-		p += sprintf(p, "\"colorbar\":%u,",    cam->status.colorbar);
-		p += sprintf(p, "\"led_intensity\":%u,", led_duty);
-		p += sprintf(p, "\"calibration_date\":\"%s\",", strMLXcalibDate);
-		p += sprintf(p, "\"mlx_fast\":%u,",        mlx90640.GetFastRefreshRate());
-		p += sprintf(p, "\"ambReflected\":%5.2f,", mlx90640.GetAmbientReflected());
-		p += sprintf(p, "\"emissivity\":%5.2f,",   mlx90640.GetEmissivity());
-		p += sprintf(p, "\"mlx_observe_offset\":%u", MLXcalibration::getUserCalibrationOffsetsEnabled());
-
-		*p++ = '}';
-		*p++ = 0;		// end of the string
-    
-		httpd_resp_set_type(req, "application/json");
-		httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    
-		esp_err_t res = httpd_resp_send(req, json_response, strlen(json_response));
 
-	free(json_response);
+// GET /metrics
+// Prometheus text exposition of the capture and send path histograms, counters and heap gauges
+#define METRICS_RESPONSE_SIZE	8192
+
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+	char* buf = (char*)ps_malloc(METRICS_RESPONSE_SIZE);
+	if (!buf)
+		return httpd_resp_send_500(req);
+
+	size_t len = metrics_expose(buf, METRICS_RESPONSE_SIZE);
+
+	httpd_resp_set_type(req, "text/plain; version=0.0.4");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+	esp_err_t res = httpd_resp_send(req, buf, len);
+
+	free(buf);
 
 	return res;
 }
 
 
+// GET /trace
+// GET /trace?clear=1 empties the ring after the export
+// Chrome trace-event JSON of the frame latency ring, sent in chunks
+#define TRACE_CHUNK_SIZE		4096
+
+static esp_err_t trace_handler(httpd_req_t *req)
+{
+	bool bClear = false;
+
+	char query[32];
+	char value[4];
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		httpd_query_key_value(query, "clear", value, sizeof(value)) == ESP_OK)
+	{
+		bClear = atoi(value) != 0;
+	}
+
+	char* buf = (char*)ps_malloc(TRACE_CHUNK_SIZE);
+	if (!buf)
+		return httpd_resp_send_500(req);
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+	httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=trace.json");
+
+	trace_reader_t reader;
+	trace_reader_begin(&reader);
+
+	esp_err_t res = ESP_OK;
+
+	size_t len;
+	while (res == ESP_OK && (len = trace_read(&reader, buf, TRACE_CHUNK_SIZE)) > 0)
+		res = httpd_resp_send_chunk(req, buf, len);
+
+	free(buf);
+
+	if (res != ESP_OK)
+		return res;
+
+	if (bClear)
+		trace_clear();
+
+	return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+
 // GET /xclk
 static esp_err_t xclk_handler(httpd_req_t *req)
 {
@@ -306,6 +235,7 @@ static esp_err_t xclk_handler(httpd_req_t *req)
     int res = s->set_xclk(s, LEDC_TIMER_0, xclk);
   
     if (res) return httpd_resp_send_500(req);
+    status_invalidate(STATUS_SETTINGS | STATUS_REGISTERS);
 
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
     return httpd_resp_send(req, NULL, 0);
@@ -344,6 +274,7 @@ static esp_err_t reg_handler(httpd_req_t *req)
   int res = s->set_reg(s, reg, mask, val);
   
   if (res) return httpd_resp_send_500(req);
+  status_invalidate(STATUS_SETTINGS | STATUS_REGISTERS);
 
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
@@ -420,6 +351,7 @@ static esp_err_t pll_handler(httpd_req_t *req)
 	sensor_t *s = esp_camera_sensor_get();
 	int res = s->set_pll(s, bypass, mul, sys, root, pre, seld5, pclken, pclk);
 	if (res) return httpd_resp_send_500(req);
+	status_invalidate(STATUS_SETTINGS | STATUS_REGISTERS);
 
 	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
@@ -460,6 +392,7 @@ static esp_err_t win_handler(httpd_req_t *req)
 	// set_window(ov2640_sensor_mode_t)startX, offsetX, offsetY, totalX, totalY, outputX, outputY);
 
     if (res) return httpd_resp_send_500(req);
+    status_invalidate(STATUS_SETTINGS | STATUS_REGISTERS);
 
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
@@ -483,7 +416,8 @@ esp_err_t reboot_handler(httpd_req_t *req)
 void startControlAndStreamServers()
 {
 	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-	config.max_uri_handlers = 24;
+	config.max_uri_handlers = 40;
+	config.max_open_sockets = CONFIG_LWIP_MAX_SOCKETS - 3;	// the socket pools of the former :81 and :82 servers
 
 	httpd_uri_t ctrl_index_uri = {
 		.uri = "/",
@@ -498,6 +432,19 @@ void startControlAndStreamServers()
 		#endif
 	};
 
+	httpd_uri_t ctrl_control_batch_uri = {
+		.uri = "/control",
+		.method = HTTP_POST,
+		.handler = control_batch_handler,
+		.user_ctx = NULL
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
 	httpd_uri_t ctrl_status_uri = {
 		.uri = "/status",
 		.method = HTTP_GET,
@@ -550,6 +497,19 @@ void startControlAndStreamServers()
 		#endif
 	};
 
+	httpd_uri_t bmp90640_uri = {
+		.uri = "/bmp90640",
+		.method = HTTP_GET,
+		.handler = mlx90640_bmp_handler,
+		.user_ctx = NULL
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
 	httpd_uri_t get_offsets90640_uri = {
 		.uri = "/get_offsets90640",
 		.method = HTTP_GET,
@@ -694,9 +654,22 @@ void startControlAndStreamServers()
 	};
 
 	httpd_uri_t stream2640_uri = {
-		.uri = "/stream",
+		.uri = "/stream2640",
 		.method = HTTP_GET,
-		.handler = stream2640_handler,
+		.handler = httpd_async_handler,
+		.user_ctx = (void*)(httpd_async_fn_t)stream2640_handler
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t metrics_uri = {
+		.uri = "/metrics",
+		.method = HTTP_GET,
+		.handler = metrics_handler,
 		.user_ctx = NULL
 		#ifdef CONFIG_HTTPD_WS_SUPPORT
 		,
@@ -706,10 +679,127 @@ void startControlAndStreamServers()
 		#endif
 	};
 
+	httpd_uri_t trace_uri = {
+		.uri = "/trace",
+		.method = HTTP_GET,
+		.handler = trace_handler,
+		.user_ctx = NULL
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t tasks_uri = {
+		.uri = "/tasks",
+		.method = HTTP_GET,
+		.handler = httpd_async_handler,
+		.user_ctx = (void*)(httpd_async_fn_t)tasks_handler
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t record_uri = {
+		.uri = "/record",
+		.method = HTTP_GET,
+		.handler = record_handler,
+		.user_ctx = NULL
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t record_trigger_uri = {
+		.uri = "/record/trigger",
+		.method = HTTP_GET,
+		.handler = record_trigger_handler,
+		.user_ctx = NULL
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t record_dump_uri = {
+		.uri = "/record/dump",
+		.method = HTTP_GET,
+		.handler = httpd_async_handler,
+		.user_ctx = (void*)(httpd_async_fn_t)record_dump_handler
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t timelapse_uri = {
+		.uri = "/timelapse",
+		.method = HTTP_GET,
+		.handler = timelapse_handler,
+		.user_ctx = NULL
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t events_uri = {
+		.uri = "/events",
+		.method = HTTP_GET,
+		.handler = httpd_async_handler,
+		.user_ctx = (void*)(httpd_async_fn_t)events_handler
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
 	httpd_uri_t stream90640_uri = {
-		.uri = "/stream",
+		.uri = "/stream90640",
+		.method = HTTP_GET,
+		.handler = httpd_async_handler,
+		.user_ctx = (void*)(httpd_async_fn_t)stream90640_handler
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t mjpeg90640_uri = {
+		.uri = "/mjpeg90640",
+		.method = HTTP_GET,
+		.handler = httpd_async_handler,
+		.user_ctx = (void*)(httpd_async_fn_t)mjpeg90640_handler
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t capture_pair_uri = {
+		.uri = "/capture_pair",
 		.method = HTTP_GET,
-		.handler = stream90640_handler,
+		.handler = capture_pair_handler,
 		.user_ctx = NULL
 		#ifdef CONFIG_HTTPD_WS_SUPPORT
 		,
@@ -719,11 +809,98 @@ void startControlAndStreamServers()
 		#endif
 	};
 
+	httpd_uri_t ctrl_hub_uri = {
+		.uri = "/hub",
+		.method = HTTP_GET,
+		.handler = hub_handler,
+		.user_ctx = NULL
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t get_fusion90640_uri = {
+		.uri = "/get_fusion90640",
+		.method = HTTP_GET,
+		.handler = mlx90640_get_fusion_handler,
+		.user_ctx = NULL
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t set_fusion90640_uri = {
+		.uri = "/set_fusion90640",
+		.method = HTTP_POST,
+		.handler = mlx90640_set_fusion_handler,
+		.user_ctx = NULL
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t fusion90640_uri = {
+		.uri = "/fusion90640",
+		.method = HTTP_GET,
+		.handler = httpd_async_handler,
+		.user_ctx = (void*)(httpd_async_fn_t)fusion90640_handler
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+	httpd_uri_t stream_pair_uri = {
+		.uri = "/stream_pair",
+		.method = HTTP_GET,
+		.handler = httpd_async_handler,
+		.user_ctx = (void*)(httpd_async_fn_t)stream_pair_handler
+		#ifdef CONFIG_HTTPD_WS_SUPPORT
+		,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+		#endif
+	};
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+	httpd_uri_t ws_uri = {
+		.uri = "/ws",
+		.method = HTTP_GET,
+		.handler = ws_handler,
+		.user_ctx = NULL,
+		.is_websocket = true,
+		.handle_ws_control_frames = false,
+		.supported_subprotocol = NULL
+	};
+#endif
+
+    hub_init();
+    stream_rate_init();
+    tasks_init();
+
+    // streams are handed over to sender tasks, a single server serves everything
+    httpd_async_start();
+
+    size_t heapInternal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+
     log_i("Starting web server on port: '%d'", config.server_port);
     if (httpd_start(&control_httpd, &config) == ESP_OK)
     {
         httpd_register_uri_handler(control_httpd, &ctrl_index_uri);
         httpd_register_uri_handler(control_httpd, &ctrl_control_uri);
+        httpd_register_uri_handler(control_httpd, &ctrl_control_batch_uri);
         httpd_register_uri_handler(control_httpd, &ctrl_status_uri);
         httpd_register_uri_handler(control_httpd, &capture2640_uri);
         httpd_register_uri_handler(control_httpd, &ctrl_bmp_uri);
@@ -740,25 +917,38 @@ void startControlAndStreamServers()
 		httpd_register_uri_handler(control_httpd, &ctrl_reboot_uri);
 
 		httpd_register_uri_handler(control_httpd, &capture90640_uri);
+		httpd_register_uri_handler(control_httpd, &bmp90640_uri);
 		httpd_register_uri_handler(control_httpd, &get_offsets90640_uri);
 		httpd_register_uri_handler(control_httpd, &set_offsets90640_uri);
+		httpd_register_uri_handler(control_httpd, &get_fusion90640_uri);
+		httpd_register_uri_handler(control_httpd, &set_fusion90640_uri);
+		httpd_register_uri_handler(control_httpd, &ctrl_hub_uri);
+		httpd_register_uri_handler(control_httpd, &capture_pair_uri);
+
+		httpd_register_uri_handler(control_httpd, &stream2640_uri);
+		httpd_register_uri_handler(control_httpd, &stream90640_uri);
+		httpd_register_uri_handler(control_httpd, &mjpeg90640_uri);
+		httpd_register_uri_handler(control_httpd, &fusion90640_uri);
+		httpd_register_uri_handler(control_httpd, &stream_pair_uri);
+		httpd_register_uri_handler(control_httpd, &events_uri);
+		httpd_register_uri_handler(control_httpd, &metrics_uri);
+		httpd_register_uri_handler(control_httpd, &trace_uri);
+		httpd_register_uri_handler(control_httpd, &tasks_uri);
+		httpd_register_uri_handler(control_httpd, &record_uri);
+		httpd_register_uri_handler(control_httpd, &record_trigger_uri);
+		httpd_register_uri_handler(control_httpd, &record_dump_uri);
+		httpd_register_uri_handler(control_httpd, &timelapse_uri);
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+		httpd_register_uri_handler(control_httpd, &ws_uri);
+#endif
     }
-    
-    config.server_port += 1;
-    config.ctrl_port   += 1;
-    
-    log_i("Starting ov2640 stream server on port: '%d'", config.server_port);
-    if (httpd_start(&stream_httpd, &config) == ESP_OK)
-    {
-        httpd_register_uri_handler(stream_httpd, &stream2640_uri);
-    }
-    
-    config.server_port += 1;
-    config.ctrl_port   += 1;
-    
-    log_i("Starting mlx90640 stream server on port: '%d'", config.server_port);
-    if (httpd_start(&mlxthc_httpd, &config) == ESP_OK)
-    {
-	    httpd_register_uri_handler(mlxthc_httpd, &stream90640_uri);
-	}
+
+    log_i("Web server uses %u bytes of internal RAM", heapInternal - heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+
+#if RECORDER_AUTOSTART
+	recorder_start();
+#endif
+
+	timelapse_init();
 }
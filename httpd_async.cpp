@@ -0,0 +1,110 @@
+
+#include "httpd_async.h"
+#include "esp32-hal-log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include <stdio.h>
+
+
+typedef struct {
+	httpd_req_t*     req;		// async copy, owned by the sender until completed
+	httpd_async_fn_t fn;
+} httpd_async_job_t;
+
+static QueueHandle_t     asyncQueue = NULL;
+static SemaphoreHandle_t asyncIdle  = NULL;		// counts sender tasks waiting for a job
+
+
+static void httpd_async_task(void* arg)
+{
+	httpd_async_job_t job;
+
+	while (true)
+	{
+		if (xQueueReceive(asyncQueue, &job, portMAX_DELAY) != pdTRUE) continue;
+
+		esp_err_t res = job.fn(job.req);
+
+		// a synchronous handler returning an error makes httpd close the socket, do the same
+		if (res != ESP_OK)
+			httpd_sess_trigger_close(job.req->handle, httpd_req_to_sockfd(job.req));
+
+		httpd_req_async_handler_complete(job.req);
+
+		xSemaphoreGive(asyncIdle);
+	}
+}
+
+
+bool httpd_async_start()
+{
+	if (asyncQueue) return true;
+
+	asyncQueue = xQueueCreate(HTTPD_ASYNC_WORKERS, sizeof(httpd_async_job_t));
+	asyncIdle  = xSemaphoreCreateCounting(HTTPD_ASYNC_WORKERS, 0);
+	if (!asyncQueue || !asyncIdle) return false;
+
+	uint8_t internal = 0;
+
+	for (uint8_t i = 0; i < HTTPD_ASYNC_WORKERS; i++)
+	{
+		char name[16];
+		snprintf(name, sizeof(name), "httpd_async%u", i);
+
+		// stacks go to PSRAM, internal RAM is what WiFi and the camera driver run short of
+		BaseType_t res = xTaskCreatePinnedToCoreWithCaps(httpd_async_task, name, HTTPD_ASYNC_STACK_SIZE, NULL, 5,
+		                                                 NULL, tskNO_AFFINITY, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+		if (res != pdPASS && internal < HTTPD_ASYNC_INTERNAL_WORKERS) {
+			res = xTaskCreatePinnedToCore(httpd_async_task, name, HTTPD_ASYNC_STACK_SIZE, NULL, 5, NULL, tskNO_AFFINITY);
+			if (res == pdPASS) internal++;
+		}
+
+		if (res != pdPASS) {
+			log_e("Async sender task creation failed");
+			break;
+		}
+
+		xSemaphoreGive(asyncIdle);
+	}
+
+	return true;
+}
+
+
+esp_err_t httpd_async_handler(httpd_req_t *req)
+{
+	return httpd_async_run(req, (httpd_async_fn_t)req->user_ctx);
+}
+
+
+esp_err_t httpd_async_run(httpd_req_t *req, httpd_async_fn_t fn)
+{
+	if (!asyncQueue || xSemaphoreTake(asyncIdle, 0) != pdTRUE)
+	{
+		log_e("No free stream sender for %s", req->uri);
+
+		httpd_resp_set_status(req, "503 Service Unavailable");
+		httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+		httpd_resp_send(req, "Too many streams", HTTPD_RESP_USE_STRLEN);
+		return ESP_OK;
+	}
+
+	httpd_async_job_t job;
+	job.fn = fn;
+
+	if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK)
+	{
+		xSemaphoreGive(asyncIdle);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+
+	// a sender is idle so the queue has room
+	xQueueSend(asyncQueue, &job, portMAX_DELAY);
+
+	return ESP_OK;
+}
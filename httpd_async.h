@@ -0,0 +1,33 @@
+#ifndef _HTTPD_ASYNC_H_
+#define _HTTPD_ASYNC_H_
+
+
+#include "esp_http_server.h"
+#include "httpd_stream.h"
+
+
+// Streams run on a pool of sender tasks, the httpd worker only hands them over
+// and keeps serving control requests
+
+// Number of simultaneous streams: every open index page holds /stream2640 and /events,
+// one more for a multipart thermal fallback, a capture or a dump
+#define HTTPD_ASYNC_WORKERS			(STREAM_MAX_CLIENTS * 2 + 1)
+
+// Workers started when PSRAM stacks are not available, internal RAM does not fit them all
+#define HTTPD_ASYNC_INTERNAL_WORKERS	2
+
+// Sender task stack, JPEG encoding runs on it
+#define HTTPD_ASYNC_STACK_SIZE		8192
+
+typedef esp_err_t (*httpd_async_fn_t)(httpd_req_t *req);
+
+bool httpd_async_start();
+
+// URI handler for long running requests, user_ctx of the URI is the httpd_async_fn_t to run
+// Answers 503 if all sender tasks are busy
+esp_err_t httpd_async_handler(httpd_req_t *req);
+
+// Same for a handler that decides itself to continue on a sender task
+esp_err_t httpd_async_run(httpd_req_t *req, httpd_async_fn_t fn);
+
+#endif
@@ -2,6 +2,7 @@
 #include "httpd_capture_stream.h"
 #include "esp_camera.h"
 #include "img_converters.h"
+#include "jpge.h"
 #include "fb_gfx.h"
 #include "sdkconfig.h"
 #include "board_config.h"
@@ -10,9 +11,20 @@
 #include "esp32-hal-ledc.h"
 #include "MLX90640_API.h"
 #include "MLX90640_calibration.h"
+#include "MLX90640_frame2bmp.h"
+#include "MLX90640_fusion.h"
+#include "MLX90640_delta.h"
+#include "frame_envelope.h"
+#include "frame_hub.h"
+#include "httpd_stream.h"
+#include "httpd_status.h"
+#include "trace.h"
 
-bool isStreaming = false;
-uint8_t mlx90640calibration_frame = 0;
+// streams and captures holding the LED on, the last one to leave switches it off
+static int ledHolders = 0;
+
+// last thermal MJPEG encoding time, the fps ceiling is 1e6/mlx_mjpeg_encode_us
+uint32_t mlx_mjpeg_encode_us = 0;
 
 #define CONFIG_LED_MAX_INTENSITY 255
 int led_duty = 0;
@@ -20,15 +32,183 @@ int led_duty = 0;
 
 typedef struct
 {
-	httpd_req_t*  req;
-	size_t        len;
+	httpd_req_t*      req;
+	stream_writer_t*  sw;		// NULL for single shot responses
+	size_t            len;
+	int64_t           send_us;	// time spent sending, to separate it from encoding time
 } jpg_chunking_t;
 
+// 320x240 preview at most
+#define MLX_BMP_MAX_SCALE	10
+
+// MCU height of H2V2 subsampling, /mjpeg90640 renders this many rows per encoder strip
+#define MLX_MJPEG_STRIP_ROWS	16
+
 #define PART_BOUNDARY "123456789000000000000987654321"
 static const char *_STREAM_MULTIPART_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
 static const char *_STREAM_BOUNDARY               = "\r\n--" PART_BOUNDARY "\r\n";
 
 
+// Copies the value of a query parameter, false if absent
+// The query is read whole, a fixed buffer would truncate it and lose every key
+static bool query_get_str(httpd_req_t *req, const char *key, char *value, size_t size)
+{
+	size_t len = httpd_req_get_url_query_len(req) + 1;
+	if (len <= 1) return false;
+
+	char* query = (char*)malloc(len);
+	if (!query) return false;
+
+	bool found = httpd_req_get_url_query_str(req, query, len) == ESP_OK &&
+	             httpd_query_key_value(query, key, value, size) == ESP_OK;
+
+	free(query);
+
+	return found;
+}
+
+
+// Returns integer value of an optional query parameter or deflt if absent
+static int query_get_int(httpd_req_t *req, const char *key, int deflt)
+{
+	char value[16];
+
+	if (!query_get_str(req, key, value, sizeof(value)))
+		return deflt;
+
+	return atoi(value);
+}
+
+
+static const char* mlx_fmt_names[] = { "f32", "i16", "u8pal", "delta" };
+
+
+int mlx_fmt_parse(const char *name)
+{
+	for (int i = 0; i < MLX_FMT_COUNT; i++)
+		if (!strcmp(name, mlx_fmt_names[i])) return i;
+
+	return -1;
+}
+
+const char* mlx_fmt_name(int fmt)
+{
+	return (fmt >= 0 && fmt < MLX_FMT_COUNT) ? mlx_fmt_names[fmt] : "";
+}
+
+
+// Returns the fmt query parameter as mlx_fmt_t, -1 if unknown
+static int query_get_fmt(httpd_req_t *req)
+{
+	char value[8];
+
+	if (!query_get_str(req, "fmt", value, sizeof(value)))
+		return MLX_FMT_F32;
+
+	return mlx_fmt_parse(value);
+}
+
+
+// Returns the payload of a published frame in the requested format
+// The published frame already carries the centi-kelvin plane, the raw plane and
+// u8pal are converted into scratch with integer math
+//
+// scratch - MLX90640_pixelCOUNT * sizeof(uint16_t) bytes
+// range   - receives "min,max" in centi-kelvin for u8pal
+const void* mlx_frame_payload(const mlx_fb_t& fb, bool bRaw, int fmt, uint16_t* scratch,
+                              size_t* len, char* range, size_t range_len)
+{
+	const uint16_t nPixels = fb.width * fb.height;
+
+	if (fmt == MLX_FMT_F32) {
+		*len = fb.nBytes;
+		return bRaw ? fb.raw : fb.values;
+	}
+
+	const uint16_t* ck = fb.centiKelvin;
+	uint16_t ckMin, ckMax;
+
+	if (bRaw && fb.raw != fb.values)
+	{
+		for (uint16_t i = 0; i < nPixels; i++)
+			scratch[i] = MLX90640_centiKelvin(fb.raw[i]);
+
+		ck = scratch;
+
+		ckMin = ckMax = ck[0];
+		for (uint16_t i = 1; i < nPixels; i++) {
+			if (ck[i] < ckMin) ckMin = ck[i];
+			if (ck[i] > ckMax) ckMax = ck[i];
+		}
+	}
+	else
+	{
+		ckMin = MLX90640_centiKelvin(fb.stats->fMin);
+		ckMax = MLX90640_centiKelvin(fb.stats->fMax);
+	}
+
+	if (fmt == MLX_FMT_I16) {
+		*len = nPixels * sizeof(uint16_t);
+		return ck;
+	}
+
+	// u8pal bytes are written in place over the scratch words, never ahead of the reads
+	uint8_t* idx  = (uint8_t*)scratch;
+	uint32_t span = ckMax - ckMin;
+
+	for (uint16_t i = 0; i < nPixels; i++)
+		idx[i] = span ? ((uint32_t)(ck[i] - ckMin) * 255 + span / 2) / span : 0;
+
+	snprintf(range, range_len, "%u,%u", ckMin, ckMax);
+
+	*len = nPixels;
+	return idx;
+}
+
+
+void frame_envelope_mlx(frame_envelope_t* env, const mlx_fb_t& fb, int fmt, uint32_t dropped, uint32_t len)
+{
+	memset(env, 0, sizeof(*env));
+
+	env->magic       = FRAME_ENVELOPE_MAGIC;
+	env->version     = FRAME_ENVELOPE_VERSION;
+	env->headerLen   = sizeof(*env);
+	env->source      = FRAME_SOURCE_MLX90640;
+	env->format      = fmt;
+	env->seq         = fb.seq;
+	env->dropped     = dropped;
+	env->timestampUs = (int64_t)fb.timestamp.tv_sec * 1000000 + fb.timestamp.tv_usec;
+	env->subpage     = fb.subpage;
+	env->fTa         = fb.fTa;
+	env->fVdd        = fb.fVdd;
+	env->fEmissivity = fb.fEmissivity;
+	if (fb.stats) {
+		env->fMin  = fb.stats->fMin;
+		env->fMax  = fb.stats->fMax;
+		env->fMean = fb.stats->fMean;
+		env->iMin  = fb.stats->iMin;
+		env->iMax  = fb.stats->iMax;
+	}
+	env->payloadLen  = len;
+}
+
+
+void frame_envelope_cam(frame_envelope_t* env, const struct timeval& timestamp, uint32_t seq, uint32_t dropped, uint32_t len)
+{
+	memset(env, 0, sizeof(*env));
+
+	env->magic       = FRAME_ENVELOPE_MAGIC;
+	env->version     = FRAME_ENVELOPE_VERSION;
+	env->headerLen   = sizeof(*env);
+	env->source      = FRAME_SOURCE_OV2640;
+	env->format      = 0xFF;
+	env->seq         = seq;
+	env->dropped     = dropped;
+	env->timestampUs = (int64_t)timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+	env->payloadLen  = len;
+}
+
+
 // Turn LED On/Off
 void enable_LED(bool en)
 {
@@ -44,15 +224,78 @@ void enable_LED(bool en)
 }
 
 
+static SemaphoreHandle_t led_mutex()
+{
+	static SemaphoreHandle_t ledMutex = xSemaphoreCreateMutex();
+
+	return ledMutex;
+}
+
+
+// Takes or gives back a hold on the LED
+void led_hold(bool bHold)
+{
+	xSemaphoreTake(led_mutex(), portMAX_DELAY);
+
+		ledHolders += bHold ? 1 : -1;
+
+		if (bHold ? ledHolders == 1 : ledHolders == 0)
+			enable_LED(bHold);
+
+	xSemaphoreGive(led_mutex());
+}
+
+
+// Takes effect at once while the LED is held
+void led_set_duty(int duty)
+{
+	xSemaphoreTake(led_mutex(), portMAX_DELAY);
+
+		led_duty = duty;
+
+		if (ledHolders)
+			enable_LED(true);
+
+	xSemaphoreGive(led_mutex());
+}
+
+
+// Single frame of a source through the frame hub, so captures share the sensors with running streams
+// afterUs- skips frames whose capture started before, 0 takes the next frame
+// Returns NULL on timeout, the caller releases the frame
+static hub_frame_t* hub_capture(hub_source_t source, const char* name, int64_t afterUs)
+{
+	int hub = hub_subscribe(source, name);
+	if (hub < 0) return NULL;
+
+	TickType_t   start = xTaskGetTickCount();
+	TickType_t   timeout = pdMS_TO_TICKS(5000);
+	hub_frame_t* f = NULL;
+
+	while (xTaskGetTickCount() - start < timeout)
+	{
+		f = hub_get(hub, timeout - (xTaskGetTickCount() - start));
+		if (!f || hub_frame_us(f) >= afterUs) break;
+
+		hub_release(f);
+		f = NULL;
+	}
+
+	hub_unsubscribe(hub);
+
+	return f;
+}
+
+
 // GET /bmp
 // Input: req- valid request
 esp_err_t bmp_handler(httpd_req_t *req)
 {
 	[[maybe_unused]] uint64_t fr_start = esp_timer_get_time();
 
-	// lock spi memory dma buffer to read from
-	camera_fb_t *fb = esp_camera_fb_get();
-		if (!fb)
+	// JPEG held by the hub
+	hub_frame_t* f = hub_capture(HUB_SRC_CAM, "bmp", 0);
+		if (!f)
 		{
 			log_e("Camera capture failed");
 			httpd_resp_send_500(req);
@@ -65,17 +308,24 @@ esp_err_t bmp_handler(httpd_req_t *req)
 		httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
 		char ts[32];
-		snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
+		snprintf(ts, 32, "%lld.%06ld", f->timestamp.tv_sec, f->timestamp.tv_usec);
 		httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
+		camera_fb_t fb = {};
+		fb.buf       = (uint8_t *)f->jpg;
+		fb.len       = f->jpg_len;
+		fb.width     = f->width;
+		fb.height    = f->height;
+		fb.format    = PIXFORMAT_JPEG;
+		fb.timestamp = f->timestamp;
+
 		uint8_t *buf = NULL;
 		size_t buf_len = 0;
 		// calls fmt2bmp to convert camera supported types to BMP type
 		// (JPEG is supported) allocates buf internally
-		bool converted = frame2bmp(fb, &buf, &buf_len);
+		bool converted = frame2bmp(&fb, &buf, &buf_len);
 
-	// unlock spi dma buffer
-	esp_camera_fb_return(fb);
+	hub_release(f);
 
 	if (!converted)
 	{
@@ -104,12 +354,16 @@ static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_
 
 	if (!index) j->len = 0;
 
+	int64_t send_start = esp_timer_get_time();
+
 	// send data as soon as available in chunks, headers are sent only during first call
 	// First or next call is saved in req->aux->first_chunk_sent
-	if (httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK)
+	esp_err_t res = j->sw ? stream_write(j->sw, data, len) : httpd_resp_send_chunk(j->req, (const char *)data, len);
+	if (res != ESP_OK)
 		return 0;
 
-	j->len += len;
+	j->send_us += esp_timer_get_time() - send_start;
+	j->len     += len;
 
 	return len;
 }
@@ -121,22 +375,21 @@ static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_
 // Input: req- valid request
 esp_err_t ov2640_capture_handler(httpd_req_t *req)
 {
-	camera_fb_t *fb = NULL;
 	esp_err_t res = ESP_OK;
 
 	[[maybe_unused]] int64_t fr_start = esp_timer_get_time();
 
 	log_i("/capture2640 received");
 
-	enable_LED(true);
-		// The LED needs to be turned on ~150ms before the call to esp_camera_fb_get()
-		// or it won't be visible in the frame. A better way to do this is needed.
+	led_hold(true);
+		// The LED needs to be turned on ~150ms before the frame starts
+		// or it won't be visible in it, older frames queued by the hub are skipped
 		vTaskDelay(150 / portTICK_PERIOD_MS);
 
-		fb = esp_camera_fb_get();
-	enable_LED(false);
+		hub_frame_t* f = hub_capture(HUB_SRC_CAM, "capture2640", esp_timer_get_time());
+	led_hold(false);
 
-		if (!fb)
+		if (!f)
 		{
 			log_e("Camera capture failed");
 			httpd_resp_send_500(req);
@@ -148,34 +401,15 @@ esp_err_t ov2640_capture_handler(httpd_req_t *req)
 		httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
 		char ts[32];
-		snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
+		snprintf(ts, 32, "%lld.%06ld", f->timestamp.tv_sec, f->timestamp.tv_usec);
 		httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
-		[[maybe_unused]] size_t fb_len;
+		// the hub converts raw sensor formats to JPEG once for all subscribers
+		[[maybe_unused]] size_t fb_len = f->jpg_len;
 
-		if (fb->format == PIXFORMAT_JPEG)
-		{
-			log_d("PIXFORMAT == JPEG");
-
-			fb_len = fb->len;
-
-			res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-		}
-		else
-		{
-			log_d("PIXFORMAT != JPEG");
-
-			jpg_chunking_t jchunk = { req, 0 };
-			res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk) ? ESP_OK : ESP_FAIL;
-
-			// marks the end of chunk stream
-			httpd_resp_send_chunk(req, NULL, 0);
+		res = httpd_resp_send(req, (const char *)f->jpg, f->jpg_len);
 
-			fb_len = jchunk.len;
-		}
-
-	// unlock dma memory buffer
-	esp_camera_fb_return(fb);
+	hub_release(f);
 
 	[[maybe_unused]] int64_t fr_end = esp_timer_get_time();
 
@@ -185,6 +419,8 @@ esp_err_t ov2640_capture_handler(httpd_req_t *req)
 }
 
 // GET /capture90640
+// GET /capture90640?raw=1 sends temperatures without user offsets
+// GET /capture90640?fmt=i16|u8pal sends uint16 centi-kelvin or 8-bit palette indices
 //
 // Input: req- valid request
 esp_err_t mlx90640_capture_handler(httpd_req_t *req)
@@ -195,10 +431,33 @@ esp_err_t mlx90640_capture_handler(httpd_req_t *req)
 
 	log_i("/capture90640 received");
 
-	MLX90640& mlx90640 = MLX90640::getInstance();
+	bool bRaw = query_get_int(req, "raw", 0);
+	int  fmt  = query_get_fmt(req);
+
+	// a single frame has nothing to be delta coded against
+	if (fmt < 0 || fmt == MLX_FMT_DELTA) {
+		httpd_resp_send_404(req);
+		return ESP_FAIL;
+	}
+
+	// converted formats would take too much of the httpd task stack
+	uint16_t* scratch = (fmt != MLX_FMT_F32) ? (uint16_t*)ps_malloc(MLX90640_pixelCOUNT * sizeof(uint16_t)) : NULL;
+	char      range[24];
+	size_t    len = 0;
+
+	if (fmt != MLX_FMT_F32 && !scratch) {
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+
+	hub_frame_t* f = hub_capture(HUB_SRC_MLX, "capture90640", 0);
+	if (!f) {
+		free(scratch);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
 
-	mlx_fb_t fb = {};
-	fb = mlx90640.fb_get();
+	const mlx_fb_t& fb = f->mlx;
 
 		httpd_resp_set_type(req, HTTPD_TYPE_OCTET);
 		httpd_resp_set_hdr(req,  "Content-Disposition", "inline; filename=capture.bmp");
@@ -208,14 +467,107 @@ esp_err_t mlx90640_capture_handler(httpd_req_t *req)
 		snprintf(ts, 32, "%lld.%06ld", fb.timestamp.tv_sec, fb.timestamp.tv_usec);
 		httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
-		MLXcalibration::applyUserCalibrationOffsets(fb);
+		// published frame already has user offsets applied, raw plane is a view into the same slot
+		const void* payload = fb.values ? mlx_frame_payload(fb, bRaw, fmt, scratch, &len, range, sizeof(range)) : NULL;
+
+		httpd_resp_set_hdr(req, "X-Format", mlx_fmt_names[fmt]);
+		if (fmt == MLX_FMT_U8PAL)
+			httpd_resp_set_hdr(req, "X-Range", range);
+
+		if (payload)
+			res = httpd_resp_send(req, (const char *)payload, len);
+		else
+			res = httpd_resp_send_500(req);
+
+	hub_release(f);
+
+	free(scratch);
+
+	[[maybe_unused]] int64_t fr_end = esp_timer_get_time();
+	log_d("RAW: %ubytes %ums", (uint32_t)len, (uint32_t)((fr_end - fr_start) >> 10));
+
+	return res;
+}
+
+// GET /bmp90640?scale=10&palette=0&raw=0
+// Colorized thermal frame upscaled by an integer factor with bilinear interpolation
+//
+// Input: req- valid request
+esp_err_t mlx90640_bmp_handler(httpd_req_t *req)
+{
+	// rendering buffer is kept between requests and grown on demand
+	static SemaphoreHandle_t bmpMutex    = xSemaphoreCreateMutex();
+	static uint8_t*          bmpBuf      = NULL;
+	static uint32_t          bmpBufSize  = 0;
+
+	[[maybe_unused]] int64_t fr_start = esp_timer_get_time();
+
+	log_i("/bmp90640 received");
+
+	int  scale   = query_get_int(req, "scale", 1);
+	int  palette = query_get_int(req, "palette", MLXpalette::getPalette());
+	bool bRaw    = query_get_int(req, "raw", 0);
+
+	if (scale < 1 || scale > MLX_BMP_MAX_SCALE || palette < 0 || palette >= MLX_PALETTE_COUNT) {
+		httpd_resp_send_404(req);
+		return ESP_FAIL;
+	}
+
+	xSemaphoreTake(bmpMutex, portMAX_DELAY);
+
+		uint32_t bmp_size = MLXbmp_size(32, 24, scale);
+		if (bmp_size > bmpBufSize)
+		{
+			uint8_t* buf = (uint8_t*)heap_caps_realloc(bmpBuf, bmp_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+			if (!buf) {
+				xSemaphoreGive(bmpMutex);
+				log_e("BMP buffer allocation failed: %u", bmp_size);
+				httpd_resp_send_500(req);
+				return ESP_FAIL;
+			}
+
+			bmpBuf     = buf;
+			bmpBufSize = bmp_size;
+		}
+
+		hub_frame_t* f = hub_capture(HUB_SRC_MLX, "bmp90640", 0);
+		mlx_fb_t     fb = f ? f->mlx : mlx_fb_t{};
+
+			uint32_t bmp_len = 0;
+			// frame statistics describe the corrected plane only
+			mlx_palette_norm_t norm;
+			if (!bRaw && fb.stats) norm = MLXagc::norm(*fb.stats);
+
+			bool converted = fb.values &&
+			                 MLXframe2bmp_buf(bRaw ? fb.raw : fb.values, fb.width, fb.height, scale,
+			                                  (mlx_palette_t)palette, (!bRaw && fb.stats) ? &norm : NULL,
+			                                  bmpBuf, bmpBufSize, &bmp_len);
+
+			char ts[32];
+			snprintf(ts, 32, "%lld.%06ld", fb.timestamp.tv_sec, fb.timestamp.tv_usec);
+
+		hub_release(f);
+
+		esp_err_t res;
+		if (converted)
+		{
+			httpd_resp_set_type(req, "image/x-windows-bmp");
+			httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture90640.bmp");
+			httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+			httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
-		res = httpd_resp_send(req, (const char *)fb.values, fb.nBytes);
+			res = httpd_resp_send(req, (const char *)bmpBuf, bmp_len);
+		}
+		else
+		{
+			log_e("BMP Conversion failed");
+			res = httpd_resp_send_500(req);
+		}
 
-	mlx90640.fb_return(fb);
+	xSemaphoreGive(bmpMutex);
 
 	[[maybe_unused]] int64_t fr_end = esp_timer_get_time();
-	log_d("RAW: %ubytes %ums", (uint32_t)(fb.nBytes), (uint32_t)((fr_end - fr_start) >> 10));
+	log_d("BMP90640: %ubytes %ums", bmp_len, (uint32_t)((fr_end - fr_start) >> 10));
 
 	return res;
 }
@@ -310,6 +662,7 @@ esp_err_t mlx90640_set_offsets_handler(httpd_req_t *req)
 	}
 
 	MLXcalibration::writeUserCalibrationOffsets(httpDate, buf);
+	status_invalidate(STATUS_CALIBRATION);
 
 	free(buf);
 
@@ -317,93 +670,178 @@ esp_err_t mlx90640_set_offsets_handler(httpd_req_t *req)
 }
 
 
-// GET :81/stream
+// GET /get_fusion90640
 //
 // Input: req- valid request
-esp_err_t stream2640_handler(httpd_req_t *req)
+esp_err_t mlx90640_get_fusion_handler(httpd_req_t *req)
 {
-	struct timeval _timestamp;
-	size_t   buffer_jpg_len = 0;
-	uint8_t *buffer_jpg = NULL;
+	log_i("GET /get_fusion90640 received");
 
-	static int64_t last_frame = 0;
-	if (!last_frame) last_frame = esp_timer_get_time();
+	float h[9];
+	MLXfusion::getHomography(h);
 
-	log_i("GET :81/stream received");
+	char json[256];
+	char* p = json;
+	p += sprintf(p, "{\"mode\":%d,\"alpha\":%d,\"homography\":[", MLXfusion::getMode(), MLXfusion::getAlpha());
+	for (int i = 0; i < 9; i++)
+		p += sprintf(p, "%s%.6g", i ? "," : "", h[i]);
+	p += sprintf(p, "]}");
 
-	esp_err_t res;
-	res = httpd_resp_set_type(req, _STREAM_MULTIPART_CONTENT_TYPE);
-	if (res != ESP_OK) return res;
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+	return httpd_resp_send(req, json, strlen(json));
+}
+
+
+// POST /set_fusion90640
+// Body: 9 little endian floats, row-major homography
+//
+// Input: req- valid request
+esp_err_t mlx90640_set_fusion_handler(httpd_req_t *req)
+{
+	log_i("POST /set_fusion90640 received");
+
+	float h[9];
+
+	if (req->content_len != sizeof(h))
+	{
+		log_e("Error: expected length %d", sizeof(h));
+		httpd_resp_send_500(req);
+
+		return ESP_FAIL;
+	}
+
+	int remaining = sizeof(h);
+	char* writePtr = (char*)h;
+
+	int iRetries = 0;
+	while (remaining > 0)
+	{
+		int nRead = httpd_req_recv(req, writePtr, remaining);
+		if (nRead <= 0)
+		{
+			if (nRead == HTTPD_SOCK_ERR_TIMEOUT) {
+				if (iRetries++ < 3) continue; // retry
+			}
+
+			log_e("Receive error");
+			httpd_resp_send_500(req);
+
+			return ESP_FAIL;
+		}
+
+		remaining -= nRead;
+		writePtr  += nRead;
+	}
+
+	if (MLXfusion::writeHomography(h) != ESP_OK) {
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
 
 	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+	return httpd_resp_sendstr(req, "Upload successful");
+}
+
+
+// GET /stream2640
+// GET /stream2640?hdr=1 prefixes every JPEG with frame_envelope_t
+//
+// Input: req- valid request
+esp_err_t stream2640_handler(httpd_req_t *req)
+{
+	int64_t last_frame = esp_timer_get_time();
+
+	log_i("GET /stream2640 received");
 
-	isStreaming = true;
-	enable_LED(true);
+	bool bEnvelope = query_get_int(req, "hdr", 0);
+
+	// frames of the shared capture loop this client was too slow for
+	uint32_t nextSeq = 0;
+	uint32_t dropped = 0;
+	bool     bFirst  = true;
+
+	int hub = hub_subscribe(HUB_SRC_CAM, "stream2640");
+	if (hub < 0) {
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+
+	stream_writer_t sw;
+	esp_err_t res = stream_begin(&sw, req, _STREAM_MULTIPART_CONTENT_TYPE);
+
+	// frames are skipped for this client alone when it falls behind the target latency
+	int rate = stream_rate_begin(req, "stream2640");
+
+	led_hold(true);
 	
-	camera_fb_t* fb = NULL;
-	while (true)
+	while (res == ESP_OK)
 	{
-		fb = esp_camera_fb_get();
-		if (!fb) {
+		hub_frame_t* f = hub_get(hub, pdMS_TO_TICKS(5000));
+		if (!f) {
 			log_e("Camera capture failed");
 			res = ESP_FAIL;
 			break;
 		}
 
-		_timestamp.tv_sec  = fb->timestamp.tv_sec;
-		_timestamp.tv_usec = fb->timestamp.tv_usec;
+		// frames the hub dropped for this client, rate control skips below are reported as skipped in /status
+		if (!bFirst && f->seq != nextSeq) dropped += f->seq - nextSeq;
+		nextSeq = f->seq + 1;
+		bFirst  = false;
 
-		if (fb->format != PIXFORMAT_JPEG)
-		{
-			bool jpeg_converted = frame2jpg(fb, 80, &buffer_jpg, &buffer_jpg_len);
+		if (stream_rate_skip(rate)) {
+			hub_release(f);
+			continue;
+		}
 
-			esp_camera_fb_return(fb);
-			fb = NULL;
+		stream_frame_trace(&sw, TRACE_CAM, TRACE_LANE_STREAM + hub, f->seq, hub_frame_us(f));
 
-			if (!jpeg_converted) {
-				log_e("JPEG compression failed");
-				res = ESP_FAIL;
-			}
-		}
-		else {
-			buffer_jpg     = fb->buf;
-			buffer_jpg_len = fb->len;
-		}
+		size_t jpg_len = f->jpg_len;
 
 		// --boundary
-		if (res == ESP_OK)
-			res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+		res = stream_write(&sw, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
 
 		if (res == ESP_OK)
 		{
-			char* bufferHeader = (char*)ps_malloc(256);
-				size_t hlen = snprintf(bufferHeader, 256,
-									   "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %lld.%06ld\r\n\r\n",
-									   buffer_jpg_len, _timestamp.tv_sec, _timestamp.tv_usec);
-
-				// Content-Type: type
-				// Content-Length: len
-				// X-Timestamp:
-				// new line
-				res = httpd_resp_send_chunk(req, bufferHeader, hlen);
-			free(bufferHeader);
+			char bufferHeader[128];
+			size_t hlen;
+
+			if (bEnvelope)
+				hlen = snprintf(bufferHeader, sizeof(bufferHeader),
+								"Content-Type: " FRAME_ENVELOPE_CONTENT_TYPE "\r\nContent-Length: %u\r\n\r\n",
+								sizeof(frame_envelope_t) + jpg_len);
+			else
+				hlen = snprintf(bufferHeader, sizeof(bufferHeader),
+								"Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %lld.%06ld\r\n\r\n",
+								jpg_len, f->timestamp.tv_sec, f->timestamp.tv_usec);
+
+			// Content-Type: type
+			// Content-Length: len
+			// X-Timestamp:
+			// new line
+			res = stream_write(&sw, bufferHeader, hlen);
+		}
+
+		if (res == ESP_OK && bEnvelope)
+		{
+			frame_envelope_t env;
+			frame_envelope_cam(&env, f->timestamp, f->seq, dropped, jpg_len);
+
+			res = stream_write(&sw, (const char *)&env, sizeof(env));
 		}
 
 		// Data
 		if (res == ESP_OK)
-			res = httpd_resp_send_chunk(req, (const char *)buffer_jpg, buffer_jpg_len);
+			res = stream_write(&sw, (const char *)f->jpg, jpg_len);
 
-		if (fb)
-		{
-			esp_camera_fb_return(fb);
-			fb = NULL;
-			buffer_jpg = NULL;	// pointer to fb internal structure
-		}
-		else if (buffer_jpg)
-		{
-			free(buffer_jpg);
-			buffer_jpg = NULL;
-		}
+		if (res == ESP_OK)
+			res = stream_frame_end(&sw);
+
+		if (res == ESP_OK)
+			stream_rate_update(rate, hub_frame_us(f), sw.lastSendUs);
+
+		hub_release(f);
 
 		if (res != ESP_OK) {
 			log_e("Frame sending failed");
@@ -414,71 +852,165 @@ esp_err_t stream2640_handler(httpd_req_t *req)
 		[[maybe_unused]] int64_t frame_time = (fr_end - last_frame) / 1000;
 		last_frame = fr_end;
 
-		log_d("MJPG: %ubytes %ums (%.1ffps)", (uint32_t)(buffer_jpg_len),
+		log_d("MJPG: %ubytes %ums (%.1ffps)", (uint32_t)(jpg_len),
 			                                  (uint32_t)frame_time,
 			                                  1000.0 / (uint32_t)frame_time );
 	}
 
-	isStreaming = false;
-	enable_LED(false);
+	stream_rate_end(rate);
+	stream_end(&sw);
+	hub_unsubscribe(hub);
+
+	led_hold(false);
 
 	return res;
 }
 
-// GET :82/stream
+// GET /stream90640
+// GET /stream90640?raw=1 streams temperatures without user offsets
+// GET /stream90640?fmt=i16|u8pal streams uint16 centi-kelvin or 8-bit palette indices
+// GET /stream90640?fmt=delta&key=16&step=1 streams delta coded centi-kelvin frames,
+//     a keyframe every key frames, deltas quantized to step centi-kelvin
+// GET /stream90640?hdr=1 prefixes every payload with frame_envelope_t
 //
 // Input: req- valid request
 esp_err_t stream90640_handler(httpd_req_t *req)
 {
-	static int64_t last_frame = 0;
-	if (!last_frame) last_frame = esp_timer_get_time();
+	int64_t last_frame = esp_timer_get_time();
 
-	log_i("GET :82/stream received");
+	log_i("GET /stream90640 received");
 
-	esp_err_t res;
-	res = httpd_resp_set_type(req, _STREAM_MULTIPART_CONTENT_TYPE);
-	if (res != ESP_OK) return res;
+	bool bRaw = query_get_int(req, "raw", 0);
+	int  fmt  = query_get_fmt(req);
 
-	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+	if (fmt < 0) {
+		httpd_resp_send_404(req);
+		return ESP_FAIL;
+	}
 
-	MLX90640& mlx90640 = MLX90640::getInstance();
+	int key  = query_get_int(req, "key", 16);
+	int step = query_get_int(req, "step", 1);
 
-	mlx_fb_t fb = {};
-	while (true)
-	{
-		fb = mlx90640.fb_get();
+	bool bEnvelope = query_get_int(req, "hdr", 0);
 
-			res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-			if (res == ESP_OK)
-			{
-				char* bufferHeader = (char*)ps_malloc(256);
-					size_t hlen = snprintf(bufferHeader, 256,
-										   "Content-Type: application/octet-stream\r\nContent-Length: %u\r\nX-Timestamp: %lld.%06ld\r\n\r\n",
-										   fb.nBytes, fb.timestamp.tv_sec, fb.timestamp.tv_usec);
+	// frames published to other consumers in between count as dropped for this client
+	uint32_t nextSeq = 0;
+	uint32_t dropped = 0;
+	bool     bFirst  = true;
 
-					res = httpd_resp_send_chunk(req, bufferHeader, hlen);
-				free(bufferHeader);
-			}
+	if (key < 0 || key > 0xFFFF || step < 1 || step > 255) {
+		httpd_resp_send_404(req);
+		return ESP_FAIL;
+	}
 
-			// if calibration is in progress
-			if (mlx90640calibration_frame > 0) {
-				mlx90640calibration_frame++;
+	// converted formats would take too much of the httpd task stack
+	uint16_t* scratch = (fmt != MLX_FMT_F32) ? (uint16_t*)ps_malloc(MLX90640_pixelCOUNT * sizeof(uint16_t)) : NULL;
+	char      range[24];
 
-				for (uint16_t i = 0; i < MLX90640_pixelCOUNT; i++) {
-					fb.offsets[i] += fb.values[i]/100.0f - fb.fTambientReflected/100.0f;
-				}
+	mlx_delta_state_t* delta     = NULL;
+	uint8_t*           delta_buf = NULL;
+	if (fmt == MLX_FMT_DELTA)
+	{
+		delta     = (mlx_delta_state_t*)ps_malloc(sizeof(mlx_delta_state_t));
+		delta_buf = (uint8_t*)ps_malloc(MLX_DELTA_MAX_LEN(MLX90640_pixelCOUNT));
+		if (delta) MLXdelta::init(*delta, key, step);
+	}
 
-				if (mlx90640calibration_frame > 100)
-					// disable calibration after 100 full frames
-					mlx90640calibration_frame = 0;
-			}
+	if ((fmt != MLX_FMT_F32 && !scratch) || (fmt == MLX_FMT_DELTA && (!delta || !delta_buf))) {
+		free(scratch);
+		free(delta);
+		free(delta_buf);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
 
-			MLXcalibration::applyUserCalibrationOffsets(fb);
+	int hub = hub_subscribe(HUB_SRC_MLX, "stream90640");
+	if (hub < 0) {
+		free(scratch);
+		free(delta);
+		free(delta_buf);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
 
+	stream_writer_t sw;
+	esp_err_t res = stream_begin(&sw, req, _STREAM_MULTIPART_CONTENT_TYPE);
+
+	while (res == ESP_OK)
+	{
+		hub_frame_t* f = hub_get(hub, pdMS_TO_TICKS(5000));
+		if (!f) {
+			log_e("Thermal frame timeout");
+			res = ESP_FAIL;
+			break;
+		}
+
+		stream_frame_trace(&sw, TRACE_MLX, TRACE_LANE_STREAM + hub, f->seq, hub_frame_us(f));
+
+		const mlx_fb_t& fb = f->mlx;
+
+			size_t len = 0;
+			const void* payload = fb.values ? mlx_frame_payload(fb, bRaw, fmt == MLX_FMT_DELTA ? MLX_FMT_I16 : fmt,
+			                                                    scratch, &len, range, sizeof(range)) : NULL;
+
+			if (payload && fmt == MLX_FMT_DELTA)
+			{
+				len = MLXdelta::encode(*delta, (const uint16_t*)payload, fb.width * fb.height, delta_buf);
+				payload = len ? delta_buf : NULL;
+			}
+
+			if (!bFirst && fb.seq != nextSeq) dropped += fb.seq - nextSeq;
+			nextSeq = fb.seq + 1;
+			bFirst  = false;
+
+			res = stream_write(&sw, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
 			if (res == ESP_OK)
-				res = httpd_resp_send_chunk(req, (const char *)fb.values, fb.nBytes);
+			{
+				char bufferHeader[256];
+				size_t hlen;
+
+				if (bEnvelope)
+					hlen = snprintf(bufferHeader, sizeof(bufferHeader),
+									"Content-Type: " FRAME_ENVELOPE_CONTENT_TYPE "\r\nContent-Length: %u\r\n",
+									sizeof(frame_envelope_t) + len);
+				else
+					hlen = snprintf(bufferHeader, sizeof(bufferHeader),
+									"Content-Type: application/octet-stream\r\nContent-Length: %u\r\nX-Timestamp: %lld.%06ld\r\n",
+									len, fb.timestamp.tv_sec, fb.timestamp.tv_usec);
+
+				if (fmt != MLX_FMT_F32)
+					hlen += snprintf(bufferHeader + hlen, sizeof(bufferHeader) - hlen, "X-Format: %s\r\n", mlx_fmt_names[fmt]);
+				if (fmt == MLX_FMT_U8PAL)
+					hlen += snprintf(bufferHeader + hlen, sizeof(bufferHeader) - hlen, "X-Range: %s\r\n", range);
+
+				// min/max with their pixel indices and the smoothed AGC range spare the client a pass
+				if (!bEnvelope && !bRaw && fb.stats)
+					hlen += snprintf(bufferHeader + hlen, sizeof(bufferHeader) - hlen,
+									 "X-Stats: %.2f,%u,%.2f,%u,%.2f,%.2f\r\n",
+									 fb.stats->fMin, fb.stats->iMin, fb.stats->fMax, fb.stats->iMax,
+									 fb.stats->fAgcMin, fb.stats->fAgcMax);
+
+				hlen += snprintf(bufferHeader + hlen, sizeof(bufferHeader) - hlen, "\r\n");
+
+				res = stream_write(&sw, bufferHeader, hlen);
+			}
 
-		mlx90640.fb_return(fb);
+			if (res == ESP_OK && bEnvelope)
+			{
+				frame_envelope_t env;
+				frame_envelope_mlx(&env, fb, fmt, dropped, len);
+
+				res = stream_write(&sw, (const char *)&env, sizeof(env));
+			}
+
+			// calibration frames are accumulated and offsets applied when the frame is published
+			if (res == ESP_OK)
+				res = payload ? stream_write(&sw, (const char *)payload, len) : ESP_FAIL;
+
+			if (res == ESP_OK)
+				res = stream_frame_end(&sw);
+
+		hub_release(f);
 
 		if (res != ESP_OK) {
 			log_e("Send frame failed");
@@ -489,10 +1021,614 @@ esp_err_t stream90640_handler(httpd_req_t *req)
 		[[maybe_unused]] int64_t frame_time = (fr_end - last_frame) / 1000;
 		last_frame = fr_end;
 
-		log_d("RAW: %ubytes %ums (%.1ffps)", (uint32_t)(fb.nBytes),
+		log_d("RAW: %ubytes %ums (%.1ffps)", (uint32_t)len,
 										     (uint32_t)frame_time,
 										     1000.0 / (uint32_t)frame_time );
 	}
 
+	stream_end(&sw);
+	hub_unsubscribe(hub);
+
+	free(scratch);
+	free(delta);
+	free(delta_buf);
+
+	return res;
+}
+
+// jpge output handed to jpg_encode_stream, as fmt2jpg_cb does
+class jpg_chunk_stream : public jpge::output_stream {
+	jpg_chunking_t* j;
+	size_t          index;
+
+public:
+	jpg_chunk_stream(jpg_chunking_t* j) : j(j), index(0) { }
+
+	virtual bool put_buf(const void* data, int len)
+	{
+		if (!data) return true;		// end of image
+
+		size_t sent = jpg_encode_stream(j, index, data, len);
+		index += sent;
+
+		return sent == (size_t)len;
+	}
+
+	virtual uint get_size() const { return index; }
+};
+
+
+// Encodes a 32x24 frame upscaled by scale as JPEG, rendered one MCU strip at a time
+// like convert_image feeds the encoder line by line, so no full RGB image is needed
+//
+// strip_buf- 32*scale * MLX_MJPEG_STRIP_ROWS * 3 bytes
+static bool mjpeg90640_encode(const float* frame, int scale, mlx_palette_t palette, const mlx_palette_norm_t& norm,
+                              int quality, uint8_t* strip_buf, jpg_chunking_t* jchunk)
+{
+	const uint16_t width  = 32 * scale;
+	const uint16_t height = 24 * scale;
+
+	jpge::params comp_params;
+	comp_params.m_subsampling = jpge::H2V2;
+	comp_params.m_quality     = quality;
+
+	jpg_chunk_stream   dst_stream(jchunk);
+	jpge::jpeg_encoder dst_image;
+
+	if (!dst_image.init(&dst_stream, width, height, 3, comp_params)) {
+		log_e("JPG encoder init failed");
+		return false;
+	}
+
+	bool ok = true;
+	for (uint32_t row = 0; ok && row < height; row += MLX_MJPEG_STRIP_ROWS)
+	{
+		uint32_t rows = height - row < MLX_MJPEG_STRIP_ROWS ? height - row : MLX_MJPEG_STRIP_ROWS;
+
+		ok = MLXrender_bgr888_rows(frame, 32, 24, scale, palette, norm, row, rows, strip_buf, width * 3);
+
+		for (uint32_t y = 0; ok && y < rows; y++)
+		{
+			// jpge takes R,G,B
+			uint8_t* line = strip_buf + y * width * 3;
+			for (uint32_t x = 0; x < (uint32_t)width * 3; x += 3) {
+				uint8_t b = line[x];
+				line[x]     = line[x + 2];
+				line[x + 2] = b;
+			}
+
+			ok = dst_image.process_scanline(line);
+		}
+	}
+
+	// flushes the last MCU row and the end of image marker
+	if (ok) ok = dst_image.process_scanline(NULL);
+
+	dst_image.deinit();
+
+	return ok;
+}
+
+
+// GET /mjpeg90640?scale=10&quality=80&palette=0
+// Colorized, upscaled thermal frames encoded on device for plain MJPEG viewers
+//
+// Input: req- valid request
+esp_err_t mjpeg90640_handler(httpd_req_t *req)
+{
+	int64_t last_frame = esp_timer_get_time();
+
+	log_i("GET /mjpeg90640 received");
+
+	int scale   = query_get_int(req, "scale", MLX_BMP_MAX_SCALE);
+	int quality = query_get_int(req, "quality", 80);
+	int palette = query_get_int(req, "palette", MLXpalette::getPalette());
+
+	if (scale < 1 || scale > MLX_BMP_MAX_SCALE || quality < 1 || quality > 100 ||
+		palette < 0 || palette >= MLX_PALETTE_COUNT)
+	{
+		httpd_resp_send_404(req);
+		return ESP_FAIL;
+	}
+
+	const uint16_t width    = 32 * scale;
+
+	// the frame is copied so the hub slot is not held while the strips are sent,
+	// one MCU strip of pixels is rendered at a time instead of the whole image
+	float*   frame     = (float*)heap_caps_malloc(MLX90640_pixelCOUNT * sizeof(float), MALLOC_CAP_8BIT);
+	uint8_t* strip_buf = (uint8_t*)heap_caps_malloc((size_t)width * MLX_MJPEG_STRIP_ROWS * 3, MALLOC_CAP_8BIT);
+	if (!frame || !strip_buf) {
+		log_e("Strip buffer allocation failed: %u", (size_t)width * MLX_MJPEG_STRIP_ROWS * 3);
+		free(frame);
+		free(strip_buf);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+
+	int hub = hub_subscribe(HUB_SRC_MLX, "mjpeg90640");
+	if (hub < 0) {
+		free(frame);
+		free(strip_buf);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+
+	stream_writer_t sw;
+	esp_err_t res = stream_begin(&sw, req, _STREAM_MULTIPART_CONTENT_TYPE);
+
+	while (res == ESP_OK)
+	{
+		hub_frame_t* f = hub_get(hub, pdMS_TO_TICKS(5000));
+
+			struct timeval     _timestamp = {};
+			uint32_t           seq = 0;
+			mlx_palette_norm_t norm;
+
+			bool copied = false;
+			if (f && f->mlx.values && f->mlx.width * f->mlx.height == MLX90640_pixelCOUNT)
+			{
+				const mlx_fb_t& fb = f->mlx;
+
+				stream_frame_trace(&sw, TRACE_MLX, TRACE_LANE_STREAM + hub, f->seq, hub_frame_us(f));
+				seq = f->seq;
+
+				_timestamp = fb.timestamp;
+				norm       = MLXagc::norm(*fb.stats);
+				memcpy(frame, fb.values, MLX90640_pixelCOUNT * sizeof(float));
+				copied = true;
+			}
+
+		hub_release(f);
+
+		if (!copied) {
+			log_e("Thermal frame rendering failed");
+			res = ESP_FAIL;
+			break;
+		}
+
+		res = stream_write(&sw, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+
+		if (res == ESP_OK)
+		{
+			// length is unknown until encoded, MJPEG clients split parts on the boundary
+			char bufferHeader[96];
+			size_t hlen = snprintf(bufferHeader, sizeof(bufferHeader),
+								   "Content-Type: image/jpeg\r\nX-Timestamp: %lld.%06ld\r\n\r\n",
+								   _timestamp.tv_sec, _timestamp.tv_usec);
+
+			res = stream_write(&sw, bufferHeader, hlen);
+		}
+
+		jpg_chunking_t jchunk = { req, &sw, 0, 0 };
+
+		if (res == ESP_OK)
+		{
+			int64_t enc_start = esp_timer_get_time();
+
+			// rendering, encoding and sending the strips are interleaved
+			if (!mjpeg90640_encode(frame, scale, (mlx_palette_t)palette, norm, quality, strip_buf, &jchunk))
+				res = ESP_FAIL;
+
+			int64_t enc_end = esp_timer_get_time();
+			mlx_mjpeg_encode_us = (uint32_t)(enc_end - enc_start - jchunk.send_us);
+
+			trace_span(TRACE_MLX, TRACE_LANE_STREAM + hub, "encode", seq, enc_start, enc_end);
+		}
+
+		if (res == ESP_OK)
+			res = stream_frame_end(&sw);
+
+		if (res != ESP_OK) {
+			log_e("Send frame failed");
+			break;
+		}
+
+		int64_t fr_end = esp_timer_get_time();
+		[[maybe_unused]] int64_t frame_time = (fr_end - last_frame) / 1000;
+		last_frame = fr_end;
+
+		log_d("MJPEG90640: %ubytes encode %uus (ceiling %.1ffps) %ums (%.1ffps)", (uint32_t)jchunk.len,
+		                                   mlx_mjpeg_encode_us,
+		                                   1000000.0 / (mlx_mjpeg_encode_us ? mlx_mjpeg_encode_us : 1),
+		                                   (uint32_t)frame_time,
+		                                   1000.0 / (uint32_t)frame_time );
+	}
+
+	stream_end(&sw);
+	hub_unsubscribe(hub);
+
+	free(frame);
+	free(strip_buf);
+
+	return res;
+}
+
+
+// GET /fusion90640?scale=4&quality=80&palette=0
+// Thermal frame registered onto the OV2640 image and blended on device
+// scale- JPEG decode downscale of the visible frame: 1, 2, 4 or 8
+//
+// Input: req- valid request
+esp_err_t fusion90640_handler(httpd_req_t *req)
+{
+	int64_t last_frame = esp_timer_get_time();
+
+	log_i("GET /fusion90640 received");
+
+	int scale   = query_get_int(req, "scale", 4);
+	int quality = query_get_int(req, "quality", 80);
+	int palette = query_get_int(req, "palette", MLXpalette::getPalette());
+
+	esp_jpeg_image_scale_t jpg_scale;
+	uint8_t shift;
+	switch (scale) {
+		case 1: jpg_scale = JPG_SCALE_NONE; shift = 0; break;
+		case 2: jpg_scale = JPG_SCALE_2X;   shift = 1; break;
+		case 4: jpg_scale = JPG_SCALE_4X;   shift = 2; break;
+		case 8: jpg_scale = JPG_SCALE_8X;   shift = 3; break;
+		default:
+			httpd_resp_send_404(req);
+			return ESP_FAIL;
+	}
+
+	if (quality < 1 || quality > 100 || palette < 0 || palette >= MLX_PALETTE_COUNT) {
+		httpd_resp_send_404(req);
+		return ESP_FAIL;
+	}
+
+	// buffers follow the camera resolution, grown on demand
+	uint8_t* rgb565_buf = NULL;
+	uint8_t* rgb_buf    = NULL;
+	size_t   buf_pixels = 0;
+
+	// paced by the thermal sensor, blended with the camera frame nearest in time
+	int hubMlx = hub_subscribe(HUB_SRC_MLX, "fusion");
+	int hubCam = hub_subscribe(HUB_SRC_CAM, "fusion", true);
+	if (hubMlx < 0 || hubCam < 0) {
+		hub_unsubscribe(hubMlx);
+		hub_unsubscribe(hubCam);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+
+	stream_writer_t sw;
+	esp_err_t res = stream_begin(&sw, req, _STREAM_MULTIPART_CONTENT_TYPE);
+
+	while (res == ESP_OK)
+	{
+		hub_frame_t* mlx_f = hub_get(hubMlx, pdMS_TO_TICKS(5000));
+		hub_frame_t* cam_f = mlx_f ? hub_get_nearest(hubCam, hub_frame_us(mlx_f), pdMS_TO_TICKS(500)) : NULL;
+
+		bool rendered = false;
+		uint16_t width  = 0;
+		uint16_t height = 0;
+		uint32_t seq    = 0;
+		struct timeval _timestamp = {};
+
+		if (mlx_f && cam_f && mlx_f->mlx.values)
+		{
+			const mlx_fb_t& fb = mlx_f->mlx;
+
+			stream_frame_trace(&sw, TRACE_MLX, TRACE_LANE_STREAM + hubMlx, mlx_f->seq, hub_frame_us(mlx_f));
+			seq = mlx_f->seq;
+
+			int64_t fuse_start = esp_timer_get_time();
+
+			_timestamp = fb.timestamp;
+			width  = cam_f->width  >> shift;
+			height = cam_f->height >> shift;
+
+			size_t pixels = (size_t)width * height;
+			if (pixels > buf_pixels) {
+				free(rgb565_buf);
+				free(rgb_buf);
+				rgb565_buf = (uint8_t*)heap_caps_malloc(pixels * 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+				rgb_buf    = (uint8_t*)heap_caps_malloc(pixels * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+				buf_pixels = (rgb565_buf && rgb_buf) ? pixels : 0;
+			}
+
+			if (buf_pixels && jpg2rgb565(cam_f->jpg, cam_f->jpg_len, rgb565_buf, jpg_scale))
+			{
+				rendered = MLXfusion::fuse((const uint16_t*)rgb565_buf, width, height,
+				                           fb.values, (mlx_palette_t)palette, MLXagc::norm(*fb.stats), rgb_buf);
+			}
+
+			// camera JPEG decode and fusion
+			trace_span(TRACE_MLX, TRACE_LANE_STREAM + hubMlx, "fuse", seq, fuse_start, esp_timer_get_time());
+		}
+
+		hub_release(cam_f);
+		hub_release(mlx_f);
+
+		if (!rendered) {
+			log_e("Fused frame rendering failed");
+			res = ESP_FAIL;
+			break;
+		}
+
+		res = stream_write(&sw, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+
+		if (res == ESP_OK)
+		{
+			char bufferHeader[96];
+			size_t hlen = snprintf(bufferHeader, sizeof(bufferHeader),
+								   "Content-Type: image/jpeg\r\nX-Timestamp: %lld.%06ld\r\n\r\n",
+								   _timestamp.tv_sec, _timestamp.tv_usec);
+
+			res = stream_write(&sw, bufferHeader, hlen);
+		}
+
+		jpg_chunking_t jchunk = { req, &sw, 0, 0 };
+
+		if (res == ESP_OK)
+		{
+			int64_t enc_start = esp_timer_get_time();
+
+			if (!fmt2jpg_cb(rgb_buf, (size_t)width * height * 3, width, height, PIXFORMAT_RGB888, quality, jpg_encode_stream, &jchunk))
+				res = ESP_FAIL;
+
+			trace_span(TRACE_MLX, TRACE_LANE_STREAM + hubMlx, "encode", seq, enc_start, esp_timer_get_time());
+		}
+
+		if (res == ESP_OK)
+			res = stream_frame_end(&sw);
+
+		if (res != ESP_OK) {
+			log_e("Send frame failed");
+			break;
+		}
+
+		int64_t fr_end = esp_timer_get_time();
+		[[maybe_unused]] int64_t frame_time = (fr_end - last_frame) / 1000;
+		last_frame = fr_end;
+
+		log_d("FUSION: %ux%u %ubytes %ums (%.1ffps)", width, height, (uint32_t)jchunk.len,
+		                                   (uint32_t)frame_time,
+		                                   1000.0 / (uint32_t)frame_time );
+	}
+
+	stream_end(&sw);
+	hub_unsubscribe(hubCam);
+	hub_unsubscribe(hubMlx);
+
+	free(rgb565_buf);
+	free(rgb_buf);
+
+	return res;
+}
+
+
+// Sends the camera frame and the thermal frame as one x-mlx-pair body, both prefixed with frame_envelope_t
+static esp_err_t send_pair(stream_writer_t* sw, const hub_frame_t* cam, uint32_t camDropped,
+                           const mlx_fb_t& fb, int fmt, uint32_t mlxDropped, const void* payload, size_t len)
+{
+	frame_envelope_t env;
+	frame_envelope_cam(&env, cam->timestamp, cam->seq, camDropped, cam->jpg_len);
+
+	esp_err_t res = stream_write(sw, (const char *)&env, sizeof(env));
+
+	if (res == ESP_OK)
+		res = stream_write(sw, (const char *)cam->jpg, cam->jpg_len);
+
+	if (res == ESP_OK)
+	{
+		frame_envelope_mlx(&env, fb, fmt, mlxDropped, len);
+		res = stream_write(sw, (const char *)&env, sizeof(env));
+	}
+
+	if (res == ESP_OK)
+		res = stream_write(sw, (const char *)payload, len);
+
+	return res;
+}
+
+
+// GET /capture_pair?fmt=f32|i16|u8pal&raw=0
+// Next thermal frame together with the OV2640 frame captured nearest to its data-ready time
+//
+// Input: req- valid request
+esp_err_t capture_pair_handler(httpd_req_t *req)
+{
+	log_i("/capture_pair received");
+
+	bool bRaw = query_get_int(req, "raw", 0);
+	int  fmt  = query_get_fmt(req);
+
+	if (fmt < 0 || fmt == MLX_FMT_DELTA) {
+		httpd_resp_send_404(req);
+		return ESP_FAIL;
+	}
+
+	uint16_t* scratch = (fmt != MLX_FMT_F32) ? (uint16_t*)ps_malloc(MLX90640_pixelCOUNT * sizeof(uint16_t)) : NULL;
+	char      range[24];
+
+	int hubMlx = hub_subscribe(HUB_SRC_MLX, "capture_pair");
+	int hubCam = hub_subscribe(HUB_SRC_CAM, "capture_pair", true);
+
+	if ((fmt != MLX_FMT_F32 && !scratch) || hubMlx < 0 || hubCam < 0)
+	{
+		hub_unsubscribe(hubMlx);
+		hub_unsubscribe(hubCam);
+		free(scratch);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+
+	esp_err_t res = ESP_FAIL;
+
+	hub_frame_t* mlx_f = hub_get(hubMlx, pdMS_TO_TICKS(5000));
+	hub_frame_t* cam_f = mlx_f ? hub_get_nearest(hubCam, hub_frame_us(mlx_f), pdMS_TO_TICKS(500)) : NULL;
+
+	size_t      len = 0;
+	const void* payload = (mlx_f && mlx_f->mlx.values) ? mlx_frame_payload(mlx_f->mlx, bRaw, fmt, scratch, &len, range, sizeof(range)) : NULL;
+
+	if (payload && cam_f)
+	{
+		char tsVisible[32];
+		char tsThermal[32];
+		char skew[16];
+		snprintf(tsVisible, sizeof(tsVisible), "%lld.%06ld", cam_f->timestamp.tv_sec, cam_f->timestamp.tv_usec);
+		snprintf(tsThermal, sizeof(tsThermal), "%lld.%06ld", mlx_f->timestamp.tv_sec, mlx_f->timestamp.tv_usec);
+		snprintf(skew, sizeof(skew), "%lld", hub_frame_us(cam_f) - hub_frame_us(mlx_f));
+
+		httpd_resp_set_hdr(req, "X-Timestamp-Visible", tsVisible);
+		httpd_resp_set_hdr(req, "X-Timestamp-Thermal", tsThermal);
+		httpd_resp_set_hdr(req, "X-Skew-Us", skew);
+		httpd_resp_set_hdr(req, "X-Format", mlx_fmt_names[fmt]);
+		if (fmt == MLX_FMT_U8PAL)
+			httpd_resp_set_hdr(req, "X-Range", range);
+
+		// single response with the headers above, chunked
+		stream_writer_t sw;
+		res = stream_begin(&sw, req, FRAME_PAIR_CONTENT_TYPE, false);
+
+		if (res == ESP_OK)
+			res = send_pair(&sw, cam_f, 0, mlx_f->mlx, fmt, 0, payload, len);
+		if (res == ESP_OK)
+			res = httpd_resp_send_chunk(req, NULL, 0);
+
+		stream_end(&sw);
+	}
+	else
+	{
+		log_e("Paired capture failed");
+		httpd_resp_send_500(req);
+	}
+
+	hub_release(cam_f);
+	hub_release(mlx_f);
+
+	hub_unsubscribe(hubCam);
+	hub_unsubscribe(hubMlx);
+
+	free(scratch);
+
+	return res;
+}
+
+
+// GET /stream_pair?fmt=f32|i16|u8pal&raw=0
+// Thermal frames each paired with the OV2640 frame captured nearest to its data-ready time,
+// one x-mlx-pair part per thermal frame
+//
+// Input: req- valid request
+esp_err_t stream_pair_handler(httpd_req_t *req)
+{
+	int64_t last_frame = esp_timer_get_time();
+
+	log_i("GET /stream_pair received");
+
+	bool bRaw = query_get_int(req, "raw", 0);
+	int  fmt  = query_get_fmt(req);
+
+	if (fmt < 0 || fmt == MLX_FMT_DELTA) {
+		httpd_resp_send_404(req);
+		return ESP_FAIL;
+	}
+
+	uint16_t* scratch = (fmt != MLX_FMT_F32) ? (uint16_t*)ps_malloc(MLX90640_pixelCOUNT * sizeof(uint16_t)) : NULL;
+	char      range[24];
+
+	int hubMlx = hub_subscribe(HUB_SRC_MLX, "stream_pair");
+	int hubCam = hub_subscribe(HUB_SRC_CAM, "stream_pair", true);
+
+	if ((fmt != MLX_FMT_F32 && !scratch) || hubMlx < 0 || hubCam < 0)
+	{
+		hub_unsubscribe(hubMlx);
+		hub_unsubscribe(hubCam);
+		free(scratch);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+
+	stream_writer_t sw;
+	esp_err_t res = stream_begin(&sw, req, _STREAM_MULTIPART_CONTENT_TYPE);
+
+	// frames of either source skipped since the previous part
+	uint32_t nextSeq[HUB_SRC_COUNT] = { 0, 0 };
+	uint32_t dropped[HUB_SRC_COUNT] = { 0, 0 };
+	bool     bFirst = true;
+
+	while (res == ESP_OK)
+	{
+		hub_frame_t* mlx_f = hub_get(hubMlx, pdMS_TO_TICKS(5000));
+		hub_frame_t* cam_f = mlx_f ? hub_get_nearest(hubCam, hub_frame_us(mlx_f), pdMS_TO_TICKS(500)) : NULL;
+
+		size_t      len = 0;
+		const void* payload = (mlx_f && mlx_f->mlx.values) ? mlx_frame_payload(mlx_f->mlx, bRaw, fmt, scratch, &len, range, sizeof(range)) : NULL;
+
+		if (!payload || !cam_f)
+		{
+			log_e("Paired frame failed");
+			hub_release(cam_f);
+			hub_release(mlx_f);
+			res = ESP_FAIL;
+			break;
+		}
+
+		// the same camera frame may pair with two thermal frames at high refresh rates
+		if (!bFirst) {
+			if (mlx_f->seq > nextSeq[HUB_SRC_MLX]) dropped[HUB_SRC_MLX] += mlx_f->seq - nextSeq[HUB_SRC_MLX];
+			if (cam_f->seq > nextSeq[HUB_SRC_CAM]) dropped[HUB_SRC_CAM] += cam_f->seq - nextSeq[HUB_SRC_CAM];
+		}
+		nextSeq[HUB_SRC_MLX] = mlx_f->seq + 1;
+		nextSeq[HUB_SRC_CAM] = cam_f->seq + 1;
+		bFirst = false;
+
+		// latency of the pair counts from the older of the two captures
+		int64_t captureUs = hub_frame_us(cam_f) < hub_frame_us(mlx_f) ? hub_frame_us(cam_f) : hub_frame_us(mlx_f);
+		stream_frame_trace(&sw, TRACE_MLX, TRACE_LANE_STREAM + hubMlx, mlx_f->seq, captureUs);
+
+		res = stream_write(&sw, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+
+		if (res == ESP_OK)
+		{
+			char bufferHeader[256];
+			size_t hlen = snprintf(bufferHeader, sizeof(bufferHeader),
+								   "Content-Type: " FRAME_PAIR_CONTENT_TYPE "\r\nContent-Length: %u\r\n"
+								   "X-Timestamp-Visible: %lld.%06ld\r\nX-Timestamp-Thermal: %lld.%06ld\r\n",
+								   2 * sizeof(frame_envelope_t) + cam_f->jpg_len + len,
+								   cam_f->timestamp.tv_sec, cam_f->timestamp.tv_usec,
+								   mlx_f->timestamp.tv_sec, mlx_f->timestamp.tv_usec);
+
+			if (fmt == MLX_FMT_U8PAL)
+				hlen += snprintf(bufferHeader + hlen, sizeof(bufferHeader) - hlen, "X-Range: %s\r\n", range);
+
+			hlen += snprintf(bufferHeader + hlen, sizeof(bufferHeader) - hlen, "\r\n");
+
+			res = stream_write(&sw, bufferHeader, hlen);
+		}
+
+		if (res == ESP_OK)
+			res = send_pair(&sw, cam_f, dropped[HUB_SRC_CAM], mlx_f->mlx, fmt, dropped[HUB_SRC_MLX], payload, len);
+
+		if (res == ESP_OK)
+			res = stream_frame_end(&sw);
+
+		int64_t skew = hub_frame_us(cam_f) - hub_frame_us(mlx_f);
+
+		hub_release(cam_f);
+		hub_release(mlx_f);
+
+		if (res != ESP_OK) {
+			log_e("Send frame failed");
+			break;
+		}
+
+		int64_t fr_end = esp_timer_get_time();
+		[[maybe_unused]] int64_t frame_time = (fr_end - last_frame) / 1000;
+		last_frame = fr_end;
+
+		log_d("PAIR: skew %lldus %ums (%.1ffps)", skew,
+		                                   (uint32_t)frame_time,
+		                                   1000.0 / (uint32_t)frame_time );
+	}
+
+	stream_end(&sw);
+	hub_unsubscribe(hubCam);
+	hub_unsubscribe(hubMlx);
+
+	free(scratch);
+
 	return res;
 }
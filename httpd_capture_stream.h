@@ -3,14 +3,45 @@
 
 
 #include "esp_http_server.h"
+#include "MLX90640_API.h"
+#include "frame_envelope.h"
+
+
+// Negotiated thermal payload formats
+typedef enum {
+	MLX_FMT_F32 = 0,	// float32 Celsius
+	MLX_FMT_I16,		// uint16 centi-kelvin
+	MLX_FMT_U8PAL,		// uint8 palette indices linear over the frame min/max
+	MLX_FMT_DELTA,		// centi-kelvin keyframes and deltas, streams only (MLX90640_delta.h)
+	MLX_FMT_COUNT
+} mlx_fmt_t;
+
+int         mlx_fmt_parse(const char *name);	// -1 if unknown
+const char* mlx_fmt_name(int fmt);
+
+// Returns the payload of a published frame in fmt (not MLX_FMT_DELTA)
+// scratch - MLX90640_pixelCOUNT * sizeof(uint16_t) bytes, used unless fmt is MLX_FMT_F32
+// range   - receives "min,max" in centi-kelvin for u8pal
+const void* mlx_frame_payload(const mlx_fb_t& fb, bool bRaw, int fmt, uint16_t* scratch,
+                              size_t* len, char* range, size_t range_len);
+
+void frame_envelope_mlx(frame_envelope_t* env, const mlx_fb_t& fb, int fmt, uint32_t dropped, uint32_t len);
+void frame_envelope_cam(frame_envelope_t* env, const struct timeval& timestamp, uint32_t seq, uint32_t dropped, uint32_t len);
 
 
 esp_err_t bmp_handler(httpd_req_t *req);
 esp_err_t ov2640_capture_handler(httpd_req_t *req);
 esp_err_t mlx90640_capture_handler(httpd_req_t *req);
+esp_err_t mlx90640_bmp_handler(httpd_req_t *req);
 esp_err_t mlx90640_get_offsets_handler(httpd_req_t *req);
 esp_err_t mlx90640_set_offsets_handler(httpd_req_t *req);
+esp_err_t mlx90640_get_fusion_handler(httpd_req_t *req);
+esp_err_t mlx90640_set_fusion_handler(httpd_req_t *req);
 esp_err_t stream2640_handler(httpd_req_t *req);
 esp_err_t stream90640_handler(httpd_req_t *req);
+esp_err_t mjpeg90640_handler(httpd_req_t *req);
+esp_err_t fusion90640_handler(httpd_req_t *req);
+esp_err_t capture_pair_handler(httpd_req_t *req);
+esp_err_t stream_pair_handler(httpd_req_t *req);
 
 #endif
\ No newline at end of file
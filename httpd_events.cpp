@@ -0,0 +1,111 @@
+
+#include "httpd_events.h"
+#include "httpd_stream.h"
+#include "frame_hub.h"
+#include "MLX90640_API.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp32-hal-log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static int events_telemetry(char* buf, size_t size, uint32_t* lastFrames, int64_t* lastUs)
+{
+	MLX90640& mlx90640 = MLX90640::getInstance();
+
+	int64_t now = esp_timer_get_time();
+
+	char thermal[64];
+	float   ta, vdd;
+	int64_t readyUs;
+	if (mlx90640.GetFrameTelemetry(ta, vdd, readyUs))
+		snprintf(thermal, sizeof(thermal), "\"ta\":%.2f,\"vdd\":%.2f,\"frame_age_ms\":%u",
+		         ta, vdd, (uint32_t)((now - readyUs) / 1000));
+	else
+		snprintf(thermal, sizeof(thermal), "\"ta\":null,\"vdd\":null,\"frame_age_ms\":null");
+
+	// capture rates over the push interval
+	float fps[HUB_SRC_COUNT];
+	for (uint8_t s = 0; s < HUB_SRC_COUNT; s++)
+	{
+		uint32_t frames = hub_source_frames((hub_source_t)s);
+
+		fps[s] = (*lastUs && now > *lastUs) ? (frames - lastFrames[s]) * 1e6f / (now - *lastUs) : 0.0f;
+		lastFrames[s] = frames;
+	}
+	*lastUs = now;
+
+	hub_sub_info_t info[HUB_MAX_SUBSCRIBERS];
+	hub_get_info(info);
+
+	uint32_t subscribers = 0;
+	uint32_t delivered   = 0;
+	uint32_t dropped     = 0;
+	for (uint8_t i = 0; i < HUB_MAX_SUBSCRIBERS; i++)
+	{
+		if (!info[i].bUsed) continue;
+
+		subscribers++;
+		delivered += info[i].delivered;
+		dropped   += info[i].dropped;
+	}
+
+	return snprintf(buf, size,
+		"event: telemetry\n"
+		"data: {%s,\"cam_fps\":%.1f,\"mlx_fps\":%.1f,\"subscribers\":%u,\"delivered\":%u,\"dropped\":%u,"
+		"\"stream_send_kBps\":%u,\"stream_quality_offset\":%d,"
+		"\"heap_internal\":%u,\"heap_internal_min\":%u,\"heap_internal_largest\":%u,\"heap_psram\":%u,"
+		"\"uptime_s\":%u}\n\n",
+		thermal, fps[HUB_SRC_CAM], fps[HUB_SRC_MLX], subscribers, delivered, dropped,
+		stream_send_kBps, stream_rate_quality_offset(),
+		heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+		heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+		heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+		heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+		(uint32_t)(now / 1000000));
+}
+
+
+// GET /events
+esp_err_t events_handler(httpd_req_t *req)
+{
+	uint32_t periodMs = EVENTS_PERIOD_MS;
+
+	char query[32];
+	char value[12];
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		httpd_query_key_value(query, "period", value, sizeof(value)) == ESP_OK)
+	{
+		periodMs = atoi(value);
+		if (periodMs < EVENTS_PERIOD_MIN_MS) periodMs = EVENTS_PERIOD_MIN_MS;
+	}
+
+	httpd_resp_set_type(req, "text/event-stream");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+	// reconnect delay for the browser
+	esp_err_t res = httpd_resp_send_chunk(req, "retry: 3000\n\n", HTTPD_RESP_USE_STRLEN);
+
+	uint32_t lastFrames[HUB_SRC_COUNT] = {};
+	int64_t  lastUs = 0;
+
+	char buf[512];
+	while (res == ESP_OK)
+	{
+		int len = events_telemetry(buf, sizeof(buf), lastFrames, &lastUs);
+
+		res = httpd_resp_send_chunk(req, buf, len);
+		if (res != ESP_OK) break;
+
+		vTaskDelay(pdMS_TO_TICKS(periodMs));
+	}
+
+	log_i("Events client gone");
+
+	return res;
+}
@@ -0,0 +1,20 @@
+#ifndef _HTTPD_EVENTS_H_
+#define _HTTPD_EVENTS_H_
+
+
+#include "esp_http_server.h"
+
+
+// GET /events, Server-Sent Events telemetry
+//
+// Pushes "telemetry" events with the sensor die temperature and supply voltage of the
+// last thermal frame, capture rates, hub drops, stream send rate and heap state.
+// Everything comes from values the capture loops already keep, no bus traffic.
+// ?period=ms sets the push interval, runs on an async sender task
+
+#define EVENTS_PERIOD_MS		1000
+#define EVENTS_PERIOD_MIN_MS	200
+
+esp_err_t events_handler(httpd_req_t *req);
+
+#endif
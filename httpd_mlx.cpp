@@ -1,15 +1,123 @@
 
 #include "httpd_mlx.h"
+#include "httpd_status.h"
 #include "MLX90640_API.h"
 #include "MLX90640_calibration.h"
+#include "httpd_async.h"
+#include "frame_hub.h"
 #include "esp32-hal-log.h"
+#include "esp_timer.h"
 #include "Arduino.h"
 
 extern esp_err_t parse_get(httpd_req_t *req, char **obuf);
-extern bool isStreaming;
 
 extern uint8_t mlx90640calibration_frame;
 
+// Ta/Vdd of a frame younger than this are served without touching the I2C bus
+#define MLX_TELEMETRY_MAX_AGE_US		5000000
+
+typedef struct {
+	const char*  httpDate;
+	int          res;
+	TaskHandle_t waiter;
+} mlx_calibration_write_t;
+
+
+// Runs on the server task, flash is not written from the PSRAM stacks of the senders
+static void mlx_calibration_write(void* arg)
+{
+	mlx_calibration_write_t* w = (mlx_calibration_write_t*)arg;
+
+	w->res = MLXcalibration::writeUserCalibrationOffsets(w->httpDate);
+	status_invalidate(STATUS_CALIBRATION);
+
+	xTaskNotifyGive(w->waiter);
+}
+
+
+// GET /mlx?var=calibrate on a sender task: frames are pulled through the hub until the
+// publisher has accumulated the offsets, one progress byte per second is sent meanwhile
+static esp_err_t mlx_calibrate(httpd_req_t *req)
+{
+	static bool bCalibrating = false;
+
+	// two requests may have passed the check of the server task
+	if (__atomic_exchange_n(&bCalibrating, true, __ATOMIC_ACQUIRE))
+		return httpd_resp_send_500(req);
+
+	char httpDate[64] = {};
+	httpd_req_get_hdr_value_str(req, "X-Client-Date", httpDate, 64);
+
+	int hub = hub_subscribe(HUB_SRC_MLX, "calibrate");
+	if (hub < 0) {
+		__atomic_store_n(&bCalibrating, false, __ATOMIC_RELEASE);
+		return httpd_resp_send_500(req);
+	}
+
+	esp_err_t res = ESP_OK;
+
+	MLXcalibration::clearUserCalibrationOffsets();
+	status_invalidate(STATUS_CALIBRATION);
+	mlx90640calibration_frame = 1;
+
+	httpd_resp_set_type(req, HTTPD_TYPE_OCTET);
+	httpd_resp_set_hdr(req,  "Access-Control-Allow-Origin", "*");
+	httpd_resp_set_hdr(req,  "Transfer-Encoding", "chunked");
+
+	int j = 0;
+	while (true)
+	{
+		// send progress
+		uint8_t progress = mlx90640calibration_frame;
+		res = httpd_resp_send_chunk(req, (const char*)&progress, 1);
+
+		if (res != ESP_OK) {
+			log_e("Sending status failed");
+			mlx90640calibration_frame = 0;
+			break;
+		}
+
+		// frames are read while someone takes them
+		TickType_t start = xTaskGetTickCount();
+		while (xTaskGetTickCount() - start < pdMS_TO_TICKS(1000))
+			hub_release(hub_get(hub, pdMS_TO_TICKS(1000) - (xTaskGetTickCount() - start)));
+
+		// prevent infinite loop (theoretical code)
+		// 05HZ in the worst case gives ~400 (one full frame consists of two subpages)
+		if (j++ > 800)
+		{
+			mlx90640calibration_frame = 0;
+			break;
+		}
+
+		// mlx90640calibration_frame is reset to 0 by the frame publisher after 100 frames captured
+		if (mlx90640calibration_frame == 0) {
+			// success
+
+			mlx_calibration_write_t w = { httpDate, ESP_FAIL, xTaskGetCurrentTaskHandle() };
+
+			if (httpd_queue_work(req->handle, mlx_calibration_write, &w) == ESP_OK)
+				ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+			// aborts the connection
+			if (w.res != ESP_OK)
+				res = ESP_FAIL;
+			break;
+		}
+	}
+
+	hub_unsubscribe(hub);
+
+	__atomic_store_n(&bCalibrating, false, __ATOMIC_RELEASE);
+
+	if (res != ESP_OK)
+		return res;
+
+	// Finalize chunked response
+	return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+
 // GET /mlx
 esp_err_t mlx_handler(httpd_req_t *req)
 {
@@ -41,13 +149,17 @@ esp_err_t mlx_handler(httpd_req_t *req)
 	if (!strcmp(variable, "reset"))
 	{
 		MLXcalibration::writeDefaultCalibrationOffsets();
+		status_invalidate(STATUS_CALIBRATION);
 
 		httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 		return httpd_resp_sendstr(req, "Reset to default profile successfully");
 	}
 	else if (!strcmp(variable, "device_voltage"))
 	{
-		float vdd = mlx90640.GetVddRAM();
+		float   ta, vdd;
+		int64_t readyUs;
+		if (!mlx90640.GetFrameTelemetry(ta, vdd, readyUs) || esp_timer_get_time() - readyUs > MLX_TELEMETRY_MAX_AGE_US)
+			vdd = mlx90640.GetVddRAM();
 
 		char str_vdd[10];
 		snprintf(str_vdd, 10, "%.2f", vdd);
@@ -57,7 +169,10 @@ esp_err_t mlx_handler(httpd_req_t *req)
 	}
 	else if (!strcmp(variable, "device_temperature"))
 	{
-		float ta = mlx90640.GetTaRAM();
+		float   ta, vdd;
+		int64_t readyUs;
+		if (!mlx90640.GetFrameTelemetry(ta, vdd, readyUs) || esp_timer_get_time() - readyUs > MLX_TELEMETRY_MAX_AGE_US)
+			ta = mlx90640.GetTaRAM();
 
 		char str_ta[10];
 		snprintf(str_ta, 10, "%.2f", ta);
@@ -67,8 +182,6 @@ esp_err_t mlx_handler(httpd_req_t *req)
 	}
 	else if (!strcmp(variable, "calibrate"))
 	{
-		esp_err_t res;
-
 		char httpDate[64] = {};
 		if (httpd_req_get_hdr_value_str(req, "X-Client-Date", httpDate, 64) != ESP_OK) {
 			log_e("X-Client-Date is missing in request");
@@ -76,62 +189,15 @@ esp_err_t mlx_handler(httpd_req_t *req)
 			return ESP_FAIL;
 		}
 		log_i("Received X-Client-Date: %s", httpDate);
-		
+
 		float fMeanTemp = atof(value);
 		log_i("Calibrating to %f mean temperature", fMeanTemp);
 
-		if (!isStreaming)
-			return httpd_resp_send_500(req);
-
-		if (!mlx90640.IsOnline())
+		if (!mlx90640.IsOnline() || mlx90640calibration_frame)
 			return httpd_resp_send_500(req);
 
-		MLXcalibration::clearUserCalibrationOffsets();
-		mlx90640calibration_frame = 1;
-
-		httpd_resp_set_type(req, HTTPD_TYPE_OCTET);
-		httpd_resp_set_hdr(req,  "Access-Control-Allow-Origin", "*");
-		httpd_resp_set_hdr(req,  "Transfer-Encoding", "chunked");
-
-		int j = 0;
-		while (true)
-		{
-			// send progress
-			res = httpd_resp_send_chunk(req, (const char*)&mlx90640calibration_frame, 1);
-
-			if (res != ESP_OK) {
-				log_e("Sending status failed");
-				mlx90640calibration_frame = 0;
-				return res;
-			}
-
-			// stream is ongoing
-			delay(1000);
-
-			// prevent infinite loop (theoretical code)
-			// 05HZ in the worst case gives ~400 (one full frame consists of two subpages)
-			if (j++ > 800)
-			{
-				mlx90640calibration_frame = 0;
-				// Finalize chunked response
-				return httpd_resp_send_chunk(req, NULL, 0);
-			}
-
-			// mlx90640calibration_frame is reset to 0 in stream90640_handler after 100 frames captured
-			if (mlx90640calibration_frame == 0) break;
-		}
-
-		// success
-
-		res = MLXcalibration::writeUserCalibrationOffsets(httpDate);
-		if (res != ESP_OK) {
-			// abort connection
-			int sockfd = httpd_req_to_sockfd(req);
-			close(sockfd);
-		}
-
-		// Finalize chunked response
-		return httpd_resp_send_chunk(req, NULL, 0);
+		// takes 100 frames, minutes at low refresh rates
+		return httpd_async_run(req, mlx_calibrate);
 	}
 	else
 	{
@@ -0,0 +1,269 @@
+
+#include "httpd_recorder.h"
+#include "httpd_capture_stream.h"
+#include "frame_hub.h"
+#include "httpd_stream.h"
+#include "esp32-hal-log.h"
+#include "esp32-hal-psram.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static recorder_record_t* recRing    = NULL;		// PSRAM
+static uint32_t           recHead    = 0;		// records written since start
+static bool               recTriggered = false;	// frozen by a trigger until a dump sends it
+static const char*        recReason  = NULL;	// trigger holding the freeze
+static uint32_t           recTriggers = 0;		// triggers taken, tells a dump which one it sent
+static uint8_t            recDumps   = 0;		// dumps sending, the ring is frozen meanwhile
+static volatile bool      recRunning = false;
+static TaskHandle_t       recTask    = NULL;
+static SemaphoreHandle_t  recMutex   = NULL;
+
+
+static void recorder_task(void* arg)
+{
+	int hub = hub_subscribe(HUB_SRC_MLX, "recorder");
+
+	uint32_t nextSeq = 0;
+	uint32_t dropped = 0;
+	bool     bFirst  = true;
+
+	while (recRunning && hub >= 0)
+	{
+		hub_frame_t* f = hub_get(hub, pdMS_TO_TICKS(1000));
+		if (!f) continue;
+
+		const mlx_fb_t& fb = f->mlx;
+
+		if (fb.centiKelvin)
+		{
+			if (!bFirst && fb.seq != nextSeq) dropped += fb.seq - nextSeq;
+			nextSeq = fb.seq + 1;
+			bFirst  = false;
+
+			// the only copy of the frame, straight into its ring slot
+			xSemaphoreTake(recMutex, portMAX_DELAY);
+				if (!recTriggered && !recDumps)
+				{
+					recorder_record_t& r = recRing[recHead % RECORDER_FRAMES];
+
+					frame_envelope_mlx(&r.env, fb, MLX_FMT_I16, dropped, sizeof(r.ck));
+					memcpy(r.ck, fb.centiKelvin, sizeof(r.ck));
+
+					recHead++;
+				}
+			xSemaphoreGive(recMutex);
+		}
+
+		hub_release(f);
+	}
+
+	if (hub >= 0) hub_unsubscribe(hub);
+
+	recTask = NULL;
+	vTaskDelete(NULL);
+}
+
+
+bool recorder_start()
+{
+	if (recRunning) return true;
+
+	if (!recRing)
+	{
+		recRing  = (recorder_record_t*)ps_malloc(RECORDER_FRAMES * sizeof(recorder_record_t));
+		recMutex = xSemaphoreCreateMutex();
+		if (!recRing || !recMutex) {
+			log_e("Recorder ring allocation failed");
+			return false;
+		}
+	}
+
+	// wait for a previous task to wind down
+	while (recTask) vTaskDelay(pdMS_TO_TICKS(50));
+
+	recRunning = true;
+	if (xTaskCreatePinnedToCoreWithCaps(recorder_task, "recorder", 3072, NULL, 4,
+	                                    &recTask, tskNO_AFFINITY, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT) != pdPASS)
+	{
+		log_e("Recorder task creation failed");
+		recRunning = false;
+		return false;
+	}
+
+	log_i("Recorder keeps %u thermal frames", RECORDER_FRAMES);
+
+	return true;
+}
+
+
+void recorder_stop()
+{
+	recRunning = false;
+}
+
+
+void recorder_trigger(const char* reason)
+{
+	if (!recMutex) return;
+
+	xSemaphoreTake(recMutex, portMAX_DELAY);
+		if (!recTriggered) {
+			recTriggered = true;
+			recReason    = reason;
+			recTriggers++;
+		}
+	xSemaphoreGive(recMutex);
+
+	log_i("Recorder triggered: %s", reason);
+}
+
+
+// GET /record
+esp_err_t record_handler(httpd_req_t *req)
+{
+	char query[32];
+	char value[4];
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		httpd_query_key_value(query, "arm", value, sizeof(value)) == ESP_OK)
+	{
+		if (atoi(value)) {
+			if (!recorder_start()) return httpd_resp_send_500(req);
+		}
+		else
+			recorder_stop();
+	}
+
+	uint32_t    head   = 0;
+	uint32_t    count  = 0;
+	bool        frozen = false;
+	const char* reason = NULL;
+	int64_t     spanUs = 0;
+
+	if (recMutex)
+	{
+		xSemaphoreTake(recMutex, portMAX_DELAY);
+			head   = recHead;
+			frozen = recTriggered || recDumps;
+			reason = recReason;
+
+			count = (head < RECORDER_FRAMES) ? head : RECORDER_FRAMES;
+			if (count > 1)
+				spanUs = recRing[(head - 1) % RECORDER_FRAMES].env.timestampUs - recRing[(head - count) % RECORDER_FRAMES].env.timestampUs;
+		xSemaphoreGive(recMutex);
+	}
+
+	char json[192];
+	snprintf(json, sizeof(json),
+	         "{\"armed\":%s,\"frozen\":%s,\"trigger\":\"%s\",\"frames\":%u,\"capacity\":%u,\"span_ms\":%u,\"recorded\":%u}",
+	         recRunning ? "true" : "false", frozen ? "true" : "false", reason ? reason : "",
+	         count, RECORDER_FRAMES, (uint32_t)(spanUs / 1000), head);
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+	return httpd_resp_sendstr(req, json);
+}
+
+
+// GET /record/trigger
+esp_err_t record_trigger_handler(httpd_req_t *req)
+{
+	if (!recRing)
+		return httpd_resp_send_500(req);
+
+	recorder_trigger("request");
+
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+	return httpd_resp_send(req, NULL, 0);
+}
+
+
+// GET /record/dump
+esp_err_t record_dump_handler(httpd_req_t *req)
+{
+	if (!recRing)
+		return httpd_resp_send_500(req);
+
+	int seconds = 0;
+
+	char query[32];
+	char value[8];
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		httpd_query_key_value(query, "seconds", value, sizeof(value)) == ESP_OK)
+	{
+		seconds = atoi(value);
+	}
+
+	// nothing is written to the ring while it is sent, a trigger arriving meanwhile
+	// is kept for the next dump
+	xSemaphoreTake(recMutex, portMAX_DELAY);
+		bool        bTriggered = recTriggered;
+		const char* reason     = recReason;
+		uint32_t    trigger    = recTriggers;
+		uint32_t    head       = recHead;
+		recDumps++;
+	xSemaphoreGive(recMutex);
+
+	uint32_t count = (head < RECORDER_FRAMES) ? head : RECORDER_FRAMES;
+
+	// oldest record inside the requested window
+	uint32_t first = head - count;
+	if (seconds > 0 && count)
+	{
+		int64_t fromUs = recRing[(head - 1) % RECORDER_FRAMES].env.timestampUs - (int64_t)seconds * 1000000;
+		while (first < head && recRing[first % RECORDER_FRAMES].env.timestampUs < fromUs) first++;
+	}
+
+	char hdr[64];
+	snprintf(hdr, sizeof(hdr), "attachment; filename=\"thermal_%u.mlxr\"", count ? recRing[first % RECORDER_FRAMES].env.seq : 0);
+
+	char frames[12];
+	snprintf(frames, sizeof(frames), "%u", head - first);
+
+	const char* headers[] = {
+		"Content-Disposition", hdr,
+		"X-Record-Frames",     frames,
+		"X-Record-Trigger",    bTriggered && reason ? reason : "dump",
+		NULL
+	};
+
+	// the ring is in PSRAM, records go out through the internal RAM bounce buffer
+	stream_writer_t sw;
+	esp_err_t res = stream_begin(&sw, req, RECORDER_CONTENT_TYPE, true, headers);
+
+	// contiguous runs of slots, split where the ring wraps
+	for (uint32_t i = first; i < head && res == ESP_OK; )
+	{
+		uint32_t slot = i % RECORDER_FRAMES;
+		uint32_t n    = head - i;
+		if (n > RECORDER_DUMP_CHUNK)     n = RECORDER_DUMP_CHUNK;
+		if (slot + n > RECORDER_FRAMES)  n = RECORDER_FRAMES - slot;
+
+		res = stream_write(&sw, &recRing[slot], n * sizeof(recorder_record_t));
+		i  += n;
+	}
+
+	if (res == ESP_OK)
+		res = stream_finish(&sw);
+
+	stream_end(&sw);
+
+	// a complete dump of a triggered ring re-arms the recorder
+	xSemaphoreTake(recMutex, portMAX_DELAY);
+		recDumps--;
+		if (bTriggered && res == ESP_OK && recTriggers == trigger) {
+			recTriggered = false;
+			recReason    = NULL;
+		}
+	xSemaphoreGive(recMutex);
+
+	log_i("Recorder dumped %u frames", head - first);
+
+	return res;
+}
@@ -0,0 +1,45 @@
+#ifndef _HTTPD_RECORDER_H_
+#define _HTTPD_RECORDER_H_
+
+
+#include "esp_http_server.h"
+#include "frame_envelope.h"
+#include "MLX90640_API.h"
+
+
+// Pre-trigger recorder of thermal frames
+//
+// A hub subscriber keeps the latest RECORDER_FRAMES thermal frames in a PSRAM ring.
+// Each record is one frame envelope (timestamp, seq, Ta, Vdd, statistics) and the
+// centi-kelvin plane the frame is published with, written once per frame.
+// A trigger freezes the ring until a dump started after it is sent completely,
+// a dump also freezes it while sending, concurrent dumps share the freeze.
+// The dump is the records back to back, the same layout as ?hdr=1&fmt=i16 stream parts
+
+#define RECORDER_FRAMES			128			// ~1 minute at the fast refresh rate, 1596 bytes each
+#define RECORDER_AUTOSTART		1			// start recording with the web server
+#define RECORDER_DUMP_CHUNK		16			// records per chunk of the dump
+
+#define RECORDER_CONTENT_TYPE	"application/x-mlx-record"
+
+typedef struct __attribute__((packed)) {
+	frame_envelope_t env;				// format MLX_FMT_I16
+	uint16_t         ck[MLX90640_pixelCOUNT];
+} recorder_record_t;
+
+bool recorder_start();
+void recorder_stop();
+
+// Freezes the ring until the next dump, reason is reported with it (string literal)
+void recorder_trigger(const char* reason);
+
+// GET /record, state as JSON, ?arm=1|0 starts or stops recording
+esp_err_t record_handler(httpd_req_t *req);
+
+// GET /record/trigger
+esp_err_t record_trigger_handler(httpd_req_t *req);
+
+// GET /record/dump, ?seconds=N limits it to the last N seconds, runs on an async sender task
+esp_err_t record_dump_handler(httpd_req_t *req);
+
+#endif
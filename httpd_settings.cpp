@@ -0,0 +1,480 @@
+
+#include "httpd_settings.h"
+#include "httpd_status.h"
+#include "httpd_timelapse.h"
+#include "MLX90640_API.h"
+#include "MLX90640_calibration.h"
+#include "MLX90640_palette.h"
+#include "MLX90640_agc.h"
+#include "MLX90640_fusion.h"
+#include "esp32-hal-log.h"
+#include "esp_timer.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+
+extern int  led_duty;
+extern void led_set_duty(int duty);
+
+
+// Sensor setting backed by cam->status
+#define CAM_SETTING(name, setter, lo, hi) \
+	{ #name, SETTING_INT, lo, hi, \
+	  [](sensor_t* s, float v) { return s->setter(s, (int)v); }, \
+	  [](sensor_t* s) { return (float)s->status.name; } }
+
+// OV2640 registers of the on/off settings (sensors/private_include/ov2640_regs.h),
+// same bits as the driver setters write. 0x100 selects the sensor bank
+#define OV2640_CTRL0		0x0C2
+#define OV2640_CTRL1		0x0C3
+#define OV2640_CTRL2		0x086
+#define OV2640_CTRL3		0x087
+#define OV2640_REG04		0x104
+#define OV2640_COM7			0x112
+#define OV2640_COM8			0x113
+
+#define CAM_REG_SETTING(name, setter, regAddr, regMask, regOn) \
+	{ #name, SETTING_INT, 0, 1, \
+	  [](sensor_t* s, float v) { return s->setter(s, (int)v); }, \
+	  [](sensor_t* s) { return (float)s->status.name; }, \
+	  regAddr, regMask, regOn, offsetof(camera_status_t, name) }
+
+#define CAM_READONLY(name) \
+	{ #name, SETTING_INT, 0, 0, NULL, \
+	  [](sensor_t* s) { return (float)s->status.name; } }
+
+static constexpr setting_t settings[] = {
+	{ "xclk",        SETTING_INT, 0, 0, NULL,
+	  [](sensor_t* s) { return (float)(s->xclk_freq_hz / 1000000); } },
+	{ "pixformat",   SETTING_INT, 0, 0, NULL,
+	  [](sensor_t* s) { return (float)s->pixformat; } },
+	{ "framesize",   SETTING_INT, 0, FRAMESIZE_INVALID - 1,
+	  [](sensor_t* s, float v) { return (s->pixformat == PIXFORMAT_JPEG) ? s->set_framesize(s, (framesize_t)(int)v) : 0; },
+	  [](sensor_t* s) { return (float)s->status.framesize; } },
+	CAM_SETTING(quality,        set_quality,        0,    63),
+	CAM_SETTING(brightness,     set_brightness,    -2,     2),
+	CAM_SETTING(contrast,       set_contrast,      -2,     2),
+	CAM_SETTING(saturation,     set_saturation,    -2,     2),
+	CAM_READONLY(sharpness),
+	CAM_SETTING(special_effect, set_special_effect, 0,     6),
+	CAM_SETTING(wb_mode,        set_wb_mode,        0,     4),
+	CAM_REG_SETTING(awb,        set_whitebal,       OV2640_CTRL1, 0x08, 0x08),
+	CAM_REG_SETTING(awb_gain,   set_awb_gain,       OV2640_CTRL1, 0x04, 0x04),
+	CAM_REG_SETTING(aec,        set_exposure_ctrl,  OV2640_COM8,  0x01, 0x01),
+	CAM_REG_SETTING(aec2,       set_aec2,           OV2640_CTRL0, 0x40, 0x00),	// bit disables it
+	CAM_SETTING(ae_level,       set_ae_level,      -2,     2),
+	CAM_SETTING(aec_value,      set_aec_value,      0,  1200),
+	CAM_REG_SETTING(agc,        set_gain_ctrl,      OV2640_COM8,  0x04, 0x04),
+	CAM_SETTING(agc_gain,       set_agc_gain,       0,    30),
+	{ "gainceiling", SETTING_INT, 0, 6,
+	  [](sensor_t* s, float v) { return s->set_gainceiling(s, (gainceiling_t)(int)v); },
+	  [](sensor_t* s) { return (float)s->status.gainceiling; } },
+	CAM_REG_SETTING(bpc,        set_bpc,            OV2640_CTRL3, 0x80, 0x80),
+	CAM_REG_SETTING(wpc,        set_wpc,            OV2640_CTRL3, 0x40, 0x40),
+	CAM_REG_SETTING(raw_gma,    set_raw_gma,        OV2640_CTRL1, 0x20, 0x20),
+	CAM_REG_SETTING(lenc,       set_lenc,           OV2640_CTRL1, 0x02, 0x02),
+	CAM_REG_SETTING(hmirror,    set_hmirror,        OV2640_REG04, 0x80, 0x80),
+	CAM_REG_SETTING(vflip,      set_vflip,          OV2640_REG04, 0x50, 0x50),	// VREF_EN with VFLIP_IMG
+	CAM_REG_SETTING(dcw,        set_dcw,            OV2640_CTRL2, 0x20, 0x20),
+	CAM_REG_SETTING(colorbar,   set_colorbar,       OV2640_COM7,  0x02, 0x02),
+	{ "led_intensity", SETTING_INT, 0, 255,
+	  [](sensor_t*, float v) { led_set_duty((int)v); return 0; },
+	  [](sensor_t*) { return (float)led_duty; } },
+	{ "timelapse_interval", SETTING_INT, 0, TIMELAPSE_INTERVAL_MAX,
+	  [](sensor_t*, float v) { return timelapse_set_interval((int)v); },
+	  [](sensor_t*) { return (float)timelapse_get_interval(); } },
+	{ "mlx_fast",    SETTING_INT, 0, 1,
+	  [](sensor_t*, float v) { return MLX90640::getInstance().SetFastRefreshRate((uint8_t)v); },
+	  [](sensor_t*) { return (float)MLX90640::getInstance().GetFastRefreshRate(); } },
+	{ "ambReflected", SETTING_FLOAT, -100, 300,
+	  [](sensor_t*, float v) { MLX90640::getInstance().SetAmbientReflected(v); return 0; },
+	  [](sensor_t*) { return MLX90640::getInstance().GetAmbientReflected(); } },
+	{ "emissivity",  SETTING_FLOAT, 0, 1,
+	  [](sensor_t*, float v) { MLX90640::getInstance().SetEmissivity(v); return 0; },
+	  [](sensor_t*) { return MLX90640::getInstance().GetEmissivity(); } },
+	{ "mlx_palette", SETTING_INT, 0, MLX_PALETTE_COUNT - 1,
+	  [](sensor_t*, float v) { return MLXpalette::setPalette((int)v); },
+	  [](sensor_t*) { return (float)MLXpalette::getPalette(); } },
+	{ "mlx_agc",     SETTING_INT, 0, MLX_AGC_COUNT - 1,
+	  [](sensor_t*, float v) { return MLXagc::setMode((int)v); },
+	  [](sensor_t*) { return (float)MLXagc::getMode(); } },
+	{ "fusion_mode", SETTING_INT, 0, MLX_FUSION_COUNT - 1,
+	  [](sensor_t*, float v) { return MLXfusion::setMode((int)v); },
+	  [](sensor_t*) { return (float)MLXfusion::getMode(); } },
+	{ "fusion_alpha", SETTING_INT, 0, 256,
+	  [](sensor_t*, float v) { return MLXfusion::setAlpha((int)v); },
+	  [](sensor_t*) { return (float)MLXfusion::getAlpha(); } },
+	{ "mlx_observe_offset", SETTING_INT, 0, 1,
+	  [](sensor_t*, float v) { return MLXcalibration::setUserCalibrationOffsetsEnabled((int)v); },
+	  [](sensor_t*) { return (float)MLXcalibration::getUserCalibrationOffsetsEnabled(); } },
+};
+
+#define SETTINGS_COUNT		(sizeof(settings) / sizeof(settings[0]))
+
+
+// Perfect hash: the first seed that maps every name to its own slot
+
+#define SETTINGS_SLOTS			128		// power of two
+#define SETTINGS_SEED_LIMIT		4096
+
+static_assert(SETTINGS_COUNT < 255, "slot index is uint8_t");
+
+static constexpr bool settings_seed_ok(uint32_t seed)
+{
+	bool used[SETTINGS_SLOTS] = {};
+	for (size_t i = 0; i < SETTINGS_COUNT; i++)
+	{
+		uint32_t slot = setting_hash(settings[i].name, seed) & (SETTINGS_SLOTS - 1);
+		if (used[slot]) return false;
+
+		used[slot] = true;
+	}
+
+	return true;
+}
+
+static constexpr uint32_t settings_seed()
+{
+	for (uint32_t seed = 0; seed < SETTINGS_SEED_LIMIT; seed++)
+		if (settings_seed_ok(seed)) return seed;
+
+	return SETTINGS_SEED_LIMIT;
+}
+
+static constexpr uint32_t settingsSeed = settings_seed();
+static_assert(settingsSeed < SETTINGS_SEED_LIMIT, "no perfect hash seed, raise SETTINGS_SLOTS");
+
+typedef struct {
+	uint8_t index[SETTINGS_SLOTS];		// 0xFF for an empty slot
+} settings_slots_t;
+
+static constexpr settings_slots_t settings_slots()
+{
+	settings_slots_t t = {};
+	for (size_t i = 0; i < SETTINGS_SLOTS; i++)
+		t.index[i] = 0xFF;
+
+	for (size_t i = 0; i < SETTINGS_COUNT; i++)
+		t.index[setting_hash(settings[i].name, settingsSeed) & (SETTINGS_SLOTS - 1)] = (uint8_t)i;
+
+	return t;
+}
+
+static constexpr settings_slots_t settingsSlots = settings_slots();
+
+
+const setting_t* setting_find(const char* name)
+{
+	uint8_t i = settingsSlots.index[setting_hash(name, settingsSeed) & (SETTINGS_SLOTS - 1)];
+	if (i == 0xFF) return NULL;
+
+	// a name outside the table may still land in an occupied slot
+	return strcmp(settings[i].name, name) ? NULL : &settings[i];
+}
+
+
+size_t setting_count()
+{
+	return SETTINGS_COUNT;
+}
+
+
+const setting_t* setting_at(size_t i)
+{
+	return (i < SETTINGS_COUNT) ? &settings[i] : NULL;
+}
+
+
+int setting_apply(const setting_t* setting, const char* value)
+{
+	if (!setting->set) {
+		log_i("Read only setting: %s", setting->name);
+		return -1;
+	}
+
+	char* end;
+	float v = strtof(value, &end);
+	if (end == value || v < setting->min || v > setting->max) {
+		log_i("%s out of range: %s", setting->name, value);
+		return -1;
+	}
+
+	if (setting->type == SETTING_INT)
+		v = (float)(int)v;
+
+	return setting->set(esp_camera_sensor_get(), v);
+}
+
+
+void setting_format(const setting_t* setting, char* buf, size_t size)
+{
+	float v = setting->get(esp_camera_sensor_get());
+
+	if (setting->type == SETTING_FLOAT)
+		snprintf(buf, size, "%.2f", v);
+	else
+		snprintf(buf, size, "%d", (int)v);
+}
+
+
+int control_set(const char *variable, const char *value)
+{
+	log_i("%s = %s", variable, value);
+
+	const setting_t* setting = setting_find(variable);
+	if (!setting) {
+		log_i("Unknown command: %s", variable);
+		return -1;
+	}
+
+	int res = setting_apply(setting, value);
+
+	// framesize and the other sensor settings change the registers /status reports
+	if (res >= 0)
+		status_invalidate(STATUS_SETTINGS | STATUS_REGISTERS);
+
+	return res;
+}
+
+
+typedef struct {
+	const setting_t* setting;
+	float            value;
+	float            previous;
+	bool             bApplied;
+} batch_item_t;
+
+// One read-modify-write of the on/off settings changed in a register
+typedef struct {
+	uint16_t reg;
+	uint8_t  mask;
+	uint8_t  value;
+	uint8_t  previous;		// bits of mask before the batch, from the status of the settings
+	bool     bApplied;
+} batch_reg_t;
+
+#define SETTINGS_BATCH_REGS		8
+
+// Sensor reconfiguration goes first: set_framesize rewrites the mode register tables,
+// the settings after it land on top. Rollback keeps the same order for the same reason
+static int batch_rank(const setting_t* setting)
+{
+	return strcmp(setting->name, "framesize") ? 1 : 0;
+}
+
+
+static uint8_t batch_bits(const setting_t* setting, float value)
+{
+	return value ? setting->on : (setting->mask & ~setting->on);
+}
+
+
+// Merges a changed on/off setting into the write of its register, false if out of slots
+static bool batch_merge(batch_reg_t* regs, int* nRegs, const batch_item_t& item)
+{
+	const setting_t* setting = item.setting;
+
+	int r = 0;
+	while (r < *nRegs && regs[r].reg != setting->reg) r++;
+
+	if (r == *nRegs)
+	{
+		if (r == SETTINGS_BATCH_REGS) return false;
+
+		regs[r] = { setting->reg, 0, 0, 0, false };
+		(*nRegs)++;
+	}
+
+	regs[r].mask     |= setting->mask;
+	regs[r].value    |= batch_bits(setting, item.value);
+	regs[r].previous |= batch_bits(setting, item.previous);
+
+	return true;
+}
+
+
+static esp_err_t control_batch_apply(httpd_req_t *req, char* body, batch_item_t* items)
+{
+	if (req->content_len == 0 || req->content_len >= SETTINGS_BATCH_BODY)
+		return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body size");
+
+	size_t received = 0;
+
+	int iRetries = 0;
+	while (received < req->content_len)
+	{
+		int nRead = httpd_req_recv(req, body + received, req->content_len - received);
+		if (nRead <= 0)
+		{
+			if (nRead == HTTPD_SOCK_ERR_TIMEOUT) {
+				if (iRetries++ < 3) continue; // retry
+			}
+
+			log_e("Receive error");
+			return httpd_resp_send_500(req);
+		}
+
+		received += nRead;
+	}
+	body[received] = 0;
+
+	// parse and validate everything before touching the sensor
+	int nItems = 0;
+
+	char* save = NULL;
+	for (char* pair = strtok_r(body, "&\r\n", &save); pair; pair = strtok_r(NULL, "&\r\n", &save))
+	{
+		char* eq = strchr(pair, '=');
+		if (!eq) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, pair);
+		*eq = 0;
+
+		const setting_t* setting = setting_find(pair);
+		if (!setting || !setting->set) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, pair);
+
+		char* end;
+		float v = strtof(eq + 1, &end);
+		if (end == eq + 1 || v < setting->min || v > setting->max)
+			return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, pair);
+
+		if (setting->type == SETTING_INT)
+			v = (float)(int)v;
+
+		// a repeated name keeps its last value
+		int i = 0;
+		while (i < nItems && items[i].setting != setting) i++;
+
+		if (i == nItems)
+		{
+			if (nItems == SETTINGS_BATCH_MAX) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Too many settings");
+			nItems++;
+		}
+
+		items[i] = { setting, v, 0, false };
+	}
+
+	// stable order by rank
+	for (int i = 1; i < nItems; i++)
+		for (int j = i; j > 0 && batch_rank(items[j - 1].setting) > batch_rank(items[j].setting); j--)
+		{
+			batch_item_t t = items[j - 1]; items[j - 1] = items[j]; items[j] = t;
+		}
+
+	sensor_t* cam = esp_camera_sensor_get();
+
+	// only the OV2640 register layout is known, other sensors go through their setters
+	bool bMerge = cam->id.PID == OV2640_PID;
+
+	batch_reg_t regs[SETTINGS_BATCH_REGS];
+	int         nRegs = 0;
+
+	int64_t startUs = esp_timer_get_time();
+
+		int nApplied = 0;
+		int nSkipped = 0;
+		int res      = 0;
+		for (int i = 0; i < nItems; i++)
+		{
+			items[i].previous = items[i].setting->get(cam);
+
+			// unchanged values cost no register write
+			if (items[i].previous == items[i].value) {
+				nSkipped++;
+				continue;
+			}
+
+			// written below together with the other bits of the register
+			if (bMerge && items[i].setting->reg && batch_merge(regs, &nRegs, items[i])) {
+				nApplied++;
+				continue;
+			}
+
+			res = items[i].setting->set(cam, items[i].value);
+			if (res < 0) {
+				log_e("Batch: %s failed, rolling back", items[i].setting->name);
+				break;
+			}
+
+			items[i].bApplied = true;
+			nApplied++;
+		}
+
+		// sensor bank registers first, the driver then switches to the DSP bank once
+		for (int i = 1; i < nRegs; i++)
+			for (int j = i; j > 0 && (regs[j - 1].reg & 0x100) < (regs[j].reg & 0x100); j--)
+			{
+				batch_reg_t t = regs[j - 1]; regs[j - 1] = regs[j]; regs[j] = t;
+			}
+
+		for (int r = 0; r < nRegs && res >= 0; r++)
+		{
+			res = cam->set_reg(cam, regs[r].reg, regs[r].mask, regs[r].value);
+			if (res < 0) {
+				log_e("Batch: register 0x%03x failed, rolling back", regs[r].reg);
+				break;
+			}
+
+			regs[r].bApplied = true;
+		}
+
+		// the driver setters keep status up to date, the merged writes do it here
+		if (res >= 0)
+		{
+			for (int i = 0; i < nItems; i++)
+				if (bMerge && items[i].setting->reg && !items[i].bApplied && items[i].previous != items[i].value)
+					*((uint8_t*)&cam->status + items[i].setting->status) = (uint8_t)items[i].value;
+		}
+
+		// in apply order, undoing framesize last would rewrite its tables over the restored settings
+		if (res < 0)
+		{
+			for (int i = 0; i < nItems; i++)
+				if (items[i].bApplied) items[i].setting->set(cam, items[i].previous);
+
+			for (int r = 0; r < nRegs; r++)
+				if (regs[r].bApplied) cam->set_reg(cam, regs[r].reg, regs[r].mask, regs[r].previous);
+		}
+
+	uint32_t applyUs = (uint32_t)(esp_timer_get_time() - startUs);
+
+	status_invalidate(STATUS_SETTINGS | STATUS_REGISTERS);
+
+	log_i("Batch: %d applied, %d unchanged, %d merged register writes in %u us", nApplied, nSkipped, nRegs, applyUs);
+
+	if (res < 0)
+		return httpd_resp_send_500(req);
+
+	char json[128];
+	snprintf(json, sizeof(json), "{\"applied\":%d,\"unchanged\":%d,\"reg_writes\":%d,\"apply_us\":%u}",
+	         nApplied, nSkipped, nRegs, applyUs);
+
+	char hdr[12];
+	snprintf(hdr, sizeof(hdr), "%u", applyUs);
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+	httpd_resp_set_hdr(req, "X-Apply-Us", hdr);
+
+	return httpd_resp_sendstr(req, json);
+}
+
+
+esp_err_t control_batch_handler(httpd_req_t *req)
+{
+	// off the httpd task stack
+	typedef struct {
+		char         body[SETTINGS_BATCH_BODY];
+		batch_item_t items[SETTINGS_BATCH_MAX];
+	} batch_t;
+
+	batch_t* batch = (batch_t*)malloc(sizeof(batch_t));
+	if (!batch) return httpd_resp_send_500(req);
+
+	esp_err_t res = control_batch_apply(req, batch->body, batch->items);
+
+	free(batch);
+
+	return res;
+}
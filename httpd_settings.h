@@ -0,0 +1,81 @@
+#ifndef _HTTPD_SETTINGS_H_
+#define _HTTPD_SETTINGS_H_
+
+
+#include "esp_camera.h"
+#include "esp_http_server.h"
+#include <stdint.h>
+#include <stddef.h>
+
+
+// Registry of every runtime setting
+//
+// One constexpr table in httpd_settings.cpp holds name, type, range, getter and setter.
+// GET /control, the WebSocket control channel and GET /status are all driven by it,
+// names are found through a perfect hash computed at compile time
+
+typedef enum {
+	SETTING_INT = 0,
+	SETTING_FLOAT
+} setting_type_t;
+
+typedef int   (*setting_set_fn)(sensor_t* cam, float value);
+typedef float (*setting_get_fn)(sensor_t* cam);
+
+typedef struct {
+	const char*     name;
+	setting_type_t  type;
+	float           min;
+	float           max;
+	setting_set_fn  set;		// NULL for read only settings
+	setting_get_fn  get;
+
+	// OV2640 on/off settings: bits of one register, merged with the others of that register
+	// by a batch. reg as for sensor_t::set_reg (0x100 selects the sensor bank), 0 if none
+	uint16_t        reg;
+	uint8_t         mask;
+	uint8_t         on;			// bits of mask when enabled
+	uint8_t         status;		// offset of the uint8_t field in camera_status_t
+} setting_t;
+
+// FNV-1a, seeded by the perfect hash search
+constexpr uint32_t setting_hash(const char* s, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ seed;
+	while (*s)
+	{
+		h ^= (uint8_t)*s++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+// NULL if the name is not registered
+const setting_t* setting_find(const char* name);
+
+size_t           setting_count();
+const setting_t* setting_at(size_t i);
+
+// Parses and range checks the value, returns negative value on failure
+int              setting_apply(const setting_t* setting, const char* value);
+
+// JSON literal of the current value
+void             setting_format(const setting_t* setting, char* buf, size_t size);
+
+// Applies a single setting by name, returns negative value on failure
+// Shared by GET /control and the WebSocket control channel
+int              control_set(const char *variable, const char *value);
+
+// POST /control, body var=val&var=val...
+// Applied as one transaction: validated up front, ordered, a repeated name and a value equal to
+// the current one cost no setter call, already applied settings rolled back if a setter fails.
+// On the OV2640 the on/off settings sharing a register (COM8, REG04, CTRL1, CTRL3...) are merged
+// into one read-modify-write per register, grouped by bank so it is selected once.
+// Multi register settings (framesize, quality, effects...) still run their own setter
+#define SETTINGS_BATCH_MAX		48
+#define SETTINGS_BATCH_BODY		1024
+
+esp_err_t        control_batch_handler(httpd_req_t *req);
+
+#endif
@@ -0,0 +1,262 @@
+
+#include "httpd_status.h"
+#include "httpd_stream.h"
+#include "httpd_settings.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "esp32-hal-log.h"
+#include "esp32-hal-psram.h"
+#include "MLX90640_calibration.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+
+extern uint32_t mlx_mjpeg_encode_us;
+
+#define STATUS_MAX_FIELDS		80
+#define STATUS_TELEMETRY_US		1000000
+
+typedef struct {
+	char     key[24];
+	char*    value;			// JSON literal, PSRAM
+	size_t   cap;
+	uint32_t version;
+} status_field_t;
+
+// only touched from the httpd task, other tasks merely raise invalidation bits
+static status_field_t statusFields[STATUS_MAX_FIELDS];
+static uint8_t        statusCount   = 0;
+static uint32_t       statusVersion = 0;
+static int64_t        statusTelemetryUs = 0;
+
+static volatile uint8_t statusDirty = STATUS_SETTINGS | STATUS_REGISTERS | STATUS_CALIBRATION;
+
+
+void status_invalidate(uint8_t what)
+{
+	__atomic_fetch_or(&statusDirty, what, __ATOMIC_RELAXED);
+}
+
+
+// Stores a JSON literal, bumps the version only if it changed
+static void status_store(const char* key, const char* value)
+{
+	status_field_t* f = NULL;
+	for (uint8_t i = 0; i < statusCount && !f; i++)
+		if (!strcmp(statusFields[i].key, key)) f = &statusFields[i];
+
+	if (!f)
+	{
+		if (statusCount == STATUS_MAX_FIELDS) {
+			log_e("Status model is full: %s", key);
+			return;
+		}
+
+		f = &statusFields[statusCount++];
+		strncpy(f->key, key, sizeof(f->key) - 1);
+	}
+	else if (!strcmp(f->value, value))
+		return;
+
+	size_t len = strlen(value);
+	if (len + 1 > f->cap)
+	{
+		char* grown = (char*)ps_realloc(f->value, len + 1);
+		if (!grown)
+		{
+			log_e("Status field allocation failed: %s", key);
+
+			// a new field without a value would be read by the next lookup and the JSON writer
+			if (!f->value)
+			{
+				memset(f, 0, sizeof(*f));
+				statusCount--;
+			}
+			return;
+		}
+
+		f->value = grown;
+		f->cap   = len + 1;
+	}
+
+	memcpy(f->value, value, len + 1);
+	f->version = ++statusVersion;
+}
+
+
+static void status_set(const char* key, const char* fmt, ...)
+{
+	char value[48];
+
+	va_list args;
+	va_start(args, fmt);
+		vsnprintf(value, sizeof(value), fmt, args);
+	va_end(args);
+
+	status_store(key, value);
+}
+
+
+static void status_set_reg(sensor_t *s, uint16_t reg, uint32_t mask)
+{
+	char key[8];
+	snprintf(key, sizeof(key), "0x%x", reg);
+
+	status_set(key, "%u", s->get_reg(s, reg, mask));
+}
+
+
+static void status_refresh_registers(sensor_t* cam)
+{
+	if (cam->id.PID == OV5640_PID || cam->id.PID == OV3660_PID)
+	{
+		for (int reg = 0x3400; reg < 0x3406; reg += 2)
+			status_set_reg(cam, reg, 0xFFF);		//12 bit
+
+		status_set_reg(cam, 0x3406, 0xFF);
+
+		status_set_reg(cam, 0x3500, 0xFFFF0);		//16 bit
+		status_set_reg(cam, 0x3503, 0xFF);
+		status_set_reg(cam, 0x350a, 0x3FF);			//10 bit
+		status_set_reg(cam, 0x350c, 0xFFFF);		//16 bit
+
+		for (int reg = 0x5480; reg <= 0x5490; reg++)
+			status_set_reg(cam, reg, 0xFF);
+
+		for (int reg = 0x5380; reg <= 0x538b; reg++)
+			status_set_reg(cam, reg, 0xFF);
+
+		for (int reg = 0x5580; reg < 0x558a; reg++)
+			status_set_reg(cam, reg, 0xFF);
+
+		status_set_reg(cam, 0x558a, 0x1FF);			//9 bit
+	}
+	else if (cam->id.PID == OV2640_PID)
+	{
+		status_set_reg(cam, 0xd3, 0xFF);
+		status_set_reg(cam, 0x111, 0xFF);
+		status_set_reg(cam, 0x132, 0xFF);
+	}
+}
+
+
+// Every readable entry of the settings registry
+static void status_refresh_settings()
+{
+	for (size_t i = 0; i < setting_count(); i++)
+	{
+		char value[24];
+		setting_format(setting_at(i), value, sizeof(value));
+
+		status_store(setting_at(i)->name, value);
+	}
+}
+
+
+static void status_refresh_telemetry()
+{
+	char clients[STREAM_RATE_STATUS_SIZE];
+	stream_rate_status(clients, sizeof(clients));
+
+	status_set("mlx_mjpeg_encode_us",   "%u", mlx_mjpeg_encode_us);
+	status_set("stream_send_us",        "%u", stream_send_us);
+	status_set("stream_send_kBps",      "%u", stream_send_kBps);
+	status_set("stream_quality_offset", "%d", stream_rate_quality_offset());
+
+	status_store("stream_clients", clients);
+}
+
+
+static void status_refresh()
+{
+	sensor_t* cam = esp_camera_sensor_get();
+
+	uint8_t dirty = __atomic_exchange_n(&statusDirty, 0, __ATOMIC_RELAXED);
+
+	if (dirty & STATUS_REGISTERS)
+		status_refresh_registers(cam);
+
+	if (dirty & STATUS_CALIBRATION)
+	{
+		char strMLXcalibDate[32];
+		MLXcalibration::readUserCalibrationOffsetsDate(strMLXcalibDate);
+
+		status_set("calibration_date", "\"%s\"", strMLXcalibDate);
+	}
+
+	if (dirty & STATUS_SETTINGS)
+		status_refresh_settings();
+
+	int64_t now = esp_timer_get_time();
+	if (now - statusTelemetryUs >= STATUS_TELEMETRY_US)
+	{
+		statusTelemetryUs = now;
+		status_refresh_telemetry();
+	}
+}
+
+
+// GET /status
+// GET /status?since=N returns only fields changed after model version N
+// The model version is sent as ETag, If-None-Match with the current one gets 304
+esp_err_t status_handler(httpd_req_t *req)
+{
+	status_refresh();
+
+	char etag[16];
+	snprintf(etag, sizeof(etag), "\"%u\"", statusVersion);
+
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+	httpd_resp_set_hdr(req, "ETag", etag);
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+	char ifNoneMatch[16];
+	if (httpd_req_get_hdr_value_str(req, "If-None-Match", ifNoneMatch, sizeof(ifNoneMatch)) == ESP_OK &&
+		!strcmp(ifNoneMatch, etag))
+	{
+		httpd_resp_set_status(req, "304 Not Modified");
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	uint32_t since = 0;
+
+	char query[32];
+	char value[12];
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK)
+	{
+		since = strtoul(value, NULL, 10);
+	}
+
+	size_t len = 32;
+	for (uint8_t i = 0; i < statusCount; i++)
+		if (statusFields[i].version > since)
+			len += strlen(statusFields[i].key) + strlen(statusFields[i].value) + 4;
+
+	char* json_response = (char*)ps_malloc(len);
+	if (!json_response)
+		return httpd_resp_send_500(req);
+
+		char *p = json_response;
+		*p++ = '{';
+
+		for (uint8_t i = 0; i < statusCount; i++)
+		{
+			const status_field_t& f = statusFields[i];
+			if (f.version > since)
+				p += sprintf(p, "\"%s\":%s,", f.key, f.value);
+		}
+
+		p += sprintf(p, "\"status_version\":%u}", statusVersion);
+
+		httpd_resp_set_type(req, "application/json");
+
+		esp_err_t res = httpd_resp_send(req, json_response, p - json_response);
+
+	free(json_response);
+
+	return res;
+}
@@ -0,0 +1,23 @@
+#ifndef _HTTPD_STATUS_H_
+#define _HTTPD_STATUS_H_
+
+
+#include "esp_http_server.h"
+
+
+// In-RAM model behind GET /status
+//
+// Every field carries the model version of its last change, the version is the ETag.
+// Sensor registers and the calibration date are only read again after being invalidated,
+// settings kept in RAM by their modules on invalidation and stream telemetry once a second
+
+#define STATUS_SETTINGS		0x01	// values kept in RAM by their modules
+#define STATUS_REGISTERS	0x02	// sensor registers read over SCCB
+#define STATUS_CALIBRATION	0x04	// calibration date stored in SPIFFS
+
+// Safe to call from any task, the model is refreshed by the next GET /status
+void      status_invalidate(uint8_t what);
+
+esp_err_t status_handler(httpd_req_t *req);
+
+#endif
@@ -0,0 +1,411 @@
+
+#include "httpd_stream.h"
+#include "metrics.h"
+#include "trace.h"
+#include "httpd_status.h"
+#include "esp32-hal-log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+uint32_t stream_send_us   = 0;
+uint32_t stream_send_kBps = 0;
+
+
+// The query is read whole, a fixed buffer would truncate long ones and lose every key
+static int stream_query_int(httpd_req_t *req, const char *key, int deflt)
+{
+	size_t len = httpd_req_get_url_query_len(req) + 1;
+	if (len <= 1) return deflt;
+
+	char* query = (char*)malloc(len);
+	if (!query) return deflt;
+
+	char value[16];
+	bool found = httpd_req_get_url_query_str(req, query, len) == ESP_OK &&
+	             httpd_query_key_value(query, key, value, sizeof(value)) == ESP_OK;
+
+	free(query);
+
+	return found ? atoi(value) : deflt;
+}
+
+
+// Writes everything, httpd_send may take only part of the buffer
+static esp_err_t stream_send_all(stream_writer_t* w, const uint8_t* data, size_t len)
+{
+	int64_t start = esp_timer_get_time();
+
+	while (len)
+	{
+		int sent = httpd_send(w->req, (const char*)data, len);
+		if (sent <= 0) return ESP_FAIL;
+
+		data += sent;
+		len  -= sent;
+	}
+
+	w->frameSendUs += esp_timer_get_time() - start;
+
+	return ESP_OK;
+}
+
+
+esp_err_t stream_begin(stream_writer_t* w, httpd_req_t* req, const char* contentType, bool bCoalesce,
+                       const char* const* headers)
+{
+	memset(w, 0, sizeof(*w));
+	w->req = req;
+
+	bCoalesce = bCoalesce && stream_query_int(req, "sg", 1);
+
+	// one segment per frame tail is all that is left to wait for, Nagle would hold it back
+	int nodelay = stream_query_int(req, "nodelay", 1);
+	setsockopt(httpd_req_to_sockfd(req), IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+	if (bCoalesce)
+		w->bounce = (uint8_t*)heap_caps_malloc(STREAM_BOUNCE_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+	w->bCoalesce = w->bounce != NULL;
+
+	if (!w->bCoalesce)
+	{
+		esp_err_t res = httpd_resp_set_type(req, contentType);
+		if (res == ESP_OK)
+			res = httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+		for (int i = 0; headers && headers[i] && res == ESP_OK; i += 2)
+			res = httpd_resp_set_hdr(req, headers[i], headers[i + 1]);
+
+		return res;
+	}
+
+	// no Content-Length and no chunked encoding, the stream ends when the connection closes
+	int hlen = snprintf((char*)w->bounce, STREAM_BOUNCE_SIZE,
+	                    "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nAccess-Control-Allow-Origin: *\r\n"
+	                    "Cache-Control: no-cache\r\nConnection: close\r\n", contentType);
+
+	for (int i = 0; headers && headers[i] && hlen < STREAM_BOUNCE_SIZE; i += 2)
+		hlen += snprintf((char*)w->bounce + hlen, STREAM_BOUNCE_SIZE - hlen, "%s: %s\r\n", headers[i], headers[i + 1]);
+
+	if (hlen < STREAM_BOUNCE_SIZE)
+		hlen += snprintf((char*)w->bounce + hlen, STREAM_BOUNCE_SIZE - hlen, "\r\n");
+
+	if (hlen >= STREAM_BOUNCE_SIZE) {
+		log_e("Stream headers exceed %u bytes", STREAM_BOUNCE_SIZE);
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	return stream_send_all(w, w->bounce, hlen);
+}
+
+
+esp_err_t stream_write(stream_writer_t* w, const void* data, size_t len)
+{
+	if (w->frameBytes == 0)
+		w->firstByteUs = esp_timer_get_time();
+
+	w->frameBytes += len;
+
+	if (!w->bCoalesce)
+	{
+		int64_t start = esp_timer_get_time();
+		esp_err_t res = httpd_resp_send_chunk(w->req, (const char*)data, len);
+		w->frameSendUs += esp_timer_get_time() - start;
+
+		return res;
+	}
+
+	const uint8_t* src = (const uint8_t*)data;
+
+	// PSRAM payloads are staged through the bounce buffer one segment group at a time
+	while (len)
+	{
+		size_t n = STREAM_BOUNCE_SIZE - w->len;
+		if (n > len) n = len;
+
+		memcpy(w->bounce + w->len, src, n);
+		w->len += n;
+		src    += n;
+		len    -= n;
+
+		if (w->len == STREAM_BOUNCE_SIZE)
+		{
+			if (stream_send_all(w, w->bounce, w->len) != ESP_OK) return ESP_FAIL;
+			w->len = 0;
+		}
+	}
+
+	return ESP_OK;
+}
+
+
+void stream_frame_trace(stream_writer_t* w, uint8_t pid, uint8_t lane, uint32_t seq, int64_t captureUs)
+{
+	w->tracePid       = pid;
+	w->traceLane      = lane;
+	w->traceSeq       = seq;
+	w->traceCaptureUs = captureUs;
+}
+
+
+esp_err_t stream_frame_end(stream_writer_t* w)
+{
+	esp_err_t res = ESP_OK;
+
+	if (w->bCoalesce && w->len)
+	{
+		res = stream_send_all(w, w->bounce, w->len);
+		w->len = 0;
+	}
+
+	if (res == ESP_OK && w->frameSendUs > 0)
+	{
+		uint32_t kBps = (uint32_t)(w->frameBytes * 1000 / w->frameSendUs);	// bytes/us*1000 = kB/s
+
+		stream_send_us   = (uint32_t)w->frameSendUs;
+
+		metrics_observe(METRIC_STREAM_SEND_US, stream_send_us);
+		metrics_inc(METRIC_STREAM_FRAMES);
+		stream_send_kBps = stream_send_kBps ? (stream_send_kBps * 7 + kBps) / 8 : kBps;
+
+		log_d("%s: %ubytes sent in %uus (%ukB/s)", w->bCoalesce ? "SG" : "CHUNKED",
+		      (uint32_t)w->frameBytes, stream_send_us, kBps);
+	}
+
+	if (res == ESP_OK && w->tracePid)
+	{
+		int64_t now = esp_timer_get_time();
+
+		trace_span((trace_pid_t)w->tracePid, w->traceLane, "send",  w->traceSeq, w->firstByteUs,    now);
+		trace_span((trace_pid_t)w->tracePid, w->traceLane, "frame", w->traceSeq, w->traceCaptureUs, now);
+	}
+	w->tracePid = 0;
+
+	w->lastSendUs  = (uint32_t)w->frameSendUs;
+	w->frameBytes  = 0;
+	w->frameSendUs = 0;
+
+	return res;
+}
+
+
+esp_err_t stream_finish(stream_writer_t* w)
+{
+	if (!w->bCoalesce)
+		return httpd_resp_send_chunk(w->req, NULL, 0);
+
+	esp_err_t res = w->len ? stream_send_all(w, w->bounce, w->len) : ESP_OK;
+	w->len = 0;
+
+	return res;
+}
+
+
+void stream_end(stream_writer_t* w)
+{
+	// a raw stream has no end marker, closing the connection terminates it
+	if (w->bCoalesce)
+		httpd_sess_trigger_close(w->req->handle, httpd_req_to_sockfd(w->req));
+
+	free(w->bounce);
+	w->bounce = NULL;
+}
+
+
+typedef struct {
+	bool     bUsed;
+	char     name[16];
+	uint32_t targetUs;
+	uint32_t latencyUs;		// smoothed capture to sent
+	uint32_t sendUs;		// smoothed socket write time per frame
+	uint8_t  skip;			// frames dropped per frame sent
+	uint8_t  skipCount;
+	uint8_t  adjustCount;
+	uint32_t sent;
+	uint32_t skipped;
+} stream_client_t;
+
+static stream_client_t   streamClients[STREAM_MAX_CLIENTS];
+static SemaphoreHandle_t streamMutex = NULL;
+
+// sensor quality the controller degrades from, restored when it lets go
+static int8_t  streamQualityOffset = 0;
+static uint8_t streamQualityBase   = 0;
+
+
+static uint8_t stream_rate_clients_locked()
+{
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < STREAM_MAX_CLIENTS; i++)
+		n += streamClients[i].bUsed;
+
+	return n;
+}
+
+
+// Applies base + offset to the sensor, streamMutex held by the caller
+static void stream_rate_quality_locked(int8_t offset)
+{
+	sensor_t* cam = esp_camera_sensor_get();
+	if (!cam) return;
+
+	// a quality set from /control while adapting becomes the new base
+	if (cam->status.quality != streamQualityBase + streamQualityOffset)
+		streamQualityBase = cam->status.quality;
+
+	if (streamQualityBase + offset > STREAM_QUALITY_WORST) offset = STREAM_QUALITY_WORST - streamQualityBase;
+	if (offset < 0) offset = 0;
+
+	if (offset != streamQualityOffset) {
+		streamQualityOffset = offset;
+		cam->set_quality(cam, streamQualityBase + streamQualityOffset);
+
+		status_invalidate(STATUS_SETTINGS);
+	}
+}
+
+
+void stream_rate_init()
+{
+	if (!streamMutex) streamMutex = xSemaphoreCreateMutex();
+}
+
+
+int stream_rate_begin(httpd_req_t* req, const char* name)
+{
+	int slot = -1;
+
+	xSemaphoreTake(streamMutex, portMAX_DELAY);
+
+		for (uint8_t i = 0; i < STREAM_MAX_CLIENTS && slot < 0; i++)
+		{
+			stream_client_t& c = streamClients[i];
+			if (c.bUsed) continue;
+
+			memset(&c, 0, sizeof(c));
+			c.bUsed    = true;
+			c.targetUs = stream_query_int(req, "latency", STREAM_TARGET_LATENCY_MS) * 1000;
+			strncpy(c.name, name, sizeof(c.name) - 1);
+
+			slot = i;
+		}
+
+		// quality is shared by all clients, only one client may trade it for latency
+		if (stream_rate_clients_locked() > 1)
+			stream_rate_quality_locked(0);
+
+	xSemaphoreGive(streamMutex);
+
+	return slot;
+}
+
+
+void stream_rate_end(int slot)
+{
+	if (slot < 0) return;
+
+	xSemaphoreTake(streamMutex, portMAX_DELAY);
+		streamClients[slot].bUsed = false;
+		stream_rate_quality_locked(0);
+	xSemaphoreGive(streamMutex);
+}
+
+
+bool stream_rate_skip(int slot)
+{
+	if (slot < 0) return false;
+
+	stream_client_t& c = streamClients[slot];
+
+	if (c.skipCount < c.skip) {
+		c.skipCount++;
+		c.skipped++;
+		return true;
+	}
+
+	c.skipCount = 0;
+	return false;
+}
+
+
+void stream_rate_update(int slot, int64_t captureUs, uint32_t sendUs)
+{
+	if (slot < 0) return;
+
+	stream_client_t& c = streamClients[slot];
+
+	uint32_t latency = (uint32_t)(esp_timer_get_time() - captureUs);
+
+	c.sent++;
+	c.latencyUs = c.latencyUs ? (c.latencyUs * 3 + latency) / 4 : latency;
+	c.sendUs    = c.sendUs    ? (c.sendUs    * 3 + sendUs)  / 4 : sendUs;
+
+	// let a step take effect before the next one
+	if (++c.adjustCount < STREAM_ADJUST_FRAMES) return;
+	c.adjustCount = 0;
+
+	xSemaphoreTake(streamMutex, portMAX_DELAY);
+
+		bool bSingle = stream_rate_clients_locked() == 1;
+
+		if (c.latencyUs > c.targetUs + c.targetUs / 4)
+		{
+			// a lone client gets smaller frames before fewer frames
+			if (bSingle && streamQualityBase + streamQualityOffset < STREAM_QUALITY_WORST)
+				stream_rate_quality_locked(streamQualityOffset + 4);
+			else if (c.skip < STREAM_MAX_SKIP)
+				c.skip++;
+		}
+		else if (c.latencyUs < c.targetUs - c.targetUs / 4)
+		{
+			if (c.skip)
+				c.skip--;
+			else if (bSingle && streamQualityOffset)
+				stream_rate_quality_locked(streamQualityOffset - 2);
+		}
+
+	xSemaphoreGive(streamMutex);
+}
+
+
+void stream_rate_status(char* buf, size_t size)
+{
+	size_t n = snprintf(buf, size, "[");
+
+	xSemaphoreTake(streamMutex, portMAX_DELAY);
+
+		for (uint8_t i = 0; i < STREAM_MAX_CLIENTS && n < size; i++)
+		{
+			const stream_client_t& c = streamClients[i];
+			if (!c.bUsed) continue;
+
+			// entries that do not fit are left out whole, the array stays valid
+			int len = snprintf(buf + n, size - n, "%s{\"name\":\"%s\",\"latency_ms\":%u,\"target_ms\":%u,\"send_us\":%u,\"skip\":%u,\"sent\":%u,\"skipped\":%u}",
+			                   n > 1 ? "," : "", c.name, c.latencyUs / 1000, c.targetUs / 1000, c.sendUs, c.skip, c.sent, c.skipped);
+			if (len < 0 || n + len + 2 > size) {
+				buf[n] = '\0';
+				break;
+			}
+
+			n += len;
+		}
+
+	xSemaphoreGive(streamMutex);
+
+	snprintf(buf + n, size - n, "]");
+}
+
+
+int stream_rate_quality_offset()
+{
+	return streamQualityOffset;
+}
@@ -0,0 +1,98 @@
+#ifndef _HTTPD_STREAM_H_
+#define _HTTPD_STREAM_H_
+
+
+#include "esp_http_server.h"
+#include "sdkconfig.h"
+
+
+// Send path of multipart streams
+//
+// Boundary, part headers and payload of a frame are gathered into full TCP segments
+// in an internal RAM bounce buffer and written to the socket without chunked encoding,
+// lwIP then never copies from PSRAM and every segment but the last of a frame is full.
+// ?sg=0 falls back to one httpd_resp_send_chunk per piece for comparison
+
+// Bounce buffer, a multiple of the TCP MSS
+#define STREAM_SEGMENTS			2
+#define STREAM_BOUNCE_SIZE		(STREAM_SEGMENTS * CONFIG_LWIP_TCP_MSS)
+
+typedef struct {
+	httpd_req_t* req;
+	bool         bCoalesce;
+	uint8_t*     bounce;		// internal RAM, NULL in chunked mode
+	size_t       len;			// bytes staged in bounce
+
+	// optional trace of the current frame, see stream_frame_trace
+	uint8_t      tracePid;		// 0 when not traced
+	uint8_t      traceLane;
+	uint32_t     traceSeq;
+	int64_t      traceCaptureUs;
+	int64_t      firstByteUs;
+
+	size_t       frameBytes;
+	int64_t      frameSendUs;	// time spent in socket writes for the current frame
+	uint32_t     lastSendUs;	// same for the previous frame
+} stream_writer_t;
+
+// Last per-frame send time and smoothed throughput over all streams
+extern uint32_t stream_send_us;
+extern uint32_t stream_send_kBps;
+
+// Starts the response, query: sg=1 coalesced send path, nodelay=1 disables Nagle
+// bCoalesce- false forces chunked mode, e.g. for single shot responses with extra headers
+// headers  - extra name, value pairs ending with NULL, valid until the first write
+esp_err_t stream_begin(stream_writer_t* w, httpd_req_t* req, const char* contentType, bool bCoalesce = true,
+                       const char* const* headers = NULL);
+
+esp_err_t stream_write(stream_writer_t* w, const void* data, size_t len);
+
+// Traces the next frame: "send" from its first to its last byte and "frame" from capture
+// to the last byte are recorded by stream_frame_end on the given lane
+void      stream_frame_trace(stream_writer_t* w, uint8_t pid, uint8_t lane, uint32_t seq, int64_t captureUs);
+
+// Pushes what is staged out, call once per frame
+esp_err_t stream_frame_end(stream_writer_t* w);
+
+// Pushes what is staged out and ends a chunked response, for downloads that are not
+// frame streams and stay out of the send statistics
+esp_err_t stream_finish(stream_writer_t* w);
+
+void      stream_end(stream_writer_t* w);
+
+
+// Per client rate control of camera streams
+//
+// Latency is measured from capture to the last byte handed to the socket, lwIP has no
+// query for unsent bytes so a client's backlog shows as send time blocking on a full window.
+// Above the target the client skips frames. A single client also pushes sensor JPEG quality
+// down first, it is restored as soon as the latency recovers or a second client joins
+
+#define STREAM_MAX_CLIENTS			4
+#define STREAM_TARGET_LATENCY_MS	200
+#define STREAM_MAX_SKIP				8		// frames skipped per frame sent at most
+#define STREAM_QUALITY_WORST		40		// sensor JPEG quality limit (0-63, higher is smaller)
+#define STREAM_ADJUST_FRAMES		5		// frames between two controller steps
+
+// Creates the client table lock, call once at startup
+void   stream_rate_init();
+
+// Registers a client, query: latency=ms target; returns slot or -1
+int    stream_rate_begin(httpd_req_t* req, const char* name);
+void   stream_rate_end(int slot);
+
+// True if the next frame is to be dropped for this client
+bool   stream_rate_skip(int slot);
+
+// Feeds the controller after a frame was sent
+void   stream_rate_update(int slot, int64_t captureUs, uint32_t sendUs);
+
+// Writes the JSON array of stream clients, size STREAM_RATE_STATUS_SIZE fits all of them
+#define STREAM_RATE_STATUS_SIZE		(2 + STREAM_MAX_CLIENTS * 160)
+
+void   stream_rate_status(char* buf, size_t size);
+
+// Sensor JPEG quality steps currently taken away by the controller
+int    stream_rate_quality_offset();
+
+#endif
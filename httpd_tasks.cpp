@@ -0,0 +1,240 @@
+
+#include "httpd_tasks.h"
+#include "sdkconfig.h"
+#include "esp32-hal-log.h"
+#include "esp32-hal-psram.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+typedef struct {
+	uint32_t     total;				// run time clock when taken
+	uint8_t      count;
+	TaskHandle_t handle[TASKS_MAX];
+	uint32_t     runtime[TASKS_MAX];
+} tasks_sample_t;
+
+// ring of the sampler task, PSRAM
+static tasks_sample_t*   tasksRing    = NULL;
+static uint32_t          tasksSamples = 0;		// samples taken
+static SemaphoreHandle_t tasksMutex   = NULL;
+static TaskHandle_t      tasksSampler = NULL;
+
+
+static void tasks_sample(tasks_sample_t* s, TaskStatus_t* status, UBaseType_t* n)
+{
+	*n = uxTaskGetSystemState(status, TASKS_MAX, &s->total);
+
+	s->count = (uint8_t)*n;
+	for (UBaseType_t i = 0; i < *n; i++)
+	{
+		s->handle[i]  = status[i].xHandle;
+		s->runtime[i] = status[i].ulRunTimeCounter;
+	}
+}
+
+
+static void tasks_sampler(void* arg)
+{
+	TaskStatus_t* status = (TaskStatus_t*)ps_malloc(TASKS_MAX * sizeof(TaskStatus_t));
+
+	while (status)
+	{
+		tasks_sample_t s;
+		UBaseType_t    n;
+		tasks_sample(&s, status, &n);
+
+		xSemaphoreTake(tasksMutex, portMAX_DELAY);
+			tasksRing[tasksSamples % TASKS_WINDOW_SAMPLES] = s;
+			tasksSamples++;
+		xSemaphoreGive(tasksMutex);
+
+		vTaskDelay(pdMS_TO_TICKS(TASKS_SAMPLE_MS));
+	}
+
+	vTaskDelete(NULL);
+}
+
+
+void tasks_init()
+{
+	if (tasksMutex) return;
+
+	tasksRing = (tasks_sample_t*)ps_calloc(TASKS_WINDOW_SAMPLES, sizeof(tasks_sample_t));
+	if (!tasksRing) {
+		log_e("Task sample ring allocation failed");
+		return;
+	}
+
+	tasksMutex = xSemaphoreCreateMutex();
+}
+
+
+// Starts the sampler with the first request, requests run on several sender tasks
+static bool tasks_sampler_start()
+{
+	if (!tasksMutex) return false;
+
+	bool bOk = true;
+
+	xSemaphoreTake(tasksMutex, portMAX_DELAY);
+		if (!tasksSampler)
+			bOk = xTaskCreatePinnedToCoreWithCaps(tasks_sampler, "tasks_sampler", 3072, NULL, 1, &tasksSampler,
+			                                      tskNO_AFFINITY, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT) == pdPASS;
+	xSemaphoreGive(tasksMutex);
+
+	return bOk;
+}
+
+
+// Oldest sample of the window, false if the sampler has not run long enough
+static bool tasks_window_start(tasks_sample_t* s)
+{
+	bool bOk = false;
+
+	xSemaphoreTake(tasksMutex, portMAX_DELAY);
+		if (tasksSamples >= 2)
+		{
+			uint32_t oldest = (tasksSamples > TASKS_WINDOW_SAMPLES) ? tasksSamples - TASKS_WINDOW_SAMPLES : 0;
+			*s  = tasksRing[oldest % TASKS_WINDOW_SAMPLES];
+			bOk = true;
+		}
+	xSemaphoreGive(tasksMutex);
+
+	return bOk;
+}
+
+
+static const char* tasks_state(eTaskState state)
+{
+	switch (state)
+	{
+		case eRunning:   return "running";
+		case eReady:     return "ready";
+		case eBlocked:   return "blocked";
+		case eSuspended: return "suspended";
+		case eDeleted:   return "deleted";
+		default:         return "invalid";
+	}
+}
+
+
+// Percent of one core spent in the task between the two samples
+static float tasks_cpu(const tasks_sample_t* from, const TaskStatus_t& t, uint32_t elapsed)
+{
+	for (uint8_t i = 0; i < from->count; i++)
+		if (from->handle[i] == t.xHandle)
+			return elapsed ? (uint32_t)(t.ulRunTimeCounter - from->runtime[i]) * 100.0f / elapsed : 0.0f;
+
+	// created inside the window
+	return elapsed ? t.ulRunTimeCounter * 100.0f / elapsed : 0.0f;
+}
+
+
+// GET /tasks
+// GET /tasks?profile=N
+esp_err_t tasks_handler(httpd_req_t *req)
+{
+	int profileS = 0;
+
+	char query[32];
+	char value[8];
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		httpd_query_key_value(query, "profile", value, sizeof(value)) == ESP_OK)
+	{
+		profileS = atoi(value);
+		if (profileS < 1) profileS = 1;
+		if (profileS > TASKS_PROFILE_MAX_S) profileS = TASKS_PROFILE_MAX_S;
+	}
+
+	if (!tasks_sampler_start())
+		return httpd_resp_send_500(req);
+
+	TaskStatus_t*   status = (TaskStatus_t*)ps_malloc(TASKS_MAX * sizeof(TaskStatus_t));
+	tasks_sample_t* from   = (tasks_sample_t*)ps_malloc(sizeof(tasks_sample_t));
+	tasks_sample_t* to     = (tasks_sample_t*)ps_malloc(sizeof(tasks_sample_t));
+	char*           json   = (char*)ps_malloc(256 + TASKS_MAX * 160);
+	if (!status || !from || !to || !json)
+	{
+		free(status); free(from); free(to); free(json);
+		return httpd_resp_send_500(req);
+	}
+
+	UBaseType_t n;
+
+	// the window of the sampler, or a fresh measurement of the requested length
+	if (profileS || !tasks_window_start(from))
+	{
+		if (!profileS) profileS = 1;
+
+		tasks_sample(from, status, &n);
+		vTaskDelay(pdMS_TO_TICKS(profileS * 1000));
+	}
+
+	tasks_sample(to, status, &n);
+
+	uint32_t elapsed = to->total - from->total;
+
+	char *p = json;
+	p += sprintf(p, "{\"window_ms\":%u,\"profile\":%s,\"cores\":[", elapsed / 1000, profileS ? "true" : "false");
+
+	// core load is what its idle task did not get
+	for (BaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+	{
+		TaskHandle_t idle = xTaskGetIdleTaskHandleForCore(core);
+
+		float idlePct = 100.0f;
+		for (UBaseType_t i = 0; i < n; i++)
+			if (status[i].xHandle == idle) idlePct = tasks_cpu(from, status[i], elapsed);
+
+		p += sprintf(p, "%s{\"core\":%d,\"load\":%.1f}", core ? "," : "", core, 100.0f - idlePct);
+	}
+
+	p += sprintf(p, "],\"tasks\":[");
+
+	for (UBaseType_t i = 0; i < n; i++)
+	{
+		const TaskStatus_t& t = status[i];
+
+		int core = (t.xCoreID == tskNO_AFFINITY) ? -1 : (int)t.xCoreID;
+
+		p += sprintf(p, "%s{\"name\":\"%s\",\"core\":%d,\"prio\":%u,\"state\":\"%s\",\"cpu\":%.1f,\"stack_free\":%u}",
+		             i ? "," : "", t.pcTaskName, core, t.uxCurrentPriority, tasks_state(t.eCurrentState),
+		             tasks_cpu(from, t, elapsed), (uint32_t)t.usStackHighWaterMark);
+	}
+
+	p += sprintf(p, "]}");
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+	esp_err_t res = httpd_resp_send(req, json, p - json);
+
+	free(status); free(from); free(to); free(json);
+
+	return res;
+}
+
+#else
+
+void tasks_init()
+{
+}
+
+
+esp_err_t tasks_handler(httpd_req_t *req)
+{
+	httpd_resp_set_status(req, "501 Not Implemented");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+	return httpd_resp_sendstr(req, "FreeRTOS run time stats are not enabled in this build");
+}
+
+#endif
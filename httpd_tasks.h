@@ -0,0 +1,26 @@
+#ifndef _HTTPD_TASKS_H_
+#define _HTTPD_TASKS_H_
+
+
+#include "esp_http_server.h"
+
+
+// GET /tasks, FreeRTOS task profiler
+//
+// CPU share of every task over a sliding window, core affinity, priority and stack
+// high-water mark (bytes never touched, i.e. what a stack can be shrunk by).
+// A sampler task records run time counters once a second after the first request,
+// ?profile=N measures the next N seconds instead. Runs on an async sender task.
+// Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+#define TASKS_MAX				40		// tasks tracked
+#define TASKS_WINDOW_SAMPLES	10		// sliding window in sampler periods
+#define TASKS_SAMPLE_MS			1000
+#define TASKS_PROFILE_MAX_S		60
+
+// Allocates the sample ring, call once at startup
+void      tasks_init();
+
+esp_err_t tasks_handler(httpd_req_t *req);
+
+#endif
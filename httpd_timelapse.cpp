@@ -0,0 +1,582 @@
+
+#include "httpd_timelapse.h"
+#include "httpd_recorder.h"
+#include "httpd_capture_stream.h"
+#include "frame_hub.h"
+#include "httpd_stream.h"
+#include "esp32-hal-log.h"
+#include "esp32-hal-psram.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "SPIFFS.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+
+#define TIMELAPSE_INDEX_MAX		(TIMELAPSE_SEGMENT_BYTES / (TIMELAPSE_BATCH_FRAMES * sizeof(recorder_record_t)) + 1)
+#define TIMELAPSE_CLOCK_VALID	1577836800		// 2020-01-01, anything earlier is time since boot
+
+typedef struct {
+	timelapse_block_t blocks[TIMELAPSE_INDEX_MAX];
+	uint16_t          count;
+	uint32_t          bytes;
+} timelapse_segment_t;
+
+static const char* tlLog[2] = { "/tl0.log", "/tl1.log" };
+static const char* tlIdx[2] = { "/tl0.idx", "/tl1.idx" };
+
+static timelapse_segment_t tlSeg[2];
+static uint8_t             tlCur       = 0;
+static uint32_t            tlNextBlock = 0;
+
+// records waiting for the next append, PSRAM
+static recorder_record_t*  tlBatch      = NULL;
+static uint8_t             tlBatchCount = 0;
+static uint32_t            tlBatchTime  = 0;
+
+static volatile int        tlInterval = 0;
+static uint32_t            tlCaptured = 0;
+static TaskHandle_t        tlTask     = NULL;
+static SemaphoreHandle_t   tlMutex    = NULL;	// segments, index and batch
+
+
+static uint32_t timelapse_block_end(const timelapse_block_t& b)
+{
+	return b.offset + b.count * sizeof(recorder_record_t);
+}
+
+
+// Cuts the log back to bytes, FS has no truncate so the indexed part is copied
+// through the batch buffer into a new file
+static bool timelapse_truncate_log(uint8_t s, uint32_t bytes)
+{
+	static const char* tmp = "/tl.tmp";
+
+	File src = SPIFFS.open(tlLog[s], "r");
+	File dst = SPIFFS.open(tmp, "w");
+
+	bool bOk = src && dst;
+	for (uint32_t done = 0; bOk && done < bytes; )
+	{
+		size_t len = bytes - done;
+		if (len > TIMELAPSE_BATCH_FRAMES * sizeof(recorder_record_t)) len = TIMELAPSE_BATCH_FRAMES * sizeof(recorder_record_t);
+
+		bOk = src.read((uint8_t*)tlBatch, len) == len && dst.write((const uint8_t*)tlBatch, len) == len;
+		done += len;
+	}
+
+	if (src) src.close();
+	if (dst) dst.close();
+
+	bOk = bOk && SPIFFS.remove(tlLog[s]) && SPIFFS.rename(tmp, tlLog[s]);
+	if (!bOk) SPIFFS.remove(tmp);
+
+	return bOk;
+}
+
+
+// Loads the index and brings it in line with the log: batches missing from the log
+// are dropped from the index, a log tail no batch points to (index append failed or
+// power lost in between) is cut off
+static void timelapse_load_segment(uint8_t s)
+{
+	timelapse_segment_t& seg = tlSeg[s];
+	memset(&seg, 0, sizeof(seg));
+
+	File idx = SPIFFS.open(tlIdx[s], "r");
+	if (!idx) return;
+
+	while (seg.count < TIMELAPSE_INDEX_MAX &&
+	       idx.read((uint8_t*)&seg.blocks[seg.count], sizeof(timelapse_block_t)) == sizeof(timelapse_block_t))
+	{
+		seg.count++;
+	}
+	idx.close();
+
+	File log = SPIFFS.open(tlLog[s], "r");
+	uint32_t logBytes = log ? log.size() : 0;
+	if (log) log.close();
+
+	uint16_t count = seg.count;
+	while (seg.count && timelapse_block_end(seg.blocks[seg.count - 1]) > logBytes)
+		seg.count--;
+
+	if (seg.count < count)
+	{
+		log_e("Time-lapse %s: %u batches missing from the log", tlIdx[s], count - seg.count);
+
+		idx = SPIFFS.open(tlIdx[s], "w");
+		if (idx) {
+			idx.write((const uint8_t*)seg.blocks, seg.count * sizeof(timelapse_block_t));
+			idx.close();
+		}
+	}
+
+	if (seg.count)
+	{
+		const timelapse_block_t& last = seg.blocks[seg.count - 1];
+		seg.bytes = timelapse_block_end(last);
+
+		if (last.block >= tlNextBlock) tlNextBlock = last.block + 1;
+	}
+
+	if (logBytes > seg.bytes)
+	{
+		log_e("Time-lapse %s: cutting %u orphaned bytes", tlLog[s], logBytes - seg.bytes);
+
+		// offsets come from the log size, a tail that cannot be cut only wastes space
+		if (!timelapse_truncate_log(s, seg.bytes))
+			seg.bytes = logBytes;
+	}
+}
+
+
+// Appends the batch to the current segment, called holding tlMutex
+static void timelapse_flush()
+{
+	if (!tlBatchCount) return;
+
+	size_t len = tlBatchCount * sizeof(recorder_record_t);
+
+	timelapse_segment_t* seg = &tlSeg[tlCur];
+	if (seg->bytes + len > TIMELAPSE_SEGMENT_BYTES || seg->count == TIMELAPSE_INDEX_MAX)
+	{
+		// the other segment holds the oldest records, it is reused
+		tlCur ^= 1;
+		SPIFFS.remove(tlLog[tlCur]);
+		SPIFFS.remove(tlIdx[tlCur]);
+
+		seg = &tlSeg[tlCur];
+		memset(seg, 0, sizeof(*seg));
+	}
+
+	int64_t start = esp_timer_get_time();
+
+	// the batch lands at the end of the file, whatever the index says about it
+	File log = SPIFFS.open(tlLog[tlCur], "a");
+	uint32_t offset  = log ? log.size() : seg->bytes;
+	size_t   written = log ? log.write((const uint8_t*)tlBatch, len) : 0;
+	if (log) log.close();
+
+	if (offset != seg->bytes)
+		log_e("Time-lapse %s is %u bytes, %u indexed", tlLog[tlCur], offset, seg->bytes);
+
+	timelapse_block_t block = {};
+	block.time    = tlBatchTime;
+	block.block   = tlNextBlock;
+	block.firstUs = tlBatch[0].env.timestampUs;
+	block.offset  = offset;
+	block.count   = tlBatchCount;
+
+	tlBatchCount = 0;
+
+	if (written != len)
+	{
+		// the segment tail is unusable, start the next batch in the other segment
+		log_e("Time-lapse append failed: %u of %u bytes", written, len);
+		seg->bytes = TIMELAPSE_SEGMENT_BYTES;
+		return;
+	}
+
+	File idx = SPIFFS.open(tlIdx[tlCur], "a");
+	if (!idx || idx.write((const uint8_t*)&block, sizeof(block)) != sizeof(block)) {
+		log_e("Time-lapse index append failed");
+		if (idx) idx.close();
+		seg->bytes = TIMELAPSE_SEGMENT_BYTES;
+		return;
+	}
+	idx.close();
+
+	tlNextBlock++;
+	seg->blocks[seg->count++] = block;
+	seg->bytes = offset + len;
+
+	log_i("Time-lapse: %u frames appended to %s in %ums", block.count, tlLog[tlCur],
+	      (uint32_t)((esp_timer_get_time() - start) / 1000));
+}
+
+
+static void timelapse_capture()
+{
+	int hub = hub_subscribe(HUB_SRC_MLX, "timelapse");
+	if (hub < 0) return;
+
+	hub_frame_t* f = hub_get(hub, pdMS_TO_TICKS(5000));
+
+	if (f && f->mlx.centiKelvin)
+	{
+		xSemaphoreTake(tlMutex, portMAX_DELAY);
+
+			recorder_record_t& r = tlBatch[tlBatchCount];
+
+			frame_envelope_mlx(&r.env, f->mlx, MLX_FMT_I16, 0, sizeof(r.ck));
+			memcpy(r.ck, f->mlx.centiKelvin, sizeof(r.ck));
+
+			if (tlBatchCount++ == 0)
+				tlBatchTime = (uint32_t)time(NULL);
+
+			tlCaptured++;
+
+			if (tlBatchCount == TIMELAPSE_BATCH_FRAMES)
+				timelapse_flush();
+
+		xSemaphoreGive(tlMutex);
+	}
+	else
+		log_e("Time-lapse frame timeout");
+
+	hub_release(f);
+	hub_unsubscribe(hub);
+}
+
+
+static void timelapse_task(void* arg)
+{
+	int64_t nextUs = 0;
+
+	while (true)
+	{
+		int interval = tlInterval;
+
+		if (interval <= 0)
+		{
+			// stopped, nothing stays behind in RAM
+			xSemaphoreTake(tlMutex, portMAX_DELAY);
+				timelapse_flush();
+			xSemaphoreGive(tlMutex);
+
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			nextUs = 0;
+			continue;
+		}
+
+		int64_t now = esp_timer_get_time();
+		if (nextUs && now < nextUs)
+		{
+			// an interval change wakes the task early
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((nextUs - now) / 1000 + 1));
+			continue;
+		}
+
+		nextUs = (nextUs ? nextUs : now) + (int64_t)interval * 1000000;
+		if (nextUs < now) nextUs = now + (int64_t)interval * 1000000;
+
+		timelapse_capture();
+	}
+}
+
+
+void timelapse_init()
+{
+	if (tlTask) return;
+
+	tlMutex = xSemaphoreCreateMutex();
+	tlBatch = (recorder_record_t*)ps_malloc(TIMELAPSE_BATCH_FRAMES * sizeof(recorder_record_t));
+	if (!tlMutex || !tlBatch) {
+		log_e("Time-lapse allocation failed");
+		return;
+	}
+
+	timelapse_load_segment(0);
+	timelapse_load_segment(1);
+
+	// the segment holding the newest batch is the current one
+	if (tlSeg[1].count && (!tlSeg[0].count || tlSeg[1].blocks[tlSeg[1].count - 1].block > tlSeg[0].blocks[tlSeg[0].count - 1].block))
+		tlCur = 1;
+
+	log_i("Time-lapse log: %u + %u batches", tlSeg[0].count, tlSeg[1].count);
+
+	// SPIFFS disables the cache while writing, the stack must stay in internal RAM
+	if (xTaskCreatePinnedToCore(timelapse_task, "timelapse", 4096, NULL, 2, &tlTask, tskNO_AFFINITY) != pdPASS)
+		log_e("Time-lapse task creation failed");
+}
+
+
+int timelapse_set_interval(int seconds)
+{
+	if (!tlTask) return -1;
+
+	tlInterval = seconds;
+	xTaskNotifyGive(tlTask);
+
+	return 0;
+}
+
+
+int timelapse_get_interval()
+{
+	return tlInterval;
+}
+
+
+static uint32_t timelapse_record_time(const timelapse_block_t& b, const recorder_record_t& r)
+{
+	return b.time + (uint32_t)((r.env.timestampUs - b.firstUs) / 1000000);
+}
+
+
+// Sends the records of [from, to] found in one batch
+static esp_err_t timelapse_send_block(stream_writer_t* sw, const timelapse_block_t& b, const recorder_record_t* records,
+                                      uint32_t from, uint32_t to, uint32_t* sent)
+{
+	uint16_t i = 0;
+	while (i < b.count)
+	{
+		// contiguous run inside the range
+		while (i < b.count && timelapse_record_time(b, records[i]) < from) i++;
+
+		uint16_t j = i;
+		while (j < b.count && timelapse_record_time(b, records[j]) <= to) j++;
+
+		if (j > i)
+		{
+			esp_err_t res = stream_write(sw, &records[i], (j - i) * sizeof(recorder_record_t));
+			if (res != ESP_OK) return res;
+
+			*sent += j - i;
+		}
+
+		if (j < b.count) break;		// past the range
+		i = j;
+	}
+
+	return ESP_OK;
+}
+
+
+// Snapshot of what an export reads, taken under tlMutex
+typedef struct {
+	timelapse_segment_t seg[2];		// older segment first
+	uint8_t             file[2];	// log file of each
+	timelapse_block_t   pending;	// batch not yet on flash
+	recorder_record_t   batch[TIMELAPSE_BATCH_FRAMES];
+} timelapse_snapshot_t;
+
+
+static esp_err_t timelapse_stream(httpd_req_t *req, uint32_t from, uint32_t to)
+{
+	timelapse_snapshot_t* snap = (timelapse_snapshot_t*)ps_malloc(sizeof(timelapse_snapshot_t));
+	recorder_record_t*    buf  = (recorder_record_t*)ps_malloc(TIMELAPSE_BATCH_FRAMES * sizeof(recorder_record_t));
+	if (!snap || !buf) {
+		free(snap);
+		free(buf);
+		return httpd_resp_send_500(req);
+	}
+
+	// the capture task keeps appending meanwhile, flash is read without the lock
+	xSemaphoreTake(tlMutex, portMAX_DELAY);
+
+		for (uint8_t k = 0; k < 2; k++) {
+			snap->file[k] = k ? tlCur : tlCur ^ 1;
+			snap->seg[k]  = tlSeg[snap->file[k]];
+		}
+
+		memset(&snap->pending, 0, sizeof(snap->pending));
+		if (tlBatchCount)
+		{
+			snap->pending.time    = tlBatchTime;
+			snap->pending.firstUs = tlBatch[0].env.timestampUs;
+			snap->pending.count   = tlBatchCount;
+			memcpy(snap->batch, tlBatch, tlBatchCount * sizeof(recorder_record_t));
+		}
+
+	xSemaphoreGive(tlMutex);
+
+	const char* headers[] = { "Content-Disposition", "attachment; filename=\"timelapse.mlxr\"", NULL };
+
+	// records are read into PSRAM, they go out through the internal RAM bounce buffer
+	stream_writer_t sw;
+	esp_err_t res  = stream_begin(&sw, req, RECORDER_CONTENT_TYPE, true, headers);
+	uint32_t  sent = 0;
+
+	for (uint8_t k = 0; k < 2 && res == ESP_OK; k++)
+	{
+		const timelapse_segment_t& seg = snap->seg[k];
+		if (!seg.count) continue;
+
+		const char* name = tlLog[snap->file[k]];
+
+		File log = SPIFFS.open(name, "r");
+		if (!log) continue;
+
+		for (uint16_t n = 0; n < seg.count && res == ESP_OK; n++)
+		{
+			const timelapse_block_t& b = seg.blocks[n];
+
+			// the index alone rules out batches, only those overlapping the range are read
+			if (b.time > to) break;
+			if (n + 1 < seg.count && seg.blocks[n + 1].time < from) continue;
+
+			size_t len = b.count * sizeof(recorder_record_t);
+			if (!log.seek(b.offset) || log.read((uint8_t*)buf, len) != len) {
+				log_e("Time-lapse read failed in %s", name);
+				break;
+			}
+
+			// the segment was recycled since the snapshot
+			if (buf[0].env.magic != FRAME_ENVELOPE_MAGIC || buf[0].env.timestampUs != b.firstUs) {
+				log_e("Time-lapse %s was rewritten during the export", name);
+				break;
+			}
+
+			res = timelapse_send_block(&sw, b, buf, from, to, &sent);
+		}
+
+		log.close();
+	}
+
+	if (res == ESP_OK && snap->pending.count)
+		res = timelapse_send_block(&sw, snap->pending, snap->batch, from, to, &sent);
+
+	free(buf);
+	free(snap);
+
+	if (res == ESP_OK)
+		res = stream_finish(&sw);
+
+	stream_end(&sw);
+
+	log_i("Time-lapse: %u frames sent", sent);
+
+	return res;
+}
+
+
+typedef struct {
+	httpd_req_t* req;		// async copy, owned by the export task
+	uint32_t     from;
+	uint32_t     to;
+} timelapse_export_t;
+
+static volatile bool tlExporting = false;
+
+
+// Sends one export off the server task, flash reads need an internal RAM stack
+// which the httpd_async senders do not have
+static void timelapse_export_task(void* arg)
+{
+	timelapse_export_t* job = (timelapse_export_t*)arg;
+
+	esp_err_t res = timelapse_stream(job->req, job->from, job->to);
+
+	// as a synchronous handler returning an error would, the socket is closed
+	if (res != ESP_OK)
+		httpd_sess_trigger_close(job->req->handle, httpd_req_to_sockfd(job->req));
+
+	httpd_req_async_handler_complete(job->req);
+
+	free(job);
+	tlExporting = false;
+
+	vTaskDelete(NULL);
+}
+
+
+static esp_err_t timelapse_export(httpd_req_t *req, uint32_t from, uint32_t to)
+{
+	// one export at a time, each holds an internal RAM stack
+	if (tlExporting)
+	{
+		httpd_resp_set_status(req, "503 Service Unavailable");
+		httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+		return httpd_resp_send(req, "Time-lapse export running", HTTPD_RESP_USE_STRLEN);
+	}
+
+	timelapse_export_t* job = (timelapse_export_t*)malloc(sizeof(timelapse_export_t));
+	if (!job || httpd_req_async_handler_begin(req, &job->req) != ESP_OK) {
+		free(job);
+		return httpd_resp_send_500(req);
+	}
+
+	job->from = from;
+	job->to   = to;
+
+	tlExporting = true;
+
+	if (xTaskCreatePinnedToCore(timelapse_export_task, "tl_export", 4096, job, 2, NULL, tskNO_AFFINITY) != pdPASS)
+	{
+		log_e("Time-lapse export task creation failed");
+		tlExporting = false;
+
+		httpd_resp_send_500(job->req);
+		httpd_req_async_handler_complete(job->req);
+		free(job);
+	}
+
+	return ESP_OK;
+}
+
+
+static esp_err_t timelapse_status(httpd_req_t *req)
+{
+	char json[384];
+	char *p = json;
+
+	xSemaphoreTake(tlMutex, portMAX_DELAY);
+
+		p += sprintf(p, "{\"interval\":%d,\"clock_set\":%s,\"captured\":%u,\"pending\":%u,\"segments\":[",
+		             tlInterval, time(NULL) >= TIMELAPSE_CLOCK_VALID ? "true" : "false", tlCaptured, tlBatchCount);
+
+		for (uint8_t k = 0; k < 2; k++)
+		{
+			uint8_t s = k ? tlCur : tlCur ^ 1;
+			const timelapse_segment_t& seg = tlSeg[s];
+
+			p += sprintf(p, "%s{\"file\":\"%s\",\"batches\":%u,\"bytes\":%u,\"from\":%u,\"to\":%u}", k ? "," : "",
+			             tlLog[s], seg.count, seg.bytes,
+			             seg.count ? seg.blocks[0].time : 0, seg.count ? seg.blocks[seg.count - 1].time : 0);
+		}
+
+	xSemaphoreGive(tlMutex);
+
+	p += sprintf(p, "]}");
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+	return httpd_resp_send(req, json, p - json);
+}
+
+
+// GET /timelapse
+esp_err_t timelapse_handler(httpd_req_t *req)
+{
+	if (!tlTask)
+		return httpd_resp_send_500(req);
+
+	uint32_t from = 0;
+	uint32_t to   = UINT32_MAX;
+	bool     bRange = false;
+
+	char query[96];
+	char value[16];
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+	{
+		if (httpd_query_key_value(query, "now", value, sizeof(value)) == ESP_OK && time(NULL) < TIMELAPSE_CLOCK_VALID)
+		{
+			struct timeval tv = { (time_t)strtoul(value, NULL, 10), 0 };
+			if (tv.tv_sec >= TIMELAPSE_CLOCK_VALID) {
+				settimeofday(&tv, NULL);
+				log_i("Wall clock set to %lu", (unsigned long)tv.tv_sec);
+			}
+		}
+
+		if (httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK) {
+			from   = strtoul(value, NULL, 10);
+			bRange = true;
+		}
+
+		if (httpd_query_key_value(query, "to", value, sizeof(value)) == ESP_OK) {
+			to     = strtoul(value, NULL, 10);
+			bRange = true;
+		}
+	}
+
+	return bRange ? timelapse_export(req, from, to) : timelapse_status(req);
+}
@@ -0,0 +1,43 @@
+#ifndef _HTTPD_TIMELAPSE_H_
+#define _HTTPD_TIMELAPSE_H_
+
+
+#include "esp_http_server.h"
+#include <stdint.h>
+
+
+// On-device radiometric time-lapse
+//
+// Every timelapse_interval seconds (settings registry, 0 is off) one thermal frame is
+// taken from the hub as a recorder record (envelope and centi-kelvin plane). Records are
+// batched in PSRAM and appended to a SPIFFS log TIMELAPSE_BATCH_FRAMES at a time, each
+// batch adds one entry to a small index file, the index is kept in RAM as well.
+// Two log segments alternate, the older one is dropped when the current one is full.
+// Time is wall clock once the client set it with ?now=, seconds since boot before that.
+// A batch still in RAM is lost on power loss
+
+#define TIMELAPSE_BATCH_FRAMES		8				// ~12.5kB per flash write
+#define TIMELAPSE_SEGMENT_BYTES		(384 * 1024)	// per segment, two segments
+#define TIMELAPSE_INTERVAL_MAX		86400
+
+typedef struct __attribute__((packed)) {
+	uint32_t time;			// wall clock seconds of the first record
+	uint32_t block;			// batch number across both segments, tells the current segment after a reboot
+	int64_t  firstUs;		// capture time of the first record since boot, maps the others to wall clock
+	uint32_t offset;		// in the segment log
+	uint16_t count;
+	uint16_t reserved;
+} timelapse_block_t;
+
+void     timelapse_init();
+
+int      timelapse_set_interval(int seconds);
+int      timelapse_get_interval();
+
+// GET /timelapse                  state as JSON
+// GET /timelapse?from=&to=        records captured in [from, to] wall clock seconds, either may be omitted
+// ?now=                           sets the wall clock when it was not set yet
+// Range exports run one at a time on a task with an internal RAM stack, flash is not read from PSRAM stacks
+esp_err_t timelapse_handler(httpd_req_t *req);
+
+#endif
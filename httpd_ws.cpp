@@ -0,0 +1,629 @@
+
+#include "httpd_ws.h"
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+
+#include "esp32-hal-log.h"
+#include "esp32-hal-psram.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "httpd_capture_stream.h"
+#include "httpd_settings.h"
+#include "MLX90640_API.h"
+#include "MLX90640_delta.h"
+#include "frame_envelope.h"
+#include "frame_hub.h"
+
+#include <string.h>
+#include <stdio.h>
+
+
+// GET /ws
+//
+// One binary message per frame: frame_envelope_t followed by the payload
+// Text messages from the client form the control channel:
+//   sub mlx [fmt] [raw] [key] [step]   subscribe to thermal frames, arguments as in /stream90640
+//   sub cam                            subscribe to OV2640 JPEG frames
+//   unsub mlx|cam
+//   credit mlx|cam N                   allow N more frames of the source
+//   set <var> <val>                    same as GET /control?var=&val=
+// Every command is answered with "ok <cmd>" or "err <cmd>"
+//
+// Frames are only sent against credits, a client that stops granting them
+// stops receiving without the sender blocking on its socket. Every client has
+// its own sender task: a client still sending the previous frame of a source
+// skips the next ones, counted as dropped, while the others keep receiving
+
+
+typedef enum {
+	WS_SRC_MLX = 0,
+	WS_SRC_CAM,
+	WS_SRC_COUNT
+} ws_source_t;
+
+typedef struct {
+	bool     bSubscribed;
+	int16_t  credits;
+	uint32_t nextSeq;			// next frame of the source this client expects
+	uint32_t dropped;
+	bool     bFirst;
+} ws_sub_t;
+
+// Frame handed from a source task to the sender of one client
+typedef struct {
+	bool             bBusy;		// reserved by the source task until the sender is done with it
+	bool             bReady;	// filled, the sender may send it
+	uint32_t         gen;		// client the message was prepared for
+	int              fd;
+	httpd_handle_t   hd;
+	frame_envelope_t env;
+	const uint8_t*   payload;
+	size_t           len;
+	uint8_t*         buf;		// thermal payload copy, MLX_DELTA_MAX_LEN of a frame
+	hub_frame_t*     frame;		// camera frame referenced while it is sent
+} ws_msg_t;
+
+typedef struct {
+	int            fd;			// -1 if the slot is free
+	httpd_handle_t hd;
+	uint32_t       gen;			// bumped on every reuse, senders drop stale snapshots
+	ws_sub_t       sub[WS_SRC_COUNT];
+
+	uint8_t        fmt;
+	bool           bRaw;
+	uint16_t       key;
+	uint8_t        step;
+	bool           bDeltaReset;
+
+	ws_msg_t       msg[WS_SRC_COUNT];
+	TaskHandle_t   sender;
+} ws_client_t;
+
+static ws_client_t       wsClients[WS_MAX_CLIENTS];
+static SemaphoreHandle_t wsMutex = NULL;
+
+// serializes messages per socket, fragments of two messages must not interleave
+static SemaphoreHandle_t wsSendMutex[WS_MAX_CLIENTS];
+
+// delta coder state lives as long as the slot and is only touched by the thermal source task
+static mlx_delta_state_t* wsDelta = NULL;
+
+// format conversion buffer of the thermal source task
+static uint16_t*          wsScratch = NULL;
+
+static TaskHandle_t wsTask[WS_SRC_COUNT] = { NULL, NULL };
+
+static void ws_sender_task(void* arg);
+
+
+static bool ws_init()
+{
+	if (wsMutex) return true;
+
+	const size_t mlxMsgSize = MLX_DELTA_MAX_LEN(MLX90640_pixelCOUNT) > MLX90640_pixelCOUNT * sizeof(float) ?
+	                          MLX_DELTA_MAX_LEN(MLX90640_pixelCOUNT) : MLX90640_pixelCOUNT * sizeof(float);
+
+	if (!wsDelta)   wsDelta   = (mlx_delta_state_t*)ps_malloc(WS_MAX_CLIENTS * sizeof(mlx_delta_state_t));
+	if (!wsScratch) wsScratch = (uint16_t*)ps_malloc(MLX90640_pixelCOUNT * sizeof(uint16_t));
+	if (!wsDelta || !wsScratch) return false;
+
+	for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++)
+	{
+		ws_client_t& c = wsClients[i];
+
+		if (!c.msg[WS_SRC_MLX].buf)
+			c.msg[WS_SRC_MLX].buf = (uint8_t*)ps_malloc(mlxMsgSize);
+		if (!c.msg[WS_SRC_MLX].buf) return false;
+	}
+
+	for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++)
+	{
+		ws_client_t& c = wsClients[i];
+
+		c.fd  = -1;
+		c.gen = 0;
+
+		char name[16];
+		snprintf(name, sizeof(name), "ws_send%u", i);
+
+		// socket sends only, the stack can live in PSRAM
+		BaseType_t res = xTaskCreatePinnedToCoreWithCaps(ws_sender_task, name, 3072, (void*)(uintptr_t)i, 5,
+		                                                 &c.sender, tskNO_AFFINITY, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+		if (res != pdPASS)
+			res = xTaskCreatePinnedToCore(ws_sender_task, name, 3072, (void*)(uintptr_t)i, 5, &c.sender, tskNO_AFFINITY);
+
+		if (res != pdPASS) {
+			log_e("WS sender task creation failed");
+			return false;
+		}
+
+		wsSendMutex[i] = xSemaphoreCreateMutex();
+	}
+
+	wsMutex = xSemaphoreCreateMutex();
+
+	return true;
+}
+
+
+// Sends envelope and payload as one binary message of two fragments
+static esp_err_t ws_send_frame(uint8_t slot, httpd_handle_t hd, int fd,
+                               const frame_envelope_t* env, const void* payload, size_t len)
+{
+	httpd_ws_frame_t frame = {};
+
+	xSemaphoreTake(wsSendMutex[slot], portMAX_DELAY);
+
+		frame.type       = HTTPD_WS_TYPE_BINARY;
+		frame.fragmented = true;
+		frame.final      = false;
+		frame.payload    = (uint8_t*)env;
+		frame.len        = sizeof(*env);
+
+		esp_err_t res = httpd_ws_send_frame_async(hd, fd, &frame);
+
+		if (res == ESP_OK)
+		{
+			frame.type    = HTTPD_WS_TYPE_CONTINUE;
+			frame.final   = true;
+			frame.payload = (uint8_t*)payload;
+			frame.len     = len;
+
+			res = httpd_ws_send_frame_async(hd, fd, &frame);
+		}
+
+	xSemaphoreGive(wsSendMutex[slot]);
+
+	return res;
+}
+
+
+static esp_err_t ws_send_text(uint8_t slot, httpd_req_t *req, const char* text)
+{
+	httpd_ws_frame_t frame = {};
+	frame.type    = HTTPD_WS_TYPE_TEXT;
+	frame.payload = (uint8_t*)text;
+	frame.len     = strlen(text);
+
+	xSemaphoreTake(wsSendMutex[slot], portMAX_DELAY);
+		esp_err_t res = httpd_ws_send_frame(req, &frame);
+	xSemaphoreGive(wsSendMutex[slot]);
+
+	return res;
+}
+
+
+// Snapshot of a client taken under wsMutex, sending happens without holding it
+typedef struct {
+	uint8_t        slot;
+	uint32_t       gen;
+	int            fd;
+	httpd_handle_t hd;
+	uint32_t       dropped;
+	uint8_t        fmt;
+	bool           bRaw;
+	uint16_t       key;
+	uint8_t        step;
+	bool           bDeltaReset;
+} ws_target_t;
+
+
+// Collects subscribers of src holding credits and an idle sender, seq accounts frames they did not get
+// Every target's message is reserved and must be handed over with ws_post
+static uint8_t ws_collect(ws_source_t src, uint32_t seq, ws_target_t* targets)
+{
+	uint8_t n = 0;
+
+	xSemaphoreTake(wsMutex, portMAX_DELAY);
+
+		for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++)
+		{
+			ws_client_t& c = wsClients[i];
+			ws_sub_t&    s = c.sub[src];
+
+			// still sending the previous frame, the gap is counted as dropped with the next one
+			if (c.fd < 0 || !s.bSubscribed || s.credits <= 0 || c.msg[src].bBusy) continue;
+
+			if (!s.bFirst && seq != s.nextSeq) s.dropped += seq - s.nextSeq;
+			s.nextSeq = seq + 1;
+			s.bFirst  = false;
+			s.credits--;
+
+			c.msg[src].bBusy = true;
+
+			ws_target_t& t = targets[n++];
+			t.slot    = i;
+			t.gen     = c.gen;
+			t.fd      = c.fd;
+			t.hd      = c.hd;
+			t.dropped = s.dropped;
+			t.fmt     = c.fmt;
+			t.bRaw    = c.bRaw;
+			t.key     = c.key;
+			t.step    = c.step;
+			t.bDeltaReset = c.bDeltaReset;
+
+			c.bDeltaReset = false;
+		}
+
+	xSemaphoreGive(wsMutex);
+
+	return n;
+}
+
+
+static bool ws_ready(ws_source_t src)
+{
+	bool bReady = false;
+
+	xSemaphoreTake(wsMutex, portMAX_DELAY);
+		for (uint8_t i = 0; i < WS_MAX_CLIENTS && !bReady; i++)
+			bReady = wsClients[i].fd >= 0 && wsClients[i].sub[src].bSubscribed && wsClients[i].sub[src].credits > 0;
+	xSemaphoreGive(wsMutex);
+
+	return bReady;
+}
+
+
+// Frees the slot of a client whose socket went away
+static void ws_drop(uint8_t slot, uint32_t gen, int fd)
+{
+	xSemaphoreTake(wsMutex, portMAX_DELAY);
+		if (wsClients[slot].gen == gen && wsClients[slot].fd == fd) {
+			log_i("WS client fd %d gone", fd);
+			wsClients[slot].fd = -1;
+			wsClients[slot].gen++;
+		}
+	xSemaphoreGive(wsMutex);
+}
+
+
+// Hands the message reserved by ws_collect to the sender of the client
+// payload must stay valid until the sender is done, msg.buf or frame
+static void ws_post(ws_source_t src, const ws_target_t& t, const frame_envelope_t& env,
+                    const uint8_t* payload, size_t len, hub_frame_t* frame)
+{
+	ws_client_t& c = wsClients[t.slot];
+	ws_msg_t&    m = c.msg[src];
+
+	xSemaphoreTake(wsMutex, portMAX_DELAY);
+		m.gen     = t.gen;
+		m.fd      = t.fd;
+		m.hd      = t.hd;
+		m.env     = env;
+		m.payload = payload;
+		m.len     = len;
+		m.frame   = frame;
+		m.bReady  = true;
+	xSemaphoreGive(wsMutex);
+
+	xTaskNotifyGive(c.sender);
+}
+
+
+// Sends the messages of one client, a slow socket only holds up this task
+static void ws_sender_task(void* arg)
+{
+	uint8_t slot = (uintptr_t)arg;
+
+	ws_client_t& c = wsClients[slot];
+
+	while (true)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		for (uint8_t src = 0; src < WS_SRC_COUNT; src++)
+		{
+			ws_msg_t& m = c.msg[src];
+
+			xSemaphoreTake(wsMutex, portMAX_DELAY);
+				bool bReady   = m.bReady;
+				bool bCurrent = c.gen == m.gen && c.fd == m.fd;	// the slot may have been reused meanwhile
+			xSemaphoreGive(wsMutex);
+
+			if (!bReady) continue;
+
+			if (bCurrent && ws_send_frame(slot, m.hd, m.fd, &m.env, m.payload, m.len) != ESP_OK)
+				ws_drop(slot, m.gen, m.fd);
+
+			hub_release(m.frame);
+
+			xSemaphoreTake(wsMutex, portMAX_DELAY);
+				m.frame  = NULL;
+				m.bReady = false;
+				m.bBusy  = false;
+			xSemaphoreGive(wsMutex);
+		}
+	}
+}
+
+
+// Keeps a hub subscription while any client holds credits for src
+// Returns the next frame or NULL if there is nothing to send yet
+static hub_frame_t* ws_next(ws_source_t src, int& hub)
+{
+	if (!ws_ready(src))
+	{
+		if (hub >= 0) {
+			hub_unsubscribe(hub);
+			hub = -1;
+		}
+
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+		return NULL;
+	}
+
+	if (hub < 0) {
+		hub = hub_subscribe(src == WS_SRC_MLX ? HUB_SRC_MLX : HUB_SRC_CAM, src == WS_SRC_MLX ? "ws_mlx" : "ws_cam");
+		if (hub < 0) {
+			vTaskDelay(pdMS_TO_TICKS(1000));
+			return NULL;
+		}
+	}
+
+	return hub_get(hub, pdMS_TO_TICKS(1000));
+}
+
+
+// Encodes every thermal frame once per client into the client's message buffer,
+// the sensor slot is released before the frames go out
+static void ws_mlx_task(void* arg)
+{
+	ws_target_t targets[WS_MAX_CLIENTS];
+	int         hub = -1;
+
+	while (true)
+	{
+		hub_frame_t* f = ws_next(WS_SRC_MLX, hub);
+		if (!f) continue;
+
+		const mlx_fb_t& fb = f->mlx;
+
+			uint8_t n = fb.values ? ws_collect(WS_SRC_MLX, fb.seq, targets) : 0;
+
+			for (uint8_t i = 0; i < n; i++)
+			{
+				const ws_target_t& t = targets[i];
+
+				uint8_t* buf = wsClients[t.slot].msg[WS_SRC_MLX].buf;
+
+				char   range[24];
+				size_t len = 0;
+				const void* payload = mlx_frame_payload(fb, t.bRaw, t.fmt == MLX_FMT_DELTA ? MLX_FMT_I16 : t.fmt,
+				                                        wsScratch, &len, range, sizeof(range));
+
+				if (t.fmt == MLX_FMT_DELTA)
+				{
+					mlx_delta_state_t& st = wsDelta[t.slot];
+					if (t.bDeltaReset) MLXdelta::init(st, t.key, t.step);
+
+					len = MLXdelta::encode(st, (const uint16_t*)payload, fb.width * fb.height, buf);
+				}
+				else
+					memcpy(buf, payload, len);
+
+				frame_envelope_t env;
+				frame_envelope_mlx(&env, fb, t.fmt, t.dropped, len);
+
+				ws_post(WS_SRC_MLX, t, env, buf, len, NULL);
+			}
+
+		hub_release(f);
+	}
+}
+
+
+// Camera frames are not copied, each client's sender holds a reference while sending
+static void ws_cam_task(void* arg)
+{
+	ws_target_t targets[WS_MAX_CLIENTS];
+	int         hub = -1;
+
+	while (true)
+	{
+		hub_frame_t* f = ws_next(WS_SRC_CAM, hub);
+		if (!f) continue;
+
+		uint8_t n = ws_collect(WS_SRC_CAM, f->seq, targets);
+
+		for (uint8_t i = 0; i < n; i++)
+		{
+			frame_envelope_t env;
+			frame_envelope_cam(&env, f->timestamp, f->seq, targets[i].dropped, f->jpg_len);
+
+			ws_post(WS_SRC_CAM, targets[i], env, f->jpg, f->jpg_len, hub_retain(f));
+		}
+
+		hub_release(f);
+	}
+}
+
+
+static void ws_wake(ws_source_t src)
+{
+	if (!wsTask[src])
+	{
+		BaseType_t res = xTaskCreatePinnedToCore(src == WS_SRC_MLX ? ws_mlx_task : ws_cam_task,
+		                                         src == WS_SRC_MLX ? "ws_mlx" : "ws_cam",
+		                                         4096, NULL, 5, &wsTask[src], 1);
+		if (res != pdPASS) {
+			log_e("WS sender task creation failed");
+			wsTask[src] = NULL;
+		}
+		return;
+	}
+
+	xTaskNotifyGive(wsTask[src]);
+}
+
+
+static int ws_parse_source(const char* name)
+{
+	if (!strcmp(name, "mlx")) return WS_SRC_MLX;
+	if (!strcmp(name, "cam")) return WS_SRC_CAM;
+
+	return -1;
+}
+
+
+// Runs one control channel command of the client in slot, returns true on success
+static bool ws_command(uint8_t slot, char* text)
+{
+	char cmd[8] = {}, arg1[24] = {}, arg2[24] = {};
+	int  raw = 0, key = 16, step = 1;
+
+	int nArgs = sscanf(text, "%7s %23s %23s %d %d %d", cmd, arg1, arg2, &raw, &key, &step);
+	if (nArgs < 2) return false;
+
+	if (!strcmp(cmd, "set"))
+		return nArgs >= 3 && control_set(arg1, arg2) >= 0;
+
+	int src = ws_parse_source(arg1);
+	if (src < 0) return false;
+
+	bool bOk = true;
+
+	xSemaphoreTake(wsMutex, portMAX_DELAY);
+
+		ws_client_t& c = wsClients[slot];
+		ws_sub_t&    s = c.sub[src];
+
+		if (!strcmp(cmd, "sub"))
+		{
+			if (src == WS_SRC_MLX)
+			{
+				int fmt = (nArgs >= 3) ? mlx_fmt_parse(arg2) : MLX_FMT_F32;
+
+				if (fmt < 0 || key < 0 || key > 0xFFFF || step < 1 || step > 255)
+					bOk = false;
+				else {
+					c.fmt  = fmt;
+					c.bRaw = raw;
+					c.key  = key;
+					c.step = step;
+					c.bDeltaReset = true;
+				}
+			}
+
+			if (bOk) {
+				s.bSubscribed = true;
+				s.bFirst      = true;
+				s.dropped     = 0;
+			}
+		}
+		else if (!strcmp(cmd, "unsub"))
+		{
+			s.bSubscribed = false;
+			s.credits     = 0;
+		}
+		else if (!strcmp(cmd, "credit") && nArgs >= 3)
+		{
+			int credits = s.credits + atoi(arg2);
+			s.credits = (credits < 0) ? 0 : (credits > WS_MAX_CREDITS) ? WS_MAX_CREDITS : credits;
+		}
+		else
+			bOk = false;
+
+	xSemaphoreGive(wsMutex);
+
+	if (bOk && (!strcmp(cmd, "sub") || !strcmp(cmd, "credit")))
+		ws_wake((ws_source_t)src);
+
+	return bOk;
+}
+
+
+esp_err_t ws_handler(httpd_req_t *req)
+{
+	if (!ws_init()) return ESP_FAIL;
+
+	int fd = httpd_req_to_sockfd(req);
+
+	// handshake, the socket stays open after the handler returns
+	if (req->method == HTTP_GET)
+	{
+		log_i("GET /ws handshake, fd %d", fd);
+
+		int slot = -1;
+
+		xSemaphoreTake(wsMutex, portMAX_DELAY);
+
+			// reclaim slots of closed sockets, a reused fd replaces its old client
+			for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+				ws_client_t& c = wsClients[i];
+				if (c.fd >= 0 && (c.fd == fd || httpd_ws_get_fd_info(c.hd, c.fd) != HTTPD_WS_CLIENT_WEBSOCKET)) {
+					c.fd = -1;
+					c.gen++;
+				}
+			}
+
+			for (uint8_t i = 0; i < WS_MAX_CLIENTS && slot < 0; i++)
+				if (wsClients[i].fd < 0) slot = i;
+
+			if (slot >= 0) {
+				ws_client_t& c = wsClients[slot];
+				memset(c.sub, 0, sizeof(c.sub));
+				c.fd   = fd;
+				c.hd   = req->handle;
+				c.gen++;
+				c.fmt  = MLX_FMT_F32;
+				c.bRaw = false;
+				c.key  = 16;
+				c.step = 1;
+				c.bDeltaReset = true;
+			}
+
+		xSemaphoreGive(wsMutex);
+
+		if (slot < 0) {
+			log_e("Too many WebSocket clients");
+			return ESP_FAIL;
+		}
+
+		return ESP_OK;
+	}
+
+	int slot = -1;
+	xSemaphoreTake(wsMutex, portMAX_DELAY);
+		for (uint8_t i = 0; i < WS_MAX_CLIENTS && slot < 0; i++)
+			if (wsClients[i].fd == fd) slot = i;
+	xSemaphoreGive(wsMutex);
+
+	if (slot < 0) return ESP_FAIL;
+
+	char text[64];
+
+	httpd_ws_frame_t frame = {};
+	frame.type = HTTPD_WS_TYPE_TEXT;
+
+	// length first, then the payload into the local buffer
+	esp_err_t res = httpd_ws_recv_frame(req, &frame, 0);
+	if (res != ESP_OK) return res;
+
+	if (frame.len >= sizeof(text)) {
+		log_e("WS message too long: %u", frame.len);
+		return ESP_FAIL;
+	}
+
+	frame.payload = (uint8_t*)text;
+	res = httpd_ws_recv_frame(req, &frame, frame.len);
+	if (res != ESP_OK) return res;
+
+	if (frame.type != HTTPD_WS_TYPE_TEXT) return ESP_OK;
+
+	text[frame.len] = '\0';
+	log_d("WS fd %d: %s", fd, text);
+
+	char reply[16];
+	char cmd[8] = {};
+	sscanf(text, "%7s", cmd);
+
+	bool bOk = ws_command(slot, text);
+	snprintf(reply, sizeof(reply), "%s %s", bOk ? "ok" : "err", cmd);
+
+	return ws_send_text(slot, req, reply);
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef _HTTPD_WS_H_
+#define _HTTPD_WS_H_
+
+
+#include "esp_http_server.h"
+#include "sdkconfig.h"
+
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+
+// Number of simultaneously connected WebSocket clients
+#define WS_MAX_CLIENTS		4
+
+// Upper limit of frames a client may have in flight per source
+#define WS_MAX_CREDITS		16
+
+esp_err_t ws_handler(httpd_req_t *req);
+
+#endif
+
+#endif
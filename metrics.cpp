@@ -0,0 +1,148 @@
+
+#include "metrics.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+
+
+// NO-EOI events of the camera driver, only present when cam_hal.c is built from this tree
+extern "C" uint32_t cam_hal_no_eoi_count __attribute__((weak));
+
+typedef struct {
+	const char* name;
+	const char* help;
+	uint32_t    bounds[METRICS_MAX_BOUNDS];		// ascending upper bounds, 0 terminates
+} metric_hist_desc_t;
+
+static const metric_hist_desc_t histDesc[METRIC_HIST_COUNT] = {
+	{ "mlx_i2c_read_microseconds",   "MLX90640 subpage read over I2C",
+	  { 5000, 10000, 20000, 30000, 50000, 75000, 100000, 200000, 500000 } },
+	{ "mlx_calculate_microseconds",  "MLX90640 CalculateTo of a subpage",
+	  { 5000, 10000, 20000, 30000, 50000, 75000, 100000, 200000 } },
+	{ "cam_fb_wait_microseconds",    "esp_camera_fb_get wait",
+	  { 1000, 5000, 10000, 20000, 40000, 60000, 100000, 200000, 500000 } },
+	{ "cam_jpeg_bytes",              "OV2640 JPEG frame size",
+	  { 8192, 16384, 32768, 49152, 65536, 98304, 131072, 196608, 262144 } },
+	{ "stream_send_microseconds",    "Socket writes of one stream frame",
+	  { 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000 } },
+};
+
+static const char* counterDesc[METRIC_COUNTER_COUNT][2] = {
+	{ "cam_frames_total",       "Camera frames captured" },
+	{ "cam_errors_total",       "Camera captures returning no frame" },
+	{ "mlx_frames_total",       "Thermal frames captured" },
+	{ "mlx_i2c_errors_total",   "Thermal frame reads failed on I2C" },
+	{ "hub_drops_total",        "Frames replaced before a subscriber picked them up" },
+	{ "stream_frames_total",    "Frames sent to stream clients" },
+};
+
+typedef struct {
+	uint32_t buckets[METRICS_MAX_BOUNDS + 1];	// per bucket, +Inf last
+	uint32_t sumLo;
+	uint32_t sumHi;								// carry of sumLo
+} metric_hist_data_t;
+
+static metric_hist_data_t histData[METRIC_HIST_COUNT];
+
+uint32_t metricsCounters[METRIC_COUNTER_COUNT];
+
+
+void metrics_observe(metric_hist_t id, uint32_t value)
+{
+	const metric_hist_desc_t& d = histDesc[id];
+	metric_hist_data_t&       h = histData[id];
+
+	uint8_t i = 0;
+	while (i < METRICS_MAX_BOUNDS && d.bounds[i] && value > d.bounds[i]) i++;
+	if (i < METRICS_MAX_BOUNDS && !d.bounds[i]) i = METRICS_MAX_BOUNDS;		// past the last bound
+
+	__atomic_fetch_add(&h.buckets[i], 1, __ATOMIC_RELAXED);
+
+	uint32_t old = __atomic_fetch_add(&h.sumLo, value, __ATOMIC_RELAXED);
+	if (old + value < old)
+		__atomic_fetch_add(&h.sumHi, 1, __ATOMIC_RELAXED);
+}
+
+
+typedef struct {
+	char*  buf;
+	size_t size;
+	size_t len;
+} metrics_out_t;
+
+static void metrics_printf(metrics_out_t* out, const char* fmt, ...)
+{
+	if (out->len >= out->size) return;
+
+	va_list args;
+	va_start(args, fmt);
+		int n = vsnprintf(out->buf + out->len, out->size - out->len, fmt, args);
+	va_end(args);
+
+	if (n > 0)
+		out->len = (out->len + n < out->size) ? out->len + n : out->size - 1;
+}
+
+
+static void metrics_gauge(metrics_out_t* out, const char* name, const char* help, uint32_t value)
+{
+	metrics_printf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %u\n", name, help, name, name, value);
+}
+
+
+size_t metrics_expose(char* buf, size_t size)
+{
+	metrics_out_t out = { buf, size, 0 };
+	if (size) buf[0] = 0;
+
+	for (uint8_t id = 0; id < METRIC_HIST_COUNT; id++)
+	{
+		const metric_hist_desc_t& d = histDesc[id];
+		metric_hist_data_t&       h = histData[id];
+
+		metrics_printf(&out, "# HELP %s %s\n# TYPE %s histogram\n", d.name, d.help, d.name);
+
+		uint32_t cumulative = 0;
+		for (uint8_t i = 0; i < METRICS_MAX_BOUNDS && d.bounds[i]; i++)
+		{
+			cumulative += __atomic_load_n(&h.buckets[i], __ATOMIC_RELAXED);
+			metrics_printf(&out, "%s_bucket{le=\"%u\"} %u\n", d.name, d.bounds[i], cumulative);
+		}
+		cumulative += __atomic_load_n(&h.buckets[METRICS_MAX_BOUNDS], __ATOMIC_RELAXED);
+
+		// retry if a carry landed between the two halves
+		uint32_t hi, lo;
+		do {
+			hi = __atomic_load_n(&h.sumHi, __ATOMIC_RELAXED);
+			lo = __atomic_load_n(&h.sumLo, __ATOMIC_RELAXED);
+		} while (hi != __atomic_load_n(&h.sumHi, __ATOMIC_RELAXED));
+
+		metrics_printf(&out, "%s_bucket{le=\"+Inf\"} %u\n%s_sum %llu\n%s_count %u\n",
+		               d.name, cumulative, d.name, ((uint64_t)hi << 32) | lo, d.name, cumulative);
+	}
+
+	for (uint8_t id = 0; id < METRIC_COUNTER_COUNT; id++)
+	{
+		metrics_printf(&out, "# HELP %s %s\n# TYPE %s counter\n%s %u\n",
+		               counterDesc[id][0], counterDesc[id][1], counterDesc[id][0], counterDesc[id][0],
+		               __atomic_load_n(&metricsCounters[id], __ATOMIC_RELAXED));
+	}
+
+	if (&cam_hal_no_eoi_count)
+	{
+		metrics_printf(&out, "# HELP cam_no_eoi_total JPEG frames dropped by the driver for a missing end marker\n"
+		                     "# TYPE cam_no_eoi_total counter\ncam_no_eoi_total %u\n",
+		               __atomic_load_n(&cam_hal_no_eoi_count, __ATOMIC_RELAXED));
+	}
+
+	metrics_gauge(&out, "heap_internal_free_bytes",    "Free internal RAM",                     heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+	metrics_gauge(&out, "heap_internal_largest_bytes", "Largest free internal RAM block",       heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+	metrics_gauge(&out, "heap_internal_min_bytes",     "Lowest free internal RAM since boot",   heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+	metrics_gauge(&out, "heap_psram_free_bytes",       "Free PSRAM",                            heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+	metrics_gauge(&out, "heap_psram_largest_bytes",    "Largest free PSRAM block",              heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+	metrics_gauge(&out, "uptime_seconds",              "Time since boot",                       (uint32_t)(esp_timer_get_time() / 1000000));
+
+	return out.len;
+}
@@ -0,0 +1,47 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// Fixed bucket histograms and counters of the capture and send paths
+//
+// Updates are relaxed atomic adds on 32 bit words, the hot path never takes a lock.
+// metrics_expose renders everything in the Prometheus text format for GET /metrics
+
+#define METRICS_MAX_BOUNDS		10
+
+typedef enum {
+	METRIC_MLX_READ_US = 0,		// I2C subpage read after data ready
+	METRIC_MLX_CALCULATE_US,	// CalculateTo of a subpage
+	METRIC_CAM_WAIT_US,			// esp_camera_fb_get
+	METRIC_CAM_JPEG_BYTES,		// camera JPEG size
+	METRIC_STREAM_SEND_US,		// socket writes of one stream frame
+	METRIC_HIST_COUNT
+} metric_hist_t;
+
+typedef enum {
+	METRIC_CAM_FRAMES = 0,
+	METRIC_CAM_ERRORS,			// esp_camera_fb_get returned no frame
+	METRIC_MLX_FRAMES,
+	METRIC_MLX_I2C_ERRORS,
+	METRIC_HUB_DROPS,			// frames replaced before a subscriber picked them up
+	METRIC_STREAM_FRAMES,
+	METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+extern uint32_t metricsCounters[METRIC_COUNTER_COUNT];
+
+void   metrics_observe(metric_hist_t id, uint32_t value);
+
+inline void metrics_inc(metric_counter_t id, uint32_t n = 1)
+{
+	__atomic_fetch_add(&metricsCounters[id], n, __ATOMIC_RELAXED);
+}
+
+// Returns bytes written, output is cut at size
+size_t metrics_expose(char* buf, size_t size);
+
+#endif
@@ -2,8 +2,8 @@
 const $ = (id) => document.getElementById(id);
 
 var baseHost         = document.location.origin;
-var streamUrl        = baseHost + ':81';
-var streamOverlayUrl = baseHost + ':82';
+var streamUrl        = baseHost;
+var streamOverlayUrl = baseHost;
 
 
 function fetchUrl(url, cb)
@@ -299,23 +299,46 @@ document.addEventListener('DOMContentLoaded', function (event)
       })
 
 
-    // read initial values
-    fetch(`${baseHost}/status`)
-        .then(function (response) { return response.json(); })
-        .then(function (state) {
-            document
-                .querySelectorAll('.default-action')
-                    .forEach( el => { updateGUIvalue(el, state[el.id], false); } );
+    // read initial values, afterwards only fields changed since the last known status version
+    let statusVersion = 0;
 
-            document
-                .querySelectorAll('.reg-action')
-                    .forEach(el => {
-                        let reg = el.attributes.reg ? parseInt(el.attributes.reg.nodeValue) : 0;
-                        if (reg == 0) { return; }
+    const readStatus = () => {
+        fetch(`${baseHost}/status` + (statusVersion ? `?since=${statusVersion}` : ''))
+            .then(function (response) { return response.json(); })
+            .then(function (state) {
+                statusVersion = state.status_version;
 
-                        updateRegValue(el, state['0x' + reg.toString(16)], false);
-                    })
+                document
+                    .querySelectorAll('.default-action')
+                        .forEach( el => { if (el.id in state) updateGUIvalue(el, state[el.id], false); } );
+
+                document
+                    .querySelectorAll('.reg-action')
+                        .forEach(el => {
+                            let reg = el.attributes.reg ? parseInt(el.attributes.reg.nodeValue) : 0;
+                            if (reg == 0) { return; }
+
+                            const key = '0x' + reg.toString(16);
+                            if (key in state) updateRegValue(el, state[key], false);
+                        })
+            });
+    }
+
+    readStatus();
+    setInterval(readStatus, 5000);     // settings changed by other clients or the stream rate controller
+
+    // live thermal sensor telemetry, taken from frames already read so the I2C bus is not touched
+    if (window.EventSource) {
+        const events = new EventSource(`${baseHost}/events`);
+
+        events.addEventListener('telemetry', (e) => {
+            const t = JSON.parse(e.data);
+            if (t.ta === null) return;
+
+            $('mlxDeviceT').value = t.ta.toFixed(2);
+            $('mlxDeviceV').value = t.vdd.toFixed(2);
         });
+    }
 
 
 
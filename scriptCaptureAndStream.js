@@ -54,7 +54,8 @@ let fMaxYcoord = 0;
 
 
 // width has to be multiple of 4 bytes
-function drawBMPBase64(frameData, width, height, elId)
+// stats - optional [min, minIndex, max, maxIndex, agcMin, agcMax] computed by the device
+function drawBMPBase64(frameData, width, height, elId, stats = null)
 {
     const bpp            = 3;
     const BMP_HEADER_LEN = 54;
@@ -105,7 +106,21 @@ function drawBMPBase64(frameData, width, height, elId)
     let fMin =  Infinity;
     let fMax = -Infinity;
 
-    for (let y=0; y < height; y++) {
+    // colors follow the smoothed device range, tooltips the frame extremes
+    let fRangeMin, fRangeMax;
+
+    if (stats) {
+        fMin = stats[0];
+        fMax = stats[2];
+        fMinXcoord = width-1  - stats[1] % width;
+        fMinYcoord = height-1 - Math.floor(stats[1] / width);
+        fMaxXcoord = width-1  - stats[3] % width;
+        fMaxYcoord = height-1 - Math.floor(stats[3] / width);
+
+        fRangeMin = stats[4];
+        fRangeMax = stats[5];
+    }
+    else for (let y=0; y < height; y++) {
         for (let x=0; x < width; x++)
         {
             let srcInd = y * width + x;
@@ -125,6 +140,11 @@ function drawBMPBase64(frameData, width, height, elId)
 
     frameMinTemp = fMin;
     frameMaxTemp = fMax;
+
+    if (!stats) {
+        fRangeMin = fMin;
+        fRangeMax = fMax;
+    }
     
     let i = 0;
     for (let y=0; y < height; y++)
@@ -133,7 +153,7 @@ function drawBMPBase64(frameData, width, height, elId)
         {
             let srcInd = y * width + (width-1 - x);     // mirror horizontally
 
-            const [r, g, b] = ironbow(floats[srcInd], fMin, fMax);
+            const [r, g, b] = ironbow(floats[srcInd], fRangeMin, fRangeMax);
 
             let indOut = BMP_HEADER_LEN + i*3;
 
@@ -263,10 +283,15 @@ async function fetchMultipartBinary(url)
                     const headers = new TextDecoder().decode(headerBytes);
                     const match = headers.match(/Content-Length:\s*(\d+)/);
                     const contentLength = match ? parseInt(match[1], 10) : null;
+
+                    const matchStats = headers.match(/X-Stats:\s*([^\r\n]+)/);
+                    const stats = matchStats ? matchStats[1].split(',').map(Number) : null;
 				                
                     // Call user function with binary body
-                    if (contentLength == 32*24*4)
-                        drawBMPBase64(bodyBytes, 32, 24, 'overlay-stream');
+                    if (headers.includes('application/x-mlx-pair'))
+                        drawPair(bodyBytes);
+                    else if (contentLength == 32*24*4)
+                        drawBMPBase64(bodyBytes, 32, 24, 'overlay-stream', (stats && stats.length == 6) ? stats : null);
                 }
             }
         }
@@ -280,6 +305,50 @@ async function fetchMultipartBinary(url)
     }
 }
 
+// Thermal frames over the control server WebSocket, one binary message per frame
+// starting with frame_envelope_t; a credit is returned per drawn frame so at most two are in flight.
+// Falls back to the multipart stream if the device has no WebSocket support
+let wsThermal = null;
+
+function startWebSocketStream(fallbackUrl)
+{
+    let bGotFrame = false;
+
+    wsThermal = new WebSocket(baseHost.replace(/^http/, 'ws') + '/ws');
+    wsThermal.binaryType = 'arraybuffer';
+
+    wsThermal.onopen = () => {
+        wsThermal.send('sub mlx f32');
+        wsThermal.send('credit mlx 2');
+    };
+
+    wsThermal.onmessage = (e) => {
+        if (typeof e.data === 'string') return;     // command replies
+
+        const view = new DataView(e.data);
+        if (view.byteLength < 60 || view.getUint32(0, true) != 0x46584C4D) return;
+
+        bGotFrame = true;
+
+        const headerLen = view.getUint8(5);
+        const fMin      = view.getFloat32(40, true);
+        const fMax      = view.getFloat32(44, true);
+        const iMin      = view.getUint16(52, true);
+        const iMax      = view.getUint16(54, true);
+
+        const body = new Uint8Array(e.data, headerLen);
+        if (body.length == 32*24*4)
+            drawBMPBase64(body, 32, 24, 'overlay-stream', [fMin, iMin, fMax, iMax, fMin, fMax]);
+
+        wsThermal.send('credit mlx 1');
+    };
+
+    wsThermal.onclose = () => {
+        if (!bGotFrame && wsThermal) fetchMultipartBinary(fallbackUrl);
+        wsThermal = null;
+    };
+}
+
 async function fetchBinary(url)
 {
     const response = await fetch(url);
@@ -292,6 +361,51 @@ async function fetchBinary(url)
         drawBMPBase64(new Uint8Array(bodyBytes), 32, 24, 'overlay-stream');
 }
 
+// Body of /capture_pair and /stream_pair parts: OV2640 envelope + JPEG, MLX90640 envelope + f32 frame,
+// both captured at nearly the same time so the overlay matches the picture
+let pairImageUrl = null;
+
+function drawPair(bytes)
+{
+    const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+
+    let offset = 0;
+    while (offset + 60 <= bytes.length && view.getUint32(offset, true) == 0x46584C4D)
+    {
+        const headerLen  = view.getUint8(offset + 5);
+        const source     = view.getUint8(offset + 6);
+        const payloadLen = view.getUint32(offset + 56, true);
+        const body       = bytes.subarray(offset + headerLen, offset + headerLen + payloadLen);
+
+        if (source == 1)
+        {
+            if (pairImageUrl) URL.revokeObjectURL(pairImageUrl);
+            pairImageUrl = URL.createObjectURL(new Blob([body], { type: 'image/jpeg' }));
+            $('stream').src = pairImageUrl;
+        }
+        else if (source == 0 && body.length == 32*24*4)
+        {
+            const fMin = view.getFloat32(offset + 40, true);
+            const fMax = view.getFloat32(offset + 44, true);
+            const iMin = view.getUint16(offset + 52, true);
+            const iMax = view.getUint16(offset + 54, true);
+
+            drawBMPBase64(body, 32, 24, 'overlay-stream', [fMin, iMin, fMax, iMax, fMin, fMax]);
+        }
+
+        offset += headerLen + payloadLen;
+    }
+}
+
+async function fetchPair(url)
+{
+    const response = await fetch(url);
+
+    if (!response.ok)   throw new Error("HTTP error " + response.status);
+
+    drawPair(new Uint8Array(await response.arrayBuffer()));
+}
+
 
 const viewOverlay = $('overlay-stream');
 const tooltip     = $('tooltip');
@@ -408,10 +522,13 @@ drawBMPBase64(new Uint8Array(32*24*4), 32, 24, 'stream');
 const view = $('stream');
 
 const startStream = () => {
-    view.src = `${streamUrl}/stream`;
-    //viewOverlay.src = `${streamOverlayUrl}/stream`;
+    view.src = `${streamUrl}/stream2640`;
+    //viewOverlay.src = `${streamOverlayUrl}/stream90640`;
 
-    fetchMultipartBinary(`${streamOverlayUrl}/stream`);
+    if ('WebSocket' in window)
+        startWebSocketStream(`${streamOverlayUrl}/stream90640`);
+    else
+        fetchMultipartBinary(`${streamOverlayUrl}/stream90640`);
 
     $('toggle-stream-btn').innerHTML = 'Stop Stream';
     $('toggle-stream-btn').style.background = '#ff3034';
@@ -434,6 +551,12 @@ const stopStream = () => {
         controller = null;
     }
 
+    if (wsThermal) {
+        const ws = wsThermal;
+        wsThermal = null;   // no fallback on intentional close
+        ws.close();
+    }
+
     $('toggle-stream-btn').innerHTML = 'Start Stream';
     $('toggle-stream-btn').style.background = '#00AA00';
 }
@@ -442,10 +565,14 @@ const stopStream = () => {
 // Attach actions to buttons
 $('capture-image-btn').onclick = () => {
     stopStream();
-    view.src = `${baseHost}/capture2640?_cb=${Date.now()}`;
-        
-    //viewOverlay.src = `${baseHost}/capture90640?_cb=${Date.now()}`;
-    fetchBinary(`${baseHost}/capture90640?_cb=${Date.now()}`);
+
+    // one request pairs both frames in time, separate captures are the fallback for older firmware
+    fetchPair(`${baseHost}/capture_pair?_cb=${Date.now()}`).catch(() => {
+        view.src = `${baseHost}/capture2640?_cb=${Date.now()}`;
+
+        //viewOverlay.src = `${baseHost}/capture90640?_cb=${Date.now()}`;
+        fetchBinary(`${baseHost}/capture90640?_cb=${Date.now()}`);
+    });
 }
 
 $('toggle-stream-btn').onclick = () => {
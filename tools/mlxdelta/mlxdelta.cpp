@@ -0,0 +1,353 @@
+// Host side decoder and benchmark of the MLX90640 delta stream format (MLX90640_delta.h)
+//
+//   curl -N http://<device>/stream90640 > rec.mp        record f32 (or i16/delta) stream
+//   ./mlxdelta decode rec.mp rec.f32                     multipart recording -> float32 frames
+//   ./mlxdelta bench  rec.f32 [key] [step]               size/CPU of delta coding vs f32/i16
+//   ./mlxdelta bench  -synth [frames] [key] [step]       same on a synthetic sequence
+//
+//   curl http://<device>/record/dump > rec.mlxr          flight recorder or time-lapse (/timelapse?from=0)
+//   ./mlxdelta bench  rec.mlxr [key] [step]              records are recognized by their envelope
+//   ./mlxdelta decode rec.mlxr rec.f32
+
+#include "MLX90640_delta.h"
+#include "frame_envelope.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stddef.h>
+#include <chrono>
+#include <vector>
+
+#define PIXELS	768
+
+
+static uint16_t centiKelvin(float fCelsius)
+{
+	long ck = lroundf((fCelsius + 273.15f) * 100.0f);
+
+	return (ck < 0) ? 0 : (ck > 0xFFFF) ? 0xFFFF : ck;
+}
+
+static float celsius(uint16_t ck)
+{
+	return ck / 100.0f - 273.15f;
+}
+
+
+static bool readFile(const char* path, std::vector<uint8_t>& data)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return false;
+	}
+
+	uint8_t buf[65536];
+	size_t  n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.insert(data.end(), buf, buf + n);
+
+	fclose(f);
+	return true;
+}
+
+
+static const uint8_t* find(const uint8_t* p, const uint8_t* end, const char* s)
+{
+	size_t n = strlen(s);
+
+	for (; p + n <= end; p++)
+		if (!memcmp(p, s, n)) return p;
+
+	return NULL;
+}
+
+
+// Record dumps (/record/dump, /timelapse) start with an envelope, multipart recordings with a boundary
+static bool isRecords(const std::vector<uint8_t>& data)
+{
+	uint32_t magic;
+
+	if (data.size() < sizeof(frame_envelope_t)) return false;
+	memcpy(&magic, data.data(), sizeof(magic));
+
+	return magic == FRAME_ENVELOPE_MAGIC;
+}
+
+
+// Converts back to back envelope + centiKelvin records to float32 frames
+static int readRecords(const std::vector<uint8_t>& data, std::vector<float>& frames)
+{
+	size_t pos = 0;
+	int skipped = 0;
+
+	while (pos + sizeof(frame_envelope_t) <= data.size())
+	{
+		frame_envelope_t env;
+		memcpy(&env, &data[pos], sizeof(env));
+
+		if (env.magic != FRAME_ENVELOPE_MAGIC || env.headerLen < sizeof(env) ||
+			pos + env.headerLen + env.payloadLen > data.size())
+		{
+			fprintf(stderr, "record at %zu: bad envelope, rest ignored\n", pos);
+			break;
+		}
+
+		const uint8_t* body = &data[pos + env.headerLen];
+		pos += env.headerLen + env.payloadLen;
+
+		if (env.source != FRAME_SOURCE_MLX90640 || env.payloadLen != PIXELS * 2) {
+			skipped++;
+			continue;
+		}
+
+		uint16_t ck[PIXELS];
+		memcpy(ck, body, sizeof(ck));
+
+		for (int i = 0; i < PIXELS; i++) frames.push_back(celsius(ck[i]));
+	}
+
+	return skipped;
+}
+
+
+// Splits a multipart recording into float32 frames, every part format the device streams is accepted
+static int decode(const char* in, const char* out)
+{
+	std::vector<uint8_t> data;
+	if (!readFile(in, data)) return 1;
+
+	FILE* f = fopen(out, "wb");
+	if (!f) {
+		fprintf(stderr, "cannot create %s\n", out);
+		return 1;
+	}
+
+	if (isRecords(data))
+	{
+		std::vector<float> frames;
+		int skipped = readRecords(data, frames);
+
+		fwrite(frames.data(), sizeof(float), frames.size(), f);
+		fclose(f);
+
+		printf("%zu frames written, %d records skipped\n", frames.size() / PIXELS, skipped);
+		return 0;
+	}
+
+	mlx_delta_state_t st;
+	MLXdelta::init(st, 0, 1);
+
+	const uint8_t* p   = data.data();
+	const uint8_t* end = p + data.size();
+
+	int frames = 0, skipped = 0;
+
+	while ((p = find(p, end, "Content-Length:")) != NULL)
+	{
+		const uint8_t* hdr     = p;
+		const uint8_t* hdr_end = find(p, end, "\r\n\r\n");
+		if (!hdr_end) break;
+
+		size_t len = strtoul((const char*)p + 15, NULL, 10);
+
+		const uint8_t* body = hdr_end + 4;
+		if (body + len > end) break;
+
+		p = body + len;
+
+		// hdr=1 streams carry frame_envelope_t ahead of the payload, the device sends
+		// Content-Type right before Content-Length
+		static const char ctEnvelope[] = "Content-Type: " FRAME_ENVELOPE_CONTENT_TYPE "\r\n";
+		const size_t ctLen = sizeof(ctEnvelope) - 1;
+
+		if (hdr - data.data() >= (ptrdiff_t)ctLen && !memcmp(hdr - ctLen, ctEnvelope, ctLen))
+		{
+			const frame_envelope_t* env = (const frame_envelope_t*)body;
+			if (len < sizeof(frame_envelope_t) || env->magic != FRAME_ENVELOPE_MAGIC || env->headerLen > len) {
+				skipped++;
+				continue;
+			}
+
+			body += env->headerLen;
+			len  -= env->headerLen;
+		}
+
+		// format header sits between Content-Length and the blank line
+		const uint8_t* fmt = find(hdr, hdr_end, "X-Format: ");
+		char format[8] = "f32";
+		if (fmt) sscanf((const char*)fmt + 10, "%7[a-z0-9]", format);
+
+		float    frame[PIXELS];
+		uint16_t ck[MLX_DELTA_MAX_PIXELS];
+		bool     bFrame = false;
+
+		if (!strcmp(format, "f32") && len == sizeof(frame)) {
+			memcpy(frame, body, len);
+			bFrame = true;
+		}
+		else if (!strcmp(format, "i16") && len == PIXELS * 2) {
+			memcpy(ck, body, len);
+			for (int i = 0; i < PIXELS; i++) frame[i] = celsius(ck[i]);
+			bFrame = true;
+		}
+		else if (!strcmp(format, "delta")) {
+			int n = MLXdelta::decode(st, body, len, ck);
+			if (n == PIXELS) {
+				for (int i = 0; i < PIXELS; i++) frame[i] = celsius(ck[i]);
+				bFrame = true;
+			}
+		}
+
+		if (bFrame) {
+			fwrite(frame, sizeof(frame), 1, f);
+			frames++;
+		}
+		else
+			skipped++;
+	}
+
+	fclose(f);
+
+	printf("%d frames written, %d parts skipped\n", frames, skipped);
+	return 0;
+}
+
+
+// Background with sensor noise and a slowly moving warm object
+static void synthesize(std::vector<float>& frames, int count)
+{
+	srand(1);
+
+	frames.resize((size_t)count * PIXELS);
+
+	for (int n = 0; n < count; n++)
+	{
+		float cx = 16.0f + 10.0f * sinf(n * 0.02f);
+		float cy = 12.0f +  6.0f * cosf(n * 0.03f);
+
+		for (int y = 0; y < 24; y++)
+			for (int x = 0; x < 32; x++)
+			{
+				float noise = 0.0f;
+				for (int k = 0; k < 4; k++) noise += rand() / (float)RAND_MAX - 0.5f;
+
+				float d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+
+				frames[(size_t)n * PIXELS + y * 32 + x] = 22.0f + 12.0f * expf(-d2 / 18.0f) + noise * 0.1f;
+			}
+	}
+}
+
+
+static int bench(std::vector<float>& frames, int key, int step)
+{
+	const size_t count = frames.size() / PIXELS;
+	if (!count) {
+		fprintf(stderr, "no frames\n");
+		return 1;
+	}
+
+	std::vector<uint16_t> ck(frames.size());
+	for (size_t i = 0; i < frames.size(); i++) ck[i] = centiKelvin(frames[i]);
+
+	mlx_delta_state_t enc, dec;
+	MLXdelta::init(enc, key, step);
+	MLXdelta::init(dec, key, step);
+
+	uint8_t  buf[MLX_DELTA_MAX_LEN(PIXELS)];
+	uint16_t out[MLX_DELTA_MAX_PIXELS];
+
+	size_t   bytes = 0, keyBytes = 0, keyFrames = 0;
+	int      maxErr = 0;
+	double   encUs = 0.0, decUs = 0.0;
+
+	for (size_t n = 0; n < count; n++)
+	{
+		const uint16_t* frame = &ck[n * PIXELS];
+
+		auto t0 = std::chrono::steady_clock::now();
+		size_t len = MLXdelta::encode(enc, frame, PIXELS, buf);
+		auto t1 = std::chrono::steady_clock::now();
+		int pixels = MLXdelta::decode(dec, buf, len, out);
+		auto t2 = std::chrono::steady_clock::now();
+
+		if (pixels != PIXELS) {
+			fprintf(stderr, "frame %zu: decode failed %d\n", n, pixels);
+			return 1;
+		}
+
+		encUs += std::chrono::duration<double, std::micro>(t1 - t0).count();
+		decUs += std::chrono::duration<double, std::micro>(t2 - t1).count();
+
+		bytes += len;
+		if (buf[0] == 'K') {
+			keyBytes += len;
+			keyFrames++;
+		}
+
+		for (int i = 0; i < PIXELS; i++) {
+			int err = abs((int)out[i] - (int)frame[i]);
+			if (err > maxErr) maxErr = err;
+		}
+	}
+
+	double avg = (double)bytes / count;
+
+	printf("frames        %zu (key %d, step %d cK)\n", count, key, step);
+	printf("f32           %u bytes/frame\n", PIXELS * 4);
+	printf("i16           %u bytes/frame\n", PIXELS * 2);
+	printf("delta         %.1f bytes/frame (%.1fx vs f32, %.1fx vs i16)\n", avg, PIXELS * 4 / avg, PIXELS * 2 / avg);
+	if (keyFrames)
+		printf("  keyframes   %.1f bytes, deltas %.1f bytes\n", (double)keyBytes / keyFrames,
+		       count > keyFrames ? (double)(bytes - keyBytes) / (count - keyFrames) : 0.0);
+	printf("max error     %d cK\n", maxErr);
+	printf("encode        %.2f us/frame (host)\n", encUs / count);
+	printf("decode        %.2f us/frame (host)\n", decUs / count);
+	printf("16Hz / 32Hz   %.1f / %.1f kbit/s payload\n", avg * 16 * 8 / 1000, avg * 32 * 8 / 1000);
+
+	return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+	if (argc >= 4 && !strcmp(argv[1], "decode"))
+		return decode(argv[2], argv[3]);
+
+	if (argc >= 3 && !strcmp(argv[1], "bench"))
+	{
+		std::vector<float> frames;
+		int arg = 3;
+
+		if (!strcmp(argv[2], "-synth")) {
+			int count = 300;
+			if (argc > 3 && argv[3][0] != '\0') count = atoi(argv[3]), arg = 4;
+			synthesize(frames, count);
+		}
+		else {
+			std::vector<uint8_t> data;
+			if (!readFile(argv[2], data)) return 1;
+
+			if (isRecords(data)) {
+				readRecords(data, frames);
+			}
+			else {
+				frames.resize(data.size() / sizeof(float));
+				memcpy(frames.data(), data.data(), frames.size() * sizeof(float));
+				frames.resize(frames.size() / PIXELS * PIXELS);
+			}
+		}
+
+		int key  = argc > arg     ? atoi(argv[arg])     : 16;
+		int step = argc > arg + 1 ? atoi(argv[arg + 1]) : 1;
+
+		return bench(frames, key, step);
+	}
+
+	fprintf(stderr, "usage: %s decode <recording | records.mlxr> <frames.f32>\n"
+	                "       %s bench <frames.f32 | records.mlxr | -synth [count]> [key] [step]\n", argv[0], argv[0]);
+	return 2;
+}
@@ -0,0 +1,391 @@
+
+#include "standin.h"
+#include "esp_camera.h"
+#include "img_converters.h"
+#include "esp32-hal-log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include <dirent.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// OV2640 replaced by recorded JPEG frames replayed in a loop at a fixed rate
+
+typedef struct {
+	std::vector<uint8_t> jpeg;
+	uint16_t             width;
+	uint16_t             height;
+} standin_jpeg_t;
+
+static std::vector<standin_jpeg_t> camFrames;
+static float                       camFps = 10.0f;
+
+static SemaphoreHandle_t camMutex   = NULL;
+static SemaphoreHandle_t camFreeSem = NULL;		// frame buffers not held by the firmware
+static int64_t           camNextUs  = 0;
+static size_t            camIndex   = 0;
+
+static sensor_t          camSensor;
+static std::map<int,int> camRegs;
+
+
+// Width and height from the SOF marker, false if the data is not a baseline/progressive JPEG
+static bool jpeg_size(const uint8_t* p, size_t len, uint16_t& width, uint16_t& height)
+{
+	size_t i = 2;
+	while (i + 9 < len)
+	{
+		if (p[i] != 0xFF) return false;
+
+		uint8_t marker = p[i + 1];
+		if (marker >= 0xC0 && marker <= 0xC2)
+		{
+			height = (p[i + 5] << 8) | p[i + 6];
+			width  = (p[i + 7] << 8) | p[i + 8];
+			return true;
+		}
+
+		i += 2 + ((p[i + 2] << 8) | p[i + 3]);
+	}
+
+	return false;
+}
+
+
+static void add_jpeg(const uint8_t* p, size_t len)
+{
+	standin_jpeg_t frame;
+	if (!jpeg_size(p, len, frame.width, frame.height)) return;
+
+	frame.jpeg.assign(p, p + len);
+	camFrames.push_back(std::move(frame));
+}
+
+
+static bool read_file(const std::string& path, std::vector<uint8_t>& data)
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f) return false;
+
+	uint8_t buf[65536];
+	size_t  n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.insert(data.end(), buf, buf + n);
+
+	fclose(f);
+	return true;
+}
+
+
+// Every SOI..EOI run of the data, a single JPEG or a recording of a multipart stream
+static void scan_jpegs(const std::vector<uint8_t>& data)
+{
+	size_t i = 0;
+	while (i + 4 <= data.size())
+	{
+		if (!(data[i] == 0xFF && data[i + 1] == 0xD8 && data[i + 2] == 0xFF)) {
+			i++;
+			continue;
+		}
+
+		size_t end = i + 2;
+		while (end + 1 < data.size() && !(data[end] == 0xFF && data[end + 1] == 0xD9)) end++;
+		if (end + 1 >= data.size()) break;
+
+		add_jpeg(&data[i], end + 2 - i);
+		i = end + 2;
+	}
+}
+
+
+// Colour bars with a frame counter stripe when nothing was recorded
+static void synth_jpegs(uint16_t width, uint16_t height, int count)
+{
+	static const uint8_t bars[8][3] = {
+		{ 255, 255, 255 }, { 255, 255, 0 }, { 0, 255, 255 }, { 0, 255, 0 },
+		{ 255, 0, 255 },   { 255, 0, 0 },   { 0, 0, 255 },   { 0, 0, 0 }
+	};
+
+	std::vector<uint8_t> rgb((size_t)width * height * 3);
+
+	for (int n = 0; n < count; n++)
+	{
+		for (uint16_t y = 0; y < height; y++)
+			for (uint16_t x = 0; x < width; x++)
+			{
+				uint8_t* px = &rgb[((size_t)y * width + x) * 3];
+				const uint8_t* c = bars[x * 8 / width];
+
+				// stripe moving down one step per frame
+				bool bStripe = (y * count / height) == n;
+
+				px[0] = bStripe ? 128 : c[2];	// BGR order of RGB888 frames
+				px[1] = bStripe ? 128 : c[1];
+				px[2] = bStripe ? 128 : c[0];
+			}
+
+		uint8_t* out = NULL;
+		size_t   len = 0;
+		if (fmt2jpg(rgb.data(), rgb.size(), width, height, PIXFORMAT_RGB888, 80, &out, &len))
+		{
+			add_jpeg(out, len);
+			free(out);
+		}
+	}
+}
+
+
+bool standin_camera_load(const char* source, float fps)
+{
+	camFps = fps > 0 ? fps : camFps;
+
+	if (!source)
+	{
+		synth_jpegs(1200, 900, 16);
+		log_i("No camera recording, %u synthetic frames", (unsigned)camFrames.size());
+		return !camFrames.empty();
+	}
+
+	DIR* dir = opendir(source);
+	if (dir)
+	{
+		std::vector<std::string> names;
+		while (struct dirent* e = readdir(dir))
+		{
+			std::string name = e->d_name;
+			if (name.size() > 4 && (name.compare(name.size() - 4, 4, ".jpg") == 0 || name.compare(name.size() - 4, 4, ".JPG") == 0))
+				names.push_back(name);
+		}
+		closedir(dir);
+
+		std::sort(names.begin(), names.end());
+
+		for (auto& name : names)
+		{
+			std::vector<uint8_t> data;
+			if (read_file(std::string(source) + "/" + name, data)) scan_jpegs(data);
+		}
+	}
+	else
+	{
+		std::vector<uint8_t> data;
+		if (!read_file(source, data)) {
+			log_e("Cannot read %s", source);
+			return false;
+		}
+		scan_jpegs(data);
+	}
+
+	if (camFrames.empty()) {
+		log_e("No JPEG frames in %s", source);
+		return false;
+	}
+
+	log_i("%u camera frames from %s, %ux%u at %.1f fps", (unsigned)camFrames.size(), source,
+	      camFrames[0].width, camFrames[0].height, camFps);
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Sensor, settings are kept in status as the driver does after writing the registers
+
+#define CAM_SET_STATUS(fn, field) \
+	static int fn(sensor_t* s, int v) { s->status.field = v; return 0; }
+
+CAM_SET_STATUS(cam_set_contrast,       contrast)
+CAM_SET_STATUS(cam_set_brightness,     brightness)
+CAM_SET_STATUS(cam_set_saturation,     saturation)
+CAM_SET_STATUS(cam_set_sharpness,      sharpness)
+CAM_SET_STATUS(cam_set_denoise,        denoise)
+CAM_SET_STATUS(cam_set_quality,        quality)
+CAM_SET_STATUS(cam_set_colorbar,       colorbar)
+CAM_SET_STATUS(cam_set_whitebal,       awb)
+CAM_SET_STATUS(cam_set_gain_ctrl,      agc)
+CAM_SET_STATUS(cam_set_exposure_ctrl,  aec)
+CAM_SET_STATUS(cam_set_hmirror,        hmirror)
+CAM_SET_STATUS(cam_set_vflip,          vflip)
+CAM_SET_STATUS(cam_set_aec2,           aec2)
+CAM_SET_STATUS(cam_set_awb_gain,       awb_gain)
+CAM_SET_STATUS(cam_set_agc_gain,       agc_gain)
+CAM_SET_STATUS(cam_set_aec_value,      aec_value)
+CAM_SET_STATUS(cam_set_special_effect, special_effect)
+CAM_SET_STATUS(cam_set_wb_mode,        wb_mode)
+CAM_SET_STATUS(cam_set_ae_level,       ae_level)
+CAM_SET_STATUS(cam_set_dcw,            dcw)
+CAM_SET_STATUS(cam_set_bpc,            bpc)
+CAM_SET_STATUS(cam_set_wpc,            wpc)
+CAM_SET_STATUS(cam_set_raw_gma,        raw_gma)
+CAM_SET_STATUS(cam_set_lenc,           lenc)
+
+static int cam_init_status(sensor_t* s)                     { return 0; }
+static int cam_reset(sensor_t* s)                           { return 0; }
+static int cam_set_pixformat(sensor_t* s, pixformat_t f)    { s->pixformat = f; return 0; }
+static int cam_set_framesize(sensor_t* s, framesize_t f)    { s->status.framesize = f; return 0; }
+static int cam_set_gainceiling(sensor_t* s, gainceiling_t g) { s->status.gainceiling = g; return 0; }
+
+static int cam_get_reg(sensor_t* s, int reg, int mask)
+{
+	xSemaphoreTake(camMutex, portMAX_DELAY);
+		int value = camRegs[reg] & mask;
+	xSemaphoreGive(camMutex);
+
+	return value;
+}
+
+static int cam_set_reg(sensor_t* s, int reg, int mask, int value)
+{
+	xSemaphoreTake(camMutex, portMAX_DELAY);
+		camRegs[reg] = (camRegs[reg] & ~mask) | (value & mask);
+	xSemaphoreGive(camMutex);
+
+	return 0;
+}
+
+static int cam_set_res_raw(sensor_t* s, int startX, int startY, int endX, int endY, int offsetX, int offsetY,
+                           int totalX, int totalY, int outputX, int outputY, bool scale, bool binning)
+{
+	// the recording has the size it was taken with
+	log_d("Output %dx%d requested", outputX, outputY);
+	return 0;
+}
+
+static int cam_set_pll(sensor_t* s, int bypass, int mul, int sys, int root, int pre, int seld5, int pclken, int pclk)
+{
+	return 0;
+}
+
+static int cam_set_xclk(sensor_t* s, int timer, int xclk)
+{
+	s->xclk_freq_hz = xclk * 1000000;
+	return 0;
+}
+
+
+esp_err_t esp_camera_init(const camera_config_t* config)
+{
+	if (camFrames.empty()) return ESP_ERR_CAMERA_NOT_DETECTED;
+
+	camMutex   = xSemaphoreCreateMutex();
+	camFreeSem = xSemaphoreCreateCounting(config->fb_count, config->fb_count);
+
+	sensor_t* s = &camSensor;
+	memset(s, 0, sizeof(*s));
+
+	s->id.PID        = OV2640_PID;
+	s->slv_addr      = 0x30;
+	s->pixformat     = config->pixel_format;
+	s->xclk_freq_hz  = config->xclk_freq_hz;
+
+	s->status.framesize = config->frame_size;
+	s->status.quality   = config->jpeg_quality;
+	s->status.awb       = 1;
+	s->status.awb_gain  = 1;
+	s->status.aec       = 1;
+	s->status.agc       = 1;
+	s->status.bpc       = 1;
+	s->status.wpc       = 1;
+	s->status.raw_gma   = 1;
+	s->status.lenc      = 1;
+	s->status.dcw       = 1;
+
+	s->init_status        = cam_init_status;
+	s->reset              = cam_reset;
+	s->set_pixformat      = cam_set_pixformat;
+	s->set_framesize      = cam_set_framesize;
+	s->set_contrast       = cam_set_contrast;
+	s->set_brightness     = cam_set_brightness;
+	s->set_saturation     = cam_set_saturation;
+	s->set_sharpness      = cam_set_sharpness;
+	s->set_denoise        = cam_set_denoise;
+	s->set_gainceiling    = cam_set_gainceiling;
+	s->set_quality        = cam_set_quality;
+	s->set_colorbar       = cam_set_colorbar;
+	s->set_whitebal       = cam_set_whitebal;
+	s->set_gain_ctrl      = cam_set_gain_ctrl;
+	s->set_exposure_ctrl  = cam_set_exposure_ctrl;
+	s->set_hmirror        = cam_set_hmirror;
+	s->set_vflip          = cam_set_vflip;
+	s->set_aec2           = cam_set_aec2;
+	s->set_awb_gain       = cam_set_awb_gain;
+	s->set_agc_gain       = cam_set_agc_gain;
+	s->set_aec_value      = cam_set_aec_value;
+	s->set_special_effect = cam_set_special_effect;
+	s->set_wb_mode        = cam_set_wb_mode;
+	s->set_ae_level       = cam_set_ae_level;
+	s->set_dcw            = cam_set_dcw;
+	s->set_bpc            = cam_set_bpc;
+	s->set_wpc            = cam_set_wpc;
+	s->set_raw_gma        = cam_set_raw_gma;
+	s->set_lenc           = cam_set_lenc;
+	s->get_reg            = cam_get_reg;
+	s->set_reg            = cam_set_reg;
+	s->set_res_raw        = cam_set_res_raw;
+	s->set_pll            = cam_set_pll;
+	s->set_xclk           = cam_set_xclk;
+
+	return ESP_OK;
+}
+
+
+sensor_t* esp_camera_sensor_get()
+{
+	return camMutex ? &camSensor : NULL;
+}
+
+
+// Blocks until the next frame is due, like the driver waiting for VSYNC
+camera_fb_t* esp_camera_fb_get()
+{
+	if (!camMutex) return NULL;
+
+	xSemaphoreTake(camFreeSem, portMAX_DELAY);
+
+	xSemaphoreTake(camMutex, portMAX_DELAY);
+
+		int64_t period = (int64_t)(1000000 / camFps);
+		int64_t now    = esp_timer_get_time();
+
+		// a consumer that fell behind gets the next frame at the frame rate, not a burst
+		if (camNextUs < now - period) camNextUs = now;
+
+		int64_t waitUs = camNextUs - now;
+		camNextUs += period;
+
+		const standin_jpeg_t& frame = camFrames[camIndex];
+		camIndex = (camIndex + 1) % camFrames.size();
+
+	xSemaphoreGive(camMutex);
+
+	if (waitUs > 0) vTaskDelay(pdMS_TO_TICKS((waitUs + 999) / 1000));
+
+	camera_fb_t* fb = (camera_fb_t*)calloc(1, sizeof(camera_fb_t));
+
+	// recordings are never written, the buffer is shared by every frame handed out
+	fb->buf    = (uint8_t*)frame.jpeg.data();
+	fb->len    = frame.jpeg.size();
+	fb->width  = frame.width;
+	fb->height = frame.height;
+	fb->format = PIXFORMAT_JPEG;
+
+	int64_t us = esp_timer_get_time();
+	fb->timestamp.tv_sec  = us / 1000000;
+	fb->timestamp.tv_usec = us % 1000000;
+
+	return fb;
+}
+
+
+void esp_camera_fb_return(camera_fb_t* fb)
+{
+	if (!fb) return;
+
+	free(fb);
+	xSemaphoreGive(camFreeSem);
+}
@@ -0,0 +1,535 @@
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "esp32-hal-log.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <deque>
+
+
+struct standin_task {
+	pthread_t       thread;
+	char            name[configMAX_TASK_NAME_LEN];
+	UBaseType_t     priority;
+	BaseType_t      coreId;
+	TaskFunction_t  fn;
+	void*           arg;
+
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	uint32_t        notifyValue;
+	bool            bNotified;
+};
+
+// Waiters are served in arrival order, a give hands the count to the oldest one
+// A thread looping on take/give would otherwise win every time over one just woken
+struct standin_semaphore {
+	pthread_mutex_t    lock;
+	pthread_cond_t     cond;
+	UBaseType_t        count;
+	UBaseType_t        maxCount;
+	std::deque<bool*>  waiters;
+};
+
+struct standin_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t  notEmpty;
+	pthread_cond_t  notFull;
+	UBaseType_t     length;
+	UBaseType_t     itemSize;
+	UBaseType_t     head;
+	UBaseType_t     count;
+	uint8_t*        items;
+};
+
+static thread_local standin_task* currentTask = NULL;
+
+
+static void cond_init(pthread_cond_t* cond)
+{
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+
+// Absolute CLOCK_MONOTONIC deadline of a timeout in ticks
+static struct timespec deadline(TickType_t ticks)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	ts.tv_sec  += ticks / 1000;
+	ts.tv_nsec += (long)(ticks % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	return ts;
+}
+
+
+// Waits on cond until pred holds, lock is held by the caller
+// Returns false on timeout
+template <typename Pred>
+static bool wait_until(pthread_cond_t* cond, pthread_mutex_t* lock, TickType_t timeout, Pred pred)
+{
+	if (pred()) return true;
+	if (timeout == 0) return false;
+
+	if (timeout == portMAX_DELAY)
+	{
+		while (!pred()) pthread_cond_wait(cond, lock);
+		return true;
+	}
+
+	struct timespec ts = deadline(timeout);
+	while (!pred())
+	{
+		if (pthread_cond_timedwait(cond, lock, &ts) == ETIMEDOUT)
+			return pred();
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Tasks
+
+static standin_task* task_new(const char* name)
+{
+	standin_task* t = (standin_task*)calloc(1, sizeof(standin_task));
+	if (!t) return NULL;
+
+	strncpy(t->name, name ? name : "", sizeof(t->name) - 1);
+	t->coreId = tskNO_AFFINITY;
+
+	pthread_mutex_init(&t->lock, NULL);
+	cond_init(&t->cond);
+
+	return t;
+}
+
+
+static void* task_entry(void* arg)
+{
+	standin_task* t = (standin_task*)arg;
+	currentTask = t;
+
+	char name[16];
+	strncpy(name, t->name, sizeof(name) - 1);
+	name[sizeof(name) - 1] = 0;
+	pthread_setname_np(pthread_self(), name);
+
+	t->fn(t->arg);
+
+	// a FreeRTOS task must not return, end it the same way vTaskDelete(NULL) does
+	log_e("Task %s returned", t->name);
+
+	return NULL;
+}
+
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t coreId)
+{
+	standin_task* t = task_new(name);
+	if (!t) return pdFAIL;
+
+	t->fn       = fn;
+	t->arg      = arg;
+	t->priority = priority;
+	t->coreId   = coreId;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, stackDepth > STANDIN_TASK_STACK_MIN ? stackDepth : STANDIN_TASK_STACK_MIN);
+
+	// the handle is valid before the task runs, as with FreeRTOS
+	if (handle) *handle = t;
+
+	int err = pthread_create(&t->thread, &attr, task_entry, t);
+	pthread_attr_destroy(&attr);
+
+	if (err)
+	{
+		log_e("Task %s creation failed: %s", t->name, strerror(err));
+		if (handle) *handle = NULL;
+		free(t);
+		return pdFAIL;
+	}
+
+	return pdPASS;
+}
+
+
+BaseType_t xTaskCreatePinnedToCoreWithCaps(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                                           UBaseType_t priority, TaskHandle_t* handle, BaseType_t coreId, uint32_t caps)
+{
+	return xTaskCreatePinnedToCore(fn, name, stackDepth, arg, priority, handle, coreId);
+}
+
+
+void vTaskDelete(TaskHandle_t task)
+{
+	if (task && task != currentTask)
+	{
+		// threads cannot be stopped from outside safely, the firmware never does it
+		log_e("Deleting task %s from another task is not supported", task->name);
+		return;
+	}
+
+	// the record stays allocated, stale handles kept by the firmware remain readable
+	pthread_exit(NULL);
+}
+
+
+void vTaskDeleteWithCaps(TaskHandle_t task)
+{
+	vTaskDelete(task);
+}
+
+
+void vTaskDelay(TickType_t ticks)
+{
+	struct timespec ts;
+	ts.tv_sec  = ticks / 1000;
+	ts.tv_nsec = (long)(ticks % 1000) * 1000000L;
+
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+}
+
+
+TickType_t xTaskGetTickCount()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (TickType_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+	// threads not created by xTaskCreate (main, httpd) get a record on first use
+	if (!currentTask)
+	{
+		char name[16] = "";
+		pthread_getname_np(pthread_self(), name, sizeof(name));
+
+		currentTask = task_new(name);
+		if (currentTask) currentTask->thread = pthread_self();
+	}
+
+	return currentTask;
+}
+
+
+char* pcTaskGetName(TaskHandle_t task)
+{
+	if (!task) task = xTaskGetCurrentTaskHandle();
+
+	return task ? task->name : NULL;
+}
+
+
+BaseType_t xTaskGetCoreID(TaskHandle_t task)
+{
+	if (!task) task = xTaskGetCurrentTaskHandle();
+
+	return task ? task->coreId : tskNO_AFFINITY;
+}
+
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+	if (!task) return pdFAIL;
+
+	BaseType_t res = pdPASS;
+
+	pthread_mutex_lock(&task->lock);
+
+		switch (action)
+		{
+		case eSetBits:
+			task->notifyValue |= value;
+			break;
+		case eIncrement:
+			task->notifyValue++;
+			break;
+		case eSetValueWithOverwrite:
+			task->notifyValue = value;
+			break;
+		case eSetValueWithoutOverwrite:
+			if (task->bNotified) res = pdFAIL;
+			else task->notifyValue = value;
+			break;
+		case eNoAction:
+		default:
+			break;
+		}
+
+		task->bNotified = true;
+		pthread_cond_broadcast(&task->cond);
+
+	pthread_mutex_unlock(&task->lock);
+
+	return res;
+}
+
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	return xTaskNotify(task, 0, eIncrement);
+}
+
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t timeout)
+{
+	standin_task* t = xTaskGetCurrentTaskHandle();
+
+	pthread_mutex_lock(&t->lock);
+
+		wait_until(&t->cond, &t->lock, timeout, [t] { return t->notifyValue != 0; });
+
+		uint32_t value = t->notifyValue;
+		if (value)
+			t->notifyValue = clearOnExit ? 0 : value - 1;
+
+		t->bNotified = false;
+
+	pthread_mutex_unlock(&t->lock);
+
+	return value;
+}
+
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t timeout)
+{
+	standin_task* t = xTaskGetCurrentTaskHandle();
+
+	pthread_mutex_lock(&t->lock);
+
+		if (!t->bNotified)
+			t->notifyValue &= ~clearOnEntry;
+
+		bool bNotified = wait_until(&t->cond, &t->lock, timeout, [t] { return t->bNotified; });
+
+		if (value) *value = t->notifyValue;
+
+		if (bNotified)
+			t->notifyValue &= ~clearOnExit;
+
+		t->bNotified = false;
+
+	pthread_mutex_unlock(&t->lock);
+
+	return bNotified ? pdTRUE : pdFALSE;
+}
+
+
+//-----------------------------------------------------------------------------
+// Semaphores, a mutex is a binary semaphore created given (no priority inheritance)
+
+static SemaphoreHandle_t semaphore_new(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+	standin_semaphore* s = new standin_semaphore();
+
+	pthread_mutex_init(&s->lock, NULL);
+	cond_init(&s->cond);
+
+	s->count    = initialCount;
+	s->maxCount = maxCount;
+
+	return s;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+	return semaphore_new(1, 1);
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+	return semaphore_new(1, 0);
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+	return semaphore_new(maxCount, initialCount);
+}
+
+
+void vSemaphoreDelete(SemaphoreHandle_t s)
+{
+	if (!s) return;
+
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+	delete s;
+}
+
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t timeout)
+{
+	pthread_mutex_lock(&s->lock);
+
+		bool bTaken = false;
+
+		if (s->count > 0 && s->waiters.empty())
+		{
+			s->count--;
+			bTaken = true;
+		}
+		else if (timeout != 0)
+		{
+			bool bGranted = false;
+			s->waiters.push_back(&bGranted);
+
+			bTaken = wait_until(&s->cond, &s->lock, timeout, [&bGranted] { return bGranted; });
+			if (!bTaken)
+				s->waiters.erase(std::find(s->waiters.begin(), s->waiters.end(), &bGranted));
+		}
+
+	pthread_mutex_unlock(&s->lock);
+
+	return bTaken ? pdTRUE : pdFALSE;
+}
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+	BaseType_t res = pdFAIL;
+
+	pthread_mutex_lock(&s->lock);
+
+		if (!s->waiters.empty())
+		{
+			*s->waiters.front() = true;
+			s->waiters.pop_front();
+
+			pthread_cond_broadcast(&s->cond);
+			res = pdPASS;
+		}
+		else if (s->count < s->maxCount)
+		{
+			s->count++;
+			res = pdPASS;
+		}
+
+	pthread_mutex_unlock(&s->lock);
+
+	return res;
+}
+
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t s)
+{
+	pthread_mutex_lock(&s->lock);
+		UBaseType_t count = s->count;
+	pthread_mutex_unlock(&s->lock);
+
+	return count;
+}
+
+
+//-----------------------------------------------------------------------------
+// Queues, items are copied in and out like FreeRTOS does
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+	standin_queue* q = (standin_queue*)calloc(1, sizeof(standin_queue));
+	if (!q) return NULL;
+
+	q->items = (uint8_t*)malloc((size_t)length * itemSize);
+	if (!q->items) {
+		free(q);
+		return NULL;
+	}
+
+	pthread_mutex_init(&q->lock, NULL);
+	cond_init(&q->notEmpty);
+	cond_init(&q->notFull);
+
+	q->length   = length;
+	q->itemSize = itemSize;
+
+	return q;
+}
+
+
+void vQueueDelete(QueueHandle_t q)
+{
+	if (!q) return;
+
+	pthread_cond_destroy(&q->notEmpty);
+	pthread_cond_destroy(&q->notFull);
+	pthread_mutex_destroy(&q->lock);
+	free(q->items);
+	free(q);
+}
+
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t timeout)
+{
+	pthread_mutex_lock(&q->lock);
+
+		bool bRoom = wait_until(&q->notFull, &q->lock, timeout, [q] { return q->count < q->length; });
+		if (bRoom)
+		{
+			UBaseType_t tail = (q->head + q->count) % q->length;
+			memcpy(q->items + (size_t)tail * q->itemSize, item, q->itemSize);
+			q->count++;
+
+			pthread_cond_signal(&q->notEmpty);
+		}
+
+	pthread_mutex_unlock(&q->lock);
+
+	return bRoom ? pdPASS : pdFAIL;
+}
+
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t timeout)
+{
+	pthread_mutex_lock(&q->lock);
+
+		bool bItem = wait_until(&q->notEmpty, &q->lock, timeout, [q] { return q->count > 0; });
+		if (bItem)
+		{
+			memcpy(item, q->items + (size_t)q->head * q->itemSize, q->itemSize);
+			q->head = (q->head + 1) % q->length;
+			q->count--;
+
+			pthread_cond_signal(&q->notFull);
+		}
+
+	pthread_mutex_unlock(&q->lock);
+
+	return bItem ? pdTRUE : pdFALSE;
+}
+
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+	pthread_mutex_lock(&q->lock);
+		UBaseType_t count = q->count;
+	pthread_mutex_unlock(&q->lock);
+
+	return count;
+}
@@ -0,0 +1,1364 @@
+
+#include "esp_http_server.h"
+#include "esp32-hal-log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <vector>
+
+
+#define HTTPD_SHIM_RECV_BUF		4096		// request line and headers, same limit as the device config
+#define HTTPD_SHIM_HDR_MAX		64
+
+#define WS_GUID					"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+struct httpd_data;
+
+typedef struct {
+	bool            bUsed;
+	int             fd;
+	bool            bAsync;			// handed to an async handler, not polled
+	bool            bClose;			// closed as soon as it is not in use
+	uint64_t        lru;
+
+	// bytes received past the last request headers: body, next request or WebSocket data
+	char            rbuf[HTTPD_SHIM_RECV_BUF];
+	size_t          rlen;
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+	bool            bWebsocket;
+	int             wsUri;			// handler serving the frames
+	pthread_mutex_t wsSendLock;
+
+	// header of the frame being received, the payload is left to httpd_ws_recv_frame
+	httpd_ws_type_t wsType;
+	bool            wsFinal;
+	bool            wsMasked;
+	uint8_t         wsMask[4];
+	uint64_t        wsLen;
+	uint64_t        wsRead;
+#endif
+} httpd_sess_t;
+
+typedef struct {
+	httpd_work_fn_t fn;
+	void*           arg;
+} httpd_work_t;
+
+struct httpd_data {
+	httpd_config_t           config;
+	std::vector<httpd_uri_t> uris;
+	std::vector<std::string> uriStrings;	// copies of the registered URIs
+
+	int                      listenFd;
+	int                      wakeFd[2];		// pipe waking the server task from other tasks
+	TaskHandle_t             task;
+
+	pthread_mutex_t          lock;			// session flags and the work queue
+	httpd_sess_t*            sess;
+	uint64_t                 lruCounter;
+	std::vector<httpd_work_t> work;
+};
+
+// Request state behind httpd_req_t::aux
+typedef struct {
+	httpd_sess_t*            sess;
+	std::string              headers;		// raw header lines of the request
+	size_t                   remaining;		// body bytes not received yet
+	bool                     bKeepAlive;
+
+	std::string              status;
+	std::string              contentType;
+	std::vector<std::pair<std::string, std::string>> respHeaders;
+	bool                     bHeadersSent;
+	bool                     bChunked;
+	bool                     bDone;			// final chunk or full response sent
+
+	bool                     bHandedOff;	// original request whose session went to an async handler
+} httpd_req_aux_t;
+
+static uint16_t shimPort = 0;
+
+
+void httpd_shim_set_port(uint16_t port)
+{
+	shimPort = port;
+}
+
+
+static void httpd_wake(httpd_data* hd)
+{
+	char c = 0;
+	if (write(hd->wakeFd[1], &c, 1) < 0) {}
+}
+
+
+//-----------------------------------------------------------------------------
+// Socket I/O
+
+static int sock_send_all(int fd, const char* buf, size_t len)
+{
+	size_t sent = 0;
+	while (sent < len)
+	{
+		ssize_t n = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+		}
+		sent += n;
+	}
+
+	return (int)sent;
+}
+
+
+// Receives into buf, bytes left over from the header read come first
+static int sess_recv(httpd_sess_t* s, char* buf, size_t len)
+{
+	if (s->rlen)
+	{
+		size_t n = s->rlen < len ? s->rlen : len;
+		memcpy(buf, s->rbuf, n);
+		memmove(s->rbuf, s->rbuf + n, s->rlen - n);
+		s->rlen -= n;
+
+		return (int)n;
+	}
+
+	while (true)
+	{
+		ssize_t n = recv(s->fd, buf, len, 0);
+		if (n >= 0) return (int)n;
+		if (errno == EINTR) continue;
+
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+	}
+}
+
+
+static bool sess_recv_all(httpd_sess_t* s, void* buf, size_t len)
+{
+	size_t got = 0;
+	while (got < len)
+	{
+		int n = sess_recv(s, (char*)buf + got, len - got);
+		if (n <= 0) return false;
+		got += n;
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Sessions
+
+static httpd_sess_t* sess_find(httpd_data* hd, int fd)
+{
+	for (uint16_t i = 0; i < hd->config.max_open_sockets; i++)
+		if (hd->sess[i].bUsed && hd->sess[i].fd == fd) return &hd->sess[i];
+
+	return NULL;
+}
+
+
+// hd->lock held by the caller
+static void sess_close_locked(httpd_data* hd, httpd_sess_t* s)
+{
+	log_d("Closing session %d", s->fd);
+
+	close(s->fd);
+
+	s->bUsed  = false;
+	s->fd     = -1;
+	s->rlen   = 0;
+	s->bClose = false;
+	s->bAsync = false;
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+	s->bWebsocket = false;
+#endif
+}
+
+
+static void sess_accept(httpd_data* hd)
+{
+	int fd = accept(hd->listenFd, NULL, NULL);
+	if (fd < 0) return;
+
+	struct timeval tv = { hd->config.recv_wait_timeout, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	tv.tv_sec = hd->config.send_wait_timeout;
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	pthread_mutex_lock(&hd->lock);
+
+		httpd_sess_t* s = NULL;
+		for (uint16_t i = 0; i < hd->config.max_open_sockets && !s; i++)
+			if (!hd->sess[i].bUsed) s = &hd->sess[i];
+
+		if (!s)
+		{
+			// only reached with lru_purge_enable, the listener is not polled otherwise
+			httpd_sess_t* lru = NULL;
+			for (uint16_t i = 0; i < hd->config.max_open_sockets; i++)
+				if (!hd->sess[i].bAsync && (!lru || hd->sess[i].lru < lru->lru)) lru = &hd->sess[i];
+
+			if (lru) {
+				log_i("Purging least recently used session %d", lru->fd);
+				sess_close_locked(hd, lru);
+				s = lru;
+			}
+		}
+
+		if (s)
+		{
+			s->bUsed  = true;
+			s->fd     = fd;
+			s->lru    = ++hd->lruCounter;
+			s->rlen   = 0;
+		}
+
+	pthread_mutex_unlock(&hd->lock);
+
+	if (!s) {
+		log_e("No free session for socket %d", fd);
+		close(fd);
+		return;
+	}
+
+	log_d("New session %d", fd);
+}
+
+
+//-----------------------------------------------------------------------------
+// Requests
+
+static httpd_req_aux_t* req_aux(httpd_req_t* req)
+{
+	return (httpd_req_aux_t*)req->aux;
+}
+
+
+static const char* find_header(const std::string& headers, const char* field, size_t* len)
+{
+	size_t flen = strlen(field);
+	size_t pos  = 0;
+
+	while (pos < headers.size())
+	{
+		size_t eol = headers.find("\r\n", pos);
+		if (eol == std::string::npos) eol = headers.size();
+
+		const char* line = headers.c_str() + pos;
+		if (eol - pos > flen && line[flen] == ':' && !strncasecmp(line, field, flen))
+		{
+			const char* v   = line + flen + 1;
+			const char* end = headers.c_str() + eol;
+
+			while (v < end && (*v == ' ' || *v == '\t')) v++;
+			while (end > v && (end[-1] == ' ' || end[-1] == '\t')) end--;
+
+			*len = end - v;
+			return v;
+		}
+
+		pos = eol + 2;
+	}
+
+	return NULL;
+}
+
+
+static esp_err_t resp_send_headers(httpd_req_t* req, const char* extra)
+{
+	httpd_req_aux_t* ra = req_aux(req);
+
+	std::string h = "HTTP/1.1 " + ra->status + "\r\nContent-Type: " + ra->contentType + "\r\n";
+	h += extra;
+
+	for (auto& kv : ra->respHeaders)
+		h += kv.first + ": " + kv.second + "\r\n";
+
+	h += "\r\n";
+
+	ra->bHeadersSent = true;
+
+	return sock_send_all(ra->sess->fd, h.data(), h.size()) < 0 ? ESP_ERR_HTTPD_RESP_SEND : ESP_OK;
+}
+
+
+esp_err_t httpd_resp_set_status(httpd_req_t* req, const char* status)
+{
+	if (!req || !status) return ESP_ERR_INVALID_ARG;
+
+	req_aux(req)->status = status;
+	return ESP_OK;
+}
+
+
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type)
+{
+	if (!req || !type) return ESP_ERR_INVALID_ARG;
+
+	req_aux(req)->contentType = type;
+	return ESP_OK;
+}
+
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t* req, const char* field, const char* value)
+{
+	if (!req || !field || !value) return ESP_ERR_INVALID_ARG;
+
+	httpd_req_aux_t*  ra = req_aux(req);
+	httpd_data*       hd = (httpd_data*)req->handle;
+
+	if (ra->respHeaders.size() >= hd->config.max_resp_headers)
+		return ESP_ERR_HTTPD_RESP_HDR;
+
+	ra->respHeaders.emplace_back(field, value);
+	return ESP_OK;
+}
+
+
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t buf_len)
+{
+	if (!req) return ESP_ERR_INVALID_ARG;
+
+	httpd_req_aux_t* ra = req_aux(req);
+	if (ra->bHeadersSent) return ESP_ERR_HTTPD_RESP_SEND;
+
+	if (buf_len == HTTPD_RESP_USE_STRLEN)
+		buf_len = buf ? strlen(buf) : 0;
+
+	char length[48];
+	snprintf(length, sizeof(length), "Content-Length: %zd\r\n", buf_len);
+
+	esp_err_t res = resp_send_headers(req, length);
+	if (res == ESP_OK && buf_len > 0 && sock_send_all(ra->sess->fd, buf, buf_len) < 0)
+		res = ESP_ERR_HTTPD_RESP_SEND;
+
+	ra->bDone = true;
+
+	return res;
+}
+
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t* req, const char* buf, ssize_t buf_len)
+{
+	if (!req) return ESP_ERR_INVALID_ARG;
+
+	httpd_req_aux_t* ra = req_aux(req);
+	if (ra->bDone) return ESP_ERR_HTTPD_RESP_SEND;
+
+	if (buf_len == HTTPD_RESP_USE_STRLEN)
+		buf_len = buf ? strlen(buf) : 0;
+
+	if (!ra->bHeadersSent)
+	{
+		ra->bChunked = true;
+		if (resp_send_headers(req, "Transfer-Encoding: chunked\r\n") != ESP_OK)
+			return ESP_ERR_HTTPD_RESP_SEND;
+	}
+
+	char size[16];
+	int  n = snprintf(size, sizeof(size), "%zx\r\n", buf_len);
+
+	int fd = ra->sess->fd;
+	if (sock_send_all(fd, size, n) < 0)
+		return ESP_ERR_HTTPD_RESP_SEND;
+
+	if (buf_len > 0 && sock_send_all(fd, buf, buf_len) < 0)
+		return ESP_ERR_HTTPD_RESP_SEND;
+
+	if (sock_send_all(fd, "\r\n", 2) < 0)
+		return ESP_ERR_HTTPD_RESP_SEND;
+
+	if (buf_len == 0)
+		ra->bDone = true;
+
+	return ESP_OK;
+}
+
+
+esp_err_t httpd_resp_send_err(httpd_req_t* req, httpd_err_code_t error, const char* msg)
+{
+	static const struct {
+		const char* status;
+		const char* msg;
+	} errors[HTTPD_ERR_CODE_MAX] = {
+		{ "500 Internal Server Error",            "Server has encountered an unexpected error" },
+		{ "501 Method Not Implemented",           "Server does not support this method" },
+		{ "505 Version Not Supported",            "HTTP version not supported by server" },
+		{ "400 Bad Request",                      "Bad request syntax" },
+		{ "401 Unauthorized",                     "No permission -- see authorization schemes" },
+		{ "403 Forbidden",                        "Request forbidden -- authorization will not help" },
+		{ "404 Not Found",                        "Nothing matches the given URI" },
+		{ "405 Method Not Allowed",               "Specified method is invalid for this resource" },
+		{ "408 Request Timeout",                  "Server closed this connection" },
+		{ "411 Length Required",                  "Client must specify Content-Length" },
+		{ "414 URI Too Long",                     "URI is too long" },
+		{ "431 Request Header Fields Too Large",  "Header fields are too long" },
+	};
+
+	if (!req || error >= HTTPD_ERR_CODE_MAX) return ESP_ERR_INVALID_ARG;
+
+	httpd_resp_set_status(req, errors[error].status);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+
+	esp_err_t res = httpd_resp_send(req, msg ? msg : errors[error].msg, HTTPD_RESP_USE_STRLEN);
+
+	log_w("%s - %s", errors[error].status, msg ? msg : errors[error].msg);
+
+	return res;
+}
+
+
+int httpd_send(httpd_req_t* req, const char* buf, size_t buf_len)
+{
+	if (!req || !buf) return HTTPD_SOCK_ERR_INVALID;
+
+	httpd_req_aux_t* ra = req_aux(req);
+
+	// raw writes carry their own response head
+	ra->bHeadersSent = true;
+	ra->bDone        = true;
+
+	ssize_t n;
+	do {
+		n = send(ra->sess->fd, buf, buf_len, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+
+	return (int)n;
+}
+
+
+int httpd_req_recv(httpd_req_t* req, char* buf, size_t buf_len)
+{
+	if (!req || !buf) return HTTPD_SOCK_ERR_INVALID;
+
+	httpd_req_aux_t* ra = req_aux(req);
+	if (ra->remaining == 0) return 0;
+
+	if (buf_len > ra->remaining) buf_len = ra->remaining;
+
+	int n = sess_recv(ra->sess, buf, buf_len);
+	if (n > 0) ra->remaining -= n;
+
+	return n;
+}
+
+
+int httpd_req_to_sockfd(httpd_req_t* req)
+{
+	return (req && req->aux) ? req_aux(req)->sess->fd : -1;
+}
+
+
+size_t httpd_req_get_url_query_len(httpd_req_t* req)
+{
+	const char* q = req ? strchr(req->uri, '?') : NULL;
+
+	return q ? strlen(q + 1) : 0;
+}
+
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* req, char* buf, size_t buf_len)
+{
+	if (!req || !buf || !buf_len) return ESP_ERR_INVALID_ARG;
+
+	const char* q = strchr(req->uri, '?');
+	if (!q) return ESP_ERR_NOT_FOUND;
+
+	q++;
+	strncpy(buf, q, buf_len - 1);
+	buf[buf_len - 1] = 0;
+
+	return strlen(q) >= buf_len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+
+esp_err_t httpd_query_key_value(const char* qry, const char* key, char* val, size_t val_size)
+{
+	if (!qry || !key || !val || !val_size) return ESP_ERR_INVALID_ARG;
+
+	size_t klen = strlen(key);
+
+	const char* p = qry;
+	while (p && *p)
+	{
+		const char* end = strchr(p, '&');
+		if (!end) end = p + strlen(p);
+
+		const char* eq = (const char*)memchr(p, '=', end - p);
+		if (eq && (size_t)(eq - p) == klen && !strncmp(p, key, klen))
+		{
+			size_t vlen = end - eq - 1;
+			size_t n    = vlen < val_size - 1 ? vlen : val_size - 1;
+
+			memcpy(val, eq + 1, n);
+			val[n] = 0;
+
+			return vlen >= val_size ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+		}
+
+		p = *end ? end + 1 : NULL;
+	}
+
+	return ESP_ERR_NOT_FOUND;
+}
+
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t* req, const char* field)
+{
+	size_t len = 0;
+
+	return (req && field && find_header(req_aux(req)->headers, field, &len)) ? len : 0;
+}
+
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t* req, const char* field, char* val, size_t val_size)
+{
+	if (!req || !field || !val || !val_size) return ESP_ERR_INVALID_ARG;
+
+	size_t      len = 0;
+	const char* v   = find_header(req_aux(req)->headers, field, &len);
+	if (!v) return ESP_ERR_NOT_FOUND;
+
+	size_t n = len < val_size - 1 ? len : val_size - 1;
+	memcpy(val, v, n);
+	val[n] = 0;
+
+	return len >= val_size ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+
+bool httpd_uri_match_wildcard(const char* reference_uri, const char* uri_to_match, size_t match_upto)
+{
+	size_t rlen = strlen(reference_uri);
+
+	if (rlen && reference_uri[rlen - 1] == '*')
+	{
+		// "/path/*" also matches "/path"
+		size_t plen = rlen - 1;
+		if (plen && reference_uri[plen - 1] == '/' && match_upto == plen - 1)
+			plen--;
+
+		return match_upto >= plen && !strncmp(reference_uri, uri_to_match, plen);
+	}
+
+	if (rlen && reference_uri[rlen - 1] == '?')
+	{
+		// trailing character optional
+		rlen--;
+		return (match_upto == rlen || match_upto == rlen + 1) && !strncmp(reference_uri, uri_to_match, rlen);
+	}
+
+	return match_upto == rlen && !strncmp(reference_uri, uri_to_match, rlen);
+}
+
+
+//-----------------------------------------------------------------------------
+// Async requests
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t* req, httpd_req_t** out)
+{
+	if (!req || !out) return ESP_ERR_INVALID_ARG;
+
+	httpd_req_t* copy = (httpd_req_t*)calloc(1, sizeof(httpd_req_t));
+	if (!copy) return ESP_ERR_NO_MEM;
+
+	memcpy((void*)copy, req, sizeof(httpd_req_t));
+	copy->aux = new httpd_req_aux_t(*req_aux(req));
+
+	httpd_data* hd = (httpd_data*)req->handle;
+
+	pthread_mutex_lock(&hd->lock);
+		req_aux(req)->sess->bAsync = true;
+	pthread_mutex_unlock(&hd->lock);
+
+	req_aux(req)->bHandedOff = true;
+
+	*out = copy;
+	return ESP_OK;
+}
+
+
+static void req_purge(httpd_req_t* req)
+{
+	char buf[512];
+
+	httpd_req_aux_t* ra = req_aux(req);
+	while (ra->remaining)
+	{
+		int n = httpd_req_recv(req, buf, sizeof(buf));
+		if (n <= 0) {
+			ra->bKeepAlive = false;
+			break;
+		}
+	}
+}
+
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t* req)
+{
+	if (!req) return ESP_ERR_INVALID_ARG;
+
+	httpd_data*      hd = (httpd_data*)req->handle;
+	httpd_req_aux_t* ra = req_aux(req);
+
+	req_purge(req);
+
+	pthread_mutex_lock(&hd->lock);
+
+		ra->sess->bAsync = false;
+		if (!ra->bKeepAlive || (ra->bHeadersSent && !ra->bDone))
+			ra->sess->bClose = true;
+
+	pthread_mutex_unlock(&hd->lock);
+
+	httpd_wake(hd);
+
+	delete ra;
+	free(req);
+
+	return ESP_OK;
+}
+
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+	httpd_data* hd = (httpd_data*)handle;
+	if (!hd) return ESP_ERR_INVALID_ARG;
+
+	pthread_mutex_lock(&hd->lock);
+		httpd_sess_t* s = sess_find(hd, sockfd);
+		if (s) s->bClose = true;
+	pthread_mutex_unlock(&hd->lock);
+
+	if (!s) return ESP_ERR_NOT_FOUND;
+
+	httpd_wake(hd);
+	return ESP_OK;
+}
+
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void* arg)
+{
+	httpd_data* hd = (httpd_data*)handle;
+	if (!hd || !work) return ESP_ERR_INVALID_ARG;
+
+	pthread_mutex_lock(&hd->lock);
+		hd->work.push_back({ work, arg });
+	pthread_mutex_unlock(&hd->lock);
+
+	httpd_wake(hd);
+	return ESP_OK;
+}
+
+
+void* httpd_get_global_user_ctx(httpd_handle_t handle)
+{
+	return handle ? ((httpd_data*)handle)->config.global_user_ctx : NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// WebSocket
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+
+static void sha1(const uint8_t* data, size_t len, uint8_t digest[20])
+{
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+	// message, 0x80, zero padding and the bit length
+	std::vector<uint8_t> m(data, data + len);
+	m.push_back(0x80);
+	while (m.size() % 64 != 56) m.push_back(0);
+
+	uint64_t bits = (uint64_t)len * 8;
+	for (int i = 7; i >= 0; i--) m.push_back((uint8_t)(bits >> (i * 8)));
+
+	for (size_t chunk = 0; chunk < m.size(); chunk += 64)
+	{
+		uint32_t w[80];
+		for (int i = 0; i < 16; i++)
+			w[i] = (m[chunk + i * 4] << 24) | (m[chunk + i * 4 + 1] << 16) | (m[chunk + i * 4 + 2] << 8) | m[chunk + i * 4 + 3];
+
+		for (int i = 16; i < 80; i++) {
+			uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+			w[i] = (x << 1) | (x >> 31);
+		}
+
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+		for (int i = 0; i < 80; i++)
+		{
+			uint32_t f, k;
+			if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+			else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+			else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+			else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+
+			uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = (b << 30) | (b >> 2);
+			b = a;
+			a = t;
+		}
+
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+
+	for (int i = 0; i < 20; i++)
+		digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+}
+
+
+static std::string base64(const uint8_t* data, size_t len)
+{
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	std::string out;
+	for (size_t i = 0; i < len; i += 3)
+	{
+		uint32_t v = data[i] << 16;
+		if (i + 1 < len) v |= data[i + 1] << 8;
+		if (i + 2 < len) v |= data[i + 2];
+
+		out += table[(v >> 18) & 0x3F];
+		out += table[(v >> 12) & 0x3F];
+		out += (i + 1 < len) ? table[(v >> 6) & 0x3F] : '=';
+		out += (i + 2 < len) ? table[v & 0x3F] : '=';
+	}
+
+	return out;
+}
+
+
+static esp_err_t ws_handshake(httpd_req_t* req, const httpd_uri_t& uri)
+{
+	char key[64];
+	if (httpd_req_get_hdr_value_str(req, "Sec-WebSocket-Key", key, sizeof(key)) != ESP_OK)
+		return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Sec-WebSocket-Key missing");
+
+	std::string accept = std::string(key) + WS_GUID;
+
+	uint8_t digest[20];
+	sha1((const uint8_t*)accept.data(), accept.size(), digest);
+
+	std::string resp = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+	                   "Sec-WebSocket-Accept: " + base64(digest, sizeof(digest)) + "\r\n";
+
+	if (uri.supported_subprotocol)
+		resp += std::string("Sec-WebSocket-Protocol: ") + uri.supported_subprotocol + "\r\n";
+
+	resp += "\r\n";
+
+	httpd_req_aux_t* ra = req_aux(req);
+	ra->bHeadersSent = true;
+	ra->bDone        = true;
+
+	return sock_send_all(ra->sess->fd, resp.data(), resp.size()) < 0 ? ESP_FAIL : ESP_OK;
+}
+
+
+static esp_err_t ws_send(httpd_sess_t* s, httpd_ws_frame_t* frame)
+{
+	uint8_t header[10];
+	size_t  hlen = 2;
+
+	header[0] = (frame->fragmented ? (frame->final ? 0x80 : 0) : 0x80) | (frame->type & 0x0F);
+
+	if (frame->len < 126)
+		header[1] = (uint8_t)frame->len;
+	else if (frame->len <= 0xFFFF) {
+		header[1] = 126;
+		header[2] = (uint8_t)(frame->len >> 8);
+		header[3] = (uint8_t)frame->len;
+		hlen = 4;
+	}
+	else {
+		header[1] = 127;
+		for (int i = 0; i < 8; i++) header[2 + i] = (uint8_t)((uint64_t)frame->len >> ((7 - i) * 8));
+		hlen = 10;
+	}
+
+	pthread_mutex_lock(&s->wsSendLock);
+
+		int res = sock_send_all(s->fd, (const char*)header, hlen);
+		if (res >= 0 && frame->len)
+			res = sock_send_all(s->fd, (const char*)frame->payload, frame->len);
+
+	pthread_mutex_unlock(&s->wsSendLock);
+
+	return res < 0 ? ESP_FAIL : ESP_OK;
+}
+
+
+// Reads the next frame header into the session
+static bool ws_read_header(httpd_sess_t* s)
+{
+	uint8_t h[2];
+	if (!sess_recv_all(s, h, 2)) return false;
+
+	s->wsFinal  = h[0] & 0x80;
+	s->wsType   = (httpd_ws_type_t)(h[0] & 0x0F);
+	s->wsMasked = h[1] & 0x80;
+	s->wsLen    = h[1] & 0x7F;
+	s->wsRead   = 0;
+
+	if (s->wsLen == 126)
+	{
+		uint8_t ext[2];
+		if (!sess_recv_all(s, ext, 2)) return false;
+		s->wsLen = (ext[0] << 8) | ext[1];
+	}
+	else if (s->wsLen == 127)
+	{
+		uint8_t ext[8];
+		if (!sess_recv_all(s, ext, 8)) return false;
+
+		s->wsLen = 0;
+		for (int i = 0; i < 8; i++) s->wsLen = (s->wsLen << 8) | ext[i];
+	}
+
+	if (s->wsMasked && !sess_recv_all(s, s->wsMask, 4)) return false;
+
+	return true;
+}
+
+
+static bool ws_read_payload(httpd_sess_t* s, uint8_t* buf, size_t len)
+{
+	if (!sess_recv_all(s, buf, len)) return false;
+
+	if (s->wsMasked)
+		for (size_t i = 0; i < len; i++) buf[i] ^= s->wsMask[(s->wsRead + i) & 3];
+
+	s->wsRead += len;
+
+	return true;
+}
+
+
+static void ws_skip_payload(httpd_sess_t* s)
+{
+	uint8_t buf[256];
+
+	while (s->wsRead < s->wsLen)
+	{
+		size_t n = s->wsLen - s->wsRead < sizeof(buf) ? s->wsLen - s->wsRead : sizeof(buf);
+		if (!ws_read_payload(s, buf, n)) break;
+	}
+}
+
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t* req, httpd_ws_frame_t* frame, size_t max_len)
+{
+	if (!req || !frame) return ESP_ERR_INVALID_ARG;
+
+	httpd_sess_t* s = req_aux(req)->sess;
+
+	frame->type       = s->wsType;
+	frame->final      = s->wsFinal;
+	frame->fragmented = !s->wsFinal || s->wsType == HTTPD_WS_TYPE_CONTINUE;
+	frame->len        = s->wsLen;
+
+	// length only
+	if (max_len == 0) return ESP_OK;
+
+	if (max_len < s->wsLen || !frame->payload) return ESP_ERR_INVALID_SIZE;
+
+	return ws_read_payload(s, frame->payload, s->wsLen - s->wsRead) ? ESP_OK : ESP_FAIL;
+}
+
+
+esp_err_t httpd_ws_send_frame(httpd_req_t* req, httpd_ws_frame_t* frame)
+{
+	if (!req || !frame) return ESP_ERR_INVALID_ARG;
+
+	return ws_send(req_aux(req)->sess, frame);
+}
+
+
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t handle, int fd, httpd_ws_frame_t* frame)
+{
+	httpd_data* hd = (httpd_data*)handle;
+	if (!hd || !frame) return ESP_ERR_INVALID_ARG;
+
+	pthread_mutex_lock(&hd->lock);
+		httpd_sess_t* s = sess_find(hd, fd);
+		bool bWebsocket = s && s->bWebsocket;
+	pthread_mutex_unlock(&hd->lock);
+
+	if (!bWebsocket) return ESP_FAIL;
+
+	return ws_send(s, frame);
+}
+
+
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t handle, int fd)
+{
+	httpd_data* hd = (httpd_data*)handle;
+	if (!hd) return HTTPD_WS_CLIENT_INVALID;
+
+	pthread_mutex_lock(&hd->lock);
+		httpd_sess_t* s = sess_find(hd, fd);
+		httpd_ws_client_info_t info = !s ? HTTPD_WS_CLIENT_INVALID :
+		                              s->bWebsocket ? HTTPD_WS_CLIENT_WEBSOCKET : HTTPD_WS_CLIENT_HTTP;
+	pthread_mutex_unlock(&hd->lock);
+
+	return info;
+}
+
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Server task
+
+static httpd_req_t* req_new(httpd_data* hd, httpd_sess_t* s)
+{
+	httpd_req_t* req = (httpd_req_t*)calloc(1, sizeof(httpd_req_t));
+	if (!req) return NULL;
+
+	httpd_req_aux_t* ra = new httpd_req_aux_t();
+	ra->sess        = s;
+	ra->remaining   = 0;
+	ra->bKeepAlive  = true;
+	ra->status      = HTTPD_200;
+	ra->contentType = HTTPD_TYPE_TEXT;
+	ra->bHeadersSent = false;
+	ra->bChunked    = false;
+	ra->bDone       = false;
+	ra->bHandedOff  = false;
+
+	req->handle = hd;
+	req->aux    = ra;
+
+	return req;
+}
+
+
+static void req_delete(httpd_req_t* req)
+{
+	delete req_aux(req);
+	free(req);
+}
+
+
+static int parse_method(const char* m, size_t len)
+{
+	static const struct { const char* name; int method; } methods[] = {
+		{ "GET", HTTP_GET }, { "POST", HTTP_POST }, { "PUT", HTTP_PUT },
+		{ "DELETE", HTTP_DELETE }, { "HEAD", HTTP_HEAD }, { "OPTIONS", HTTP_OPTIONS }
+	};
+
+	for (auto& e : methods)
+		if (strlen(e.name) == len && !strncmp(e.name, m, len)) return e.method;
+
+	return -1;
+}
+
+
+static const httpd_uri_t* uri_find(httpd_data* hd, const char* uri, size_t len, int method, bool* bPathMatched)
+{
+	*bPathMatched = false;
+
+	for (auto& u : hd->uris)
+	{
+		bool bMatch = hd->config.uri_match_fn ? hd->config.uri_match_fn(u.uri, uri, len)
+		                                      : (strlen(u.uri) == len && !strncmp(u.uri, uri, len));
+		if (!bMatch) continue;
+
+		*bPathMatched = true;
+		if ((int)u.method == method) return &u;
+	}
+
+	return NULL;
+}
+
+
+// Handles one request or WebSocket frame of a readable session
+// Returns false if the session is to be closed
+static bool sess_process(httpd_data* hd, httpd_sess_t* s)
+{
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+	if (s->bWebsocket)
+	{
+		if (!ws_read_header(s)) return false;
+
+		const httpd_uri_t& uri = hd->uris[s->wsUri];
+
+		if (!uri.handle_ws_control_frames)
+		{
+			if (s->wsType == HTTPD_WS_TYPE_CLOSE)
+			{
+				httpd_ws_frame_t frame = {};
+				frame.type = HTTPD_WS_TYPE_CLOSE;
+				ws_send(s, &frame);
+				return false;
+			}
+
+			if (s->wsType == HTTPD_WS_TYPE_PING || s->wsType == HTTPD_WS_TYPE_PONG)
+			{
+				std::vector<uint8_t> payload(s->wsLen);
+				if (!ws_read_payload(s, payload.data(), payload.size())) return false;
+
+				if (s->wsType == HTTPD_WS_TYPE_PING)
+				{
+					httpd_ws_frame_t frame = {};
+					frame.type    = HTTPD_WS_TYPE_PONG;
+					frame.payload = payload.data();
+					frame.len     = payload.size();
+					ws_send(s, &frame);
+				}
+				return true;
+			}
+		}
+
+		httpd_req_t* req = req_new(hd, s);
+		if (!req) return false;
+
+		strncpy((char*)req->uri, uri.uri, HTTPD_MAX_URI_LEN);
+		req->method   = 0;
+		req->user_ctx = uri.user_ctx;
+
+		esp_err_t res = uri.handler(req);
+
+		// payload the handler did not take
+		ws_skip_payload(s);
+
+		req_delete(req);
+
+		return res == ESP_OK;
+	}
+#endif
+
+	// request line and headers
+	char* end = NULL;
+	while (!(end = (char*)memmem(s->rbuf, s->rlen, "\r\n\r\n", 4)))
+	{
+		if (s->rlen == sizeof(s->rbuf))
+		{
+			log_e("Request headers too long on %d", s->fd);
+			return false;
+		}
+
+		ssize_t n = recv(s->fd, s->rbuf + s->rlen, sizeof(s->rbuf) - s->rlen, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;		// closed by the client or timed out
+
+		s->rlen += n;
+	}
+
+	size_t headLen = end + 4 - s->rbuf;
+	std::string head(s->rbuf, headLen);
+
+	memmove(s->rbuf, s->rbuf + headLen, s->rlen - headLen);
+	s->rlen -= headLen;
+
+	httpd_req_t* req = req_new(hd, s);
+	if (!req) return false;
+
+	httpd_req_aux_t* ra = req_aux(req);
+
+	size_t lineEnd = head.find("\r\n");
+	std::string line = head.substr(0, lineEnd);
+	ra->headers = head.substr(lineEnd + 2);
+
+	size_t sp1 = line.find(' ');
+	size_t sp2 = line.find(' ', sp1 + 1);
+	if (sp1 == std::string::npos || sp2 == std::string::npos)
+	{
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, NULL);
+		req_delete(req);
+		return false;
+	}
+
+	std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+	if (target.size() > HTTPD_MAX_URI_LEN)
+	{
+		httpd_resp_send_err(req, HTTPD_414_URI_TOO_LONG, NULL);
+		req_delete(req);
+		return false;
+	}
+
+	strcpy((char*)req->uri, target.c_str());
+	req->method = parse_method(line.c_str(), sp1);
+
+	size_t      len = 0;
+	const char* v   = find_header(ra->headers, "Content-Length", &len);
+	req->content_len = v ? strtoul(std::string(v, len).c_str(), NULL, 10) : 0;
+	ra->remaining    = req->content_len;
+
+	v = find_header(ra->headers, "Connection", &len);
+	if ((v && len == 5 && !strncasecmp(v, "close", 5)) || line.compare(sp2 + 1, 8, "HTTP/1.0") == 0)
+		ra->bKeepAlive = false;
+
+	log_d("%.*s on %d", (int)line.size(), line.c_str(), s->fd);
+
+	size_t pathLen = target.find('?');
+	if (pathLen == std::string::npos) pathLen = target.size();
+
+	bool bPathMatched = false;
+	const httpd_uri_t* uri = req->method < 0 ? NULL : uri_find(hd, req->uri, pathLen, req->method, &bPathMatched);
+
+	esp_err_t res = ESP_OK;
+
+	if (req->method < 0)
+		res = httpd_resp_send_err(req, HTTPD_501_METHOD_NOT_IMPLEMENTED, NULL);
+	else if (!uri)
+		res = httpd_resp_send_err(req, bPathMatched ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND, NULL);
+	else
+	{
+		req->user_ctx = uri->user_ctx;
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+		v = find_header(ra->headers, "Upgrade", &len);
+		if (uri->is_websocket && v && len == 9 && !strncasecmp(v, "websocket", 9))
+		{
+			res = ws_handshake(req, *uri);
+			if (res == ESP_OK)
+			{
+				pthread_mutex_lock(&hd->lock);
+					s->bWebsocket = true;
+					s->wsUri      = uri - hd->uris.data();
+				pthread_mutex_unlock(&hd->lock);
+
+				res = uri->handler(req);
+			}
+
+			req_delete(req);
+			return res == ESP_OK;
+		}
+#endif
+
+		res = uri->handler(req);
+	}
+
+	if (ra->bHandedOff)
+	{
+		// the async copy owns the session now
+		req_delete(req);
+		return true;
+	}
+
+	req_purge(req);
+
+	// a response cut short leaves the client waiting for bytes that never come
+	bool bKeep = res == ESP_OK && ra->bKeepAlive && !(ra->bHeadersSent && !ra->bDone);
+
+	req_delete(req);
+
+	return bKeep;
+}
+
+
+static void httpd_server_task(void* arg)
+{
+	httpd_data* hd = (httpd_data*)arg;
+
+	std::vector<struct pollfd> fds;
+	std::vector<httpd_sess_t*> polled;
+
+	while (true)
+	{
+		fds.clear();
+		polled.clear();
+
+		fds.push_back({ hd->wakeFd[0], POLLIN, 0 });
+
+		bool bFree = hd->config.lru_purge_enable;
+
+		pthread_mutex_lock(&hd->lock);
+
+			for (uint16_t i = 0; i < hd->config.max_open_sockets; i++)
+			{
+				httpd_sess_t* s = &hd->sess[i];
+
+				if (!s->bUsed) {
+					bFree = true;
+					continue;
+				}
+
+				if (s->bAsync) continue;
+
+				if (s->bClose) {
+					sess_close_locked(hd, s);
+					bFree = true;
+					continue;
+				}
+
+				fds.push_back({ s->fd, POLLIN, 0 });
+				polled.push_back(s);
+			}
+
+			std::vector<httpd_work_t> work;
+			work.swap(hd->work);
+
+		pthread_mutex_unlock(&hd->lock);
+
+		for (auto& w : work) w.fn(w.arg);
+
+		// connections wait in the backlog while all sessions are taken
+		size_t listenIdx = fds.size();
+		if (bFree) fds.push_back({ hd->listenFd, POLLIN, 0 });
+
+		if (poll(fds.data(), fds.size(), -1) < 0)
+		{
+			if (errno == EINTR) continue;
+			log_e("poll failed: %s", strerror(errno));
+			vTaskDelay(pdMS_TO_TICKS(100));
+			continue;
+		}
+
+		if (fds[0].revents)
+		{
+			char buf[64];
+			while (read(hd->wakeFd[0], buf, sizeof(buf)) == sizeof(buf)) {}
+		}
+
+		for (size_t i = 0; i < polled.size(); i++)
+		{
+			if (!fds[i + 1].revents) continue;
+
+			httpd_sess_t* s = polled[i];
+			s->lru = ++hd->lruCounter;
+
+			bool bKeep = sess_process(hd, s);
+
+			// pipelined requests already buffered are served right away
+			while (bKeep && s->rlen && !s->bAsync && !s->bClose)
+				bKeep = sess_process(hd, s);
+
+			if (!bKeep)
+			{
+				pthread_mutex_lock(&hd->lock);
+					if (s->bAsync) s->bClose = true;
+					else sess_close_locked(hd, s);
+				pthread_mutex_unlock(&hd->lock);
+			}
+		}
+
+		if (listenIdx < fds.size() && fds[listenIdx].revents)
+			sess_accept(hd);
+	}
+}
+
+
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config)
+{
+	if (!handle || !config) return ESP_ERR_INVALID_ARG;
+
+	httpd_data* hd = new httpd_data();
+	hd->config     = *config;
+	hd->lruCounter = 0;
+
+	if (shimPort) hd->config.server_port = shimPort;
+
+	hd->sess = (httpd_sess_t*)calloc(hd->config.max_open_sockets, sizeof(httpd_sess_t));
+	for (uint16_t i = 0; i < hd->config.max_open_sockets; i++) {
+		hd->sess[i].fd = -1;
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+		pthread_mutex_init(&hd->sess[i].wsSendLock, NULL);
+#endif
+	}
+
+	pthread_mutex_init(&hd->lock, NULL);
+
+	hd->listenFd = socket(AF_INET6, SOCK_STREAM, 0);
+	if (hd->listenFd < 0) {
+		log_e("socket: %s", strerror(errno));
+		return ESP_FAIL;
+	}
+
+	int on = 1, off = 0;
+	setsockopt(hd->listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(hd->listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+	struct sockaddr_in6 addr = {};
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr   = in6addr_any;
+	addr.sin6_port   = htons(hd->config.server_port);
+
+	if (bind(hd->listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(hd->listenFd, hd->config.backlog_conn) < 0)
+	{
+		log_e("Port %u: %s", hd->config.server_port, strerror(errno));
+		close(hd->listenFd);
+		return ESP_FAIL;
+	}
+
+	if (pipe(hd->wakeFd) < 0) {
+		close(hd->listenFd);
+		return ESP_FAIL;
+	}
+	fcntl(hd->wakeFd[0], F_SETFL, O_NONBLOCK);
+	fcntl(hd->wakeFd[1], F_SETFL, O_NONBLOCK);
+
+	if (xTaskCreatePinnedToCore(httpd_server_task, "httpd", hd->config.stack_size, hd,
+	                            hd->config.task_priority, &hd->task, hd->config.core_id) != pdPASS)
+	{
+		close(hd->listenFd);
+		return ESP_ERR_HTTPD_TASK;
+	}
+
+	log_i("Listening on port %u", hd->config.server_port);
+
+	*handle = hd;
+	return ESP_OK;
+}
+
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+	// the stand-in serves until it exits
+	return ESP_ERR_NOT_SUPPORTED;
+}
+
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri_handler)
+{
+	httpd_data* hd = (httpd_data*)handle;
+	if (!hd || !uri_handler || !uri_handler->uri) return ESP_ERR_INVALID_ARG;
+
+	for (auto& u : hd->uris)
+		if (u.method == uri_handler->method && !strcmp(u.uri, uri_handler->uri))
+			return ESP_ERR_HTTPD_HANDLER_EXISTS;
+
+	if (hd->uris.size() >= hd->config.max_uri_handlers)
+	{
+		log_e("No slot left for %s", uri_handler->uri);
+		return ESP_ERR_HTTPD_HANDLERS_FULL;
+	}
+
+	// registration happens before the first request, the vectors do not move afterwards
+	hd->uriStrings.reserve(hd->config.max_uri_handlers);
+	hd->uris.reserve(hd->config.max_uri_handlers);
+
+	hd->uriStrings.push_back(uri_handler->uri);
+	hd->uris.push_back(*uri_handler);
+	hd->uris.back().uri = hd->uriStrings.back().c_str();
+
+	log_d("Registered %s", uri_handler->uri);
+
+	return ESP_OK;
+}
@@ -0,0 +1,548 @@
+
+#include "standin.h"
+#include "MLX90640_API.h"
+#include "MLX90640_calibration.h"
+#include "httpd_recorder.h"
+#include "trace.h"
+#include <Arduino.h>
+
+#include <math.h>
+#include <vector>
+
+
+// MLX90640 replaced by recorded frames
+// Same class as MLX90640_API.cpp, frames come from the recording instead of I2C and CalculateTo,
+// publishing (user offsets, calibration accumulation, statistics) is the device code path
+
+float mlx90640_float_frame[MLX90640_pixelCOUNT]   = {0.0};
+float mlx90640_float_offsets[MLX90640_pixelCOUNT] = {0.0};
+
+typedef struct {
+	float             raw[MLX90640_pixelCOUNT];
+	float             values[MLX90640_pixelCOUNT];
+	uint16_t          ck[MLX90640_pixelCOUNT];
+	mlx_frame_stats_t stats;
+} mlx_pub_slot_t;
+
+static mlx_pub_slot_t* mlx90640_pub = NULL;
+
+typedef struct {
+	float    values[MLX90640_pixelCOUNT];
+	float    fTa;
+	float    fVdd;
+	uint8_t  subpage;
+} standin_mlx_frame_t;
+
+static std::vector<standin_mlx_frame_t> mlxFrames;
+static size_t                           mlxIndex = 0;
+
+// subpages per second of the refresh rate codes
+static const float mlxRefreshHz[8] = { 0.5f, 1, 2, 4, 8, 16, 32, 64 };
+static uint8_t     mlxRefreshRate  = MLX90640_REFRESH_RATE_2HZ;
+static int64_t     mlxNextUs       = 0;
+static uint16_t    mlxCtrlReg1     = 0x1901;	// chess mode, 18 bit ADC, 2Hz
+
+
+static bool read_file(const char* path, std::vector<uint8_t>& data)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+
+	uint8_t buf[65536];
+	size_t  n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.insert(data.end(), buf, buf + n);
+
+	fclose(f);
+	return true;
+}
+
+
+// Frame envelopes followed by i16 (centi-kelvin) or f32 payloads, records back to back
+static void parse_envelopes(const std::vector<uint8_t>& data)
+{
+	size_t pos = 0;
+	while (pos + sizeof(frame_envelope_t) <= data.size())
+	{
+		frame_envelope_t env;
+		memcpy(&env, &data[pos], sizeof(env));
+
+		if (env.magic != FRAME_ENVELOPE_MAGIC || env.headerLen < sizeof(env)) {
+			log_e("Bad record at byte %u", (unsigned)pos);
+			return;
+		}
+
+		size_t payload = pos + env.headerLen;
+		if (payload + env.payloadLen > data.size()) break;
+
+		standin_mlx_frame_t frame;
+		frame.fTa     = env.fTa;
+		frame.fVdd    = env.fVdd;
+		frame.subpage = env.subpage;
+
+		bool bThermal = env.source == FRAME_SOURCE_MLX90640;
+
+		if (bThermal && env.payloadLen == MLX90640_pixelCOUNT * sizeof(uint16_t))
+		{
+			for (uint16_t i = 0; i < MLX90640_pixelCOUNT; i++) {
+				uint16_t ck;
+				memcpy(&ck, &data[payload + i * sizeof(ck)], sizeof(ck));
+				frame.values[i] = ck / 100.0f - 273.15f;
+			}
+			mlxFrames.push_back(frame);
+		}
+		else if (bThermal && env.payloadLen == MLX90640_pixelCOUNT * sizeof(float))
+		{
+			memcpy(frame.values, &data[payload], sizeof(frame.values));
+			mlxFrames.push_back(frame);
+		}
+
+		pos = payload + env.payloadLen;
+	}
+}
+
+
+// Room background with a warm spot circling the field of view
+static void synth_frames(int count)
+{
+	for (int n = 0; n < count; n++)
+	{
+		standin_mlx_frame_t frame;
+		frame.fTa     = 30.0f;
+		frame.fVdd    = 3.3f;
+		frame.subpage = 1;
+
+		float a  = 2.0f * (float)M_PI * n / count;
+		float cx = 16.0f + 9.0f * cosf(a);
+		float cy = 12.0f + 6.0f * sinf(a);
+
+		for (uint16_t i = 0; i < MLX90640_pixelCOUNT; i++)
+		{
+			float x  = i % 32;
+			float y  = i / 32;
+			float d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+
+			frame.values[i] = 21.0f + y * 0.08f + 14.0f * expf(-d2 / 8.0f) + ((i * 7919 + n * 104729) % 13) * 0.02f;
+		}
+
+		mlxFrames.push_back(frame);
+	}
+}
+
+
+bool standin_mlx_load(const char* source)
+{
+	if (!source)
+	{
+		synth_frames(64);
+		log_i("No thermal recording, %u synthetic frames", (unsigned)mlxFrames.size());
+		return true;
+	}
+
+	std::vector<uint8_t> data;
+	if (!read_file(source, data)) {
+		log_e("Cannot read %s", source);
+		return false;
+	}
+
+	uint32_t magic = 0;
+	if (data.size() >= sizeof(magic)) memcpy(&magic, data.data(), sizeof(magic));
+
+	if (magic == FRAME_ENVELOPE_MAGIC)
+		parse_envelopes(data);
+	else
+	{
+		// float32 frames of mlxdelta decode
+		standin_mlx_frame_t frame;
+		frame.fTa     = 30.0f;
+		frame.fVdd    = 3.3f;
+		frame.subpage = 1;
+
+		for (size_t pos = 0; pos + sizeof(frame.values) <= data.size(); pos += sizeof(frame.values)) {
+			memcpy(frame.values, &data[pos], sizeof(frame.values));
+			mlxFrames.push_back(frame);
+		}
+	}
+
+	if (mlxFrames.empty()) {
+		log_e("No thermal frames in %s", source);
+		return false;
+	}
+
+	log_i("%u thermal frames from %s", (unsigned)mlxFrames.size(), source);
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+
+MLX90640::MLX90640()
+{
+	bOnline				= false;
+	uiSlaveAddr			= 0;
+
+	fTambientReflected	= 20.0f;
+	fEmissivity			= 0.95f;
+
+	bMLXfastRefreshRate = 1;
+
+	iFrame_delayMS		= 0.8 * 1000 / 2;
+
+	mlx90640_pub = (mlx_pub_slot_t*)ps_malloc(MLX90640_FB_COUNT * sizeof(mlx_pub_slot_t));
+
+	mlxMutex  = xSemaphoreCreateMutex();
+	fbMutex   = xSemaphoreCreateMutex();
+	fbFreeSem = xSemaphoreCreateCounting(MLX90640_FB_COUNT, MLX90640_FB_COUNT);
+
+	for (uint8_t i = 0; i < MLX90640_FB_COUNT; i++)
+		fbSlotBusy[i] = false;
+
+	fbSeq        = 0;
+	frameReadyUs = 0;
+	frameSubpage = 0;
+	frameTa      = 0.0f;
+	frameVdd     = 0.0f;
+}
+
+
+MLX90640& MLX90640::getInstance()
+{
+	static MLX90640 instance;
+	return instance;
+}
+
+
+int MLX90640::MLX90640_Init(uint8_t _slaveAddr)
+{
+	uiSlaveAddr = _slaveAddr;
+
+	// online once a recording is loaded
+	bOnline = !mlxFrames.empty();
+
+	return bOnline ? 0 : -3;
+}
+
+
+bool MLX90640::IsOnline()
+{
+	return bOnline;
+}
+
+
+int MLX90640::DumpEE_(uint16_t *eeData)
+{
+	return -1;
+}
+
+
+// Waits until two subpages of the refresh rate have passed and converts the next recorded frame
+int MLX90640::GetFrameData_(uint16_t *frameData)
+{
+	int64_t period = (int64_t)(2 * 1000000 / mlxRefreshHz[mlxRefreshRate]);
+	int64_t now    = esp_timer_get_time();
+
+	if (mlxNextUs < now - period) mlxNextUs = now;
+
+	int64_t waitUs = mlxNextUs - now;
+	mlxNextUs += period;
+
+	if (waitUs > 0) delay((waitUs + 999) / 1000);
+
+	const standin_mlx_frame_t& frame = mlxFrames[mlxIndex];
+	mlxIndex = (mlxIndex + 1) % mlxFrames.size();
+
+	memcpy(mlx90640_float_frame, frame.values, sizeof(mlx90640_float_frame));
+
+	frameTa      = frame.fTa;
+	frameVdd     = frame.fVdd;
+	frameSubpage = frame.subpage;
+
+	return frame.subpage;
+}
+
+
+mlx_fb_t MLX90640::fb_get()
+{
+	mlx_fb_t fb = {};
+	fb.slot = -1;
+
+	xSemaphoreTake(fbFreeSem, portMAX_DELAY);
+
+	xSemaphoreTake(fbMutex, portMAX_DELAY);
+
+		if (bOnline)
+		{
+			int64_t readUs = esp_timer_get_time();
+
+			GetFrameData_(NULL);
+
+			frameReadyUs = esp_timer_get_time();
+
+			trace_span(TRACE_MLX, TRACE_LANE_CAPTURE, "i2c_read", fbSeq, readUs, frameReadyUs);
+		}
+		else
+			frameReadyUs = esp_timer_get_time();
+
+		int64_t publishUs = esp_timer_get_time();
+
+		PublishFrame_(fb);
+
+		trace_span(TRACE_MLX, TRACE_LANE_PROCESS, "calibrate", fb.seq, publishUs, esp_timer_get_time());
+
+	xSemaphoreGive(fbMutex);
+
+	return fb;
+}
+
+
+// Same as MLX90640_API.cpp
+void MLX90640::PublishFrame_(mlx_fb_t& fb)
+{
+	int8_t slot = 0;
+	while (fbSlotBusy[slot]) slot++;
+
+	fbSlotBusy[slot] = true;
+
+	MLXcalibration::accumulateUserCalibrationFrame(mlx90640_float_frame, fTambientReflected);
+
+	float* raw    = mlx90640_pub[slot].raw;
+	float* values = mlx90640_pub[slot].values;
+	uint16_t* ck  = mlx90640_pub[slot].ck;
+
+	mlx_frame_stats_t& stats = mlx90640_pub[slot].stats;
+
+	MLXagc::begin(stats);
+
+	if (MLXcalibration::getUserCalibrationOffsetsEnabled())
+	{
+		for (uint16_t i = 0; i < MLX90640_pixelCOUNT; i++) {
+			float fValue = mlx90640_float_frame[i];
+
+			raw[i]    = fValue;
+			fValue   -= mlx90640_float_offsets[i];
+			values[i] = fValue;
+			ck[i]     = MLX90640_centiKelvin(fValue);
+
+			MLXagc::accumulate(stats, fValue, i);
+		}
+	}
+	else
+	{
+		for (uint16_t i = 0; i < MLX90640_pixelCOUNT; i++) {
+			float fValue = mlx90640_float_frame[i];
+
+			raw[i] = fValue;
+			ck[i]  = MLX90640_centiKelvin(fValue);
+
+			MLXagc::accumulate(stats, fValue, i);
+		}
+		values = raw;
+	}
+
+	MLXagc::end(stats, MLX90640_pixelCOUNT);
+
+	uint64_t us = (uint64_t)frameReadyUs;
+	fb.timestamp.tv_sec  = us / 1000000UL;
+	fb.timestamp.tv_usec = us % 1000000UL;
+
+	fb.width    = 32;
+	fb.height   = 24;
+	fb.values   = values;
+	fb.raw      = raw;
+	fb.offsets  = mlx90640_float_offsets;
+	fb.stats    = &stats;
+	fb.centiKelvin = ck;
+	fb.nBytes   = fb.width * fb.height * sizeof(float);
+	fb.fTambientReflected = fTambientReflected;
+	fb.fEmissivity = fEmissivity;
+	fb.fTa      = frameTa;
+	fb.fVdd     = frameVdd;
+	fb.seq      = fbSeq++;
+	fb.subpage  = frameSubpage;
+	fb.slot     = slot;
+}
+
+
+void MLX90640::fb_return(mlx_fb_t& fb)
+{
+	if (fb.slot >= 0)
+	{
+		fbSlotBusy[fb.slot] = false;
+		xSemaphoreGive(fbFreeSem);
+	}
+
+	fb.values  = NULL;
+	fb.raw     = NULL;
+	fb.offsets = NULL;
+	fb.stats   = NULL;
+	fb.centiKelvin = NULL;
+	fb.slot    = -1;
+}
+
+uint8_t MLX90640::fb_free()
+{
+	return uxSemaphoreGetCount(fbFreeSem);
+}
+
+
+mlx_ob_t MLX90640::ob_get()
+{
+	mlx_ob_t ob = {};
+
+	uint64_t us = (uint64_t)esp_timer_get_time();
+	ob.timestamp.tv_sec  = us / 1000000UL;
+	ob.timestamp.tv_usec = us % 1000000UL;
+
+	ob.width   = 32;
+	ob.height  = 24;
+	ob.offsets = mlx90640_float_offsets;
+	ob.nBytes  = ob.width * ob.height * sizeof(float);
+
+	return ob;
+}
+
+
+void MLX90640::ob_return(mlx_ob_t& ob)
+{
+	ob.offsets = NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Control register 1 is kept in memory, the recording does not change with it
+
+int MLX90640::SetADCresolution(uint8_t resolution)
+{
+	if (!bOnline) return -1000;
+
+	mlxCtrlReg1 = (mlxCtrlReg1 & 0xF3FF) | ((resolution & 0x03) << 10);
+	return 0;
+}
+
+
+int MLX90640::GetCurADCresolution()
+{
+	if (!bOnline) return -1000;
+
+	return (mlxCtrlReg1 & 0x0C00) >> 10;
+}
+
+
+int MLX90640::SetRefreshRate(uint8_t refreshRate)
+{
+	if (!bOnline) return -1000;
+
+	mlxRefreshRate = refreshRate & 0x07;
+	mlxCtrlReg1    = (mlxCtrlReg1 & 0xFC7F) | (mlxRefreshRate << 7);
+
+	iFrame_delayMS = 0.8 * 1000 / mlxRefreshHz[mlxRefreshRate];
+
+	return 0;
+}
+
+
+int MLX90640::SetFastRefreshRate(uint8_t fast)
+{
+	if (!bOnline) return -1000;
+
+	bMLXfastRefreshRate = fast;
+
+	if (bMLXfastRefreshRate)
+		return SetRefreshRate(MLX90640_REFRESH_RATE_4HZ);
+	else
+		return SetRefreshRate(MLX90640_REFRESH_RATE_05HZ);
+}
+
+
+int MLX90640::GetFastRefreshRate()
+{
+	return bMLXfastRefreshRate;
+}
+
+
+int MLX90640::GetRefreshRate()
+{
+	if (!bOnline) return -1000;
+
+	return (mlxCtrlReg1 & 0x0380) >> 7;
+}
+
+
+int MLX90640::GetSubPageNumber(uint16_t *frameData)
+{
+	return frameData[MLX90640_FRAME_AUX_SUBPAGE];
+}
+
+
+int MLX90640::SetInterleavedMode()
+{
+	if (!bOnline) return -1000;
+
+	mlxCtrlReg1 &= 0xEFFF;
+	return 0;
+}
+
+
+int MLX90640::SetChessMode()
+{
+	if (!bOnline) return -1000;
+
+	mlxCtrlReg1 |= 0x1000;
+	return 0;
+}
+
+
+int MLX90640::GetCurMode()
+{
+	if (!bOnline) return -1000;
+
+	return (mlxCtrlReg1 & 0x1000) >> 12;
+}
+
+
+void MLX90640::SetAmbientReflected(float value)
+{
+	fTambientReflected = value;
+}
+
+
+void MLX90640::SetEmissivity(float value)
+{
+	fEmissivity = value;
+}
+
+
+bool MLX90640::GetFrameTelemetry(float& ta, float& vdd, int64_t& readyUs)
+{
+	if (!bOnline || frameReadyUs == 0) return false;
+
+	ta      = frameTa;
+	vdd     = frameVdd;
+	readyUs = frameReadyUs;
+
+	return true;
+}
+
+
+float MLX90640::GetAmbientReflected()
+{
+	return fTambientReflected;
+}
+
+
+float MLX90640::GetEmissivity()
+{
+	return fEmissivity;
+}
+
+
+float MLX90640::GetVddRAM()
+{
+	return bOnline ? frameVdd : 0.0f;
+}
+
+
+float MLX90640::GetTaRAM()
+{
+	return bOnline ? frameTa : 0.0f;
+}
@@ -0,0 +1,189 @@
+
+#include "Arduino.h"
+#include "esp_http_server.h"
+
+#include <stdarg.h>
+#include <time.h>
+
+
+int standin_log_level = ARDUHAL_LOG_LEVEL_INFO;
+
+static struct timespec bootTime = []() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts;
+}();
+
+
+//-----------------------------------------------------------------------------
+// IDF
+
+int64_t esp_timer_get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)(ts.tv_sec - bootTime.tv_sec) * 1000000 + (ts.tv_nsec - bootTime.tv_nsec) / 1000;
+}
+
+
+uint32_t standin_log_ms()
+{
+	return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+
+const char* esp_err_to_name(esp_err_t code)
+{
+	switch (code) {
+	case ESP_OK:                        return "ESP_OK";
+	case ESP_FAIL:                      return "ESP_FAIL";
+	case ESP_ERR_NO_MEM:                return "ESP_ERR_NO_MEM";
+	case ESP_ERR_INVALID_ARG:           return "ESP_ERR_INVALID_ARG";
+	case ESP_ERR_INVALID_STATE:         return "ESP_ERR_INVALID_STATE";
+	case ESP_ERR_INVALID_SIZE:          return "ESP_ERR_INVALID_SIZE";
+	case ESP_ERR_NOT_FOUND:             return "ESP_ERR_NOT_FOUND";
+	case ESP_ERR_NOT_SUPPORTED:         return "ESP_ERR_NOT_SUPPORTED";
+	case ESP_ERR_TIMEOUT:               return "ESP_ERR_TIMEOUT";
+	case ESP_ERR_HTTPD_HANDLERS_FULL:   return "ESP_ERR_HTTPD_HANDLERS_FULL";
+	case ESP_ERR_HTTPD_HANDLER_EXISTS:  return "ESP_ERR_HTTPD_HANDLER_EXISTS";
+	case ESP_ERR_HTTPD_INVALID_REQ:     return "ESP_ERR_HTTPD_INVALID_REQ";
+	case ESP_ERR_HTTPD_RESULT_TRUNC:    return "ESP_ERR_HTTPD_RESULT_TRUNC";
+	case ESP_ERR_HTTPD_RESP_HDR:        return "ESP_ERR_HTTPD_RESP_HDR";
+	case ESP_ERR_HTTPD_RESP_SEND:       return "ESP_ERR_HTTPD_RESP_SEND";
+	case ESP_ERR_HTTPD_ALLOC_MEM:       return "ESP_ERR_HTTPD_ALLOC_MEM";
+	case ESP_ERR_HTTPD_TASK:            return "ESP_ERR_HTTPD_TASK";
+	default:                            return "UNKNOWN ERROR";
+	}
+}
+
+
+void esp_restart(void)
+{
+	log_i("Restart requested, exiting");
+
+	// tasks are still running, static destructors are skipped
+	fflush(stdout);
+	_exit(0);
+}
+
+
+// Nominal figures of the device after startup, see esp_heap_caps.h
+#define STANDIN_FREE_INTERNAL		(180 * 1024)
+#define STANDIN_LARGEST_INTERNAL	(110 * 1024)
+#define STANDIN_FREE_SPIRAM			(3900 * 1024)
+#define STANDIN_LARGEST_SPIRAM		(3800 * 1024)
+
+void* heap_caps_malloc(size_t size, uint32_t caps)             { return malloc(size); }
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps)   { return calloc(n, size); }
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps) { return realloc(ptr, size); }
+void  heap_caps_free(void* ptr)                                { free(ptr); }
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+	return (caps & MALLOC_CAP_SPIRAM) ? STANDIN_FREE_SPIRAM : STANDIN_FREE_INTERNAL;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+	return (caps & MALLOC_CAP_SPIRAM) ? STANDIN_LARGEST_SPIRAM : STANDIN_LARGEST_INTERNAL;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+	return heap_caps_get_free_size(caps);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+	return STANDIN_FREE_INTERNAL + STANDIN_FREE_SPIRAM;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+	return esp_get_free_heap_size();
+}
+
+
+bool  psramFound()                            { return true; }
+void* ps_malloc(size_t size)                  { return malloc(size); }
+void* ps_calloc(size_t n, size_t size)        { return calloc(n, size); }
+void* ps_realloc(void* ptr, size_t size)      { return realloc(ptr, size); }
+
+
+//-----------------------------------------------------------------------------
+// Arduino core
+
+HardwareSerial Serial;
+EspClass       ESP;
+
+
+char* itoa(int value, char* str, int base)
+{
+	static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+	unsigned int v = (value < 0 && base == 10) ? -(unsigned int)value : (unsigned int)value;
+
+	char  tmp[34];
+	char* p = tmp;
+	do {
+		*p++ = digits[v % base];
+		v /= base;
+	} while (v);
+
+	char* out = str;
+	if (value < 0 && base == 10) *out++ = '-';
+	while (p > tmp) *out++ = *--p;
+	*out = 0;
+
+	return str;
+}
+
+
+void delay(uint32_t ms)
+{
+	vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+unsigned long millis()
+{
+	return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros()
+{
+	return (unsigned long)esp_timer_get_time();
+}
+
+
+size_t HardwareSerial::print(const char* s) { return fputs(s, stdout) < 0 ? 0 : strlen(s); }
+size_t HardwareSerial::print(int n)         { return printf("%d", n); }
+size_t HardwareSerial::println(const char* s) { return printf("%s\n", s); }
+size_t HardwareSerial::println(int n)       { return printf("%d\n", n); }
+
+int HardwareSerial::printf(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vprintf(format, args);
+	va_end(args);
+
+	return n;
+}
+
+
+uint32_t EspClass::getFreeHeap()  { return STANDIN_FREE_INTERNAL; }
+uint32_t EspClass::getFreePsram() { return STANDIN_FREE_SPIRAM; }
+
+
+bool ledcAttach(uint8_t pin, uint32_t freq, uint8_t resolution)
+{
+	log_d("LED pin %u, %u Hz, %u bit", pin, freq, resolution);
+	return true;
+}
+
+bool ledcWrite(uint8_t pin, uint32_t duty)
+{
+	log_d("LED duty %u", duty);
+	return true;
+}
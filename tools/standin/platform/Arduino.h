@@ -0,0 +1,54 @@
+#ifndef _STANDIN_ARDUINO_H_
+#define _STANDIN_ARDUINO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp32-hal-log.h"
+#include "esp32-hal-psram.h"
+#include "esp32-hal-ledc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "WString.h"
+
+// Arduino core, what the firmware calls of it
+
+char*         itoa(int value, char* str, int base);
+
+void          delay(uint32_t ms);
+unsigned long millis();
+unsigned long micros();
+
+class HardwareSerial {
+public:
+	void   begin(unsigned long baud) {}
+	void   setDebugOutput(bool) {}
+
+	size_t print(const char* s);
+	size_t print(int n);
+	size_t println(const char* s = "");
+	size_t println(int n);
+	int    printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+	void     restart() { esp_restart(); }
+	uint32_t getFreeHeap();
+	uint32_t getFreePsram();
+};
+
+extern EspClass ESP;
+
+#endif
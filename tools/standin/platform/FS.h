@@ -0,0 +1,68 @@
+#ifndef _STANDIN_FS_H_
+#define _STANDIN_FS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <memory>
+#include "Arduino.h"
+
+// Arduino FS on a host directory (spiffs_shim.cpp)
+
+namespace fs {
+
+enum SeekMode {
+	SeekSet = 0,
+	SeekCur = 1,
+	SeekEnd = 2
+};
+
+class File {
+public:
+	File() {}
+	explicit File(FILE* f);
+
+	operator bool() const { return (bool)impl; }
+
+	size_t write(uint8_t c) { return write(&c, 1); }
+	size_t write(const uint8_t* buf, size_t size);
+	size_t print(const char* s);
+
+	int    available();
+	int    read();
+	size_t read(uint8_t* buf, size_t size);
+	size_t readBytes(char* buf, size_t size) { return read((uint8_t*)buf, size); }
+	String readString();
+
+	bool   seek(uint32_t pos, SeekMode mode = SeekSet);
+	size_t position() const;
+	size_t size() const;
+	void   flush();
+	void   close();
+
+private:
+	std::shared_ptr<FILE> impl;
+};
+
+class FS {
+public:
+	File open(const char* path, const char* mode = "r", bool create = false);
+	bool exists(const char* path);
+	bool remove(const char* path);
+	bool rename(const char* pathFrom, const char* pathTo);
+
+protected:
+	std::string root;		// host directory the FS root maps to
+	std::string hostPath(const char* path) const;
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _STANDIN_SPIFFS_H_
+#define _STANDIN_SPIFFS_H_
+
+#include "FS.h"
+
+class SPIFFSFS : public fs::FS {
+public:
+	// Stand-in only: host directory holding the partition, set before begin()
+	void   setRoot(const char* dir);
+
+	bool   begin(bool formatOnFail = false);
+	size_t totalBytes();
+	size_t usedBytes();
+};
+
+extern SPIFFSFS SPIFFS;
+
+#endif
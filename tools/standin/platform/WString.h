@@ -0,0 +1,25 @@
+#ifndef _STANDIN_WSTRING_H_
+#define _STANDIN_WSTRING_H_
+
+#include <string>
+
+// Arduino String, what the firmware calls of it
+class String {
+public:
+	String() {}
+	String(const char* s) : str(s ? s : "") {}
+	String(const std::string& s) : str(s) {}
+
+	const char* c_str() const { return str.c_str(); }
+	unsigned int length() const { return str.length(); }
+
+	String& operator+=(const String& s) { str += s.str; return *this; }
+	String& operator+=(char c)          { str += c; return *this; }
+
+	bool operator==(const char* s) const { return str == (s ? s : ""); }
+
+private:
+	std::string str;
+};
+
+#endif
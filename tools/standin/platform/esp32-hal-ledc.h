@@ -0,0 +1,10 @@
+#ifndef _STANDIN_ESP32_HAL_LEDC_H_
+#define _STANDIN_ESP32_HAL_LEDC_H_
+
+#include <stdint.h>
+
+// No flash LED, the duty is only logged
+bool ledcAttach(uint8_t pin, uint32_t freq, uint8_t resolution);
+bool ledcWrite(uint8_t pin, uint32_t duty);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _STANDIN_ESP32_HAL_LOG_H_
+#define _STANDIN_ESP32_HAL_LOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+
+// Same line format as the Arduino core log, written to stderr
+// standin_log_level: 1 error .. 5 verbose, -v raises it
+
+#define ARDUHAL_LOG_LEVEL_ERROR		1
+#define ARDUHAL_LOG_LEVEL_WARN		2
+#define ARDUHAL_LOG_LEVEL_INFO		3
+#define ARDUHAL_LOG_LEVEL_DEBUG		4
+#define ARDUHAL_LOG_LEVEL_VERBOSE	5
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int standin_log_level;
+
+uint32_t standin_log_ms();
+
+#ifdef __cplusplus
+}
+#endif
+
+#define STANDIN_LOG(level, letter, format, ...) \
+	do { \
+		if (standin_log_level >= level) \
+			fprintf(stderr, "[%6u][" letter "][%s:%u] %s(): " format "\n", \
+			        standin_log_ms(), __FILE__, __LINE__, __func__, ##__VA_ARGS__); \
+	} while (0)
+
+#define log_e(format, ...)	STANDIN_LOG(ARDUHAL_LOG_LEVEL_ERROR,   "E", format, ##__VA_ARGS__)
+#define log_w(format, ...)	STANDIN_LOG(ARDUHAL_LOG_LEVEL_WARN,    "W", format, ##__VA_ARGS__)
+#define log_i(format, ...)	STANDIN_LOG(ARDUHAL_LOG_LEVEL_INFO,    "I", format, ##__VA_ARGS__)
+#define log_d(format, ...)	STANDIN_LOG(ARDUHAL_LOG_LEVEL_DEBUG,   "D", format, ##__VA_ARGS__)
+#define log_v(format, ...)	STANDIN_LOG(ARDUHAL_LOG_LEVEL_VERBOSE, "V", format, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...)	log_e(format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)	log_w(format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)	log_i(format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)	log_d(format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)	log_v(format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _STANDIN_ESP32_HAL_PSRAM_H_
+#define _STANDIN_ESP32_HAL_PSRAM_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_heap_caps.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool  psramFound();
+
+void* ps_malloc(size_t size);
+void* ps_calloc(size_t n, size_t size);
+void* ps_realloc(void* ptr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
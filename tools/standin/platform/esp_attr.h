@@ -0,0 +1,8 @@
+#ifndef _STANDIN_ESP_ATTR_H_
+#define _STANDIN_ESP_ATTR_H_
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define EXT_RAM_BSS_ATTR
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _STANDIN_ESP_ERR_H_
+#define _STANDIN_ESP_ERR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK						0
+#define ESP_FAIL					-1
+
+#define ESP_ERR_NO_MEM				0x101
+#define ESP_ERR_INVALID_ARG			0x102
+#define ESP_ERR_INVALID_STATE		0x103
+#define ESP_ERR_INVALID_SIZE		0x104
+#define ESP_ERR_NOT_FOUND			0x105
+#define ESP_ERR_NOT_SUPPORTED		0x106
+#define ESP_ERR_TIMEOUT				0x107
+
+#define ESP_ERR_HTTPD_BASE			0xb000
+#define ESP_ERR_HTTPD_HANDLERS_FULL	(ESP_ERR_HTTPD_BASE + 1)
+#define ESP_ERR_HTTPD_HANDLER_EXISTS	(ESP_ERR_HTTPD_BASE + 2)
+#define ESP_ERR_HTTPD_INVALID_REQ	(ESP_ERR_HTTPD_BASE + 3)
+#define ESP_ERR_HTTPD_RESULT_TRUNC	(ESP_ERR_HTTPD_BASE + 4)
+#define ESP_ERR_HTTPD_RESP_HDR		(ESP_ERR_HTTPD_BASE + 5)
+#define ESP_ERR_HTTPD_RESP_SEND		(ESP_ERR_HTTPD_BASE + 6)
+#define ESP_ERR_HTTPD_ALLOC_MEM		(ESP_ERR_HTTPD_BASE + 7)
+#define ESP_ERR_HTTPD_TASK			(ESP_ERR_HTTPD_BASE + 8)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char* esp_err_to_name(esp_err_t code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
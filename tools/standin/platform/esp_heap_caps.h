@@ -0,0 +1,36 @@
+#ifndef _STANDIN_ESP_HEAP_CAPS_H_
+#define _STANDIN_ESP_HEAP_CAPS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Every capability maps to the process heap, buffers are released with free() by the
+// firmware as on the device. The size queries report the free heap of a device
+// (ESP32 with 4MB PSRAM) after startup, they do not follow the allocations
+
+#define MALLOC_CAP_EXEC			(1 << 0)
+#define MALLOC_CAP_32BIT		(1 << 1)
+#define MALLOC_CAP_8BIT			(1 << 2)
+#define MALLOC_CAP_DMA			(1 << 3)
+#define MALLOC_CAP_SPIRAM		(1 << 10)
+#define MALLOC_CAP_INTERNAL		(1 << 11)
+#define MALLOC_CAP_DEFAULT		(1 << 12)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void*  heap_caps_malloc(size_t size, uint32_t caps);
+void*  heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+void*  heap_caps_realloc(void* ptr, size_t size, uint32_t caps);
+void   heap_caps_free(void* ptr);
+
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef _STANDIN_ESP_HTTP_SERVER_H_
+#define _STANDIN_ESP_HTTP_SERVER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+// esp_http_server on POSIX sockets (httpd_shim.cpp)
+//
+// Same threading as ESP-IDF: one server task selects over the sessions and runs
+// handlers to completion one request at a time; a session handed to
+// httpd_req_async_handler_begin leaves the select set until completed
+
+#define HTTPD_MAX_REQ_HDR_LEN	1024
+#define HTTPD_MAX_URI_LEN		512
+#define HTTPD_SCRATCH_BUF		HTTPD_MAX_REQ_HDR_LEN
+
+typedef void* httpd_handle_t;
+
+typedef enum {
+	HTTP_DELETE  = 0,
+	HTTP_GET     = 1,
+	HTTP_HEAD    = 2,
+	HTTP_POST    = 3,
+	HTTP_PUT     = 4,
+	HTTP_OPTIONS = 6
+} httpd_method_t;
+
+typedef void (*httpd_free_ctx_fn_t)(void* ctx);
+
+typedef struct httpd_req {
+	httpd_handle_t      handle;
+	int                 method;
+	const char          uri[HTTPD_MAX_URI_LEN + 1];
+	size_t              content_len;
+	void*               aux;
+	void*               user_ctx;
+	void*               sess_ctx;
+	httpd_free_ctx_fn_t free_ctx;
+	bool                ignore_sess_ctx_changes;
+} httpd_req_t;
+
+typedef struct httpd_uri {
+	const char*     uri;
+	httpd_method_t  method;
+	esp_err_t     (*handler)(httpd_req_t* req);
+	void*           user_ctx;
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+	bool            is_websocket;
+	bool            handle_ws_control_frames;
+	const char*     supported_subprotocol;
+#endif
+} httpd_uri_t;
+
+typedef bool (*httpd_uri_match_func_t)(const char* reference_uri, const char* uri_to_match, size_t match_upto);
+
+typedef struct httpd_config {
+	unsigned    task_priority;
+	size_t      stack_size;
+	int         core_id;
+	uint32_t    task_caps;
+	uint16_t    server_port;
+	uint16_t    ctrl_port;
+	uint16_t    max_open_sockets;
+	uint16_t    max_uri_handlers;
+	uint16_t    max_resp_headers;
+	uint16_t    backlog_conn;
+	bool        lru_purge_enable;
+	uint16_t    recv_wait_timeout;		// seconds
+	uint16_t    send_wait_timeout;		// seconds
+	void*       global_user_ctx;
+	void*       global_user_ctx_free_fn;
+	void*       global_transport_ctx;
+	void*       global_transport_ctx_free_fn;
+	bool        enable_so_linger;
+	int         linger_timeout;
+	bool        keep_alive_enable;
+	int         keep_alive_idle;
+	int         keep_alive_interval;
+	int         keep_alive_count;
+	void*       open_fn;
+	void*       close_fn;
+	httpd_uri_match_func_t uri_match_fn;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() {				\
+	.task_priority      = 5,					\
+	.stack_size         = 4096,					\
+	.core_id            = 0x7FFFFFFF,			\
+	.task_caps          = 0,					\
+	.server_port        = 80,					\
+	.ctrl_port          = 32768,				\
+	.max_open_sockets   = 7,					\
+	.max_uri_handlers   = 8,					\
+	.max_resp_headers   = 8,					\
+	.backlog_conn       = 5,					\
+	.lru_purge_enable   = false,				\
+	.recv_wait_timeout  = 5,					\
+	.send_wait_timeout  = 5,					\
+	.global_user_ctx    = NULL,					\
+	.global_user_ctx_free_fn = NULL,			\
+	.global_transport_ctx = NULL,				\
+	.global_transport_ctx_free_fn = NULL,		\
+	.enable_so_linger   = false,				\
+	.linger_timeout     = 0,					\
+	.keep_alive_enable  = false,				\
+	.keep_alive_idle    = 0,					\
+	.keep_alive_interval = 0,					\
+	.keep_alive_count   = 0,					\
+	.open_fn            = NULL,					\
+	.close_fn           = NULL,					\
+	.uri_match_fn       = NULL					\
+}
+
+#define HTTPD_200		"200 OK"
+#define HTTPD_204		"204 No Content"
+#define HTTPD_207		"207 Multi-Status"
+#define HTTPD_400		"400 Bad Request"
+#define HTTPD_404		"404 Not Found"
+#define HTTPD_408		"408 Request Timeout"
+#define HTTPD_500		"500 Internal Server Error"
+
+#define HTTPD_TYPE_JSON		"application/json"
+#define HTTPD_TYPE_TEXT		"text/html"
+#define HTTPD_TYPE_OCTET	"application/octet-stream"
+
+#define HTTPD_RESP_USE_STRLEN	-1
+
+#define HTTPD_SOCK_ERR_FAIL		-1
+#define HTTPD_SOCK_ERR_INVALID	-2
+#define HTTPD_SOCK_ERR_TIMEOUT	-3
+
+typedef enum {
+	HTTPD_500_INTERNAL_SERVER_ERROR = 0,
+	HTTPD_501_METHOD_NOT_IMPLEMENTED,
+	HTTPD_505_VERSION_NOT_SUPPORTED,
+	HTTPD_400_BAD_REQUEST,
+	HTTPD_401_UNAUTHORIZED,
+	HTTPD_403_FORBIDDEN,
+	HTTPD_404_NOT_FOUND,
+	HTTPD_405_METHOD_NOT_ALLOWED,
+	HTTPD_408_REQ_TIMEOUT,
+	HTTPD_411_LENGTH_REQUIRED,
+	HTTPD_414_URI_TOO_LONG,
+	HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE,
+	HTTPD_ERR_CODE_MAX
+} httpd_err_code_t;
+
+typedef void (*httpd_work_fn_t)(void* arg);
+
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config);
+esp_err_t httpd_stop(httpd_handle_t handle);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri_handler);
+bool      httpd_uri_match_wildcard(const char* reference_uri, const char* uri_to_match, size_t match_upto);
+
+size_t    httpd_req_get_url_query_len(httpd_req_t* req);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* req, char* buf, size_t buf_len);
+esp_err_t httpd_query_key_value(const char* qry, const char* key, char* val, size_t val_size);
+size_t    httpd_req_get_hdr_value_len(httpd_req_t* req, const char* field);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t* req, const char* field, char* val, size_t val_size);
+int       httpd_req_recv(httpd_req_t* req, char* buf, size_t buf_len);
+int       httpd_req_to_sockfd(httpd_req_t* req);
+
+esp_err_t httpd_resp_set_status(httpd_req_t* req, const char* status);
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t* req, const char* field, const char* value);
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t buf_len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t* req, const char* buf, ssize_t buf_len);
+esp_err_t httpd_resp_send_err(httpd_req_t* req, httpd_err_code_t error, const char* msg);
+int       httpd_send(httpd_req_t* req, const char* buf, size_t buf_len);
+
+inline esp_err_t httpd_resp_sendstr(httpd_req_t* req, const char* str)
+{
+	return httpd_resp_send(req, str, str ? HTTPD_RESP_USE_STRLEN : 0);
+}
+
+inline esp_err_t httpd_resp_sendstr_chunk(httpd_req_t* req, const char* str)
+{
+	return httpd_resp_send_chunk(req, str, str ? HTTPD_RESP_USE_STRLEN : 0);
+}
+
+inline esp_err_t httpd_resp_send_404(httpd_req_t* req)
+{
+	return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+}
+
+inline esp_err_t httpd_resp_send_408(httpd_req_t* req)
+{
+	return httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, NULL);
+}
+
+inline esp_err_t httpd_resp_send_500(httpd_req_t* req)
+{
+	return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t* req, httpd_req_t** out);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t* req);
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void* arg);
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd);
+void*     httpd_get_global_user_ctx(httpd_handle_t handle);
+
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+
+typedef enum {
+	HTTPD_WS_TYPE_CONTINUE = 0x0,
+	HTTPD_WS_TYPE_TEXT     = 0x1,
+	HTTPD_WS_TYPE_BINARY   = 0x2,
+	HTTPD_WS_TYPE_CLOSE    = 0x8,
+	HTTPD_WS_TYPE_PING     = 0x9,
+	HTTPD_WS_TYPE_PONG     = 0xA
+} httpd_ws_type_t;
+
+typedef enum {
+	HTTPD_WS_CLIENT_INVALID   = 0x0,
+	HTTPD_WS_CLIENT_HTTP      = 0x1,
+	HTTPD_WS_CLIENT_WEBSOCKET = 0x2
+} httpd_ws_client_info_t;
+
+typedef struct httpd_ws_frame {
+	bool            final;
+	bool            fragmented;
+	httpd_ws_type_t type;
+	uint8_t*        payload;
+	size_t          len;
+} httpd_ws_frame_t;
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t* req, httpd_ws_frame_t* pkt, size_t max_len);
+esp_err_t httpd_ws_send_frame(httpd_req_t* req, httpd_ws_frame_t* pkt);
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t hd, int fd, httpd_ws_frame_t* frame);
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd);
+
+#endif
+
+// Stand-in only: port the next httpd_start listens on instead of config->server_port
+void      httpd_shim_set_port(uint16_t port);
+
+#endif
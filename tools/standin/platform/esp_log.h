@@ -0,0 +1,6 @@
+#ifndef _STANDIN_ESP_LOG_H_
+#define _STANDIN_ESP_LOG_H_
+
+#include "esp32-hal-log.h"
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _STANDIN_ESP_SYSTEM_H_
+#define _STANDIN_ESP_SYSTEM_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Exits the stand-in, a supervisor restarts it like the device reboots
+void     esp_restart(void);
+
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _STANDIN_ESP_TIMER_H_
+#define _STANDIN_ESP_TIMER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Microseconds since the stand-in started, like time since boot on the device
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _STANDIN_FB_GFX_H_
+#define _STANDIN_FB_GFX_H_
+
+// Text overlay of the camera driver, not used by the firmware
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _STANDIN_FREERTOS_H_
+#define _STANDIN_FREERTOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// FreeRTOS on POSIX threads, the subset the firmware uses (freertos_shim.cpp)
+// One tick is one millisecond, priorities and core affinity are recorded but not enforced
+
+typedef uint32_t     TickType_t;
+typedef int          BaseType_t;
+typedef unsigned int UBaseType_t;
+
+typedef void (*TaskFunction_t)(void*);
+
+#define portMAX_DELAY			((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS		((TickType_t)1)
+#define pdMS_TO_TICKS(ms)		((TickType_t)(ms))
+
+#define pdFALSE					((BaseType_t)0)
+#define pdTRUE					((BaseType_t)1)
+#define pdFAIL					pdFALSE
+#define pdPASS					pdTRUE
+
+#define tskNO_AFFINITY			((BaseType_t)0x7FFFFFFF)
+#define configMAX_TASK_NAME_LEN	16
+#define configNUMBER_OF_CORES	2
+#define portNUM_PROCESSORS		configNUMBER_OF_CORES
+
+typedef uint32_t configSTACK_DEPTH_TYPE;
+
+#include "freertos/task.h"
+
+#endif
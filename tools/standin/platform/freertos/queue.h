@@ -0,0 +1,15 @@
+#ifndef _STANDIN_FREERTOS_QUEUE_H_
+#define _STANDIN_FREERTOS_QUEUE_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct standin_queue* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+void          vQueueDelete(QueueHandle_t queue);
+
+BaseType_t    xQueueSend(QueueHandle_t queue, const void* item, TickType_t timeout);
+BaseType_t    xQueueReceive(QueueHandle_t queue, void* item, TickType_t timeout);
+UBaseType_t   uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#endif
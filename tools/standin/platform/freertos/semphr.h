@@ -0,0 +1,17 @@
+#ifndef _STANDIN_FREERTOS_SEMPHR_H_
+#define _STANDIN_FREERTOS_SEMPHR_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct standin_semaphore* SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount);
+void              vSemaphoreDelete(SemaphoreHandle_t sem);
+
+BaseType_t        xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout);
+BaseType_t        xSemaphoreGive(SemaphoreHandle_t sem);
+UBaseType_t       uxSemaphoreGetCount(SemaphoreHandle_t sem);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef _STANDIN_FREERTOS_TASK_H_
+#define _STANDIN_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct standin_task* TaskHandle_t;
+
+typedef enum {
+	eRunning = 0,
+	eReady,
+	eBlocked,
+	eSuspended,
+	eDeleted,
+	eInvalid
+} eTaskState;
+
+typedef enum {
+	eNoAction = 0,
+	eSetBits,
+	eIncrement,
+	eSetValueWithOverwrite,
+	eSetValueWithoutOverwrite
+} eNotifyAction;
+
+// Stack depth is in bytes as in ESP-IDF, threads get at least STANDIN_TASK_STACK_MIN
+// since host code needs more stack than the Xtensa build
+#define STANDIN_TASK_STACK_MIN	(256 * 1024)
+
+BaseType_t   xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                                     UBaseType_t priority, TaskHandle_t* handle, BaseType_t coreId);
+BaseType_t   xTaskCreatePinnedToCoreWithCaps(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                                             UBaseType_t priority, TaskHandle_t* handle, BaseType_t coreId, uint32_t caps);
+
+inline BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                              UBaseType_t priority, TaskHandle_t* handle)
+{
+	return xTaskCreatePinnedToCore(fn, name, stackDepth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+// Only the calling task can be deleted (NULL or its own handle)
+void         vTaskDelete(TaskHandle_t task);
+void         vTaskDeleteWithCaps(TaskHandle_t task);
+
+void         vTaskDelay(TickType_t ticks);
+TickType_t   xTaskGetTickCount();
+
+TaskHandle_t xTaskGetCurrentTaskHandle();
+char*        pcTaskGetName(TaskHandle_t task);
+BaseType_t   xTaskGetCoreID(TaskHandle_t task);
+
+BaseType_t   xTaskNotifyGive(TaskHandle_t task);
+BaseType_t   xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+uint32_t     ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t timeout);
+BaseType_t   xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t timeout);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _STANDIN_JPEG_DECODER_H_
+#define _STANDIN_JPEG_DECODER_H_
+
+// ROM JPEG decoder, only the types img_converters.h refers to
+// Decoding is done with libjpeg in img_converters_shim.cpp
+
+typedef enum {
+	JPEG_IMAGE_SCALE_0 = 0,
+	JPEG_IMAGE_SCALE_1_2,
+	JPEG_IMAGE_SCALE_1_4,
+	JPEG_IMAGE_SCALE_1_8
+} esp_jpeg_image_scale_t;
+
+#endif
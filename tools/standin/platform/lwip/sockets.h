@@ -0,0 +1,12 @@
+#ifndef _STANDIN_LWIP_SOCKETS_H_
+#define _STANDIN_LWIP_SOCKETS_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _STANDIN_SDKCONFIG_H_
+#define _STANDIN_SDKCONFIG_H_
+
+// Configuration the firmware is built with, as far as the shared sources look at it
+// Run time stats are left out, /tasks answers 501 like a build without them
+
+#define CONFIG_IDF_TARGET_ESP32				1
+#define CONFIG_SPIRAM_SUPPORT				1
+#define CONFIG_HTTPD_WS_SUPPORT				1
+#define CONFIG_LWIP_MAX_SOCKETS				16
+#define CONFIG_LWIP_TCP_MSS					1440
+#define CONFIG_FREERTOS_NUMBER_OF_CORES		2
+#define CONFIG_ARDUHAL_ESP_LOG				1
+
+#define ARDUINO_ARCH_ESP32					1
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef _STANDIN_SOC_EFUSE_REG_H_
+#define _STANDIN_SOC_EFUSE_REG_H_
+
+#endif
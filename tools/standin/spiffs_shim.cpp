@@ -0,0 +1,184 @@
+
+#include "SPIFFS.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+
+
+SPIFFSFS SPIFFS;
+
+// SPIFFS partition of the default 4MB layout with OTA, reported as its size
+#define STANDIN_SPIFFS_BYTES	(1408 * 1024)
+
+
+namespace fs {
+
+File::File(FILE* f) : impl(f, fclose)
+{
+}
+
+
+size_t File::write(const uint8_t* buf, size_t size)
+{
+	return impl ? fwrite(buf, 1, size, impl.get()) : 0;
+}
+
+
+size_t File::print(const char* s)
+{
+	return write((const uint8_t*)s, strlen(s));
+}
+
+
+int File::available()
+{
+	return impl ? (int)(size() - position()) : 0;
+}
+
+
+int File::read()
+{
+	return impl ? fgetc(impl.get()) : -1;
+}
+
+
+size_t File::read(uint8_t* buf, size_t size)
+{
+	return impl ? fread(buf, 1, size, impl.get()) : 0;
+}
+
+
+String File::readString()
+{
+	std::string s;
+
+	char   buf[256];
+	size_t n;
+	while ((n = read((uint8_t*)buf, sizeof(buf))) > 0)
+		s.append(buf, n);
+
+	return String(s);
+}
+
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+	static const int whence[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+
+	return impl && fseek(impl.get(), pos, whence[mode]) == 0;
+}
+
+
+size_t File::position() const
+{
+	return impl ? ftell(impl.get()) : 0;
+}
+
+
+size_t File::size() const
+{
+	if (!impl) return 0;
+
+	fflush(impl.get());
+
+	struct stat st;
+	return fstat(fileno(impl.get()), &st) == 0 ? st.st_size : 0;
+}
+
+
+void File::flush()
+{
+	if (impl) fflush(impl.get());
+}
+
+
+void File::close()
+{
+	impl.reset();
+}
+
+
+std::string FS::hostPath(const char* path) const
+{
+	return root + (path[0] == '/' ? "" : "/") + path;
+}
+
+
+File FS::open(const char* path, const char* mode, bool create)
+{
+	// binary, SPIFFS does not translate line ends
+	std::string m = std::string(mode) + "b";
+
+	FILE* f = fopen(hostPath(path).c_str(), m.c_str());
+
+	return f ? File(f) : File();
+}
+
+
+bool FS::exists(const char* path)
+{
+	struct stat st;
+	return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+
+bool FS::remove(const char* path)
+{
+	return ::remove(hostPath(path).c_str()) == 0;
+}
+
+
+bool FS::rename(const char* pathFrom, const char* pathTo)
+{
+	return ::rename(hostPath(pathFrom).c_str(), hostPath(pathTo).c_str()) == 0;
+}
+
+} // namespace fs
+
+
+void SPIFFSFS::setRoot(const char* dir)
+{
+	root = dir;
+	while (root.size() > 1 && root.back() == '/') root.pop_back();
+}
+
+
+bool SPIFFSFS::begin(bool formatOnFail)
+{
+	if (root.empty()) root = ".";
+
+	if (mkdir(root.c_str(), 0755) != 0 && errno != EEXIST) {
+		log_e("Cannot create %s: %s", root.c_str(), strerror(errno));
+		return false;
+	}
+
+	log_i("SPIFFS on %s", root.c_str());
+	return true;
+}
+
+
+size_t SPIFFSFS::totalBytes()
+{
+	return STANDIN_SPIFFS_BYTES;
+}
+
+
+size_t SPIFFSFS::usedBytes()
+{
+	size_t used = 0;
+
+	DIR* dir = opendir(root.c_str());
+	if (!dir) return 0;
+
+	while (struct dirent* e = readdir(dir))
+	{
+		struct stat st;
+		if (stat((root + "/" + e->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+			used += st.st_size;
+	}
+
+	closedir(dir);
+
+	return used;
+}
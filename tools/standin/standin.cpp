@@ -0,0 +1,160 @@
+// Linux stand-in for the device: the firmware HTTP API served from recorded data
+//
+// The handler code of the firmware runs unchanged on top of an esp_http_server shim
+// (httpd_shim.cpp) and FreeRTOS tasks mapped to threads. OV2640 and MLX90640 are
+// replaced by recordings replayed in a loop, SPIFFS is a host directory.
+//
+//   curl -N http://<device>/stream2640 > cam.mp          record camera frames (or a directory of *.jpg)
+//   curl http://<device>/record/dump > thermal.rec       record thermal frames (or /timelapse, *.f32)
+//   ./standin -c cam.mp -t thermal.rec -d spiffs         serve http://localhost:8080
+//
+//   -p <port>     listening port, default 8080
+//   -d <dir>      SPIFFS directory (index.html, calibration, homography, time-lapse), default ./spiffs
+//   -c <source>   camera recording, colour bars without it
+//   -t <source>   thermal recording, a synthetic scene without it
+//   -f <fps>      camera frame rate, default 10
+//   -v            debug log, twice for verbose
+
+#include "standin.h"
+#include "esp_camera.h"
+#include "esp_http_server.h"
+#include "MLX90640_API.h"
+#include "MLX90640_calibration.h"
+#include "MLX90640_fusion.h"
+#include "MLX90640_palette.h"
+#include "board_config.h"
+#include "SPIFFS.h"
+#include <Arduino.h>
+
+#include <getopt.h>
+#include <signal.h>
+
+
+const char* strBuildTimestamp = __TIMESTAMP__;
+
+void startControlAndStreamServers();
+
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-p port] [-d spiffs_dir] [-c camera_recording] [-t thermal_recording] [-f fps] [-v]\n", name);
+	exit(1);
+}
+
+
+// Same sequence as setup() of the sketch
+static bool setup(const char* camSource, const char* mlxSource, float fps)
+{
+	Serial.print("OV2640 camera init...");
+
+		if (!standin_camera_load(camSource, fps)) return false;
+
+		camera_config_t config = {};
+
+		config.xclk_freq_hz   = 20000000;
+		config.frame_size     = FRAMESIZE_UXGA;
+		config.pixel_format   = PIXFORMAT_JPEG;
+		config.grab_mode      = CAMERA_GRAB_LATEST;
+		config.fb_location    = CAMERA_FB_IN_PSRAM;
+		config.jpeg_quality   = 14;
+		config.fb_count	      = 3;
+
+		esp_err_t err = esp_camera_init(&config);
+		if (err != ESP_OK) {
+			Serial.printf("Camera init failed with error 0x%x", err);
+			return false;
+		}
+
+		sensor_t *s = esp_camera_sensor_get();
+		s->set_hmirror(s, 1);
+		s->set_res_raw(s, 0, 0, 0, 0, 150, 90, 1350, 990, 1200, 900, false, false);
+
+		ledcAttach(LED_GPIO_NUM, 5000, 8);
+
+		s->set_brightness(s, 0);
+
+	Serial.println("success");
+
+	Serial.print("MLX90640 thermal camera init...");
+
+		if (!standin_mlx_load(mlxSource)) return false;
+
+		MLX90640& mlx90640 = MLX90640::getInstance();
+
+		mlx90640.MLX90640_Init(0x33);
+		mlx90640.SetRefreshRate(MLX90640_REFRESH_RATE_4HZ);
+
+		MLXpalette::buildLUTs();
+
+	Serial.println("success");
+
+	Serial.print("Mounting SPIFFS...");
+
+	if (!SPIFFS.begin(true)) {
+		Serial.println("Failed to mount SPIFFS");
+		return false;
+	}
+
+	Serial.println("SPIFFS mounted successfully");
+
+	Serial.println("Reading user calibration data from SPIFFS...");
+
+		MLXcalibration::readUserCalibrationOffsets();
+
+	Serial.println("success");
+
+	Serial.println("Reading fusion homography from SPIFFS...");
+
+		MLXfusion::readHomography();
+
+	Serial.println("success");
+
+	Serial.println("Launching http servers...");
+
+		startControlAndStreamServers();
+
+	Serial.println("success");
+
+	return true;
+}
+
+
+int main(int argc, char** argv)
+{
+	uint16_t    port      = 8080;
+	const char* spiffsDir = "spiffs";
+	const char* camSource = NULL;
+	const char* mlxSource = NULL;
+	float       fps       = 10.0f;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:d:c:t:f:v")) != -1)
+	{
+		switch (opt) {
+		case 'p': port      = atoi(optarg); break;
+		case 'd': spiffsDir = optarg; break;
+		case 'c': camSource = optarg; break;
+		case 't': mlxSource = optarg; break;
+		case 'f': fps       = atof(optarg); break;
+		case 'v': standin_log_level++; break;
+		default:  usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || port == 0 || fps <= 0) usage(argv[0]);
+
+	// clients going away are reported by send(), not by the signal
+	signal(SIGPIPE, SIG_IGN);
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	httpd_shim_set_port(port);
+	SPIFFS.setRoot(spiffsDir);
+
+	if (!setup(camSource, mlxSource, fps)) return 1;
+
+	Serial.printf("All ready! Use 'http://localhost:%u' to connect\n", port);
+
+	while (true)
+		delay(1000);
+}
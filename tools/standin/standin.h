@@ -0,0 +1,15 @@
+#ifndef _STANDIN_H_
+#define _STANDIN_H_
+
+
+// Recorded data replacing the sensors, loaded before the setup sequence
+
+// Directory of *.jpg, a JPEG or a file holding several (e.g. a recorded /stream2640)
+// NULL synthesizes colour bars. Frames are replayed in a loop at fps
+bool standin_camera_load(const char* source, float fps);
+
+// Recorder records (/record/dump, /timelapse) or float32 frames (mlxdelta decode, *.f32)
+// NULL synthesizes a scene. Frames are replayed in a loop at the refresh rate set by the firmware
+bool standin_mlx_load(const char* source);
+
+#endif
@@ -0,0 +1,177 @@
+
+#include "trace.h"
+#include "esp32-hal-psram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+typedef struct {
+	uint32_t    ver;		// odd while the slot is being written
+	const char* name;		// NULL when cleared
+	int64_t     ts;
+	uint32_t    dur;
+	uint32_t    seq;
+	uint8_t     pid;
+	uint8_t     lane;
+} trace_event_t;
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of two");
+
+static trace_event_t* traceRing = NULL;
+static uint32_t       traceHead = 0;		// spans recorded since boot or trace_clear
+
+// Lane names exported as thread_name metadata
+#define TRACE_LANES				(TRACE_LANE_STREAM + 8)
+
+
+static trace_event_t* trace_ring()
+{
+	trace_event_t* ring = __atomic_load_n(&traceRing, __ATOMIC_ACQUIRE);
+	if (ring) return ring;
+
+	ring = (trace_event_t*)ps_calloc(TRACE_RING_SIZE, sizeof(trace_event_t));
+	if (!ring) return NULL;
+
+	// first recorder wins, a concurrent one frees its copy
+	trace_event_t* expected = NULL;
+	if (!__atomic_compare_exchange_n(&traceRing, &expected, ring, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		free(ring);
+		ring = expected;
+	}
+
+	return ring;
+}
+
+
+void trace_span(trace_pid_t pid, uint8_t lane, const char* name, uint32_t seq, int64_t startUs, int64_t endUs)
+{
+	trace_event_t* ring = trace_ring();
+	if (!ring) return;
+
+	uint32_t i = __atomic_fetch_add(&traceHead, 1, __ATOMIC_RELAXED) & (TRACE_RING_SIZE - 1);
+
+	trace_event_t& e = ring[i];
+
+	// seqlock, the reader drops the slot when ver changed or was odd during its copy
+	uint32_t ver = __atomic_load_n(&e.ver, __ATOMIC_RELAXED) | 1;
+	__atomic_store_n(&e.ver, ver, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+		e.ts   = startUs;
+		e.dur  = (endUs > startUs) ? (uint32_t)(endUs - startUs) : 0;
+		e.seq  = seq;
+		e.pid  = pid;
+		e.lane = lane;
+		__atomic_store_n(&e.name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&e.ver, ver + 1, __ATOMIC_RELEASE);
+}
+
+
+void trace_clear()
+{
+	trace_event_t* ring = __atomic_load_n(&traceRing, __ATOMIC_ACQUIRE);
+	if (!ring) return;
+
+	for (uint32_t i = 0; i < TRACE_RING_SIZE; i++)
+		__atomic_store_n(&ring[i].name, (const char*)NULL, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&traceHead, 0, __ATOMIC_RELAXED);
+}
+
+
+void trace_reader_begin(trace_reader_t* r)
+{
+	uint32_t head = __atomic_load_n(&traceHead, __ATOMIC_RELAXED);
+
+	r->end    = head;
+	r->next   = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+	r->stage  = 0;
+	r->bFirst = true;
+}
+
+
+size_t trace_read(trace_reader_t* r, char* buf, size_t size)
+{
+	static const char* pidNames[] = { "", "OV2640", "MLX90640" };
+
+	size_t len = 0;
+
+	// a stage that produced nothing falls through to the next one, 0 is returned only when done
+	while (len == 0 && r->stage < 3)
+	{
+		switch (r->stage)
+		{
+			case 0:
+				// header and process/lane names
+				len += snprintf(buf + len, size - len, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+				for (uint8_t pid = TRACE_CAM; pid <= TRACE_MLX && len < size; pid++)
+				{
+					len += snprintf(buf + len, size - len,
+					                "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"%s\"}}",
+					                r->bFirst ? "" : ",", pid, pidNames[pid]);
+					r->bFirst = false;
+
+					for (uint8_t lane = 0; lane < TRACE_LANES && len < size; lane++)
+					{
+						char name[16];
+						if (lane == TRACE_LANE_CAPTURE)      snprintf(name, sizeof(name), "capture");
+						else if (lane == TRACE_LANE_PROCESS) snprintf(name, sizeof(name), "process");
+						else                                 snprintf(name, sizeof(name), "stream %u", lane - TRACE_LANE_STREAM);
+
+						len += snprintf(buf + len, size - len,
+						                ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+						                pid, lane, name);
+					}
+				}
+
+				r->stage = 1;
+				break;
+
+			case 1:
+			{
+				trace_event_t* ring = __atomic_load_n(&traceRing, __ATOMIC_ACQUIRE);
+
+				// one span is at most ~120 bytes
+				while (ring && r->next < r->end && len + 128 < size)
+				{
+					const trace_event_t& e = ring[r->next++ & (TRACE_RING_SIZE - 1)];
+
+					uint32_t ver = __atomic_load_n(&e.ver, __ATOMIC_ACQUIRE);
+					if (ver & 1) continue;	// being overwritten
+
+					trace_event_t c;
+					c.name = __atomic_load_n(&e.name, __ATOMIC_RELAXED);
+					c.ts   = e.ts;
+					c.dur  = e.dur;
+					c.seq  = e.seq;
+					c.pid  = e.pid;
+					c.lane = e.lane;
+
+					__atomic_thread_fence(__ATOMIC_ACQUIRE);
+					if (__atomic_load_n(&e.ver, __ATOMIC_RELAXED) != ver) continue;	// overwritten during the copy
+					if (!c.name) continue;	// cleared
+
+					len += snprintf(buf + len, size - len,
+					                ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%lld,\"dur\":%u,\"args\":{\"seq\":%u}}",
+					                c.name, c.pid, c.lane, (long long)c.ts, c.dur, c.seq);
+				}
+
+				if (!ring || r->next >= r->end)
+					r->stage = 2;
+				break;
+			}
+
+			case 2:
+				len = snprintf(buf, size, "]}");
+				r->stage = 3;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return (len < size) ? len : size - 1;
+}
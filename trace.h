@@ -0,0 +1,47 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// Per frame latency trace
+//
+// Capture, processing and send stages of both sensors are recorded as spans into a fixed
+// ring in PSRAM, oldest entries are overwritten. Recording is a relaxed atomic index bump
+// and a slot write, no lock. GET /trace exports the ring as Chrome trace-event JSON,
+// load it in chrome://tracing or Perfetto. The frame sequence number is in every span's args
+
+#define TRACE_RING_SIZE			2048		// spans, power of two
+
+// Chrome trace process per sensor
+typedef enum {
+	TRACE_CAM = 1,
+	TRACE_MLX = 2
+} trace_pid_t;
+
+// Chrome trace thread lanes within a sensor
+#define TRACE_LANE_CAPTURE		0			// sensor to memory
+#define TRACE_LANE_PROCESS		1			// conversion and correction shared by all streams
+#define TRACE_LANE_STREAM		2			// + hub subscriber id, per client encode and send
+
+// name must be a string literal, it is stored by pointer
+void trace_span(trace_pid_t pid, uint8_t lane, const char* name, uint32_t seq, int64_t startUs, int64_t endUs);
+
+typedef struct {
+	uint32_t next;
+	uint32_t end;
+	uint8_t  stage;
+	bool     bFirst;
+} trace_reader_t;
+
+// Snapshots the ring, spans recorded afterwards are not exported
+void   trace_reader_begin(trace_reader_t* r);
+
+// Fills buf with the next piece of JSON, returns 0 when done
+size_t trace_read(trace_reader_t* r, char* buf, size_t size);
+
+void   trace_clear();
+
+#endif